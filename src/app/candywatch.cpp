@@ -0,0 +1,72 @@
+// Copyright (c) 2018-2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "app/candywatch.h"
+#include "tinyformat.h"
+
+#include <algorithm>
+#include <iterator>
+
+CCandyWatchSet candyWatchSet;
+
+size_t CCandyWatchSet::Add(const std::vector<CIndexAddress>& vAdd)
+{
+    std::vector<CIndexAddress> vSorted(vAdd);
+    std::sort(vSorted.begin(), vSorted.end());
+
+    LOCK(cs);
+    size_t nSizeBefore = vAddress.size();
+    std::vector<CIndexAddress> vMerged;
+    vMerged.reserve(nSizeBefore + vSorted.size());
+    std::set_union(vAddress.begin(), vAddress.end(), vSorted.begin(), std::unique(vSorted.begin(), vSorted.end()), std::back_inserter(vMerged));
+    vAddress.swap(vMerged);
+    return vAddress.size() - nSizeBefore;
+}
+
+size_t CCandyWatchSet::Remove(const std::vector<CIndexAddress>& vRemove)
+{
+    std::vector<CIndexAddress> vSorted(vRemove);
+    std::sort(vSorted.begin(), vSorted.end());
+
+    LOCK(cs);
+    size_t nSizeBefore = vAddress.size();
+    std::vector<CIndexAddress> vKept;
+    vKept.reserve(nSizeBefore);
+    std::set_difference(vAddress.begin(), vAddress.end(), vSorted.begin(), vSorted.end(), std::back_inserter(vKept));
+    vAddress.swap(vKept);
+    return nSizeBefore - vAddress.size();
+}
+
+size_t CCandyWatchSet::Size() const
+{
+    LOCK(cs);
+    return vAddress.size();
+}
+
+std::vector<std::string> CCandyWatchSet::GetAddresses() const
+{
+    LOCK(cs);
+    std::vector<std::string> vRet;
+    vRet.reserve(vAddress.size());
+    for (size_t i = 0; i < vAddress.size(); i++)
+        vRet.push_back(vAddress[i].ToString());
+    return vRet;
+}
+
+void CCandyWatchSet::CheckAndRemove()
+{
+    // Nothing expires; the set only changes through the RPC
+}
+
+void CCandyWatchSet::Clear()
+{
+    LOCK(cs);
+    vAddress.clear();
+}
+
+std::string CCandyWatchSet::ToString() const
+{
+    LOCK(cs);
+    return strprintf("Candy watch addresses: %d", vAddress.size());
+}
@@ -0,0 +1,53 @@
+// Copyright (c) 2018-2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef APP_CANDYWATCH_H
+#define APP_CANDYWATCH_H
+
+#include "serialize.h"
+#include "sync.h"
+#include "validation.h"
+
+#include <string>
+#include <vector>
+
+class CCandyWatchSet;
+extern CCandyWatchSet candyWatchSet;
+
+// Addresses whose candy shares are evaluated without being in the wallet,
+// e.g. the deposit addresses of an exchange, as their index keys. Stored in
+// candywatch.dat.
+class CCandyWatchSet
+{
+private:
+    mutable CCriticalSection cs;
+    // sorted and unique
+    std::vector<CIndexAddress> vAddress;
+
+public:
+    CCandyWatchSet() {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        LOCK(cs);
+        READWRITE(vAddress);
+    }
+
+    /** Add the addresses, returning how many were not in the set yet */
+    size_t Add(const std::vector<CIndexAddress>& vAdd);
+    /** Remove the addresses, returning how many were in the set */
+    size_t Remove(const std::vector<CIndexAddress>& vRemove);
+    size_t Size() const;
+    /** Encoded addresses, in set order */
+    std::vector<std::string> GetAddresses() const;
+
+    void CheckAndRemove();
+    void Clear();
+
+    std::string ToString() const;
+};
+
+#endif // APP_CANDYWATCH_H
@@ -5,6 +5,9 @@
 #include <univalue.h>
 
 #include "app.h"
+#include "app/candywatch.h"
+#include "assetamount.h"
+#include "flat-database.h"
 #include "init.h"
 #include "spork.h"
 #include "txdb.h"
@@ -17,6 +20,10 @@
 #include "masternode-sync.h"
 #include "txmempool.h"
 #include <boost/regex.hpp>
+#include <boost/thread.hpp>
+
+#include <atomic>
+#include <fstream>
 
 using namespace std;
 
@@ -123,12 +130,7 @@ UniValue issueasset(const UniValue& params, bool fHelp)
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Need candy information");
 
         nCandyAmount = AmountFromValue(params[9], nAssetDecimals, true);
-        char totalAmountStr[64] = "",candyAmountStr[64]="";
-        snprintf(totalAmountStr,sizeof(totalAmountStr),"%lld",nAssetTotalAmount);
-        snprintf(candyAmountStr,sizeof(candyAmountStr),"%lld",nCandyAmount);
-        string candyMinStr = numtofloatstring(totalAmountStr,3); // 1‰
-        string candyMaxStr = numtofloatstring(totalAmountStr,1); // 10%
-        if(compareFloatString(candyAmountStr,candyMinStr)<0 || compareFloatString(candyAmountStr,candyMaxStr)>0)
+        if(!IsCandyAmountInRange(nAssetTotalAmount, nCandyAmount))
             throw JSONRPCError(INVALID_CANDYAMOUNT, "Candy amount out of range (min: 0.001 * total, max: 0.1 * total)");
         if(nCandyAmount >= nFirstIssueAmount)
             throw JSONRPCError(CANDY_EXCEED_FIRST, "Candy amout exceed first issue amount");
@@ -522,12 +524,7 @@ UniValue putcandy(const UniValue& params, bool fHelp)
         throw JSONRPCError(INSUFFICIENT_AUTH_FOR_APPCMD, "You are not the admin");
 
     CAmount nAmount = AmountFromValue(params[1], assetInfo.assetData.nDecimals, true);
-    char totalAmountStr[64] = "",candyAmountStr[64]="";
-    snprintf(totalAmountStr,sizeof(totalAmountStr),"%lld",assetInfo.assetData.nTotalAmount);
-    snprintf(candyAmountStr,sizeof(candyAmountStr),"%lld",nAmount);
-    string candyMinStr = numtofloatstring(totalAmountStr,3); // 1‰
-    string candyMaxStr = numtofloatstring(totalAmountStr,1); // 10%
-    if(compareFloatString(candyAmountStr,candyMinStr)<0 || compareFloatString(candyAmountStr,candyMaxStr)>0)
+    if(!IsCandyAmountInRange(assetInfo.assetData.nTotalAmount, nAmount))
         throw JSONRPCError(INVALID_CANDYAMOUNT, "Candy amount out of range (min: 0.001 * total, max: 0.1 * total)");
 
     uint16_t nExpired = (uint16_t)params[2].get_int();
@@ -589,60 +586,134 @@ UniValue putcandy(const UniValue& params, bool fHelp)
     return ret;
 }
 
-UniValue getcandy(const UniValue& params, bool fHelp)
+/** Computes the candy share of each address, several addresses at a time */
+struct CCandyShareCalculator
 {
-    if (!EnsureWalletIsAvailable(fHelp))
-        return NullUniValue;
+    const std::vector<std::string>& vAddress;
+    const std::set<std::string>& setClaimed;
+    int nTxHeight;
+    CAmount nTotalSafe;
+    CAmount nCandyAmount;
+    CAmount nMinAmount;
+    std::vector<CAmount> vShare;
+    std::vector<CAmount> vSafe;
+    std::atomic<size_t> nNext;
+
+    CCandyShareCalculator(const std::vector<std::string>& vAddressIn, const std::set<std::string>& setClaimedIn, int nTxHeightIn, CAmount nTotalSafeIn, CAmount nCandyAmountIn, CAmount nMinAmountIn)
+        : vAddress(vAddressIn), setClaimed(setClaimedIn), nTxHeight(nTxHeightIn), nTotalSafe(nTotalSafeIn), nCandyAmount(nCandyAmountIn), nMinAmount(nMinAmountIn),
+          vShare(vAddressIn.size(), 0), vSafe(vAddressIn.size(), 0), nNext(0) {}
+
+    void Run()
+    {
+        while (true)
+        {
+            size_t i = nNext++;
+            if (i >= vAddress.size())
+                return;
 
-    if (fHelp || params.size() != 1)
-        throw runtime_error(
-            "getcandy \"assetId\"\n"
-            "\nGet candy by specified asset id.\n"
-            "\nArguments:\n"
-            "1. \"assetId\"         (string, required) The asset id\n"
-            "\nResult:\n"
-            "{\n"
-            "    \"txId\":\"xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx\"\n"
-            "    \"assetAmount\": xxxxx\n"
-            "}\n"
-            "\nExamples:\n"
-            + HelpExampleCli("getcandy", "\"723468197263af02cdf836aa12033864df0de857780dcb7982262efface6afdd\"")
-            + HelpExampleRpc("getcandy", "\"723468197263af02cdf836aa12033864df0de857780dcb7982262efface6afdd\"")
-        );
+            const std::string& strAddress = vAddress[i];
+            if (setClaimed.count(strAddress)) // got candy
+                continue;
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+            CAmount nSafe = 0;
+            if (!GetAddressAmountByHeight(nTxHeight, strAddress, nSafe))
+                continue;
 
-    if(!masternodeSync.IsBlockchainSynced())
-        throw JSONRPCError(SYNCING_BLOCK, "Synchronizing block data");
+            if (nSafe < 1 * COIN || nSafe > nTotalSafe)
+                continue;
 
-    uint256 assetId = uint256S(TrimString(params[0].get_str()));
-    CAssetId_AssetInfo_IndexValue assetInfo;
-    if(assetId.IsNull() || !GetAssetInfoByAssetId(assetId, assetInfo, false))
-        throw JSONRPCError(NONEXISTENT_ASSETID, "Non-existent asset id");
+            CAmount nShare = GetCandyShareAmount(nSafe, nTotalSafe, nCandyAmount);
+            if (nShare < nMinAmount)
+                continue;
 
-    // get candy tx
-    map<COutPoint, CCandyInfo> mapCandyInfo;
-    GetAssetIdCandyInfo(assetId, mapCandyInfo);
-    if(mapCandyInfo.size() == 0)
-        throw JSONRPCError(NONEXISTENT_ASSETCANDY, "Non-existent asset candy");
+            vSafe[i] = nSafe;
+            vShare[i] = nShare;
+        }
+    }
 
-    EnsureWalletIsUnlocked();
+    void RunParallel()
+    {
+        int nThreads = std::min(GetNumCores(), (int)(vAddress.size() / 32)) - 1;
+        boost::thread_group workers;
+        for (int i = 0; i < nThreads; i++)
+            workers.create_thread(boost::bind(&CCandyShareCalculator::Run, this));
+        Run();
+        workers.join_all();
+    }
+};
 
-    if(pwalletMain->GetBroadcastTransactions() && !g_connman)
-        throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
+/** Addresses which already got the candy, in a block or in the mempool */
+static void GetCandyClaimedAddresses(const uint256& assetId, const COutPoint& out, const map<COutPoint, vector<string> >& mapOutAddress, set<string>& setClaimed)
+{
+    map<COutPoint, vector<string> >::const_iterator it = mapOutAddress.find(out);
+    if(it != mapOutAddress.end())
+        setClaimed.insert(it->second.begin(), it->second.end());
+    mempool.get_GetCandy_Index(assetId, out, setClaimed);
+}
 
-    map<CKeyID, int64_t> mapKeyBirth;
-    pwalletMain->GetKeyBirthTimes(mapKeyBirth);
+/** A candy claim started by getcandy, polled with getcandyjob */
+struct CCandyClaimJob
+{
+    uint256 jobId;
+    uint256 assetId;
+    int64_t nStartTime;
+    int64_t nEndTime;
+    int nCandyCount;
+    int nCandyDone;
+    bool fDone;
+    std::string strError;
+    UniValue result;
+
+    CCandyClaimJob() : nStartTime(0), nEndTime(0), nCandyCount(0), nCandyDone(0), fDone(false), result(UniValue::VARR) {}
+};
+
+static const unsigned int MAX_CANDY_CLAIM_JOBS = 100;
+
+static CCriticalSection cs_candyClaim;
+static std::mutex g_mutexCandyClaimJobs;
+static std::map<uint256, boost::shared_ptr<CCandyClaimJob> > g_mapCandyClaimJobs;
+static boost::thread_group g_candyClaimThreads;
+static bool g_fCandyClaimStopHooked = false;
+
+static void UpdateCandyClaimJob(CCandyClaimJob* pjob, int nCandyDone, const UniValue& ret)
+{
+    if (!pjob)
+        return;
+    std::lock_guard<std::mutex> lock(g_mutexCandyClaimJobs);
+    pjob->nCandyDone = nCandyDone;
+    pjob->result = ret;
+}
 
-    vector<CKeyID> vKeyID;
-    for(map<CKeyID, int64_t>::const_iterator it = mapKeyBirth.begin(); it != mapKeyBirth.end(); it++)
-        vKeyID.push_back(it->first);
+/**
+ * Claim every eligible candy of the asset for the wallet addresses. The claimed
+ * addresses come from one index scan, the shares are computed on a thread pool
+ * and the claim transactions of each candy are created, signed and committed
+ * together. Errors are thrown until the first claim succeeds; after that the
+ * claims made so far are returned.
+ */
+static void ClaimCandy(const uint256& assetId, const CAssetId_AssetInfo_IndexValue& assetInfo, const map<COutPoint, CCandyInfo>& mapCandyInfo, UniValue& ret, CCandyClaimJob* pjob)
+{
+    LOCK(cs_candyClaim);
+
+    boost::shared_ptr<const vector<CKeyAddressEntry> > pKeyAddresses = pwalletMain->GetKeyAddresses();
+    const vector<CKeyAddressEntry>& vKeyAddress = *pKeyAddresses;
+    vector<string> vAddress;
+    vAddress.reserve(vKeyAddress.size());
+    for(unsigned int i = 0; i < vKeyAddress.size(); i++)
+        vAddress.push_back(vKeyAddress[i].strAddress);
 
     int nCurrentHeight = g_nChainHeight;
+    CAmount nMinAmount = AmountFromValue("0.0001", assetInfo.assetData.nDecimals, true);
 
-    UniValue ret(UniValue::VARR);
-    for(map<COutPoint, CCandyInfo>::const_iterator it = mapCandyInfo.begin(); it != mapCandyInfo.end(); it++)
+    // addresses which already got each candy, from a single pass over the index
+    map<COutPoint, vector<string> > mapOutAddress;
+    GetCOutPointAddress(assetId, mapOutAddress);
+
+    int nCandyDone = 0;
+    for(map<COutPoint, CCandyInfo>::const_iterator it = mapCandyInfo.begin(); it != mapCandyInfo.end(); it++, UpdateCandyClaimJob(pjob, ++nCandyDone, ret))
     {
+        boost::this_thread::interruption_point();
+
         const COutPoint& out = it->first;
         const CCandyInfo& candyInfo = it->second;
 
@@ -650,7 +721,11 @@ UniValue getcandy(const UniValue& params, bool fHelp)
             continue;
 
         uint256 blockHash;
-        int nTxHeight = GetTxHeight(out.hash, &blockHash);
+        int nTxHeight = 0;
+        {
+            LOCK(cs_main);
+            nTxHeight = GetTxHeight(out.hash, &blockHash);
+        }
         if(blockHash.IsNull())
             continue;
         if(nTxHeight + BLOCKS_PER_DAY > nCurrentHeight)
@@ -665,7 +740,7 @@ UniValue getcandy(const UniValue& params, bool fHelp)
             if(ret.empty())
                 throw JSONRPCError(GET_ALL_ADDRESS_SAFE_FAILED, "Error: get all address safe amount failed");
             else
-                return ret;
+                return;
         }
 
         if(nTotalSafe <= 0)
@@ -673,7 +748,7 @@ UniValue getcandy(const UniValue& params, bool fHelp)
              if(ret.empty())
                 throw JSONRPCError(INVALID_TOTAL_SAFE, "Error: get total safe amount failed");
             else
-                return ret;
+                return;
         }
 
         CAppHeader appHeader(g_nAppHeaderVersion, uint256S(g_strSafeAssetId), GET_CANDY_CMD);
@@ -689,26 +764,17 @@ UniValue getcandy(const UniValue& params, bool fHelp)
         CAmount nGetCandyAmount =  dbamount + memamount;
         CAmount nNowGetCandyTotalAmount = 0;
 
-        vector<CRecipient> vecSend;
-        for(unsigned int i = 0; i < vKeyID.size(); i++)
-        {
-            string strAddress = CBitcoinAddress(vKeyID[i]).ToString();
-
-            CAmount nTempAmount = 0;
-            if(GetGetCandyAmount(assetId, out, strAddress, nTempAmount)) // got candy
-                continue;
-
-            CBitcoinAddress recvAddress(strAddress);
+        set<string> setClaimed;
+        GetCandyClaimedAddresses(assetId, out, mapOutAddress, setClaimed);
 
-            CAmount nSafe = 0;
-            if(!GetAddressAmountByHeight(nTxHeight, strAddress, nSafe))
-                continue;
+        CCandyShareCalculator calc(vAddress, setClaimed, nTxHeight, nTotalSafe, candyInfo.nAmount, nMinAmount);
+        calc.RunParallel();
 
-            if(nSafe < 1 * COIN || nSafe > nTotalSafe)
-                continue;
-
-            CAmount nCandyAmount = (CAmount)(1.0 * nSafe / nTotalSafe * candyInfo.nAmount);
-            if(nCandyAmount < AmountFromValue("0.0001", assetInfo.assetData.nDecimals, true))
+        vector<CRecipient> vecSend;
+        for(unsigned int i = 0; i < vKeyAddress.size(); i++)
+        {
+            CAmount nCandyAmount = calc.vShare[i];
+            if(nCandyAmount == 0)
                 continue;
 
             if (nCandyAmount + nGetCandyAmount > candyInfo.nAmount)
@@ -716,8 +782,8 @@ UniValue getcandy(const UniValue& params, bool fHelp)
 
             nNowGetCandyTotalAmount += nCandyAmount;
 
-            LogPrint("asset", "rpc-getcandy: candy-height: %d, address: %s, total_safe: %lld, user_safe: %lld, total_candy_amount: %lld, can_get_candy_amount: %lld, out: %s\n", nTxHeight, strAddress, nTotalSafe, nSafe, candyInfo.nAmount, nCandyAmount, out.ToString());
-            CRecipient recvRecipient = {GetScriptForDestination(recvAddress.Get()), nCandyAmount, 0, false, true};
+            LogPrint("asset", "rpc-getcandy: candy-height: %d, address: %s, total_safe: %lld, user_safe: %lld, total_candy_amount: %lld, can_get_candy_amount: %lld, out: %s\n", nTxHeight, vKeyAddress[i].strAddress, nTotalSafe, calc.vSafe[i], candyInfo.nAmount, nCandyAmount, out.ToString());
+            CRecipient recvRecipient = {vKeyAddress[i].scriptPubKey, nCandyAmount, 0, false, true};
             vecSend.push_back(recvRecipient);
         }
 
@@ -727,48 +793,36 @@ UniValue getcandy(const UniValue& params, bool fHelp)
         if(vecSend.size() == 0)
             continue;
 
-        unsigned int nTxCount = vecSend.size() / GET_CANDY_TXOUT_SIZE;
-        if(vecSend.size() % GET_CANDY_TXOUT_SIZE != 0)
-            nTxCount++;
-
-        for(unsigned int i = 0; i < nTxCount; i++)
+        vector<CWalletTx> vwtx;
+        CReserveKey reservekey(pwalletMain);
+        CAmount nFeeRequired = 0;
+        string strError;
+        if(!pwalletMain->CreateCandyClaimTransactions(appHeader, assetIdCandyInfo, vecSend, vwtx, reservekey, nFeeRequired, strError))
         {
-            vector<CRecipient> vecNowSend;
-            if(i != nTxCount - 1)
-            {
-                for(int m = 0; m < GET_CANDY_TXOUT_SIZE; m++)
-                    vecNowSend.push_back(vecSend[i * GET_CANDY_TXOUT_SIZE + m]);
-            }
+            if(ret.empty())
+                throw JSONRPCError(RPC_WALLET_ERROR, strError);
             else
-            {
-                int nCount = vecSend.size() - i * GET_CANDY_TXOUT_SIZE;
-                for(int m = 0; m < nCount; m++)
-                    vecNowSend.push_back(vecSend[i * GET_CANDY_TXOUT_SIZE + m]);
-            }
+                return;
+        }
 
-            CWalletTx wtx;
-            CReserveKey reservekey(pwalletMain);
-            CAmount nFeeRequired;
-            int nChangePosRet = -1;
-            string strError;
-            if(!pwalletMain->CreateAssetTransaction(&appHeader, &assetIdCandyInfo, vecNowSend, NULL, NULL, wtx, reservekey, nFeeRequired, nChangePosRet, strError, NULL, true, ALL_COINS))
-            {
-                if(nFeeRequired > pwalletMain->GetBalance())
-                    strError = strprintf("Error: Insufficient safe funds, this transaction requires a transaction fee of at least %1!", FormatMoney(nFeeRequired));
-                 if(ret.empty())
-                    throw JSONRPCError(RPC_WALLET_ERROR, strError);
-                 else
-                    return ret;
-            }
+        // Transactions committed before a rejected one are already relayed:
+        // report them and drop the candy before giving up on the rest.
+        vector<bool> vAccepted;
+        bool fCommitted = pwalletMain->CommitTransactions(vwtx, reservekey, g_connman.get(), vAccepted);
+        if(std::find(vAccepted.begin(), vAccepted.end(), true) == vAccepted.end())
+        {
+            if(ret.empty())
+                throw JSONRPCError(RPC_WALLET_ERROR, "Error: Get candy failed, please check your wallet and try again later!");
+            else
+                return;
+        }
 
-            if(!pwalletMain->CommitTransaction(wtx, reservekey, g_connman.get()))
-            {
-                if(ret.empty())
-                    throw JSONRPCError(RPC_WALLET_ERROR, "Error: Get candy failed, please check your wallet and try again later!");
-                else
-                    return ret;
-            }
+        for(unsigned int n = 0; n < vwtx.size(); n++)
+        {
+            if(!vAccepted[n])
+                continue;
 
+            const CWalletTx& wtx = vwtx[n];
             for(unsigned int m = 0; m < wtx.vout.size(); m++)
             {
                 const CTxOut& txout = wtx.vout[m];
@@ -808,6 +862,430 @@ UniValue getcandy(const UniValue& params, bool fHelp)
         if(!found){
             LogPrintf("erase candy not found,height:%d,assetId:%s\n", nTxHeight,assetId.ToString());
         }
+
+        if(!fCommitted)
+            return;
+    }
+}
+
+static void ThreadCandyClaim(boost::shared_ptr<CCandyClaimJob> pjob, CAssetId_AssetInfo_IndexValue assetInfo, map<COutPoint, CCandyInfo> mapCandyInfo)
+{
+    RenameThread("safe-getcandy");
+
+    UniValue ret(UniValue::VARR);
+    string strError;
+    try {
+        ClaimCandy(pjob->assetId, assetInfo, mapCandyInfo, ret, pjob.get());
+    } catch (const boost::thread_interrupted&) {
+        strError = "Interrupted";
+    } catch (const UniValue& objError) {
+        strError = find_value(objError, "message").get_str();
+    } catch (const std::exception& e) {
+        strError = e.what();
+    }
+
+    std::lock_guard<std::mutex> lock(g_mutexCandyClaimJobs);
+    pjob->result = ret;
+    pjob->strError = strError;
+    pjob->nEndTime = GetTime();
+    pjob->fDone = true;
+    LogPrintf("getcandy: job %s finished, %u claims%s\n", pjob->jobId.ToString(), ret.size(), strError.empty() ? "" : ", " + strError);
+}
+
+static void StopCandyClaimJobs()
+{
+    g_candyClaimThreads.interrupt_all();
+    g_candyClaimThreads.join_all();
+}
+
+UniValue getcandy(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getcandy \"assetId\" ( async )\n"
+            "\nGet candy by specified asset id.\n"
+            "\nArguments:\n"
+            "1. \"assetId\"         (string, required) The asset id\n"
+            "2. async             (boolean, optional, default=false) Claim in the background and return a job id for getcandyjob\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"txId\":\"xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx\"\n"
+            "    \"assetAmount\": xxxxx\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nResult (async = true):\n"
+            "{\n"
+            "  \"jobId\":\"xxxxx\"     (string) The id to pass to getcandyjob\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getcandy", "\"723468197263af02cdf836aa12033864df0de857780dcb7982262efface6afdd\"")
+            + HelpExampleCli("getcandy", "\"723468197263af02cdf836aa12033864df0de857780dcb7982262efface6afdd\" true")
+            + HelpExampleRpc("getcandy", "\"723468197263af02cdf836aa12033864df0de857780dcb7982262efface6afdd\"")
+        );
+
+    uint256 assetId = uint256S(TrimString(params[0].get_str()));
+    bool fAsync = params.size() > 1 && params[1].get_bool();
+
+    CAssetId_AssetInfo_IndexValue assetInfo;
+    map<COutPoint, CCandyInfo> mapCandyInfo;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        if(!masternodeSync.IsBlockchainSynced())
+            throw JSONRPCError(SYNCING_BLOCK, "Synchronizing block data");
+
+        if(assetId.IsNull() || !GetAssetInfoByAssetId(assetId, assetInfo, false))
+            throw JSONRPCError(NONEXISTENT_ASSETID, "Non-existent asset id");
+
+        // get candy tx
+        GetAssetIdCandyInfo(assetId, mapCandyInfo);
+        if(mapCandyInfo.size() == 0)
+            throw JSONRPCError(NONEXISTENT_ASSETCANDY, "Non-existent asset candy");
+
+        EnsureWalletIsUnlocked();
+
+        if(pwalletMain->GetBroadcastTransactions() && !g_connman)
+            throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
+    }
+
+    if(!fAsync)
+    {
+        UniValue ret(UniValue::VARR);
+        ClaimCandy(assetId, assetInfo, mapCandyInfo, ret, NULL);
+        return ret;
+    }
+
+    boost::shared_ptr<CCandyClaimJob> pjob(new CCandyClaimJob());
+    pjob->jobId = GetRandHash();
+    pjob->assetId = assetId;
+    pjob->nStartTime = GetTime();
+    pjob->nCandyCount = mapCandyInfo.size();
+    {
+        std::lock_guard<std::mutex> lock(g_mutexCandyClaimJobs);
+        if(!g_fCandyClaimStopHooked)
+        {
+            RPCServer::OnStopped(&StopCandyClaimJobs);
+            g_fCandyClaimStopHooked = true;
+        }
+
+        // forget the oldest finished jobs
+        while(g_mapCandyClaimJobs.size() >= MAX_CANDY_CLAIM_JOBS)
+        {
+            std::map<uint256, boost::shared_ptr<CCandyClaimJob> >::iterator itOldest = g_mapCandyClaimJobs.end();
+            for(std::map<uint256, boost::shared_ptr<CCandyClaimJob> >::iterator it = g_mapCandyClaimJobs.begin(); it != g_mapCandyClaimJobs.end(); it++)
+            {
+                if(it->second->fDone && (itOldest == g_mapCandyClaimJobs.end() || it->second->nStartTime < itOldest->second->nStartTime))
+                    itOldest = it;
+            }
+            if(itOldest == g_mapCandyClaimJobs.end())
+                throw JSONRPCError(RPC_WALLET_ERROR, "Error: Too many candy claims in progress");
+            g_mapCandyClaimJobs.erase(itOldest);
+        }
+        g_mapCandyClaimJobs[pjob->jobId] = pjob;
+    }
+    g_candyClaimThreads.create_thread(boost::bind(&ThreadCandyClaim, pjob, assetInfo, mapCandyInfo));
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("jobId", pjob->jobId.GetHex()));
+    return ret;
+}
+
+UniValue getcandyjob(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getcandyjob \"jobId\"\n"
+            "\nReturn the progress of a candy claim started by getcandy with async = true.\n"
+            "\nArguments:\n"
+            "1. \"jobId\"           (string, required) The job id returned by getcandy\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"jobId\":\"xxxxx\",            (string) The job id\n"
+            "  \"assetId\":\"xxxxx\",          (string) The asset id\n"
+            "  \"status\":\"xxxxx\",           (string) running, done or failed\n"
+            "  \"candies\": n,               (numeric) The number of candies of the asset\n"
+            "  \"processed\": n,             (numeric) The number of candies processed so far\n"
+            "  \"claims\": n,                (numeric) The number of candy outputs created so far\n"
+            "  \"duration\": n,              (numeric) Seconds since the job started\n"
+            "  \"result\": [...],            (array) The claims, as returned by getcandy\n"
+            "  \"error\":\"xxxxx\"             (string, optional) Why the job stopped early\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getcandyjob", "\"5f3a8cd16bbdc29e84e2b7b6d1c6f4a2b9c00f7b3bd2f1e1d8e6a0c4b5e7d9f1\"")
+            + HelpExampleRpc("getcandyjob", "\"5f3a8cd16bbdc29e84e2b7b6d1c6f4a2b9c00f7b3bd2f1e1d8e6a0c4b5e7d9f1\"")
+        );
+
+    uint256 jobId = uint256S(TrimString(params[0].get_str()));
+
+    std::lock_guard<std::mutex> lock(g_mutexCandyClaimJobs);
+    std::map<uint256, boost::shared_ptr<CCandyClaimJob> >::const_iterator it = g_mapCandyClaimJobs.find(jobId);
+    if(it == g_mapCandyClaimJobs.end())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown candy job id");
+
+    const CCandyClaimJob& job = *it->second;
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("jobId", job.jobId.GetHex()));
+    ret.push_back(Pair("assetId", job.assetId.GetHex()));
+    ret.push_back(Pair("status", !job.fDone ? "running" : (job.strError.empty() ? "done" : "failed")));
+    ret.push_back(Pair("candies", job.nCandyCount));
+    ret.push_back(Pair("processed", job.nCandyDone));
+    ret.push_back(Pair("claims", (int)job.result.size()));
+    ret.push_back(Pair("duration", (job.fDone ? job.nEndTime : GetTime()) - job.nStartTime));
+    ret.push_back(Pair("result", job.result));
+    if(!job.strError.empty())
+        ret.push_back(Pair("error", job.strError));
+    return ret;
+}
+
+// RPC threads run concurrently: keep each change of the candy watch set and its
+// write to candywatch.dat together, so the file always holds the latest set
+static CCriticalSection cs_candywatchdb;
+
+static void ParseCandyWatchAddresses(const UniValue& param, vector<CIndexAddress>& vAddress)
+{
+    vector<string> vStrAddress;
+    if (param.isStr())
+    {
+        // one address per line, blank lines and # comments ignored
+        ifstream file(param.get_str().c_str());
+        if (!file.is_open())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open address file");
+        string strLine;
+        while (getline(file, strLine))
+        {
+            strLine = TrimString(strLine);
+            if (strLine.empty() || strLine[0] == '#')
+                continue;
+            vStrAddress.push_back(strLine);
+        }
+    }
+    else
+    {
+        const UniValue& addresses = param.get_array();
+        vStrAddress.reserve(addresses.size());
+        for (unsigned int i = 0; i < addresses.size(); i++)
+            vStrAddress.push_back(addresses[i].get_str());
+    }
+
+    vAddress.reserve(vStrAddress.size());
+    BOOST_FOREACH(const string& strAddress, vStrAddress)
+    {
+        CBitcoinAddress address(strAddress);
+        CIndexAddress indexAddress(address.Get());
+        if (!address.IsValid() || indexAddress.IsNull())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, string("Invalid Safe address: ") + strAddress);
+        vAddress.push_back(indexAddress);
+    }
+}
+
+UniValue addcandywatchaddresses(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "addcandywatchaddresses [\"safeAddress\",...]|\"filename\"\n"
+            "\nAdd addresses to the candy watch set, whose candy shares are reported by getcandywatchamounts\n"
+            "without the addresses being in the wallet.\n"
+            "\nArguments:\n"
+            "1. addresses           (array or string, required) A json array of addresses, or the name of a file\n"
+            "                       with one address per line\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"added\": n,          (numeric) The number of addresses which were not in the set yet\n"
+            "  \"size\": n            (numeric) The number of addresses in the set\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("addcandywatchaddresses", "\"[\\\"XrmKC1TAp7ibUNHn6rNRrNPLNTLcj5FbZB\\\"]\"")
+            + HelpExampleCli("addcandywatchaddresses", "'\"/home/user/addresses.txt\"'")
+            + HelpExampleRpc("addcandywatchaddresses", "[\"XrmKC1TAp7ibUNHn6rNRrNPLNTLcj5FbZB\"]")
+        );
+
+    vector<CIndexAddress> vAddress;
+    ParseCandyWatchAddresses(params[0], vAddress);
+
+    LOCK(cs_candywatchdb);
+    size_t nAdded = candyWatchSet.Add(vAddress);
+    CFlatDB<CCandyWatchSet> flatdb("candywatch.dat", "magicCandyWatchCache");
+    if (!flatdb.Dump(candyWatchSet))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Error: Failed to write candywatch.dat");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("added", (uint64_t)nAdded));
+    ret.push_back(Pair("size", (uint64_t)candyWatchSet.Size()));
+    return ret;
+}
+
+UniValue removecandywatchaddresses(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "removecandywatchaddresses [\"safeAddress\",...]|\"filename\"\n"
+            "\nRemove addresses from the candy watch set.\n"
+            "\nArguments:\n"
+            "1. addresses           (array or string, required) A json array of addresses, or the name of a file\n"
+            "                       with one address per line\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"removed\": n,        (numeric) The number of addresses which were in the set\n"
+            "  \"size\": n            (numeric) The number of addresses in the set\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("removecandywatchaddresses", "\"[\\\"XrmKC1TAp7ibUNHn6rNRrNPLNTLcj5FbZB\\\"]\"")
+            + HelpExampleRpc("removecandywatchaddresses", "[\"XrmKC1TAp7ibUNHn6rNRrNPLNTLcj5FbZB\"]")
+        );
+
+    vector<CIndexAddress> vAddress;
+    ParseCandyWatchAddresses(params[0], vAddress);
+
+    LOCK(cs_candywatchdb);
+    size_t nRemoved = candyWatchSet.Remove(vAddress);
+    CFlatDB<CCandyWatchSet> flatdb("candywatch.dat", "magicCandyWatchCache");
+    if (!flatdb.Dump(candyWatchSet))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Error: Failed to write candywatch.dat");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("removed", (uint64_t)nRemoved));
+    ret.push_back(Pair("size", (uint64_t)candyWatchSet.Size()));
+    return ret;
+}
+
+UniValue getcandywatchamounts(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3 || params.size() == 2)
+        throw runtime_error(
+            "getcandywatchamounts \"assetId\" ( \"txid\" vout )\n"
+            "\nReturn the candy each address of the candy watch set can still get.\n"
+            "\nArguments:\n"
+            "1. \"assetId\"         (string, required) The asset id\n"
+            "2. \"txid\"            (string, optional) Only the candy put by this transaction\n"
+            "3. vout              (numeric, optional) The output of the candy in that transaction\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"txid\":\"xxxxx\",              (string) The transaction which put the candy\n"
+            "    \"vout\": n,                   (numeric) The candy output\n"
+            "    \"height\": n,                 (numeric) The height of the candy\n"
+            "    \"candyAmount\": xxxxx,        (numeric) The amount of candy put\n"
+            "    \"totalSafe\": xxxxx,          (numeric) The safe in all addresses at that height\n"
+            "    \"claimableAmount\": xxxxx,    (numeric) The candy the watched addresses can still get\n"
+            "    \"addresses\": [\n"
+            "      {\n"
+            "        \"address\":\"xxxxx\",       (string) The watched address\n"
+            "        \"safeAmount\": xxxxx,     (numeric) Its safe at the candy height\n"
+            "        \"candyAmount\": xxxxx     (numeric) The candy it can get\n"
+            "      }\n"
+            "      ,...\n"
+            "    ]\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getcandywatchamounts", "\"723468197263af02cdf836aa12033864df0de857780dcb7982262efface6afdd\"")
+            + HelpExampleRpc("getcandywatchamounts", "\"723468197263af02cdf836aa12033864df0de857780dcb7982262efface6afdd\"")
+        );
+
+    uint256 assetId = uint256S(TrimString(params[0].get_str()));
+    COutPoint filter;
+    if (params.size() > 1)
+    {
+        int nOut = params[2].get_int();
+        if (nOut < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, vout must be positive");
+        filter = COutPoint(ParseHashV(params[1], "txid"), nOut);
+    }
+
+    CAssetId_AssetInfo_IndexValue assetInfo;
+    map<COutPoint, CCandyInfo> mapCandyInfo;
+    {
+        LOCK(cs_main);
+
+        if(!masternodeSync.IsBlockchainSynced())
+            throw JSONRPCError(SYNCING_BLOCK, "Synchronizing block data");
+
+        if(assetId.IsNull() || !GetAssetInfoByAssetId(assetId, assetInfo, false))
+            throw JSONRPCError(NONEXISTENT_ASSETID, "Non-existent asset id");
+
+        GetAssetIdCandyInfo(assetId, mapCandyInfo);
+        if(mapCandyInfo.size() == 0)
+            throw JSONRPCError(NONEXISTENT_ASSETCANDY, "Non-existent asset candy");
+    }
+
+    vector<string> vAddress = candyWatchSet.GetAddresses();
+    int nCurrentHeight = g_nChainHeight;
+    CAmount nMinAmount = AmountFromValue("0.0001", assetInfo.assetData.nDecimals, true);
+
+    map<COutPoint, vector<string> > mapOutAddress;
+    GetCOutPointAddress(assetId, mapOutAddress);
+
+    UniValue ret(UniValue::VARR);
+    for(map<COutPoint, CCandyInfo>::const_iterator it = mapCandyInfo.begin(); it != mapCandyInfo.end(); it++)
+    {
+        const COutPoint& out = it->first;
+        const CCandyInfo& candyInfo = it->second;
+
+        if(!filter.IsNull() && out != filter)
+            continue;
+
+        if(candyInfo.nAmount <= 0)
+            continue;
+
+        uint256 blockHash;
+        int nTxHeight = 0;
+        {
+            LOCK(cs_main);
+            nTxHeight = GetTxHeight(out.hash, &blockHash);
+        }
+        if(blockHash.IsNull())
+            continue;
+        if(nTxHeight + BLOCKS_PER_DAY > nCurrentHeight)
+            continue;
+
+        if(candyInfo.nExpired * BLOCKS_PER_MONTH + nTxHeight < nCurrentHeight)
+            continue;
+
+        CAmount nTotalSafe = 0;
+        if(!GetTotalAmountByHeight(nTxHeight, nTotalSafe))
+            throw JSONRPCError(GET_ALL_ADDRESS_SAFE_FAILED, "Error: get all address safe amount failed");
+        if(nTotalSafe <= 0)
+            throw JSONRPCError(INVALID_TOTAL_SAFE, "Error: get total safe amount failed");
+
+        set<string> setClaimed;
+        GetCandyClaimedAddresses(assetId, out, mapOutAddress, setClaimed);
+
+        CCandyShareCalculator calc(vAddress, setClaimed, nTxHeight, nTotalSafe, candyInfo.nAmount, nMinAmount);
+        calc.RunParallel();
+
+        CAmount nClaimable = 0;
+        UniValue addresses(UniValue::VARR);
+        for(unsigned int i = 0; i < vAddress.size(); i++)
+        {
+            if(calc.vShare[i] == 0)
+                continue;
+            nClaimable += calc.vShare[i];
+
+            UniValue entry(UniValue::VOBJ);
+            entry.push_back(Pair("address", vAddress[i]));
+            entry.push_back(Pair("safeAmount", ValueFromAmount(calc.vSafe[i])));
+            entry.push_back(Pair("candyAmount", StrValueFromAmount(calc.vShare[i], assetInfo.assetData.nDecimals)));
+            addresses.push_back(entry);
+        }
+
+        UniValue candy(UniValue::VOBJ);
+        candy.push_back(Pair("txid", out.hash.GetHex()));
+        candy.push_back(Pair("vout", (int)out.n));
+        candy.push_back(Pair("height", nTxHeight));
+        candy.push_back(Pair("candyAmount", StrValueFromAmount(candyInfo.nAmount, assetInfo.assetData.nDecimals)));
+        candy.push_back(Pair("totalSafe", ValueFromAmount(nTotalSafe)));
+        candy.push_back(Pair("claimableAmount", StrValueFromAmount(nClaimable, assetInfo.assetData.nDecimals)));
+        candy.push_back(Pair("addresses", addresses));
+        ret.push_back(candy);
     }
 
     return ret;
@@ -1222,10 +1700,9 @@ UniValue getaddrassetbalance(const UniValue& params, bool fHelp)
     if (!GetTxInfoByAssetIdAddressTxClass(assetId, strAddress, 1, vOut))
         throw JSONRPCError(GET_TXID_FAILED, "No transaction available about asset with specified address");
 
-    std::string TotalSendAmount = "";
-    std::string TotalReceiveAmount = "";
-    std::string TotalLockingAmount = "";
-    std::string Totalbalance = "";
+    CAssetAmount TotalSendAmount;
+    CAssetAmount TotalReceiveAmount;
+    CAssetAmount TotalLockingAmount;
 
     vector<uint256> vHash;
     BOOST_FOREACH(const COutPoint& out, vOut)
@@ -1256,12 +1733,10 @@ UniValue getaddrassetbalance(const UniValue& params, bool fHelp)
                 std::string strtempAddress = CBitcoinAddress(tempdest).ToString();
                 if (strtempAddress == strAddress)
                 {
-                    char ctempdata[64] = {0};
-                    sprintf(ctempdata, "%lld", txout.nValue);
-                    TotalReceiveAmount = plusstring(TotalReceiveAmount, ctempdata);
+                    TotalReceiveAmount += txout.nValue;
 
                     if (txout.nUnlockedHeight > chainActive.Height())
-                        TotalLockingAmount = plusstring(TotalLockingAmount, ctempdata);
+                        TotalLockingAmount += txout.nValue;
                 }
             }
 
@@ -1290,37 +1765,20 @@ UniValue getaddrassetbalance(const UniValue& params, bool fHelp)
                     std::string strtempAddress = CBitcoinAddress(tempdest).ToString();
                     if (strtempAddress == strAddress)
                     {
-                        char ctempdata[64] = {0};
-                        sprintf(ctempdata, "%lld", txout.nValue);
-                        TotalSendAmount = plusstring(TotalSendAmount, ctempdata);
+                        TotalSendAmount += txout.nValue;
                     }
                 }
             }
         }
     }
 
-    Totalbalance = minusstring(TotalReceiveAmount, TotalSendAmount);
+    CAssetAmount Totalbalance = TotalReceiveAmount - TotalSendAmount;
 
     UniValue ret(UniValue::VOBJ);
-    if (TotalReceiveAmount.length() <= assetInfo.assetData.nDecimals)
-        ret.push_back(Pair("ReceiveAmount",  StrValueFromAmount(atol(TotalReceiveAmount.c_str()), assetInfo.assetData.nDecimals)));
-    else
-        ret.push_back(Pair("ReceiveAmount",  numtofloatstring(TotalReceiveAmount, assetInfo.assetData.nDecimals)));
-
-    if (TotalSendAmount.length() <= assetInfo.assetData.nDecimals)
-        ret.push_back(Pair("SendAmount",  StrValueFromAmount(atol(TotalSendAmount.c_str()), assetInfo.assetData.nDecimals)));
-    else
-        ret.push_back(Pair("SendAmount",  numtofloatstring(TotalSendAmount, assetInfo.assetData.nDecimals)));
-
-    if (Totalbalance.length() <= assetInfo.assetData.nDecimals)
-        ret.push_back(Pair("totalAmount",  StrValueFromAmount(atol(Totalbalance.c_str()), assetInfo.assetData.nDecimals)));
-    else
-         ret.push_back(Pair("totalAmount",  numtofloatstring(Totalbalance, assetInfo.assetData.nDecimals)));
-
-    if (TotalLockingAmount.length() <= assetInfo.assetData.nDecimals)
-        ret.push_back(Pair("lockAmount",  StrValueFromAmount(atol(TotalLockingAmount.c_str()), assetInfo.assetData.nDecimals)));
-    else
-        ret.push_back(Pair("lockAmount",  numtofloatstring(TotalLockingAmount, assetInfo.assetData.nDecimals)));
+    ret.push_back(Pair("ReceiveAmount", TotalReceiveAmount.ToString(assetInfo.assetData.nDecimals)));
+    ret.push_back(Pair("SendAmount", TotalSendAmount.ToString(assetInfo.assetData.nDecimals)));
+    ret.push_back(Pair("totalAmount", Totalbalance.ToString(assetInfo.assetData.nDecimals)));
+    ret.push_back(Pair("lockAmount", TotalLockingAmount.ToString(assetInfo.assetData.nDecimals)));
 
     return ret;
 }
@@ -1972,52 +2430,10 @@ UniValue getlocalassetlist(const UniValue& params, bool fHelp)
     return ret;
 }
 
-UniValue transfermanyasset(const UniValue& params, bool fHelp)
+static void ParseAssetReceivers(const UniValue& receiveinfo, const CAssetId_AssetInfo_IndexValue& assetInfo, vector<CRecipient>& vecSend, CAmount& nTotalAmount)
 {
-    if (!EnsureWalletIsAvailable(fHelp))
-        return NullUniValue;
-
-    if (fHelp || params.size() != 2)
-        throw runtime_error(
-            "transfermanyasset \"assetId\" [{\"safeAddress\":\"xxx\",\"assetAmount\":xxxx, \"lockTime\":xxxx, \"remarks\":xxx},...]\n"
-            "\nTransfer asset to multiple people.\n"
-            "\nArguments:\n"
-            "1. \"assetId\"            (string, required) The asset id for transfer\n"
-            "2. \"receiveinfo\"        (string, required) A json array of json objects\n"
-            "     [\n"
-            "       {\n"
-            "         \"safeAddress\":\"xxx\",          (string, required) The receiver's address\n"
-            "         \"assetAmount\":,                 (numeric, required) The asset amount\n"
-            "         \"lockTime\":n,                   (numeric, optional) The locked monthes\n"
-            "         \"remarks\":                      (string, optional) The remarks\n"
-            "       }\n"
-            "       ,...\n"
-            "     ]\n"
-            "\nResult:\n"
-            "{\n"
-            "  \"txId\": \"xxxxx\"  (string) The transaction id\n"
-            "}\n"
-            "\nExamples:\n"
-            + HelpExampleCli("transfermanyasset", "\"723468197263af02cdf836aa12033864df0de857780dcb7982262efface6afdd\" \"[{\\\"safeAddress\\\":\\\"Xg1wCDXKuv4rEfsR9Ldv2qmUHSS9Ds1VCL\\\",\\\"assetAmount\\\":1000,\\\"lockTime\\\":6,\\\"remarks\\\":\\\"This is a test\\\"},{\\\"safeAddress\\\":\\\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\\\",\\\"assetAmount\\\":1000,\\\"lockTime\\\":6,\\\"remarks\\\":\\\"This is a test\\\"}]\"")
-            + HelpExampleCli("transfermanyasset", "\"723468197263af02cdf836aa12033864df0de857780dcb7982262efface6afdd\" \"[{\\\"safeAddress\\\":\\\"Xg1wCDXKuv4rEfsR9Ldv2qmUHSS9Ds1VCL\\\",\\\"assetAmount\\\":1000},{\\\"safeAddress\\\":\\\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\\\",\\\"assetAmount\\\":1000}]\"")
-            + HelpExampleRpc("transfermanyasset", "\"723468197263af02cdf836aa12033864df0de857780dcb7982262efface6afdd\", \"[{\\\"safeAddress\\\":\\\"Xg1wCDXKuv4rEfsR9Ldv2qmUHSS9Ds1VCL\\\",\\\"assetAmount\\\":1000,\\\"lockTime\\\":6,\\\"remarks\\\":\\\"This is a test\\\"},{\\\"safeAddress\\\":\\\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\\\",\\\"assetAmount\\\":1000,\\\"lockTime\\\":6,\\\"remarks\\\":\\\"This is a test\\\"}]\"")
-        );
-
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
-    if(!masternodeSync.IsBlockchainSynced())
-        throw JSONRPCError(SYNCING_BLOCK, "Synchronizing block data");
-
-    uint256 assetId = uint256S(TrimString(params[0].get_str()));
-    CAssetId_AssetInfo_IndexValue assetInfo;
-    if(assetId.IsNull() || !GetAssetInfoByAssetId(assetId, assetInfo, false))
-        throw JSONRPCError(NONEXISTENT_ASSETID, "Non-existent asset id");
-
-    UniValue receiveinfo = params[1].get_array();
-    CAmount totalassetamount = 0;
-    string strtempRemarks = "";
-
-    vector<CRecipient> vecSend;
+    nTotalAmount = 0;
+    vecSend.reserve(vecSend.size() + receiveinfo.size());
     for (unsigned int i = 0; i < receiveinfo.size(); i++)
     {
         const UniValue& input = receiveinfo[i];
@@ -2036,7 +2452,9 @@ UniValue transfermanyasset(const UniValue& params, bool fHelp)
         CAmount nAmount = AmountFromValue(vamount, assetInfo.assetData.nDecimals, true);
         if (nAmount <= 0)
             throw JSONRPCError(INVALID_ASSET_AMOUNT, "Invalid asset amount");
-        totalassetamount += nAmount;
+        nTotalAmount += nAmount;
+        if (nTotalAmount > MAX_ASSETS)
+            throw JSONRPCError(INVALID_ASSET_AMOUNT, "Invalid asset amount");
 
         const UniValue& vlockmonth = find_value(o, "lockTime");
         int nLockedMonth = 0;
@@ -2063,6 +2481,54 @@ UniValue transfermanyasset(const UniValue& params, bool fHelp)
         CRecipient recvRecipient = {GetScriptForDestination(address.Get()), nAmount, nLockedMonth, false, true, strRemarks};
         vecSend.push_back(recvRecipient);
     }
+}
+
+UniValue transfermanyasset(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "transfermanyasset \"assetId\" [{\"safeAddress\":\"xxx\",\"assetAmount\":xxxx, \"lockTime\":xxxx, \"remarks\":xxx},...]\n"
+            "\nTransfer asset to multiple people.\n"
+            "\nArguments:\n"
+            "1. \"assetId\"            (string, required) The asset id for transfer\n"
+            "2. \"receiveinfo\"        (string, required) A json array of json objects\n"
+            "     [\n"
+            "       {\n"
+            "         \"safeAddress\":\"xxx\",          (string, required) The receiver's address\n"
+            "         \"assetAmount\":,                 (numeric, required) The asset amount\n"
+            "         \"lockTime\":n,                   (numeric, optional) The locked monthes\n"
+            "         \"remarks\":                      (string, optional) The remarks\n"
+            "       }\n"
+            "       ,...\n"
+            "     ]\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txId\": \"xxxxx\"  (string) The transaction id\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("transfermanyasset", "\"723468197263af02cdf836aa12033864df0de857780dcb7982262efface6afdd\" \"[{\\\"safeAddress\\\":\\\"Xg1wCDXKuv4rEfsR9Ldv2qmUHSS9Ds1VCL\\\",\\\"assetAmount\\\":1000,\\\"lockTime\\\":6,\\\"remarks\\\":\\\"This is a test\\\"},{\\\"safeAddress\\\":\\\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\\\",\\\"assetAmount\\\":1000,\\\"lockTime\\\":6,\\\"remarks\\\":\\\"This is a test\\\"}]\"")
+            + HelpExampleCli("transfermanyasset", "\"723468197263af02cdf836aa12033864df0de857780dcb7982262efface6afdd\" \"[{\\\"safeAddress\\\":\\\"Xg1wCDXKuv4rEfsR9Ldv2qmUHSS9Ds1VCL\\\",\\\"assetAmount\\\":1000},{\\\"safeAddress\\\":\\\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\\\",\\\"assetAmount\\\":1000}]\"")
+            + HelpExampleRpc("transfermanyasset", "\"723468197263af02cdf836aa12033864df0de857780dcb7982262efface6afdd\", \"[{\\\"safeAddress\\\":\\\"Xg1wCDXKuv4rEfsR9Ldv2qmUHSS9Ds1VCL\\\",\\\"assetAmount\\\":1000,\\\"lockTime\\\":6,\\\"remarks\\\":\\\"This is a test\\\"},{\\\"safeAddress\\\":\\\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\\\",\\\"assetAmount\\\":1000,\\\"lockTime\\\":6,\\\"remarks\\\":\\\"This is a test\\\"}]\"")
+        );
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    if(!masternodeSync.IsBlockchainSynced())
+        throw JSONRPCError(SYNCING_BLOCK, "Synchronizing block data");
+
+    uint256 assetId = uint256S(TrimString(params[0].get_str()));
+    CAssetId_AssetInfo_IndexValue assetInfo;
+    if(assetId.IsNull() || !GetAssetInfoByAssetId(assetId, assetInfo, false))
+        throw JSONRPCError(NONEXISTENT_ASSETID, "Non-existent asset id");
+
+    CAmount totalassetamount = 0;
+    string strtempRemarks = "";
+
+    vector<CRecipient> vecSend;
+    ParseAssetReceivers(params[1].get_array(), assetInfo, vecSend, totalassetamount);
 
     CAppHeader appHeader(g_nAppHeaderVersion, uint256S(g_strSafeAssetId), TRANSFER_ASSET_CMD);
     CCommonData transferData(assetId, totalassetamount, strtempRemarks);
@@ -2098,18 +2564,142 @@ UniValue transfermanyasset(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue bulktransferasset(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() < 2 || params.size() > 3)
+        throw runtime_error(
+            "bulktransferasset \"assetId\" [{\"safeAddress\":\"xxx\",\"assetAmount\":xxxx, \"lockTime\":xxxx, \"remarks\":xxx},...]|\"filename\" ( maxOutputs )\n"
+            "\nPay out asset to a large number of receivers, split over as many transactions as needed.\n"
+            "Coins are selected once for the whole payout and all transactions are committed together.\n"
+            "\nArguments:\n"
+            "1. \"assetId\"            (string, required) The asset id for transfer\n"
+            "2. \"receiveinfo\"        (string, required) A json array of json objects as in transfermanyasset,\n"
+            "                            or the name of a file containing such an array\n"
+            "     [\n"
+            "       {\n"
+            "         \"safeAddress\":\"xxx\",          (string, required) The receiver's address\n"
+            "         \"assetAmount\":,                 (numeric, required) The asset amount\n"
+            "         \"lockTime\":n,                   (numeric, optional) The locked monthes\n"
+            "         \"remarks\":                      (string, optional) The remarks\n"
+            "       }\n"
+            "       ,...\n"
+            "     ]\n"
+            "3. maxOutputs             (numeric, optional, default=" + strprintf("%u", DEFAULT_ASSET_PAYOUT_OUTPUTS) + ") Maximum receivers per transaction\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txIds\": [\"xxxxx\",...]  (array) The transaction ids\n"
+            "  \"fee\": x.xxx             (numeric) The total fee in " + CURRENCY_UNIT + "\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("bulktransferasset", "\"723468197263af02cdf836aa12033864df0de857780dcb7982262efface6afdd\" \"[{\\\"safeAddress\\\":\\\"Xg1wCDXKuv4rEfsR9Ldv2qmUHSS9Ds1VCL\\\",\\\"assetAmount\\\":1000},{\\\"safeAddress\\\":\\\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\\\",\\\"assetAmount\\\":1000}]\"")
+            + HelpExampleCli("bulktransferasset", "\"723468197263af02cdf836aa12033864df0de857780dcb7982262efface6afdd\" \"\\\"payout.json\\\"\" 300")
+            + HelpExampleRpc("bulktransferasset", "\"723468197263af02cdf836aa12033864df0de857780dcb7982262efface6afdd\", \"payout.json\"")
+        );
+
+    uint256 assetId = uint256S(TrimString(params[0].get_str()));
+    CAssetId_AssetInfo_IndexValue assetInfo;
+    {
+        LOCK(cs_main);
+        if(!masternodeSync.IsBlockchainSynced())
+            throw JSONRPCError(SYNCING_BLOCK, "Synchronizing block data");
+        if(assetId.IsNull() || !GetAssetInfoByAssetId(assetId, assetInfo, false))
+            throw JSONRPCError(NONEXISTENT_ASSETID, "Non-existent asset id");
+    }
+
+    UniValue receiveinfo;
+    if (params[1].isStr())
+    {
+        ifstream file(params[1].get_str().c_str());
+        if (!file.is_open())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open receiver file");
+        std::string strJson((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (!receiveinfo.read(strJson) || !receiveinfo.isArray())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Receiver file must contain a json array");
+    }
+    else
+        receiveinfo = params[1].get_array();
+
+    unsigned int nMaxOutputs = DEFAULT_ASSET_PAYOUT_OUTPUTS;
+    if (params.size() > 2)
+    {
+        int nValue = params[2].get_int();
+        if (nValue <= 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter:maxOutputs");
+        nMaxOutputs = nValue;
+    }
+
+    // Parse and validate the receivers before taking the wallet lock
+    CAmount totalassetamount = 0;
+    vector<CRecipient> vecSend;
+    ParseAssetReceivers(receiveinfo, assetInfo, vecSend, totalassetamount);
+    if (vecSend.empty())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "No receiver");
+
+    CAppHeader appHeader(g_nAppHeaderVersion, uint256S(g_strSafeAssetId), TRANSFER_ASSET_CMD);
+    CCommonData transferData(assetId, totalassetamount, "");
+
+    EnsureWalletIsUnlocked();
+
+    if (pwalletMain->GetBroadcastTransactions() && !g_connman)
+        throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
+
+    if(pwalletMain->GetBalance() <= 0)
+        throw JSONRPCError(INSUFFICIENT_SAFE, "Insufficient safe funds");
+
+    if(pwalletMain->GetBalance(true, &assetId) < totalassetamount)
+        throw JSONRPCError(INSUFFICIENT_ASSET, "Insufficient asset funds");
+
+    vector<CWalletTx> vwtx;
+    CReserveKey reservekey(pwalletMain);
+    CAmount nFeeRequired = 0;
+    string strError;
+    if(!pwalletMain->CreateAssetPayoutTransactions(appHeader, transferData, vecSend, nMaxOutputs, vwtx, reservekey, nFeeRequired, strError))
+        throw JSONRPCError(RPC_WALLET_ERROR, strError);
+    vector<bool> vAccepted;
+    if(!pwalletMain->CommitTransactions(vwtx, reservekey, g_connman.get(), vAccepted))
+    {
+        string strSent;
+        for(unsigned int i = 0; i < vwtx.size(); i++)
+        {
+            if(vAccepted.size() == vwtx.size() && vAccepted[i])
+                strSent += (strSent.empty() ? "" : ",") + vwtx[i].GetHash().GetHex();
+        }
+        if(strSent.empty())
+            throw JSONRPCError(RPC_WALLET_ERROR, "Error: Transfer asset failed, please check your wallet and try again later!");
+        throw JSONRPCError(RPC_WALLET_ERROR, strprintf("Error: Transfer asset partly failed, transactions already sent: %s. Do not pay their receivers again!", strSent));
+    }
+
+    UniValue txIds(UniValue::VARR);
+    BOOST_FOREACH(const CWalletTx& wtx, vwtx)
+        txIds.push_back(wtx.GetHash().GetHex());
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("txIds", txIds));
+    ret.push_back(Pair("fee", ValueFromAmount(nFeeRequired)));
+    return ret;
+}
+
 UniValue getassetlocaltxlist(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 2)
+    if (fHelp || params.size() < 2 || params.size() > 7)
         throw runtime_error(
-            "getassetlocaltxlist \"assetId\" txClass\n"
+            "getassetlocaltxlist \"assetId\" txClass ( count from starttime endtime \"beforetxid\" )\n"
             "\nReturns list of local transactions by specified asset id and transaction type.\n"
             "\nArguments:\n"
             "1. \"assetId\"             (string, required) The asset id for transaction lookup\n"
             "2. txClass                 (numeric, required) The transaction type (1=all, 2=normal, 3=locked,4=issue,5=addissue,6=destory)\n"
+            "3. count                   (numeric, optional) Return at most this many of the most recent transactions, default all\n"
+            "4. from                    (numeric, optional, default=0) The number of most recent transactions to skip\n"
+            "5. starttime               (numeric, optional, default=0) Only transactions at or after this time (seconds since epoch)\n"
+            "6. endtime                 (numeric, optional) Only transactions at or before this time (seconds since epoch)\n"
+            "7. \"beforetxid\"            (string, optional) Only transactions older than this wallet transaction. Pass the first txid\n"
+            "                            of a page to get the page before it, which is faster than a large 'from'\n"
             "\nResult:\n"
             "{\n"
-            "    \"txList\":\n"
+            "    \"txList\":           (array) The transaction ids, oldest first\n"
             "    [\n"
             "        \"txId\"\n"
             "        ,...\n"
@@ -2117,6 +2707,7 @@ UniValue getassetlocaltxlist(const UniValue& params, bool fHelp)
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getassetlocaltxlist", "\"723468197263af02cdf836aa12033864df0de857780dcb7982262efface6afdd\" 1")
+            + HelpExampleCli("getassetlocaltxlist", "\"723468197263af02cdf836aa12033864df0de857780dcb7982262efface6afdd\" 1 20 100")
             + HelpExampleRpc("getassetlocaltxlist", "\"723468197263af02cdf836aa12033864df0de857780dcb7982262efface6afdd\", 3")
         );
 
@@ -2127,30 +2718,48 @@ UniValue getassetlocaltxlist(const UniValue& params, bool fHelp)
     if(nTxClass < 1 || nTxClass > sporkManager.GetSporkValue(SPORK_105_TX_CLASS_MAX_VALUE))
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid type of transaction");
 
-    vector<COutPoint> vOut;
-    if(!GetTxInfoByAssetIdTxClass(assetId, nTxClass, vOut))
-        throw JSONRPCError(GET_TXID_FAILED, "No transaction available about asset");
-
-    std::vector<uint256> vTx;
-    BOOST_FOREACH(const COutPoint& out, vOut)
+    int nCount = -1;
+    if(params.size() > 2)
     {
-        if(find(vTx.begin(), vTx.end(), out.hash) == vTx.end())
-            vTx.push_back(out.hash);
+        nCount = params[2].get_int();
+        if(nCount < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
     }
-
-    std::vector<uint256> vlocalTx;
-    std::vector<uint256>::iterator it = vTx.begin();
-    for (; it != vTx.end(); it++)
+    int nFrom = 0;
+    if(params.size() > 3)
     {
-        std::map<uint256, CWalletTx>::iterator tempit = pwalletMain->mapWallet.find(*it);
-        if (tempit != pwalletMain->mapWallet.end())
-            vlocalTx.push_back(*it);
+        nFrom = params[3].get_int();
+        if(nFrom < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative from");
     }
+    int64_t nStartTime = 0;
+    if(params.size() > 4)
+        nStartTime = params[4].get_int64();
+    int64_t nEndTime = std::numeric_limits<int64_t>::max();
+    if(params.size() > 5)
+        nEndTime = params[5].get_int64();
+    uint256 hashBefore;
+    if(params.size() > 6)
+        hashBefore = ParseHashV(params[6], "beforetxid");
+
+    uint32_t nClassMask;
+    if(nTxClass == ALL_TXOUT)
+        nClassMask = std::numeric_limits<uint32_t>::max();
+    else if(nTxClass == UNLOCKED_TXOUT)
+        nClassMask = ~((uint32_t)1 << LOCKED_TXOUT);
+    else
+        nClassMask = (uint32_t)1 << nTxClass;
+
+    std::vector<const CWalletTx*> vwtx;
+    if(!pwalletMain->ListAssetTransactions(assetId, nClassMask, nStartTime, nEndTime, hashBefore, nFrom, nCount, vwtx))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid or non-wallet transaction id");
+    if(vwtx.empty() && params.size() == 2)
+        throw JSONRPCError(GET_TXID_FAILED, "No transaction available about asset");
 
     UniValue ret(UniValue::VOBJ);
     UniValue transactionList(UniValue::VARR);
-    for(unsigned int i = 0; i < vlocalTx.size(); i++)
-        transactionList.push_back(vlocalTx[i].GetHex());
+    for(unsigned int i = 0; i < vwtx.size(); i++)
+        transactionList.push_back(vwtx[i]->GetHash().GetHex());
     ret.push_back(Pair("txList", transactionList));
 
     return ret;
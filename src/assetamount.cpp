@@ -0,0 +1,251 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "assetamount.h"
+
+#include <assert.h>
+#include <limits>
+
+static const uint64_t TEN_POW_19 = 10000000000000000000ULL;
+
+static uint64_t AbsAmount(const CAmount& nAmount)
+{
+    // -INT64_MIN is not representable as int64_t, so negate in unsigned space
+    return nAmount < 0 ? ~(uint64_t)nAmount + 1 : (uint64_t)nAmount;
+}
+
+CAssetAmount::CAssetAmount(uint64_t nHighIn, uint64_t nLowIn, bool fNegativeIn) : nHigh(nHighIn), nLow(nLowIn), fNegative(fNegativeIn)
+{
+    Normalize();
+}
+
+CAssetAmount::CAssetAmount(const CAmount& nAmount) : nHigh(0), nLow(AbsAmount(nAmount)), fNegative(nAmount < 0)
+{
+}
+
+int CAssetAmount::CompareMagnitude(const CAssetAmount& a, const CAssetAmount& b)
+{
+    if (a.nHigh != b.nHigh)
+        return a.nHigh < b.nHigh ? -1 : 1;
+    if (a.nLow != b.nLow)
+        return a.nLow < b.nLow ? -1 : 1;
+    return 0;
+}
+
+void CAssetAmount::AddMagnitude(CAssetAmount& a, const CAssetAmount& b)
+{
+    uint64_t nLow = a.nLow + b.nLow;
+    a.nHigh += b.nHigh + (nLow < a.nLow ? 1 : 0);
+    a.nLow = nLow;
+}
+
+void CAssetAmount::SubMagnitude(CAssetAmount& a, const CAssetAmount& b)
+{
+    // requires |a| >= |b|
+    uint64_t nBorrow = a.nLow < b.nLow ? 1 : 0;
+    a.nLow -= b.nLow;
+    a.nHigh -= b.nHigh + nBorrow;
+}
+
+uint64_t CAssetAmount::DivModMagnitude(uint64_t nDivisor)
+{
+    assert(nDivisor != 0);
+    if (nHigh == 0)
+    {
+        uint64_t nRemainder = nLow % nDivisor;
+        nLow /= nDivisor;
+        return nRemainder;
+    }
+
+    // Shift-subtract long division; the remainder always stays below nDivisor,
+    // but shifting it left can carry out of 64 bits, which means it certainly
+    // exceeds the divisor.
+    uint64_t nRemainder = 0;
+    uint64_t nQuotientHigh = 0, nQuotientLow = 0;
+    for (int i = 127; i >= 0; i--)
+    {
+        uint64_t nBit = i >= 64 ? (nHigh >> (i - 64)) & 1 : (nLow >> i) & 1;
+        bool fCarry = (nRemainder >> 63) != 0;
+        nRemainder = (nRemainder << 1) | nBit;
+        if (fCarry || nRemainder >= nDivisor)
+        {
+            nRemainder -= nDivisor;
+            if (i >= 64)
+                nQuotientHigh |= (uint64_t)1 << (i - 64);
+            else
+                nQuotientLow |= (uint64_t)1 << i;
+        }
+    }
+    nHigh = nQuotientHigh;
+    nLow = nQuotientLow;
+    return nRemainder;
+}
+
+CAssetAmount CAssetAmount::Mul(const CAmount& a, const CAmount& b)
+{
+    const uint64_t nMask = 0xFFFFFFFF;
+    uint64_t x = AbsAmount(a), y = AbsAmount(b);
+    uint64_t x0 = x & nMask, x1 = x >> 32;
+    uint64_t y0 = y & nMask, y1 = y >> 32;
+
+    uint64_t p00 = x0 * y0;
+    uint64_t p01 = x0 * y1;
+    uint64_t p10 = x1 * y0;
+    uint64_t p11 = x1 * y1;
+
+    uint64_t nMid = (p00 >> 32) + (p01 & nMask) + (p10 & nMask);
+    uint64_t nLow = (nMid << 32) | (p00 & nMask);
+    uint64_t nHigh = p11 + (p01 >> 32) + (p10 >> 32) + (nMid >> 32);
+    return CAssetAmount(nHigh, nLow, (a < 0) != (b < 0));
+}
+
+CAssetAmount CAssetAmount::Div(const CAmount& nDivisor) const
+{
+    CAssetAmount r(*this);
+    r.DivModMagnitude(AbsAmount(nDivisor));
+    r.fNegative = fNegative != (nDivisor < 0);
+    r.Normalize();
+    return r;
+}
+
+bool CAssetAmount::GetAmount(CAmount& nAmount) const
+{
+    if (nHigh != 0)
+        return false;
+    if (!fNegative)
+    {
+        if (nLow > (uint64_t)std::numeric_limits<int64_t>::max())
+            return false;
+        nAmount = (CAmount)nLow;
+        return true;
+    }
+    if (nLow > (uint64_t)std::numeric_limits<int64_t>::max() + 1)
+        return false;
+    nAmount = nLow == (uint64_t)std::numeric_limits<int64_t>::max() + 1 ? std::numeric_limits<int64_t>::min() : -(CAmount)nLow;
+    return true;
+}
+
+std::string CAssetAmount::ToString(uint8_t nDecimals) const
+{
+    // Collect base-10^19 chunks, least significant first; 2^128 needs at most three
+    CAssetAmount tmp(nHigh, nLow, false);
+    uint64_t vChunk[3];
+    int nChunks = 0;
+    do {
+        vChunk[nChunks++] = tmp.DivModMagnitude(TEN_POW_19);
+    } while (!tmp.IsZero());
+
+    std::string strDigits;
+    strDigits.reserve(40 + nDecimals);
+    for (int i = nChunks - 1; i >= 0; i--)
+    {
+        char buf[20];
+        int nLen = 0;
+        uint64_t n = vChunk[i];
+        do {
+            buf[nLen++] = '0' + (n % 10);
+            n /= 10;
+        } while (n != 0);
+        if (i != nChunks - 1)
+            strDigits.append(19 - nLen, '0');
+        while (nLen > 0)
+            strDigits.push_back(buf[--nLen]);
+    }
+
+    if (strDigits.size() <= nDecimals)
+        strDigits.insert(0, nDecimals + 1 - strDigits.size(), '0');
+    if (nDecimals > 0)
+        strDigits.insert(strDigits.size() - nDecimals, 1, '.');
+    if (fNegative)
+        strDigits.insert(0, 1, '-');
+    return strDigits;
+}
+
+bool CAssetAmount::Parse(const std::string& str, uint8_t nDecimals, CAssetAmount& amount)
+{
+    size_t ptr = 0, end = str.size();
+    bool fNeg = false;
+    if (ptr < end && str[ptr] == '-')
+    {
+        fNeg = true;
+        ++ptr;
+    }
+
+    CAssetAmount value;
+    int nIntDigits = 0, nFracDigits = 0;
+    bool fPoint = false;
+    for (; ptr < end; ++ptr)
+    {
+        char ch = str[ptr];
+        if (ch == '.' && !fPoint)
+        {
+            fPoint = true;
+            continue;
+        }
+        if (ch < '0' || ch > '9')
+            return false; /* unexpected character */
+        if (fPoint && ++nFracDigits > nDecimals)
+            return false; /* more precision than the asset has */
+        if (!fPoint)
+            ++nIntDigits;
+        if (value.nHigh >> 59)
+            return false; /* overflow */
+        CAssetAmount x8(value.nHigh << 3 | value.nLow >> 61, value.nLow << 3, false);
+        CAssetAmount x2(value.nHigh << 1 | value.nLow >> 63, value.nLow << 1, false);
+        AddMagnitude(x8, x2);
+        AddMagnitude(x8, CAssetAmount((CAmount)(ch - '0')));
+        value = x8;
+    }
+    if (nIntDigits == 0 || (fPoint && nFracDigits == 0))
+        return false; /* missing expected digit */
+
+    for (int i = nFracDigits; i < nDecimals; i++)
+    {
+        if (value.nHigh >> 59)
+            return false; /* overflow */
+        CAssetAmount x8(value.nHigh << 3 | value.nLow >> 61, value.nLow << 3, false);
+        CAssetAmount x2(value.nHigh << 1 | value.nLow >> 63, value.nLow << 1, false);
+        AddMagnitude(x8, x2);
+        value = x8;
+    }
+
+    value.fNegative = fNeg;
+    value.Normalize();
+    amount = value;
+    return true;
+}
+
+CAssetAmount& CAssetAmount::operator+=(const CAssetAmount& b)
+{
+    if (fNegative == b.fNegative)
+        AddMagnitude(*this, b);
+    else if (CompareMagnitude(*this, b) >= 0)
+        SubMagnitude(*this, b);
+    else
+    {
+        CAssetAmount r(b);
+        SubMagnitude(r, *this);
+        *this = r;
+    }
+    Normalize();
+    return *this;
+}
+
+CAssetAmount& CAssetAmount::operator-=(const CAssetAmount& b)
+{
+    return *this += -b;
+}
+
+CAssetAmount CAssetAmount::operator-() const
+{
+    return CAssetAmount(nHigh, nLow, !fNegative);
+}
+
+int CAssetAmount::Compare(const CAssetAmount& a, const CAssetAmount& b)
+{
+    if (a.fNegative != b.fNegative)
+        return a.fNegative ? -1 : 1;
+    int nCmp = CompareMagnitude(a, b);
+    return a.fNegative ? -nCmp : nCmp;
+}
@@ -0,0 +1,77 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ASSETAMOUNT_H
+#define BITCOIN_ASSETAMOUNT_H
+
+#include "amount.h"
+
+#include <stdint.h>
+#include <string>
+
+/** Exact signed fixed-point asset amount.
+ *
+ * The value is held as a 128-bit magnitude plus a sign, in units of the
+ * asset's smallest denomination (10^-nDecimals), so that sums and products
+ * of CAmount values can be accumulated and formatted without overflow,
+ * floating point rounding or decimal string arithmetic. The decimals are
+ * not part of the value; they are supplied when formatting and parsing.
+ */
+class CAssetAmount
+{
+private:
+    uint64_t nHigh;
+    uint64_t nLow;
+    bool fNegative;
+
+    CAssetAmount(uint64_t nHighIn, uint64_t nLowIn, bool fNegativeIn);
+
+    bool IsZero() const { return nHigh == 0 && nLow == 0; }
+    void Normalize() { if (IsZero()) fNegative = false; }
+
+    static int CompareMagnitude(const CAssetAmount& a, const CAssetAmount& b);
+    static void AddMagnitude(CAssetAmount& a, const CAssetAmount& b);
+    static void SubMagnitude(CAssetAmount& a, const CAssetAmount& b);
+    /** Divide the magnitude in place, returning the remainder */
+    uint64_t DivModMagnitude(uint64_t nDivisor);
+
+public:
+    CAssetAmount() : nHigh(0), nLow(0), fNegative(false) {}
+    CAssetAmount(const CAmount& nAmount);
+
+    /** Exact product of two CAmount values */
+    static CAssetAmount Mul(const CAmount& a, const CAmount& b);
+
+    /** Quotient truncated toward zero; nDivisor must be non-zero */
+    CAssetAmount Div(const CAmount& nDivisor) const;
+
+    /** Convert back to a CAmount, failing if the value does not fit */
+    bool GetAmount(CAmount& nAmount) const;
+
+    bool IsNegative() const { return fNegative; }
+
+    /** Format as [-]integer.fraction with exactly nDecimals fraction digits */
+    std::string ToString(uint8_t nDecimals) const;
+
+    /** Parse [-]integer[.fraction] with at most nDecimals fraction digits */
+    static bool Parse(const std::string& str, uint8_t nDecimals, CAssetAmount& amount);
+
+    CAssetAmount& operator+=(const CAssetAmount& b);
+    CAssetAmount& operator-=(const CAssetAmount& b);
+    CAssetAmount operator-() const;
+
+    friend inline CAssetAmount operator+(const CAssetAmount& a, const CAssetAmount& b) { CAssetAmount r(a); r += b; return r; }
+    friend inline CAssetAmount operator-(const CAssetAmount& a, const CAssetAmount& b) { CAssetAmount r(a); r -= b; return r; }
+
+    static int Compare(const CAssetAmount& a, const CAssetAmount& b);
+
+    friend inline bool operator==(const CAssetAmount& a, const CAssetAmount& b) { return Compare(a, b) == 0; }
+    friend inline bool operator!=(const CAssetAmount& a, const CAssetAmount& b) { return Compare(a, b) != 0; }
+    friend inline bool operator<(const CAssetAmount& a, const CAssetAmount& b) { return Compare(a, b) < 0; }
+    friend inline bool operator<=(const CAssetAmount& a, const CAssetAmount& b) { return Compare(a, b) <= 0; }
+    friend inline bool operator>(const CAssetAmount& a, const CAssetAmount& b) { return Compare(a, b) > 0; }
+    friend inline bool operator>=(const CAssetAmount& a, const CAssetAmount& b) { return Compare(a, b) >= 0; }
+};
+
+#endif // BITCOIN_ASSETAMOUNT_H
@@ -0,0 +1,234 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "app/app.h"
+#include "base58.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "random.h"
+#include "script/standard.h"
+#include "txdb.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+
+static const unsigned int CLAIM_COUNT = 100;
+static const unsigned int TRANSFER_COUNT = 100;
+static const CAmount CANDY_AMOUNT = 1000 * 10000; // 1000 assets with 4 decimals
+static const CAmount ADDRESS_SAFE = 10 * COIN;
+
+static CScript ScriptFor(unsigned int n)
+{
+    std::vector<unsigned char> vch(20, 0);
+    vch[0] = n & 0xff;
+    vch[1] = n >> 8;
+    return GetScriptForDestination(CKeyID(uint160(vch)));
+}
+
+static std::string AddressFor(unsigned int n)
+{
+    CTxDestination dest;
+    ExtractDestination(ScriptFor(n), dest);
+    return CBitcoinAddress(dest).ToString();
+}
+
+static CTxOut AssetOut(const CAmount& nValue, const CScript& script, const std::vector<unsigned char>& vReserve)
+{
+    CTxOut txout(nValue, script);
+    txout.vReserve = vReserve;
+    return txout;
+}
+
+/** A block as a candy day ends: every address claims its share of its own candy
+ * output of one put candy tx, between asset transfers. The put candy tx, the
+ * index records and the address amount files the checks read are set up in a
+ * throwaway data directory. */
+class CAppCheckBlock
+{
+private:
+    boost::filesystem::path pathTemp;
+    CCoinsView viewDummy;
+    CCoinsViewCache* pcoinsTipPrev;
+    CBlockTreeDB* pblocktreePrev;
+    int nChainHeightPrev;
+    uint256 hashPutBlock;
+
+public:
+    CCoinsViewCache view;
+    CBlock block;
+
+    CAppCheckBlock() : view(&viewDummy)
+    {
+        SelectParams(CBaseChainParams::MAIN);
+        pathTemp = GetTempPath() / strprintf("bench_safe_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+        boost::filesystem::create_directories(pathTemp / "height");
+        mapArgs["-datadir"] = pathTemp.string();
+        ClearDatadirCache();
+        pblocktreePrev = pblocktree;
+        pblocktree = new CBlockTreeDB(1 << 20, true);
+        pcoinsTipPrev = pcoinsTip;
+        pcoinsTip = new CCoinsViewCache(&viewDummy);
+
+        // detail.dat stays empty, so the candy height is the last one before it
+        int nCandyHeight = g_nCriticalHeight - 1;
+        nChainHeightPrev = g_nChainHeight;
+        g_nChainHeight = nCandyHeight + BLOCKS_PER_DAY;
+
+        const uint256 appId = uint256S(g_strSafeAssetId);
+        CAssetData assetData("BENCH", "BenchAsset", "app check bench asset", "bch", 100 * CANDY_AMOUNT, 100 * CANDY_AMOUNT, 100 * CANDY_AMOUNT, 4, false, true, CANDY_AMOUNT, 1, "");
+        const uint256 assetId = assetData.GetHash();
+        std::vector<std::pair<uint256, CAssetId_AssetInfo_IndexValue> > vAsset;
+        vAsset.push_back(std::make_pair(assetId, CAssetId_AssetInfo_IndexValue(AddressFor(0), assetData, nCandyHeight - 1)));
+        pblocktree->Write_AssetId_AssetInfo_Index(vAsset);
+
+        CMutableTransaction txPut;
+        txPut.nVersion = SAFE_TX_VERSION_2;
+        txPut.vin.resize(1);
+        txPut.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        for (unsigned int i = 0; i < CLAIM_COUNT; i++)
+            txPut.vout.push_back(AssetOut(CANDY_AMOUNT, GetScriptForDestination(CBitcoinAddress(g_strPutCandyAddress).Get()),
+                FillPutCandyData(CAppHeader(g_nAppHeaderVersion, appId, PUT_CANDY_CMD), CPutCandyData(assetId, CANDY_AMOUNT, 1, ""))));
+        const CTransaction txPutConst(txPut);
+        const uint256 hashPut = txPutConst.GetHash();
+
+        // the claims read the height of the put candy tx through the tx index
+        CBlock blockPut;
+        blockPut.nTime = 1500000000;
+        blockPut.vtx.push_back(txPutConst);
+        CDiskBlockPos pos(0, 0);
+        bool fWritten = WriteBlockToDisk(blockPut, pos, Params().MessageStart());
+        assert(fWritten);
+        std::vector<std::pair<uint256, CDiskTxPos> > vTxPos;
+        vTxPos.push_back(std::make_pair(hashPut, CDiskTxPos(pos, GetSizeOfCompactSize(blockPut.vtx.size()))));
+        pblocktree->WriteTxIndex(vTxPos);
+        hashPutBlock = blockPut.GetHash();
+        CBlockIndex* pindex = new CBlockIndex(blockPut);
+        pindex->nHeight = nCandyHeight;
+        pindex->phashBlock = &mapBlockIndex.insert(std::make_pair(hashPutBlock, pindex)).first->first;
+
+        std::vector<std::pair<CPutCandy_IndexKey, CPutCandy_IndexValue> > vCandy;
+        std::map<std::string, CAmount> mapSafe;
+        for (unsigned int i = 0; i < CLAIM_COUNT; i++) {
+            COutPoint out(hashPut, i);
+            vCandy.push_back(std::make_pair(CPutCandy_IndexKey(assetId, out, CCandyInfo(CANDY_AMOUNT, 1)), CPutCandy_IndexValue(nCandyHeight, hashPutBlock, 0)));
+            view.AddCoin(out, Coin(txPutConst.vout[i], nCandyHeight, false), false);
+            mapSafe[AddressFor(i + 1)] = ADDRESS_SAFE;
+        }
+        pblocktree->Write_PutCandy_Index(vCandy);
+        pblocktree->Write_CandyHeight_Index(nCandyHeight);
+        pblocktree->Write_CandyHeight_TotalAmount_Index(nCandyHeight, CLAIM_COUNT * ADDRESS_SAFE);
+
+        FILE* file = fopen((pathTemp / "height" / "detail.dat").string().c_str(), "wb");
+        assert(file);
+        fclose(file);
+        file = fopen((pathTemp / "height" / "all.dat").string().c_str(), "wb");
+        assert(file);
+        for (std::map<std::string, CAmount>::const_iterator it = mapSafe.begin(); it != mapSafe.end(); it++) {
+            CAddressAmount amount(it->first.c_str(), it->second);
+            fwrite(&amount, sizeof(amount), 1, file);
+        }
+        fclose(file);
+
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].prevout.SetNull();
+        coinbase.vout.resize(1);
+        block.vtx.push_back(coinbase);
+
+        const CAmount nClaim = GetCandyShareAmount(ADDRESS_SAFE, CLAIM_COUNT * ADDRESS_SAFE, CANDY_AMOUNT);
+        for (unsigned int i = 0; i < std::max(CLAIM_COUNT, TRANSFER_COUNT); i++) {
+            CScript script = ScriptFor(i + 1);
+            if (i < CLAIM_COUNT) {
+                CMutableTransaction tx;
+                tx.nVersion = SAFE_TX_VERSION_2;
+                tx.vin.resize(2);
+                tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+                tx.vin[1].prevout = COutPoint(hashPut, i);
+                view.AddCoin(tx.vin[0].prevout, Coin(CTxOut(COIN, script), nCandyHeight, false), false);
+                tx.vout.push_back(AssetOut(nClaim, script, FillGetCandyData(CAppHeader(g_nAppHeaderVersion, appId, GET_CANDY_CMD), CGetCandyData(assetId, nClaim, ""))));
+                tx.vout.push_back(CTxOut(COIN - COIN / 100, script));
+                block.vtx.push_back(tx);
+            }
+            if (i < TRANSFER_COUNT) {
+                CMutableTransaction tx;
+                tx.nVersion = SAFE_TX_VERSION_2;
+                tx.vin.resize(2);
+                tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+                tx.vin[1].prevout = COutPoint(GetRandHash(), 0);
+                view.AddCoin(tx.vin[0].prevout, Coin(CTxOut(COIN, script), nCandyHeight, false), false);
+                std::vector<unsigned char> vTransfer = FillCommonData(CAppHeader(g_nAppHeaderVersion, appId, TRANSFER_ASSET_CMD), CCommonData(assetId, CANDY_AMOUNT, ""));
+                view.AddCoin(tx.vin[1].prevout, Coin(AssetOut(CANDY_AMOUNT, script, vTransfer), nCandyHeight, false), false);
+                tx.vout.push_back(AssetOut(CANDY_AMOUNT, ScriptFor(CLAIM_COUNT + i + 1), vTransfer));
+                tx.vout.push_back(CTxOut(COIN - COIN / 100, script));
+                block.vtx.push_back(tx);
+            }
+        }
+    }
+
+    ~CAppCheckBlock()
+    {
+        BlockMap::iterator it = mapBlockIndex.find(hashPutBlock);
+        delete it->second;
+        mapBlockIndex.erase(it);
+        g_nChainHeight = nChainHeightPrev;
+        delete pcoinsTip;
+        pcoinsTip = pcoinsTipPrev;
+        delete pblocktree;
+        pblocktree = pblocktreePrev;
+        mapArgs.erase("-datadir");
+        ClearDatadirCache();
+        boost::filesystem::remove_all(pathTemp);
+    }
+};
+
+// The app checks of ConnectBlock, with the app check workers or serially in block order
+static void AppCheck(benchmark::State& state, int nThreads)
+{
+    CAppCheckBlock appBlock;
+
+    int nScriptCheckThreadsPrev = nScriptCheckThreads;
+    nScriptCheckThreads = nThreads > 1 ? nThreads : 0;
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads - 1; i++)
+        threads.create_thread(&ThreadAppCheck);
+
+    while (state.KeepRunning()) {
+        LOCK(cs_main);
+        std::vector<CAppTxCheckResult> vResult;
+        std::map<CPutCandy_IndexKey, CAmount> mapAssetGetCandy;
+        CheckBlockAppTransactions(appBlock.block, appBlock.view, vResult);
+        for (unsigned int i = 0; i < appBlock.block.vtx.size(); i++) {
+            CValidationState valState;
+            bool fValid = CheckBlockAppTransaction(appBlock.block.vtx[i], valState, appBlock.view, mapAssetGetCandy, vResult[i]);
+            assert(fValid);
+        }
+    }
+
+    threads.interrupt_all();
+    threads.join_all();
+    nScriptCheckThreads = nScriptCheckThreadsPrev;
+}
+
+static void AppCheckSerial(benchmark::State& state)
+{
+    AppCheck(state, 1);
+}
+
+static void AppCheckParallel(benchmark::State& state)
+{
+    AppCheck(state, std::max(1, std::min(GetNumCores(), MAX_SCRIPTCHECK_THREADS)));
+}
+
+BENCHMARK(AppCheckSerial);
+BENCHMARK(AppCheckParallel);
@@ -0,0 +1,89 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "assetamount.h"
+#include "tinyformat.h"
+
+#include <assert.h>
+#include <string>
+#include <vector>
+
+// Decimal string addition as previously done by getaddrassetbalance
+// (plusstring over fixed digit arrays), kept here as the baseline.
+static const int LEGACY_DIGITS = 2000;
+
+static std::string LegacyPlusString(const std::string& numAStr, const std::string& numBStr)
+{
+    std::vector<int> numA(LEGACY_DIGITS + 1, 0), numB(LEGACY_DIGITS + 1, 0);
+    for (size_t i = 0; i < numAStr.size(); i++)
+        numA[i] = numAStr[numAStr.size() - i - 1] - '0';
+    for (size_t i = 0; i < numBStr.size(); i++)
+        numB[i] = numBStr[numBStr.size() - i - 1] - '0';
+
+    for (int i = 0; i < LEGACY_DIGITS; i++)
+    {
+        numA[i] += numB[i];
+        if (numA[i] > 9)
+        {
+            numA[i] -= 10;
+            numA[i + 1]++;
+        }
+    }
+
+    std::string str;
+    bool isBegin = false;
+    for (int i = LEGACY_DIGITS - 1; i >= 0; i--)
+    {
+        if (numA[i] != 0)
+            isBegin = true;
+        if (isBegin)
+            str += numA[i] + '0';
+    }
+    return str;
+}
+
+static std::vector<CAmount> BenchAmounts()
+{
+    std::vector<CAmount> vAmount;
+    for (int i = 0; i < 100; i++)
+        vAmount.push_back((CAmount)(i + 1) * 123456789012345LL);
+    return vAmount;
+}
+
+static void AssetAmountSumString(benchmark::State& state)
+{
+    std::vector<CAmount> vAmount = BenchAmounts();
+    while (state.KeepRunning()) {
+        std::string strTotal;
+        for (size_t i = 0; i < vAmount.size(); i++)
+            strTotal = LegacyPlusString(strTotal, strprintf("%d", vAmount[i]));
+        assert(!strTotal.empty());
+    }
+}
+
+static void AssetAmountSumFixed(benchmark::State& state)
+{
+    std::vector<CAmount> vAmount = BenchAmounts();
+    while (state.KeepRunning()) {
+        CAssetAmount total;
+        for (size_t i = 0; i < vAmount.size(); i++)
+            total += vAmount[i];
+        assert(!total.ToString(8).empty());
+    }
+}
+
+static void AssetAmountFormat(benchmark::State& state)
+{
+    CAssetAmount amount = CAssetAmount::Mul(MAX_ASSETS, 100);
+    while (state.KeepRunning()) {
+        CAssetAmount parsed;
+        bool fParsed = CAssetAmount::Parse(amount.ToString(10), 10, parsed);
+        assert(fParsed && parsed == amount);
+    }
+}
+
+BENCHMARK(AssetAmountSumString);
+BENCHMARK(AssetAmountSumFixed);
+BENCHMARK(AssetAmountFormat);
@@ -0,0 +1,98 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "checkqueue.h"
+#include "key.h"
+#include "policy/policy.h"
+#include "script/interpreter.h"
+#include "script/standard.h"
+#include "util.h"
+#include "validation.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+// Transactions of a full block, spending pay-to-pubkey-hash outputs with two inputs each
+struct CBenchBlock
+{
+    std::vector<CTransaction> vtx;
+    std::vector<CTxOut> vPrevOut;
+};
+
+static const CBenchBlock& GetBenchBlock()
+{
+    static CBenchBlock block;
+    if (!block.vtx.empty())
+        return block;
+
+    std::vector<CKey> vKey(16);
+    for (size_t i = 0; i < vKey.size(); i++)
+        vKey[i].MakeNewKey(true);
+
+    for (int n = 0; n < 1000; n++) {
+        CMutableTransaction tx;
+        tx.vin.resize(2);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 2 * COIN;
+        tx.vout[0].scriptPubKey = GetScriptForDestination(vKey[n % vKey.size()].GetPubKey().GetID());
+        std::vector<CTxOut> vOut;
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            const CKey& key = vKey[(n + i) % vKey.size()];
+            tx.vin[i].prevout = COutPoint(uint256S(strprintf("%064x", n + 1)), i);
+            vOut.push_back(CTxOut(COIN, GetScriptForDestination(key.GetPubKey().GetID())));
+        }
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            const CKey& key = vKey[(n + i) % vKey.size()];
+            std::vector<unsigned char> vchSig;
+            key.Sign(SignatureHash(vOut[i].scriptPubKey, tx, i, SIGHASH_ALL), vchSig);
+            vchSig.push_back((unsigned char)SIGHASH_ALL);
+            tx.vin[i].scriptSig << vchSig << ToByteVector(key.GetPubKey());
+        }
+        block.vtx.push_back(tx);
+        block.vPrevOut.insert(block.vPrevOut.end(), vOut.begin(), vOut.end());
+    }
+    return block;
+}
+
+static void BlockScriptChecks(benchmark::State& state, int nThreads)
+{
+    const CBenchBlock& block = GetBenchBlock();
+
+    CCheckQueue<CScriptCheck> queue(128);
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads - 1; i++)
+        threads.create_thread(boost::bind(&CCheckQueue<CScriptCheck>::Thread, boost::ref(queue)));
+
+    while (state.KeepRunning()) {
+        // one Add per transaction, as in ConnectBlock
+        CCheckQueueControl<CScriptCheck> control(&queue);
+        size_t nOut = 0;
+        for (size_t i = 0; i < block.vtx.size(); i++) {
+            std::vector<CScriptCheck> vChecks;
+            for (unsigned int j = 0; j < block.vtx[i].vin.size(); j++)
+                vChecks.push_back(CScriptCheck(block.vPrevOut[nOut++], block.vtx[i], j, STANDARD_SCRIPT_VERIFY_FLAGS, false));
+            control.Add(vChecks);
+        }
+        bool fOk = control.Wait();
+        assert(fOk);
+    }
+
+    threads.interrupt_all();
+    threads.join_all();
+}
+
+static void BlockScriptChecks1(benchmark::State& state) { BlockScriptChecks(state, 1); }
+static void BlockScriptChecks2(benchmark::State& state) { BlockScriptChecks(state, 2); }
+static void BlockScriptChecks4(benchmark::State& state) { BlockScriptChecks(state, 4); }
+static void BlockScriptChecks8(benchmark::State& state) { BlockScriptChecks(state, 8); }
+static void BlockScriptChecks16(benchmark::State& state) { BlockScriptChecks(state, 16); }
+static void BlockScriptChecks32(benchmark::State& state) { BlockScriptChecks(state, 32); }
+
+BENCHMARK(BlockScriptChecks1);
+BENCHMARK(BlockScriptChecks2);
+BENCHMARK(BlockScriptChecks4);
+BENCHMARK(BlockScriptChecks8);
+BENCHMARK(BlockScriptChecks16);
+BENCHMARK(BlockScriptChecks32);
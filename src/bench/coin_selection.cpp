@@ -0,0 +1,73 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "policy/policy.h"
+#include "validation.h"
+#include "wallet/wallet.h"
+
+#include <assert.h>
+#include <set>
+#include <vector>
+
+typedef std::set<std::pair<const CWalletTx*, unsigned int> > CoinSet;
+
+// A fragmented wallet: many small outputs of irregular value, as left
+// behind by candy claims and asset payouts
+static void MakeFragmentedCoins(CWallet& wallet, std::vector<COutput>& vCoins)
+{
+    for (int i = 0; i < 2000; i++)
+    {
+        CMutableTransaction tx;
+        tx.nLockTime = i; // so all transactions get different hashes
+        tx.vout.resize(1);
+        tx.vout[0].nValue = (CAmount)((i * 7919) % 1000 + 1) * 100000;
+        CWalletTx* wtx = new CWalletTx(&wallet, tx);
+        vCoins.push_back(COutput(wtx, 0, 6 * 24, true, true));
+    }
+}
+
+// Serialized size estimate of a P2PKH transaction paying one recipient
+static size_t EstimateTxSize(const CoinSet& setCoins, bool fChange)
+{
+    return 10 + setCoins.size() * 148 + (fChange ? 2 : 1) * 34;
+}
+
+static void CoinSelection(benchmark::State& state, bool fBnB)
+{
+    CWallet wallet;
+    std::vector<COutput> vCoins;
+    MakeFragmentedCoins(wallet, vCoins);
+
+    const CAmount nChangeWindow = CTxOut(0, GetScriptForDestination(CKeyID())).GetDustThreshold(::minRelayTxFee);
+    const CAmount nTargetValue = 537 * CENT + 12345;
+    fSelectCoinsBnB = fBnB;
+    {
+        LOCK(wallet.cs_wallet);
+        while (state.KeepRunning()) {
+            CoinSet setCoinsRet;
+            CAmount nValueRet;
+            bool fSuccess = wallet.SelectCoinsMinConf(nTargetValue, 1, 6, vCoins, setCoinsRet, nValueRet, false, nChangeWindow);
+            assert(fSuccess);
+            assert(EstimateTxSize(setCoinsRet, nValueRet - nTargetValue > nChangeWindow) <= MAX_STANDARD_TX_SIZE);
+        }
+    }
+    fSelectCoinsBnB = DEFAULT_SELECT_COINS_BNB;
+
+    for (size_t i = 0; i < vCoins.size(); i++)
+        delete vCoins[i].tx;
+}
+
+static void CoinSelectionKnapsack(benchmark::State& state)
+{
+    CoinSelection(state, false);
+}
+
+static void CoinSelectionBnB(benchmark::State& state)
+{
+    CoinSelection(state, true);
+}
+
+BENCHMARK(CoinSelectionKnapsack);
+BENCHMARK(CoinSelectionBnB);
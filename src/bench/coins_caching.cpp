@@ -0,0 +1,50 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "coins.h"
+#include "pubkey.h"
+#include "script/standard.h"
+
+#include <assert.h>
+#include <vector>
+
+// A candy payout: one transaction paying a small amount to many addresses,
+// whose outputs are then claimed one at a time
+static CMutableTransaction MakeCandyPayout(int nSeq)
+{
+    CMutableTransaction tx;
+    tx.nLockTime = nSeq; // so all transactions get different hashes
+    tx.vin.resize(1);
+    tx.vout.resize(200);
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        tx.vout[i].nValue = (i + 1) * COIN / 100;
+        tx.vout[i].scriptPubKey = GetScriptForDestination(CKeyID(uint160(std::vector<unsigned char>(20, i))));
+    }
+    return tx;
+}
+
+static void CoinsCandyPayout(benchmark::State& state)
+{
+    CCoinsView dummy;
+    std::vector<CMutableTransaction> vPayouts;
+    for (int i = 0; i < 50; i++)
+        vPayouts.push_back(MakeCandyPayout(i));
+
+    while (state.KeepRunning()) {
+        CCoinsViewCache cache(&dummy);
+        for (size_t i = 0; i < vPayouts.size(); i++)
+            AddCoins(cache, vPayouts[i], 100);
+        // claim a tenth of every payout
+        for (size_t i = 0; i < vPayouts.size(); i++) {
+            const uint256 txid = vPayouts[i].GetHash();
+            for (uint32_t n = 0; n < vPayouts[i].vout.size(); n += 10) {
+                bool fSpent = cache.SpendCoin(COutPoint(txid, n));
+                assert(fSpent);
+            }
+        }
+    }
+}
+
+BENCHMARK(CoinsCandyPayout);
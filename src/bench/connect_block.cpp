@@ -0,0 +1,165 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "app/app.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "random.h"
+#include "script/standard.h"
+#include "txdb.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <assert.h>
+
+#include <boost/filesystem.hpp>
+
+static const unsigned int PAYOUT_OUTPUTS = 200;
+//! Candy payouts already in the UTXO set, and new ones in the block
+static const unsigned int OLD_PAYOUTS = 50;
+static const unsigned int NEW_PAYOUTS = 10;
+//! Transfers in the block, each spending one output of an old payout
+static const unsigned int PAYOUT_SPENDS = 400;
+static const CAmount CANDY_SHARE = 10000;
+
+static CScript ScriptFor(unsigned int n)
+{
+    std::vector<unsigned char> vch(20, 0);
+    vch[0] = n & 0xff;
+    vch[1] = n >> 8;
+    return GetScriptForDestination(CKeyID(uint160(vch)));
+}
+
+static CTxOut AssetOut(const CAmount& nValue, const CScript& script, const std::vector<unsigned char>& vReserve)
+{
+    CTxOut txout(nValue, script);
+    txout.vReserve = vReserve;
+    return txout;
+}
+
+/** A block of a busy candy day: new candy payouts of PAYOUT_OUTPUTS claims
+ * each, and transfers that each spend a single output of an older payout.
+ * The older payouts and the funding coins are in an in-memory chainstate
+ * database, so every ConnectBlock reads the coins it touches through a fresh
+ * cache, as a node with a cold dbcache does. */
+class CCandyPayoutBlock
+{
+private:
+    boost::filesystem::path pathTemp;
+    CBlockIndex* pindexPrev;
+
+public:
+    CCoinsViewDB* pcoinsdb;
+    CBlock block;
+    CBlockIndex index;
+
+    CCandyPayoutBlock()
+    {
+        SelectParams(CBaseChainParams::MAIN);
+        pathTemp = GetTempPath() / strprintf("bench_safe_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+        boost::filesystem::create_directories(pathTemp);
+        mapArgs["-datadir"] = pathTemp.string();
+        ClearDatadirCache();
+        pcoinsdb = new CCoinsViewDB(8 << 20, true);
+
+        // a protocol v1 height, where candy payouts are made
+        const int nHeight = g_nProtocolV1Height + 1000;
+        const uint256 hashPrev = GetRandHash();
+        pindexPrev = new CBlockIndex();
+        pindexPrev->nHeight = nHeight - 1;
+        pindexPrev->nBits = Params().GenesisBlock().nBits;
+        pindexPrev->phashBlock = &mapBlockIndex.insert(std::make_pair(hashPrev, pindexPrev)).first->first;
+
+        const uint256 appId = uint256S(g_strSafeAssetId);
+        const uint256 assetId = GetRandHash();
+        const std::vector<unsigned char> vGetCandy = FillGetCandyData(CAppHeader(g_nAppHeaderVersion, appId, GET_CANDY_CMD), CGetCandyData(assetId, CANDY_SHARE, ""));
+        const std::vector<unsigned char> vTransfer = FillCommonData(CAppHeader(g_nAppHeaderVersion, appId, TRANSFER_ASSET_CMD), CCommonData(assetId, CANDY_SHARE, ""));
+        const CScript scriptTrue = CScript() << OP_TRUE;
+
+        CCoinsViewCache cache(pcoinsdb);
+        std::vector<uint256> vOldPayout;
+        for (unsigned int i = 0; i < OLD_PAYOUTS; i++) {
+            CMutableTransaction tx;
+            tx.nVersion = SAFE_TX_VERSION_2;
+            tx.vin.resize(1);
+            tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+            for (unsigned int n = 0; n < PAYOUT_OUTPUTS; n++)
+                tx.vout.push_back(AssetOut(CANDY_SHARE, scriptTrue, vGetCandy));
+            tx.vout.push_back(CTxOut(COIN, ScriptFor(i)));
+            AddCoins(cache, tx, nHeight - 10);
+            vOldPayout.push_back(tx.GetHash());
+        }
+
+        CMutableTransaction coinbase;
+        coinbase.nVersion = SAFE_TX_VERSION_2;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].prevout.SetNull();
+        coinbase.vin[0].scriptSig = CScript() << nHeight << OP_0;
+        coinbase.vout.push_back(CTxOut(0, ScriptFor(0)));
+        block.vtx.push_back(coinbase);
+
+        // every new payout and every transfer is funded by a coin of its own
+        for (unsigned int i = 0; i < NEW_PAYOUTS + PAYOUT_SPENDS; i++) {
+            CMutableTransaction tx;
+            tx.nVersion = SAFE_TX_VERSION_2;
+            tx.vin.resize(1);
+            tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+            cache.AddCoin(tx.vin[0].prevout, Coin(CTxOut(COIN, scriptTrue), nHeight - 10, false), false);
+            if (i < NEW_PAYOUTS) {
+                for (unsigned int n = 0; n < PAYOUT_OUTPUTS; n++)
+                    tx.vout.push_back(AssetOut(CANDY_SHARE, ScriptFor(n), vGetCandy));
+            } else {
+                unsigned int nSpend = i - NEW_PAYOUTS;
+                tx.vin.push_back(CTxIn(COutPoint(vOldPayout[nSpend % OLD_PAYOUTS], nSpend / OLD_PAYOUTS)));
+                tx.vout.push_back(AssetOut(CANDY_SHARE, ScriptFor(nSpend), vTransfer));
+            }
+            tx.vout.push_back(CTxOut(COIN - COIN / 100, ScriptFor(i)));
+            block.vtx.push_back(tx);
+        }
+        cache.SetBestBlock(hashPrev);
+        bool fFlushed = cache.Flush();
+        assert(fFlushed);
+
+        block.nVersion = 4;
+        block.hashPrevBlock = hashPrev;
+        block.nTime = 1530000000;
+        block.nBits = pindexPrev->nBits;
+        index = CBlockIndex(block);
+        index.pprev = pindexPrev;
+        index.nHeight = nHeight;
+    }
+
+    ~CCandyPayoutBlock()
+    {
+        const uint256 hashPrev = *pindexPrev->phashBlock;
+        mapBlockIndex.erase(hashPrev);
+        delete pindexPrev;
+        versionbitscache.Clear();
+        delete pcoinsdb;
+        mapArgs.erase("-datadir");
+        ClearDatadirCache();
+        boost::filesystem::remove_all(pathTemp);
+    }
+};
+
+// ConnectBlock on a candy payout block, reading its coins from the chainstate database
+static void ConnectBlockCandyPayout(benchmark::State& state)
+{
+    CCandyPayoutBlock payoutBlock;
+
+    while (state.KeepRunning()) {
+        LOCK(cs_main);
+        CCoinsViewCache view(payoutBlock.pcoinsdb);
+        CValidationState valState;
+        bool fConnected = ConnectBlock(payoutBlock.block, valState, &payoutBlock.index, view, true);
+        assert(fConnected);
+    }
+}
+
+BENCHMARK(ConnectBlockCandyPayout);
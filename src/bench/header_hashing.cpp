@@ -0,0 +1,55 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "primitives/block.h"
+#include "util.h"
+#include "validation.h"
+
+#include <boost/thread/thread.hpp>
+
+// A full headers message
+static std::vector<CBlockHeader> MakeHeaders()
+{
+    std::vector<CBlockHeader> headers(2000);
+    for (size_t i = 0; i < headers.size(); i++) {
+        headers[i].nVersion = 4;
+        headers[i].nTime = 1500000000 + i * 150;
+        headers[i].nBits = 0x1b0404cb;
+        headers[i].nNonce = i;
+    }
+    return headers;
+}
+
+static void HeaderHash(benchmark::State& state, int nThreads)
+{
+    std::vector<CBlockHeader> headers = MakeHeaders();
+    std::vector<uint256> vHash;
+
+    int nScriptCheckThreadsPrev = nScriptCheckThreads;
+    nScriptCheckThreads = nThreads > 1 ? nThreads : 0;
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads - 1; i++)
+        threads.create_thread(&ThreadHeaderHashCheck);
+
+    while (state.KeepRunning())
+        HashBlockHeaders(headers, vHash);
+
+    threads.interrupt_all();
+    threads.join_all();
+    nScriptCheckThreads = nScriptCheckThreadsPrev;
+}
+
+static void HeaderHashSerial(benchmark::State& state)
+{
+    HeaderHash(state, 1);
+}
+
+static void HeaderHashParallel(benchmark::State& state)
+{
+    HeaderHash(state, std::max(1, std::min(GetNumCores(), MAX_SCRIPTCHECK_THREADS)));
+}
+
+BENCHMARK(HeaderHashSerial);
+BENCHMARK(HeaderHashParallel);
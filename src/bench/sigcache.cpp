@@ -0,0 +1,121 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "cuckoocache.h"
+#include "random.h"
+
+#include <atomic>
+
+#include <boost/bind.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/unordered_set.hpp>
+
+// Entries the caches are filled with before timing starts
+static const int SIGCACHE_BENCH_ENTRIES = 200000;
+
+struct CSigCacheBenchHasher
+{
+    size_t operator()(const uint256& key) const { return key.GetCheapHash(); }
+};
+
+// The signature cache as it was before: a set behind a shared mutex
+class CLockedSigCache
+{
+private:
+    boost::unordered_set<uint256, CSigCacheBenchHasher> setValid;
+    boost::shared_mutex cs;
+
+public:
+    bool Contains(const uint256& entry, bool fErase)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs);
+        return setValid.count(entry);
+    }
+
+    void Insert(const uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs);
+        setValid.insert(entry);
+    }
+};
+
+static const std::vector<uint256>& GetEntries()
+{
+    static std::vector<uint256> vEntry;
+    if (vEntry.empty()) {
+        vEntry.resize(SIGCACHE_BENCH_ENTRIES * 2);
+        for (size_t i = 0; i < vEntry.size(); i++)
+            vEntry[i] = GetRandHash();
+    }
+    return vEntry;
+}
+
+// Look up entries, half of which are cached, and insert one in every 16 misses
+template <typename Cache>
+static void LookupThread(Cache& cache, uint32_t nSeed, const std::atomic<bool>& fStop)
+{
+    const std::vector<uint256>& vEntry = GetEntries();
+    uint32_t n = nSeed;
+    while (!fStop) {
+        for (int i = 0; i < 256; i++) {
+            n = n * 1103515245 + 12345;
+            const uint256& entry = vEntry[(n >> 8) % vEntry.size()];
+            if (!cache.Contains(entry, false) && (n & 0xf00000) == 0)
+                cache.Insert(entry);
+        }
+    }
+}
+
+template <typename Cache>
+static void SigCacheLookup(benchmark::State& state, Cache& cache, int nThreads)
+{
+    const std::vector<uint256>& vEntry = GetEntries();
+    for (int i = 0; i < SIGCACHE_BENCH_ENTRIES; i++)
+        cache.Insert(vEntry[i]);
+
+    // the other threads keep looking up and inserting while the lookups of this one are timed
+    std::atomic<bool> fStop(false);
+    boost::thread_group threads;
+    for (int i = 1; i < nThreads; i++)
+        threads.create_thread(boost::bind(&LookupThread<Cache>, boost::ref(cache), i, boost::cref(fStop)));
+
+    uint32_t n = 0;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000; i++) {
+            n = n * 1103515245 + 12345;
+            cache.Contains(vEntry[(n >> 8) % vEntry.size()], false);
+        }
+    }
+    fStop = true;
+    threads.join_all();
+}
+
+static void SigCacheLookupLockFree(benchmark::State& state, int nThreads)
+{
+    CCuckooCache cache;
+    cache.Setup(SIGCACHE_BENCH_ENTRIES * 80);
+    SigCacheLookup(state, cache, nThreads);
+}
+
+static void SigCacheLookupLocked(benchmark::State& state, int nThreads)
+{
+    CLockedSigCache cache;
+    SigCacheLookup(state, cache, nThreads);
+}
+
+static void SigCacheLookupLockFree1(benchmark::State& state) { SigCacheLookupLockFree(state, 1); }
+static void SigCacheLookupLockFree4(benchmark::State& state) { SigCacheLookupLockFree(state, 4); }
+static void SigCacheLookupLockFree16(benchmark::State& state) { SigCacheLookupLockFree(state, 16); }
+static void SigCacheLookupLocked1(benchmark::State& state) { SigCacheLookupLocked(state, 1); }
+static void SigCacheLookupLocked4(benchmark::State& state) { SigCacheLookupLocked(state, 4); }
+static void SigCacheLookupLocked16(benchmark::State& state) { SigCacheLookupLocked(state, 16); }
+
+BENCHMARK(SigCacheLookupLockFree1);
+BENCHMARK(SigCacheLookupLockFree4);
+BENCHMARK(SigCacheLookupLockFree16);
+BENCHMARK(SigCacheLookupLocked1);
+BENCHMARK(SigCacheLookupLocked4);
+BENCHMARK(SigCacheLookupLocked16);
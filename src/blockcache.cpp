@@ -0,0 +1,101 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+
+#include "core_memusage.h"
+#include "memusage.h"
+
+static size_t GetBlockUsage(const CBlock& block)
+{
+    size_t nUsage = memusage::MallocUsage(sizeof(CBlock)) + RecursiveDynamicUsage(block);
+    // app and asset outputs carry their data in vReserve
+    for (std::vector<CTransaction>::const_iterator it = block.vtx.begin(); it != block.vtx.end(); ++it)
+        for (std::vector<CTxOut>::const_iterator out = it->vout.begin(); out != it->vout.end(); ++out)
+            nUsage += memusage::DynamicUsage(out->vReserve);
+    return nUsage;
+}
+
+CBlockCache::CBlockCache(size_t nMaxUsageIn) : nUsage(0), nMaxUsage(nMaxUsageIn), nHits(0), nMisses(0)
+{
+}
+
+void CBlockCache::Evict(size_t nMaxUsageIn)
+{
+    while (nUsage > nMaxUsageIn && !listBlocks.empty()) {
+        nUsage -= listBlocks.back().nUsage;
+        mapIndex.erase(listBlocks.back().hash);
+        listBlocks.pop_back();
+    }
+}
+
+void CBlockCache::SetMaxUsage(size_t nMaxUsageIn)
+{
+    LOCK(cs);
+    nMaxUsage = nMaxUsageIn;
+    Evict(nMaxUsage);
+}
+
+bool CBlockCache::Get(const uint256& hash, boost::shared_ptr<const CBlock>& pblock)
+{
+    LOCK(cs);
+    map_t::iterator it = mapIndex.find(hash);
+    if (it == mapIndex.end()) {
+        nMisses++;
+        return false;
+    }
+    nHits++;
+    listBlocks.splice(listBlocks.begin(), listBlocks, it->second);
+    pblock = it->second->pblock;
+    return true;
+}
+
+void CBlockCache::Insert(const uint256& hash, const boost::shared_ptr<const CBlock>& pblock)
+{
+    size_t nBlockUsage = GetBlockUsage(*pblock);
+
+    LOCK(cs);
+    if (nBlockUsage > nMaxUsage)
+        return;
+    map_t::iterator it = mapIndex.find(hash);
+    if (it != mapIndex.end()) {
+        listBlocks.splice(listBlocks.begin(), listBlocks, it->second);
+        return;
+    }
+    Evict(nMaxUsage - nBlockUsage);
+    listBlocks.push_front(CBlockCacheEntry(hash, pblock, nBlockUsage));
+    mapIndex[hash] = listBlocks.begin();
+    nUsage += nBlockUsage;
+}
+
+void CBlockCache::Erase(const uint256& hash)
+{
+    LOCK(cs);
+    map_t::iterator it = mapIndex.find(hash);
+    if (it == mapIndex.end())
+        return;
+    nUsage -= it->second->nUsage;
+    listBlocks.erase(it->second);
+    mapIndex.erase(it);
+}
+
+void CBlockCache::Clear()
+{
+    LOCK(cs);
+    listBlocks.clear();
+    mapIndex.clear();
+    nUsage = 0;
+}
+
+CBlockCacheStats CBlockCache::GetStats() const
+{
+    LOCK(cs);
+    CBlockCacheStats stats;
+    stats.nBlocks = listBlocks.size();
+    stats.nUsage = nUsage;
+    stats.nMaxUsage = nMaxUsage;
+    stats.nHits = nHits;
+    stats.nMisses = nMisses;
+    return stats;
+}
@@ -0,0 +1,83 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCACHE_H
+#define BITCOIN_BLOCKCACHE_H
+
+#include "primitives/block.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <list>
+#include <map>
+
+#include <boost/shared_ptr.hpp>
+
+//! -blockcachesize default (MiB)
+static const unsigned int DEFAULT_BLOCK_CACHE_SIZE = 32;
+
+struct CBlockCacheStats
+{
+    size_t nBlocks;
+    size_t nUsage;
+    size_t nMaxUsage;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    CBlockCacheStats() : nBlocks(0), nUsage(0), nMaxUsage(0), nHits(0), nMisses(0) {}
+};
+
+/**
+ * Memory bounded LRU cache of deserialized blocks, keyed by block hash.
+ *
+ * Blocks are immutable once cached and handed out as shared pointers, so
+ * readers don't copy them and an evicted block stays valid for as long as
+ * someone still holds it. Only blocks that passed the header checks of
+ * ReadBlockFromDisk, or were connected to the chain, are inserted.
+ */
+class CBlockCache
+{
+private:
+    struct CBlockCacheEntry
+    {
+        uint256 hash;
+        boost::shared_ptr<const CBlock> pblock;
+        size_t nUsage;
+
+        CBlockCacheEntry(const uint256& hashIn, const boost::shared_ptr<const CBlock>& pblockIn, size_t nUsageIn) :
+            hash(hashIn), pblock(pblockIn), nUsage(nUsageIn) {}
+    };
+    typedef std::list<CBlockCacheEntry> list_t;
+    typedef std::map<uint256, list_t::iterator> map_t;
+
+    mutable CCriticalSection cs;
+    //! most recently used first
+    list_t listBlocks;
+    map_t mapIndex;
+    size_t nUsage;
+    size_t nMaxUsage;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    void Evict(size_t nMaxUsageIn);
+
+public:
+    CBlockCache(size_t nMaxUsageIn = (size_t)DEFAULT_BLOCK_CACHE_SIZE << 20);
+
+    //! Set the memory limit in bytes, 0 disables the cache
+    void SetMaxUsage(size_t nMaxUsageIn);
+
+    //! Look up a block, counting a hit or miss
+    bool Get(const uint256& hash, boost::shared_ptr<const CBlock>& pblock);
+
+    //! Add the block with the given hash, evicting the least recently used ones as needed
+    void Insert(const uint256& hash, const boost::shared_ptr<const CBlock>& pblock);
+
+    void Erase(const uint256& hash);
+    void Clear();
+
+    CBlockCacheStats GetStats() const;
+};
+
+#endif // BITCOIN_BLOCKCACHE_H
@@ -0,0 +1,197 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockimport.h"
+
+#include "clientversion.h"
+#include "core_memusage.h"
+#include "streams.h"
+#include "util.h"
+
+#include <string.h>
+
+#include <boost/bind.hpp>
+
+CBlockImportReader::CBlockImportReader(FILE* fileIn, int nFileIn, const CMessageHeader::MessageStartChars& messageStart, unsigned int nMaxBlockSizeIn, int nThreads) :
+    nRecords(0), nNext(0), nReadAhead(0), fEndOfFile(false), fShutdown(false), nLastValidEnd(0),
+    nFile(nFileIn), nMaxBlockSize(nMaxBlockSizeIn)
+{
+    memcpy(pchMessageStart, messageStart, sizeof(pchMessageStart));
+    threads.create_thread(boost::bind(&CBlockImportReader::ThreadRead, this, fileIn));
+    for (int i = 0; i < std::max(nThreads, 1); i++)
+        threads.create_thread(boost::bind(&CBlockImportReader::ThreadDecode, this));
+}
+
+CBlockImportReader::~CBlockImportReader()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fShutdown = true;
+    }
+    condRead.notify_all();
+    condWork.notify_all();
+    condDone.notify_all();
+    threads.join_all();
+}
+
+void CBlockImportReader::ThreadRead(FILE* fileIn)
+{
+    RenameThread("safe-importread");
+    try {
+        // Leave room to rewind over a whole record plus its header and the peek behind it
+        CBufferedFile blkdat(fileIn, 4*nMaxBlockSize, nMaxBlockSize+16, SER_DISK, CLIENT_VERSION);
+        uint64_t nRewind = blkdat.GetPos();
+        // End of the last record that had to be searched for embedded headers
+        uint64_t nCoverEnd = 0;
+        while (!blkdat.eof()) {
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (fShutdown)
+                    break;
+            }
+
+            blkdat.SetPos(nRewind);
+            nRewind++; // start one byte further next time, in case of failure
+            blkdat.SetLimit(); // remove former limit
+            CRawBlock raw;
+            unsigned int nSize = 0;
+            try {
+                // locate a header
+                unsigned char buf[MESSAGE_START_SIZE];
+                blkdat.FindByte(pchMessageStart[0]);
+                raw.nHeaderPos = blkdat.GetPos();
+                nRewind = raw.nHeaderPos+1;
+                blkdat >> FLATDATA(buf);
+                if (memcmp(buf, pchMessageStart, MESSAGE_START_SIZE))
+                    continue;
+                // read size
+                blkdat >> nSize;
+                if (nSize < 80 || nSize > nMaxBlockSize)
+                    continue;
+            } catch (const std::exception&) {
+                // no valid block header found; don't complain
+                break;
+            }
+
+            uint64_t nBlockPos = blkdat.GetPos();
+            raw.pos = CDiskBlockPos(nFile, nBlockPos);
+            raw.fTentative = nBlockPos < nCoverEnd;
+            raw.vData.resize(nSize);
+            try {
+                blkdat.read(&raw.vData[0], nSize);
+            } catch (const std::exception&) {
+                // truncated record at the end of the file
+                break;
+            }
+
+            // A record followed by another header (or the end of the file) is
+            // skipped over as a whole. Otherwise the record may be damaged, so
+            // search its inside for headers like a failed read would.
+            bool fFollowed = false;
+            try {
+                unsigned char buf[MESSAGE_START_SIZE];
+                blkdat >> FLATDATA(buf);
+                fFollowed = memcmp(buf, pchMessageStart, MESSAGE_START_SIZE) == 0;
+            } catch (const std::exception&) {
+                fFollowed = true;
+            }
+            if (!raw.fTentative) {
+                if (fFollowed)
+                    nRewind = nBlockPos + nSize;
+                else
+                    nCoverEnd = nBlockPos + nSize;
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fShutdown && nReadAhead > MAX_IMPORT_READAHEAD)
+                condRead.wait(lock);
+            if (fShutdown)
+                break;
+            raw.nSeq = nRecords++;
+            nReadAhead += nSize;
+            queueRaw.push_back(CRawBlock());
+            std::swap(queueRaw.back(), raw);
+            condWork.notify_one();
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("%s: I/O error - %s\n", __func__, e.what());
+    }
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fEndOfFile = true;
+    condWork.notify_all();
+    condDone.notify_all();
+}
+
+void CBlockImportReader::ThreadDecode()
+{
+    RenameThread("safe-importdec");
+    while (true) {
+        CRawBlock raw;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fShutdown && !fEndOfFile && queueRaw.empty())
+                condWork.wait(lock);
+            if (fShutdown || queueRaw.empty())
+                return;
+            std::swap(raw, queueRaw.front());
+            queueRaw.pop_front();
+        }
+
+        CDecodedBlock decoded;
+        CImportedBlock& block = decoded.block;
+        block.pos = raw.pos;
+        block.nSize = raw.vData.size();
+        decoded.nHeaderPos = raw.nHeaderPos;
+        decoded.nEndPos = 0;
+        decoded.fTentative = raw.fTentative;
+        try {
+            // Deserializing computes the transaction hashes as well
+            CDataStream ssBlock(raw.vData, SER_DISK, CLIENT_VERSION);
+            boost::shared_ptr<CBlock> pblock(new CBlock());
+            ssBlock >> *pblock;
+            block.hash = pblock->GetHash();
+            block.nMemUsage = memusage::MallocUsage(sizeof(CBlock)) + RecursiveDynamicUsage(*pblock);
+            block.pblock = pblock;
+            // the size in the header may overstate the block
+            decoded.nEndPos = raw.nHeaderPos + 8 + raw.vData.size() - ssBlock.size();
+        } catch (const std::exception& e) {
+            if (!raw.fTentative)
+                LogPrintf("%s: Deserialize error - %s\n", __func__, e.what());
+        }
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        mapDone.insert(std::make_pair(raw.nSeq, decoded));
+        if (raw.nSeq == nNext)
+            condDone.notify_all();
+    }
+}
+
+bool CBlockImportReader::Next(CImportedBlock& block)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        std::map<uint64_t, CDecodedBlock>::iterator it = mapDone.find(nNext);
+        if (it == mapDone.end()) {
+            if (fShutdown || (fEndOfFile && nNext == nRecords))
+                return false;
+            condDone.wait(lock);
+            continue;
+        }
+
+        CDecodedBlock decoded = it->second;
+        mapDone.erase(it);
+        nNext++;
+        nReadAhead -= decoded.block.nSize;
+        condRead.notify_one();
+
+        // Headers found inside a block that deserialized fine are block data
+        if (decoded.fTentative && decoded.nHeaderPos < nLastValidEnd)
+            continue;
+        if (!decoded.fTentative || decoded.nEndPos > nLastValidEnd)
+            nLastValidEnd = decoded.nEndPos;
+        block = decoded.block;
+        return true;
+    }
+}
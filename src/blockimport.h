@@ -0,0 +1,105 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKIMPORT_H
+#define BITCOIN_BLOCKIMPORT_H
+
+#include "chain.h"
+#include "primitives/block.h"
+#include "protocol.h"
+#include "uint256.h"
+
+#include <deque>
+#include <map>
+#include <stdio.h>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+//! Maximum number of threads deserializing and hashing imported blocks
+static const int MAX_IMPORT_THREADS = 8;
+//! Serialized block data the reader may be ahead of the importing thread
+static const uint64_t MAX_IMPORT_READAHEAD = 64 << 20;
+//! Memory used by the imported blocks kept while their parent isn't known yet
+static const uint64_t MAX_IMPORT_UNKNOWN_PARENT = 128 << 20;
+
+/** A block record read from a bootstrap or blk file */
+struct CImportedBlock
+{
+    //! NULL if the record couldn't be deserialized
+    boost::shared_ptr<CBlock> pblock;
+    uint256 hash;
+    //! position of the block data; nFile is only meaningful for blk files
+    CDiskBlockPos pos;
+    unsigned int nSize;
+    //! memory used by the deserialized block
+    size_t nMemUsage;
+
+    CImportedBlock() : nSize(0), nMemUsage(0) {}
+};
+
+/**
+ * Reads the block records of a bootstrap or blk file ahead of the importing
+ * thread. A reader thread scans the file with large sequential reads, a pool
+ * of worker threads deserializes the records and computes the block and
+ * transaction hashes, and Next() hands the blocks back in file order.
+ */
+class CBlockImportReader
+{
+private:
+    struct CRawBlock
+    {
+        uint64_t nSeq;
+        //! file offset of the record header
+        uint64_t nHeaderPos;
+        std::vector<char> vData;
+        CDiskBlockPos pos;
+        //! found inside an earlier record that wasn't followed by a block header
+        bool fTentative;
+    };
+
+    struct CDecodedBlock
+    {
+        CImportedBlock block;
+        uint64_t nHeaderPos;
+        //! file offset behind the deserialized block data
+        uint64_t nEndPos;
+        bool fTentative;
+    };
+
+    boost::mutex mutex;
+    boost::condition_variable condRead;
+    boost::condition_variable condWork;
+    boost::condition_variable condDone;
+    std::deque<CRawBlock> queueRaw;
+    std::map<uint64_t, CDecodedBlock> mapDone;
+    uint64_t nRecords;
+    uint64_t nNext;
+    uint64_t nReadAhead;
+    bool fEndOfFile;
+    bool fShutdown;
+    //! end of the block data of the last record that wasn't tentative, 0 if it couldn't be deserialized
+    uint64_t nLastValidEnd;
+    boost::thread_group threads;
+
+    const int nFile;
+    const unsigned int nMaxBlockSize;
+    CMessageHeader::MessageStartChars pchMessageStart;
+
+    void ThreadRead(FILE* fileIn);
+    void ThreadDecode();
+
+public:
+    /** Takes over fileIn; nFile is the blk file number, or -1 for other files */
+    CBlockImportReader(FILE* fileIn, int nFile, const CMessageHeader::MessageStartChars& messageStart, unsigned int nMaxBlockSize, int nThreads);
+    ~CBlockImportReader();
+
+    //! Wait for the next record in file order, returns false at the end of the file
+    bool Next(CImportedBlock& block);
+};
+
+#endif // BITCOIN_BLOCKIMPORT_H
@@ -0,0 +1,191 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockwriter.h"
+
+#include "reverselock.h"
+#include "util.h"
+#include "validation.h"
+
+#include <boost/bind.hpp>
+
+CBlockFileWriter::CBlockFileWriter(size_t nMaxQueuedBytesIn) :
+    nQueuedBytes(0), nMaxQueuedBytes(nMaxQueuedBytesIn), nQueued(0), nDone(0),
+    fRunning(false), fStop(false), fFailed(false)
+{
+}
+
+CBlockFileWriter::~CBlockFileWriter()
+{
+    Stop();
+}
+
+void CBlockFileWriter::Start()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (fRunning)
+        return;
+    fStop = false;
+    fRunning = true;
+    thread = boost::thread(boost::bind(&CBlockFileWriter::ThreadWrite, this));
+}
+
+void CBlockFileWriter::Stop()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!fRunning)
+            return;
+        fStop = true;
+    }
+    condQueue.notify_all();
+    thread.join();
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fRunning = false;
+}
+
+bool CBlockFileWriter::Process(const CWriteJob& job)
+{
+    if (job.type == JOB_WRITE) {
+        FILE* file = job.fUndo ? OpenUndoFile(job.pos) : OpenBlockFile(job.pos);
+        if (!file)
+            return error("%s: Open%sFile failed for %s", __func__, job.fUndo ? "Undo" : "Block", job.pos.ToString());
+        bool fWritten = fwrite(&job.vData[0], 1, job.vData.size(), file) == job.vData.size();
+        if (fclose(file) != 0 || !fWritten)
+            return error("%s: write failed for %s", __func__, job.pos.ToString());
+        setDirty.insert(std::make_pair(job.pos.nFile, job.fUndo));
+        return true;
+    }
+
+    std::set<std::pair<int, bool> > setSync;
+    if (job.type == JOB_COMMIT) {
+        setSync.insert(std::make_pair(job.pos.nFile, false));
+        setSync.insert(std::make_pair(job.pos.nFile, true));
+    } else {
+        setSync.swap(setDirty);
+    }
+    for (std::set<std::pair<int, bool> >::const_iterator it = setSync.begin(); it != setSync.end(); ++it) {
+        CDiskBlockPos pos(it->first, 0);
+        FILE* file = it->second ? OpenUndoFile(pos) : OpenBlockFile(pos);
+        if (!file)
+            continue;
+        if (job.fFinalize)
+            TruncateFile(file, it->second ? job.nUndoSize : job.nSize);
+        FileCommit(file);
+        fclose(file);
+        setDirty.erase(*it);
+    }
+    return true;
+}
+
+void CBlockFileWriter::ThreadWrite()
+{
+    RenameThread("safe-blockwrite");
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        while (!fStop && queue.empty())
+            condQueue.wait(lock);
+        if (queue.empty())
+            break;
+
+        // The job stays queued while it is written, so ReadPending still finds it
+        const CWriteJob& job = queue.front();
+        bool fOk;
+        {
+            reverse_lock<boost::unique_lock<boost::mutex> > unlock(lock);
+            fOk = Process(job);
+        }
+        if (!fOk)
+            fFailed = true;
+        nQueuedBytes -= job.vData.size();
+        nDone = job.nSeq;
+        queue.pop_front();
+        condDone.notify_all();
+    }
+}
+
+uint64_t CBlockFileWriter::Enqueue(CWriteJob& job, boost::unique_lock<boost::mutex>& lock)
+{
+    job.nSeq = ++nQueued;
+    if (!fRunning) {
+        if (!Process(job))
+            fFailed = true;
+        nDone = job.nSeq;
+        return job.nSeq;
+    }
+
+    while (nQueuedBytes > 0 && nQueuedBytes + job.vData.size() > nMaxQueuedBytes)
+        condDone.wait(lock);
+    nQueuedBytes += job.vData.size();
+    queue.push_back(CWriteJob());
+    std::swap(queue.back(), job);
+    condQueue.notify_one();
+    return queue.back().nSeq;
+}
+
+void CBlockFileWriter::WaitFor(uint64_t nSeq, boost::unique_lock<boost::mutex>& lock)
+{
+    while (nDone < nSeq)
+        condDone.wait(lock);
+}
+
+bool CBlockFileWriter::Write(const CDiskBlockPos& pos, bool fUndo, std::vector<char>& vRecord)
+{
+    CWriteJob job;
+    job.type = JOB_WRITE;
+    job.pos = pos;
+    job.fUndo = fUndo;
+    job.vData.swap(vRecord);
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    Enqueue(job, lock);
+    return !fFailed;
+}
+
+void CBlockFileWriter::Commit(int nFile, bool fFinalize, unsigned int nSize, unsigned int nUndoSize)
+{
+    CWriteJob job;
+    job.type = JOB_COMMIT;
+    job.pos = CDiskBlockPos(nFile, 0);
+    job.fFinalize = fFinalize;
+    job.nSize = nSize;
+    job.nUndoSize = nUndoSize;
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    Enqueue(job, lock);
+}
+
+bool CBlockFileWriter::Flush()
+{
+    CWriteJob job;
+    job.type = JOB_SYNC;
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    WaitFor(Enqueue(job, lock), lock);
+    return !fFailed;
+}
+
+bool CBlockFileWriter::ReadPending(const CDiskBlockPos& pos, bool fUndo, std::vector<char>& vData)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    for (std::deque<CWriteJob>::const_iterator it = queue.begin(); it != queue.end(); ++it) {
+        if (it->type != JOB_WRITE || it->fUndo != fUndo || it->pos.nFile != pos.nFile)
+            continue;
+        if (pos.nPos >= it->pos.nPos && pos.nPos < it->pos.nPos + it->vData.size()) {
+            vData.assign(it->vData.begin() + (pos.nPos - it->pos.nPos), it->vData.end());
+            return true;
+        }
+    }
+    return false;
+}
+
+void CBlockFileWriter::WaitForFile(int nFile, bool fUndo)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    uint64_t nSeq = 0;
+    for (std::deque<CWriteJob>::const_iterator it = queue.begin(); it != queue.end(); ++it)
+        if (it->type == JOB_WRITE && it->fUndo == fUndo && it->pos.nFile == nFile)
+            nSeq = it->nSeq;
+    WaitFor(nSeq, lock);
+}
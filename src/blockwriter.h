@@ -0,0 +1,100 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKWRITER_H
+#define BITCOIN_BLOCKWRITER_H
+
+#include "chain.h"
+
+#include <deque>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+//! Block and undo records that may be waiting for the writer thread
+static const size_t MAX_BLOCK_WRITE_QUEUE = 64 << 20;
+
+/**
+ * Appends block and undo records to the blk/rev files on a background
+ * thread, so validation doesn't wait for the disk.
+ *
+ * Positions are still reserved up front by FindBlockPos and FindUndoPos.
+ * Records that haven't reached their file yet can be read back with
+ * ReadPending. Files are only synced by Commit and Flush, and Flush is the
+ * durability barrier: it returns once every record queued before it is
+ * written and synced, so the block index may refer to them. Without a
+ * running thread (before Start, and in tests) every call completes inline.
+ */
+class CBlockFileWriter
+{
+private:
+    enum JobType {
+        JOB_WRITE,
+        JOB_COMMIT,
+        JOB_SYNC,
+    };
+
+    struct CWriteJob
+    {
+        JobType type;
+        CDiskBlockPos pos;
+        bool fUndo;
+        std::vector<char> vData;
+        //! JOB_COMMIT: truncate the files to these sizes before syncing them
+        bool fFinalize;
+        unsigned int nSize;
+        unsigned int nUndoSize;
+        uint64_t nSeq;
+
+        CWriteJob() : type(JOB_WRITE), fUndo(false), fFinalize(false), nSize(0), nUndoSize(0), nSeq(0) {}
+    };
+
+    boost::mutex mutex;
+    boost::condition_variable condQueue;
+    boost::condition_variable condDone;
+    std::deque<CWriteJob> queue;
+    size_t nQueuedBytes;
+    const size_t nMaxQueuedBytes;
+    uint64_t nQueued;
+    uint64_t nDone;
+    bool fRunning;
+    bool fStop;
+    bool fFailed;
+    boost::thread thread;
+
+    //! blk (false) and rev (true) files written since they were last synced
+    std::set<std::pair<int, bool> > setDirty;
+
+    bool Process(const CWriteJob& job);
+    void ThreadWrite();
+    //! Queue a job, or run it if there is no thread, and return its sequence number
+    uint64_t Enqueue(CWriteJob& job, boost::unique_lock<boost::mutex>& lock);
+    void WaitFor(uint64_t nSeq, boost::unique_lock<boost::mutex>& lock);
+
+public:
+    CBlockFileWriter(size_t nMaxQueuedBytesIn = MAX_BLOCK_WRITE_QUEUE);
+    ~CBlockFileWriter();
+
+    void Start();
+    //! Write everything still queued and stop the thread
+    void Stop();
+
+    //! Queue vRecord to be written at pos in a blk or rev file
+    bool Write(const CDiskBlockPos& pos, bool fUndo, std::vector<char>& vRecord);
+    //! Queue syncing the blk and rev files of nFile, truncating them first when fFinalize is set
+    void Commit(int nFile, bool fFinalize, unsigned int nSize, unsigned int nUndoSize);
+    //! Wait for all queued records and sync every file written since the last Flush
+    bool Flush();
+
+    //! Copy the queued data starting at pos if it hasn't been written yet
+    bool ReadPending(const CDiskBlockPos& pos, bool fUndo, std::vector<char>& vData);
+    //! Wait until no record is queued for the file
+    void WaitForFile(int nFile, bool fUndo);
+};
+
+#endif // BITCOIN_BLOCKWRITER_H
@@ -0,0 +1,487 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainindexer.h"
+
+#include "blockcache.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "hash.h"
+#include "reverselock.h"
+#include "txdb.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+CChainIndexer chainindexer;
+
+/** Address type and hash of the outputs the address index knows, type 0 for any other */
+static int GetIndexAddress(const CScript& script, uint160& hashBytes)
+{
+    if (script.IsPayToScriptHash()) {
+        hashBytes = uint160(std::vector<unsigned char>(script.begin()+2, script.begin()+22));
+        return 2;
+    } else if (script.IsPayToPublicKeyHash()) {
+        hashBytes = uint160(std::vector<unsigned char>(script.begin()+3, script.begin()+23));
+        return 1;
+    } else if (script.IsPayToPublicKey()) {
+        hashBytes = Hash160(script.begin()+1, script.end()-1);
+        return 1;
+    }
+    hashBytes.SetNull();
+    return 0;
+}
+
+/** Positions of the transactions of a block stored at posBlock */
+static void GetTxPositions(const CBlock& block, const CDiskBlockPos& posBlock, std::vector<std::pair<uint256, CDiskTxPos> >& vPos)
+{
+    CDiskTxPos pos(posBlock, GetSizeOfCompactSize(block.vtx.size()));
+    vPos.reserve(block.vtx.size());
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        vPos.push_back(std::make_pair(block.vtx[i].GetHash(), pos));
+        pos.nTxOffset += ::GetSerializeSize(block.vtx[i], SER_DISK, CLIENT_VERSION);
+    }
+}
+
+CChainIndexer::CChainIndexer(size_t nMaxQueuedBytesIn) :
+    nQueuedBytes(0), nMaxQueuedBytes(nMaxQueuedBytesIn), nQueued(0), nWritten(0), nSynced(0), nWriteRequested(0),
+    fSyncRequested(false), fRunning(false), fStop(false), fFailed(false),
+    nBatchBytes(0), nBatchSeq(0), nBatchTime(0)
+{
+}
+
+CChainIndexer::~CChainIndexer()
+{
+    Stop();
+}
+
+void CChainIndexer::Start()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (fRunning)
+        return;
+    fStop = false;
+    fRunning = true;
+    thread = boost::thread(boost::bind(&CChainIndexer::ThreadIndex, this));
+    lock.unlock();
+
+    CatchUp();
+}
+
+void CChainIndexer::CatchUp()
+{
+    if (!fTxIndex && !fAddressIndex && !fSpentIndex && !fTimestampIndex)
+        return;
+
+    LOCK(cs_main);
+    // indexes from before the marker was written, and those of a new node, have nothing to catch up
+    BlockMap::const_iterator mi = mapBlockIndex.find(GetBestBlock());
+    if (mi == mapBlockIndex.end())
+        return;
+    const CBlockIndex* pindexFork = chainActive.FindFork(mi->second);
+    if (!pindexFork)
+        return;
+    if (pindexFork != mi->second)
+        LogPrintf("%s: indexes are at %s, which is not in the active chain; its entries past %s are kept\n", __func__,
+                mi->first.ToString(), pindexFork->GetBlockHash().ToString());
+
+    int nReplayed = 0;
+    for (const CBlockIndex* pindex = chainActive.Next(pindexFork); pindex; pindex = chainActive.Next(pindex)) {
+        boost::shared_ptr<const CBlock> pblock;
+        boost::shared_ptr<CBlockUndo> pblockSpent = boost::make_shared<CBlockUndo>();
+        if (!ReadBlockFromDisk(pblock, pindex, Params().GetConsensus()) ||
+            ((fAddressIndex || fSpentIndex) && !ReadBlockSpentCoins(*pblock, pindex, *pblockSpent))) {
+            LogPrintf("%s: failed to read block %s\n", __func__, pindex->GetBlockHash().ToString());
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fFailed = true;
+            return;
+        }
+        EnqueueConnect(*pblock, pindex, pblock, pblockSpent);
+        nReplayed++;
+    }
+    if (nReplayed > 0)
+        LogPrintf("%s: replayed %d blocks the indexes were missing\n", __func__, nReplayed);
+}
+
+void CChainIndexer::Stop()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!fRunning)
+            return;
+        fStop = true;
+    }
+    condQueue.notify_all();
+    thread.join();
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fRunning = false;
+}
+
+void CChainIndexer::Apply(const CIndexJob& job, const CBlock* pblockIn)
+{
+    if (!batch)
+        batch.reset(new CDBBatch(&pblocktree->GetObfuscateKey()));
+    if (nBatchBytes == 0)
+        nBatchTime = GetTimeMillis();
+    nBatchBytes += job.nBytes;
+    nBatchSeq = job.nSeq;
+
+    if (job.fConnect) {
+        pblocktree->BatchTxIndex(*batch, job.vPos);
+        vBatchPos.insert(vBatchPos.end(), job.vPos.begin(), job.vPos.end());
+        if (fTimestampIndex)
+            pblocktree->BatchTimestampIndex(*batch, CTimestampIndexKey(job.nTime, job.hashBlock));
+    }
+    if (!fAddressIndex && !fSpentIndex)
+        return;
+
+    // the block wasn't copied while cs_main was held, it is read here instead
+    boost::shared_ptr<const CBlock> pblock = job.pblock;
+    if (!pblockIn && !pblock && !blockcache.Get(job.hashBlock, pblock)) {
+        boost::shared_ptr<CBlock> pblockRead = boost::make_shared<CBlock>();
+        if (!ReadBlockFromDisk(*pblockRead, job.posBlock, Params().GetConsensus()) || pblockRead->GetHash() != job.hashBlock) {
+            LogPrintf("%s: failed to read block %s\n", __func__, job.hashBlock.ToString());
+            // the updates are dropped, the node shuts down once the failure is seen
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fFailed = true;
+            return;
+        }
+        pblock = pblockRead;
+    }
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+    const CBlock& block = pblockIn ? *pblockIn : *pblock;
+    const CBlockUndo& spent = *job.pspent;
+    const int nHeight = job.nHeight;
+
+    if (job.fConnect) {
+        for (unsigned int i = 0; i < block.vtx.size(); i++) {
+            const CTransaction& tx = block.vtx[i];
+            const uint256& txhash = tx.GetHash();
+
+            if (!tx.IsCoinBase() && i - 1 < spent.vtxundo.size()) {
+                const CTxUndo& txspent = spent.vtxundo[i-1];
+                for (unsigned int j = 0; j < tx.vin.size() && j < txspent.vprevout.size(); j++) {
+                    const CTxIn& input = tx.vin[j];
+                    const CTxOut& prevout = txspent.vprevout[j].out;
+                    if (prevout.IsNull())
+                        continue;
+
+                    uint160 hashBytes;
+                    int addressType = GetIndexAddress(prevout.scriptPubKey, hashBytes);
+
+                    if (!prevout.IsAsset() && fAddressIndex && addressType > 0) {
+                        // record spending activity
+                        addressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, hashBytes, nHeight, i, txhash, j, true), prevout.nValue * -1));
+
+                        // remove address from unspent index
+                        addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(addressType, hashBytes, input.prevout.hash, input.prevout.n), CAddressUnspentValue()));
+                    }
+
+                    if (fSpentIndex) {
+                        // add the spent index to determine the txid and input that spent an output
+                        // and to find the amount and address from an input
+                        spentIndex.push_back(std::make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n), CSpentIndexValue(txhash, j, nHeight, prevout.nValue, addressType, hashBytes)));
+                    }
+                }
+            }
+
+            if (!fAddressIndex)
+                continue;
+            for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                const CTxOut& out = tx.vout[k];
+                uint160 hashBytes;
+                int addressType;
+                if (out.IsAsset() || (addressType = GetIndexAddress(out.scriptPubKey, hashBytes)) == 0)
+                    continue;
+
+                // record receiving activity
+                addressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, hashBytes, nHeight, i, txhash, k, false), out.nValue));
+
+                // record unspent output
+                addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(addressType, hashBytes, txhash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, nHeight)));
+            }
+        }
+
+        if (fAddressIndex) {
+            pblocktree->BatchAddressIndex(*batch, addressIndex, false);
+            pblocktree->BatchAddressUnspentIndex(*batch, addressUnspentIndex);
+        }
+        if (fSpentIndex)
+            pblocktree->BatchSpentIndex(*batch, spentIndex);
+        return;
+    }
+
+    // undo transactions in reverse order
+    for (int i = block.vtx.size() - 1; i >= 0; i--) {
+        const CTransaction& tx = block.vtx[i];
+        const uint256& hash = tx.GetHash();
+
+        for (unsigned int k = tx.vout.size(); k-- > 0 && fAddressIndex;) {
+            const CTxOut& out = tx.vout[k];
+            uint160 hashBytes;
+            int addressType;
+            if (out.IsAsset() || (addressType = GetIndexAddress(out.scriptPubKey, hashBytes)) == 0)
+                continue;
+
+            // undo receiving activity
+            addressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, hashBytes, nHeight, i, hash, k, false), out.nValue));
+
+            // undo unspent index
+            addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(addressType, hashBytes, hash, k), CAddressUnspentValue()));
+        }
+
+        if (i == 0 || (unsigned int)i - 1 >= spent.vtxundo.size())
+            continue;
+        const CTxUndo& txspent = spent.vtxundo[i-1];
+        for (unsigned int j = std::min(tx.vin.size(), txspent.vprevout.size()); j-- > 0;) {
+            const CTxIn& input = tx.vin[j];
+            const Coin& restored = txspent.vprevout[j];
+            // put-candy inputs keep their spent index entries
+            if (restored.out.IsNull())
+                continue;
+
+            if (fSpentIndex) {
+                // undo and delete the spent index
+                spentIndex.push_back(std::make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n), CSpentIndexValue()));
+            }
+
+            uint160 hashBytes;
+            int addressType;
+            if (!fAddressIndex || restored.out.IsAsset() || (addressType = GetIndexAddress(restored.out.scriptPubKey, hashBytes)) == 0)
+                continue;
+
+            // undo spending activity
+            addressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, hashBytes, nHeight, i, hash, j, true), restored.out.nValue * -1));
+
+            // restore unspent index
+            addressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(addressType, hashBytes, input.prevout.hash, input.prevout.n), CAddressUnspentValue(restored.out.nValue, restored.out.scriptPubKey, restored.nHeight)));
+        }
+    }
+
+    if (fAddressIndex) {
+        pblocktree->BatchAddressIndex(*batch, addressIndex, true);
+        pblocktree->BatchAddressUnspentIndex(*batch, addressUnspentIndex);
+    }
+    if (fSpentIndex)
+        pblocktree->BatchSpentIndex(*batch, spentIndex);
+}
+
+bool CChainIndexer::WriteBatch(bool fSync)
+{
+    bool fOk;
+    {
+        // nothing more is written once an update was lost
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fOk = !fFailed;
+    }
+    try {
+        if (fOk && batch) {
+            pblocktree->BatchIndexBestBlock(*batch, GetBestBlock());
+            fOk = pblocktree->WriteBatch(*batch, fSync);
+        } else if (fOk && fSync) {
+            fOk = pblocktree->Sync();
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+        fOk = false;
+    }
+    batch.reset();
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (!fOk) {
+        // the updates are dropped, the node shuts down once the failure is seen
+        fFailed = true;
+    } else {
+        for (std::vector<std::pair<uint256, CDiskTxPos> >::const_iterator it = vBatchPos.begin(); it != vBatchPos.end(); ++it) {
+            // leave the position of a transaction that was connected again in a later block
+            std::map<uint256, CDiskTxPos>::iterator mi = mapPendingTx.find(it->first);
+            if (mi != mapPendingTx.end() && mi->second == it->second && mi->second.nTxOffset == it->second.nTxOffset)
+                mapPendingTx.erase(mi);
+        }
+    }
+    vBatchPos.clear();
+    nBatchBytes = 0;
+    nWritten = nBatchSeq;
+    if (fSync || !fOk)
+        nSynced = nBatchSeq;
+    condDone.notify_all();
+    return fOk;
+}
+
+void CChainIndexer::ThreadIndex()
+{
+    RenameThread("safe-indexer");
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        if (queue.empty()) {
+            bool fRequested = nWriteRequested > nWritten || (fSyncRequested && nWriteRequested > nSynced);
+            if (nBatchSeq == nWritten && !fRequested) {
+                if (fStop)
+                    break;
+                condQueue.wait(lock);
+                continue;
+            }
+            // an idle batch is written once it is old enough, or as soon as someone waits for it
+            if (!fStop && !fRequested) {
+                int64_t nWait = nBatchTime + INDEX_WRITE_DELAY - GetTimeMillis();
+                if (nWait > 0) {
+                    condQueue.timed_wait(lock, boost::posix_time::milliseconds(nWait));
+                    continue;
+                }
+            }
+            bool fSync = fSyncRequested;
+            fSyncRequested = false;
+            reverse_lock<boost::unique_lock<boost::mutex> > unlock(lock);
+            WriteBatch(fSync);
+            continue;
+        }
+
+        CIndexJob job;
+        std::swap(job, queue.front());
+        queue.pop_front();
+        nQueuedBytes -= job.nBytes;
+        condDone.notify_all();
+        hashBest = job.hashBest;
+        reverse_lock<boost::unique_lock<boost::mutex> > unlock(lock);
+        Apply(job, NULL);
+        if (nBatchBytes >= INDEX_BATCH_SIZE)
+            WriteBatch(false);
+    }
+}
+
+void CChainIndexer::Enqueue(CIndexJob& job, const CBlock& block)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    job.nSeq = ++nQueued;
+    for (std::vector<std::pair<uint256, CDiskTxPos> >::const_iterator it = job.vPos.begin(); it != job.vPos.end(); ++it)
+        mapPendingTx[it->first] = it->second;
+
+    if (!fRunning) {
+        hashBest = job.hashBest;
+        reverse_lock<boost::unique_lock<boost::mutex> > unlock(lock);
+        Apply(job, &block);
+        WriteBatch(false);
+        return;
+    }
+
+    while (nQueuedBytes > 0 && nQueuedBytes + job.nBytes > nMaxQueuedBytes)
+        condDone.wait(lock);
+    nQueuedBytes += job.nBytes;
+    queue.push_back(CIndexJob());
+    std::swap(queue.back(), job);
+    condQueue.notify_one();
+}
+
+void CChainIndexer::EnqueueConnect(const CBlock& block, const CBlockIndex* pindex, const boost::shared_ptr<const CBlock>& pblock, const boost::shared_ptr<const CBlockUndo>& pblockSpent)
+{
+    CIndexJob job;
+    job.fConnect = true;
+    job.hashBlock = pindex->GetBlockHash();
+    job.hashBest = job.hashBlock;
+    job.nHeight = pindex->nHeight;
+    job.nTime = pindex->nTime;
+    job.posBlock = pindex->GetBlockPos();
+    if (fAddressIndex || fSpentIndex) {
+        job.pblock = pblock;
+        job.pspent = pblockSpent;
+        job.nBytes = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION) + ::GetSerializeSize(*pblockSpent, SER_DISK, CLIENT_VERSION);
+    }
+    if (fTxIndex) {
+        GetTxPositions(block, job.posBlock, job.vPos);
+        job.nBytes += job.vPos.size() * sizeof(job.vPos[0]);
+    }
+    Enqueue(job, block);
+}
+
+void CChainIndexer::BlockConnected(const CBlock& block, const CBlockIndex* pindex, const boost::shared_ptr<const CBlockUndo>& pblockSpent)
+{
+    if (!fTxIndex && !fAddressIndex && !fSpentIndex && !fTimestampIndex)
+        return;
+
+    EnqueueConnect(block, pindex, boost::shared_ptr<const CBlock>(), pblockSpent);
+}
+
+void CChainIndexer::BlockDisconnected(const CBlock& block, const CBlockIndex* pindex, const boost::shared_ptr<const CBlockUndo>& pblockSpent)
+{
+    if (!fAddressIndex && !fSpentIndex && !fTxIndex && !fTimestampIndex)
+        return;
+
+    // The tx and timestamp indexes keep the entries of disconnected blocks
+    CIndexJob job;
+    job.fConnect = false;
+    job.hashBlock = pindex->GetBlockHash();
+    job.hashBest = pindex->pprev ? pindex->pprev->GetBlockHash() : uint256();
+    job.nHeight = pindex->nHeight;
+    job.nTime = pindex->nTime;
+    job.posBlock = pindex->GetBlockPos();
+    if (fAddressIndex || fSpentIndex) {
+        job.pspent = pblockSpent;
+        job.nBytes = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION) + ::GetSerializeSize(*pblockSpent, SER_DISK, CLIENT_VERSION);
+    }
+    Enqueue(job, block);
+}
+
+bool CChainIndexer::WaitWritten(bool fSync)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (!fRunning) {
+        if (fSync) {
+            reverse_lock<boost::unique_lock<boost::mutex> > unlock(lock);
+            pblocktree->Sync();
+        }
+        return !fFailed;
+    }
+
+    uint64_t nSeq = nQueued;
+    uint64_t& nDone = fSync ? nSynced : nWritten;
+    if (nDone >= nSeq)
+        return !fFailed;
+    nWriteRequested = std::max(nWriteRequested, nSeq);
+    if (fSync)
+        fSyncRequested = true;
+    condQueue.notify_one();
+    while (nDone < nSeq)
+        condDone.wait(lock);
+    return !fFailed;
+}
+
+bool CChainIndexer::Sync()
+{
+    return WaitWritten(false);
+}
+
+bool CChainIndexer::Flush()
+{
+    return WaitWritten(true);
+}
+
+bool CChainIndexer::ReadTxIndex(const uint256& txid, CDiskTxPos& pos)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        std::map<uint256, CDiskTxPos>::const_iterator it = mapPendingTx.find(txid);
+        if (it != mapPendingTx.end()) {
+            pos = it->second;
+            return true;
+        }
+    }
+    return pblocktree->ReadTxIndex(txid, pos);
+}
+
+uint256 CChainIndexer::GetBestBlock()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!hashBest.IsNull())
+            return hashBest;
+    }
+    uint256 hash;
+    pblocktree->ReadIndexBestBlock(hash);
+    return hash;
+}
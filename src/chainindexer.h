@@ -0,0 +1,148 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SAFE_CHAININDEXER_H
+#define SAFE_CHAININDEXER_H
+
+#include "primitives/block.h"
+#include "undo.h"
+#include "validation.h"
+#include "validationinterface.h"
+
+#include <deque>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+class CDBBatch;
+
+//! Blocks that may be waiting for the indexer thread, in serialized bytes of the blocks and their spent coins
+static const size_t MAX_INDEX_QUEUE = 64 << 20;
+//! Index updates are written once this many bytes of blocks went into them
+static const size_t INDEX_BATCH_SIZE = 16 << 20;
+//! Index updates of an idle indexer are written after this many milliseconds
+static const int64_t INDEX_WRITE_DELAY = 2000;
+
+/**
+ * Maintains the tx, address, spent and timestamp indexes on a background
+ * thread, so that connecting a block doesn't wait for their writes.
+ *
+ * Blocks reach the indexer through the BlockConnected and BlockDisconnected
+ * signals and are applied in that order. The callbacks run under cs_main, so
+ * they only take references: the spent coins are shared with ConnectBlock and
+ * DisconnectBlock, and the block is taken from the block cache or read back
+ * from disk by the indexer thread. Updates of consecutive blocks go
+ * into one batch, which is written together with the block it brings the
+ * indexes to, see CBlockTreeDB::ReadIndexBestBlock. The batch is written
+ * when it is large, when the indexer has been idle for a while, and when
+ * Sync or Flush asks for it.
+ *
+ * Transaction positions are available from ReadTxIndex as soon as the block
+ * is connected. The other indexes are read from the database, so their
+ * readers call Sync first. Flush is the durability barrier that has to come
+ * before the chain state is written, so the indexes on disk are never behind
+ * it. Without a running thread (before Start, and in tests) every block is
+ * written inline. Start replays the active chain from the block the indexes
+ * on disk are at, which is behind the tip when a crash lost their last batch.
+ */
+class CChainIndexer : public CValidationInterface
+{
+private:
+    struct CIndexJob
+    {
+        bool fConnect;
+        uint256 hashBlock;
+        //! Block the indexes are at once the job is applied
+        uint256 hashBest;
+        int nHeight;
+        unsigned int nTime;
+        //! The block, or null to read it on the indexer thread from the block cache or posBlock
+        boost::shared_ptr<const CBlock> pblock;
+        CDiskBlockPos posBlock;
+        //! Coins spent by (or restored for) the inputs, null unless the address or spent index is on
+        boost::shared_ptr<const CBlockUndo> pspent;
+        std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+        size_t nBytes;
+        uint64_t nSeq;
+
+        CIndexJob() : fConnect(true), nHeight(0), nTime(0), nBytes(0), nSeq(0) {}
+    };
+
+    boost::mutex mutex;
+    boost::condition_variable condQueue;
+    boost::condition_variable condDone;
+    std::deque<CIndexJob> queue;
+    size_t nQueuedBytes;
+    const size_t nMaxQueuedBytes;
+    uint64_t nQueued;
+    //! Jobs up to this one are on disk
+    uint64_t nWritten;
+    //! Jobs up to this one are on disk and synced
+    uint64_t nSynced;
+    //! Jobs up to this one have to be written as soon as possible, and synced if fSyncRequested
+    uint64_t nWriteRequested;
+    bool fSyncRequested;
+    bool fRunning;
+    bool fStop;
+    bool fFailed;
+    boost::thread thread;
+
+    //! Positions of the transactions of blocks whose tx index isn't written yet
+    std::map<uint256, CDiskTxPos> mapPendingTx;
+    //! Block the applied updates bring the indexes to
+    uint256 hashBest;
+
+    // Only used by the thread that applies jobs
+    boost::scoped_ptr<CDBBatch> batch;
+    size_t nBatchBytes;
+    uint64_t nBatchSeq;
+    int64_t nBatchTime;
+    std::vector<std::pair<uint256, CDiskTxPos> > vBatchPos;
+
+    //! Add a job to the batch, with the block from pblockIn if given; fails the indexer if the block can't be read
+    void Apply(const CIndexJob& job, const CBlock* pblockIn);
+    //! Write the batch, with fSync to make it durable
+    bool WriteBatch(bool fSync);
+    void ThreadIndex();
+    //! Queue a job, or apply it right away when the thread isn't running
+    void Enqueue(CIndexJob& job, const CBlock& block);
+    void EnqueueConnect(const CBlock& block, const CBlockIndex* pindex, const boost::shared_ptr<const CBlock>& pblock, const boost::shared_ptr<const CBlockUndo>& pblockSpent);
+    //! Wait until the jobs queued so far are written
+    bool WaitWritten(bool fSync);
+    //! Queue the blocks of the active chain the indexes on disk don't have yet
+    void CatchUp();
+
+protected:
+    void BlockConnected(const CBlock& block, const CBlockIndex* pindex, const boost::shared_ptr<const CBlockUndo>& pblockSpent);
+    void BlockDisconnected(const CBlock& block, const CBlockIndex* pindex, const boost::shared_ptr<const CBlockUndo>& pblockSpent);
+
+public:
+    CChainIndexer(size_t nMaxQueuedBytesIn = MAX_INDEX_QUEUE);
+    ~CChainIndexer();
+
+    //! Start the thread, and catch up with the active chain
+    void Start();
+    //! Write everything still queued and stop the thread
+    void Stop();
+
+    //! Wait until the indexes include every block connected so far
+    bool Sync();
+    //! Like Sync, and also sync the database, so that the chain state may be written after it
+    bool Flush();
+
+    //! Position of a transaction in the block files, including blocks not yet written to the index
+    bool ReadTxIndex(const uint256& txid, CDiskTxPos& pos);
+    //! Block the indexes are at, including updates that aren't written yet
+    uint256 GetBestBlock();
+};
+
+extern CChainIndexer chainindexer;
+
+#endif // SAFE_CHAININDEXER_H
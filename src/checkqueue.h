@@ -1,4 +1,5 @@
 // Copyright (c) 2012-2015 The Bitcoin Core developers
+// Copyright (c) 2018 The Safe Core developers
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
@@ -6,17 +7,23 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
 #include <vector>
 
 #include <boost/foreach.hpp>
+#include <boost/scoped_array.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
 
+//! Default number of work deques of a CCheckQueue; further workers share them
+static const unsigned int DEFAULT_CHECKQUEUE_DEQUES = 64;
+
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/**
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
   * operator(), returning a bool.
@@ -25,135 +32,206 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every worker owns a deque, and the master owns deque 0. The master deals
+  * added checks over the deques; each worker takes from the back of its own
+  * deque and, once that is empty, steals from the front of the others. There
+  * is no lock shared by all workers: a deque's mutex is only taken by its
+  * owner and by thieves, and the counters are atomics. The idle mutex is only
+  * used to put workers to sleep and wake them up.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
-    boost::mutex mutex;
-
-    //! Worker threads block on this when out of work
-    boost::condition_variable condWorker;
-
-    //! Master thread blocks on this when out of work
-    boost::condition_variable condMaster;
+    struct WorkDeque
+    {
+        boost::mutex mutex;
+        std::deque<T> checks;
+    };
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! The work deques; deque 0 belongs to the master
+    boost::scoped_array<WorkDeque> deques;
+    const unsigned int nDeques;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! Number of worker threads running, not counting the master
+    std::atomic<unsigned int> nWorkers;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! Number of deques checks have been dealt over; a worker that left may have left checks in its deque
+    std::atomic<unsigned int> nDealtDeques;
 
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! Checks added but not taken out of a deque yet
+    std::atomic<int64_t> nQueued;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<int64_t> nTodo;
+
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    //! The deque the next added check goes to
+    unsigned int nNextDeque;
+
+    //! Protects sleeping and waking up; no queue state is kept under it
+    boost::mutex mutexIdle;
+
+    //! Worker threads block on this when out of work
+    boost::condition_variable condWorker;
+
+    //! Master thread blocks on this when out of work
+    boost::condition_variable condMaster;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
-    /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    //! Number of deques in use by the master and the current workers
+    unsigned int ActiveDeques() const
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
-        std::vector<T> vChecks;
-        vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
-            }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
-        } while (true);
+        return std::min(nDeques, nWorkers.load() + 1);
+    }
+
+    //! Move up to half the checks of a deque, at most nBatchSize, into vBatch
+    bool Take(unsigned int nDeque, bool fSteal, std::vector<T>& vBatch)
+    {
+        WorkDeque& work = deques[nDeque];
+        boost::unique_lock<boost::mutex> lock(work.mutex);
+        if (work.checks.empty())
+            return false;
+        size_t nNow = std::max<size_t>(1, std::min<size_t>(nBatchSize, work.checks.size() / 2));
+        vBatch.resize(nNow);
+        for (size_t i = 0; i < nNow; i++) {
+            // the owner works LIFO, thieves take the oldest checks
+            T& check = fSteal ? work.checks.front() : work.checks.back();
+            vBatch[i].swap(check);
+            if (fSteal)
+                work.checks.pop_front();
+            else
+                work.checks.pop_back();
+        }
+        nQueued -= nNow;
+        return true;
+    }
+
+    //! Take checks from the own deque, or else from another one
+    bool TakeWork(unsigned int nOwn, unsigned int& nVictim, std::vector<T>& vBatch)
+    {
+        if (Take(nOwn, false, vBatch))
+            return true;
+        unsigned int nDealt = nDealtDeques;
+        for (unsigned int i = 0; i < nDealt && nQueued > 0; i++) {
+            nVictim = (nVictim + 1) % nDealt;
+            if (nVictim != nOwn && Take(nVictim, true, vBatch))
+                return true;
+        }
+        return false;
+    }
+
+    //! Run a batch and account for it
+    void Run(std::vector<T>& vBatch)
+    {
+        // Check whether we need to do work at all
+        bool fOk = fAllOk;
+        BOOST_FOREACH (T& check, vBatch)
+            if (fOk)
+                fOk = check();
+        if (!fOk)
+            fAllOk = false;
+        int64_t nDone = vBatch.size();
+        vBatch.clear();
+        if (nTodo.fetch_sub(nDone) == nDone) {
+            // We processed the last element; inform the master it can exit and return the result
+            boost::unique_lock<boost::mutex> lock(mutexIdle);
+            condMaster.notify_one();
+        }
     }
 
 public:
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn, unsigned int nDequesIn = DEFAULT_CHECKQUEUE_DEQUES) :
+        deques(new WorkDeque[std::max(1U, nDequesIn)]), nDeques(std::max(1U, nDequesIn)),
+        nWorkers(0), nDealtDeques(1), nQueued(0), nTodo(0), fAllOk(true), nNextDeque(0), nBatchSize(nBatchSizeIn) {}
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        unsigned int nWorker = nWorkers++;
+        unsigned int nOwn = nDeques > 1 ? 1 + nWorker % (nDeques - 1) : 0;
+        unsigned int nVictim = nOwn;
+        std::vector<T> vBatch;
+        vBatch.reserve(nBatchSize);
+        try {
+            while (true) {
+                if (TakeWork(nOwn, nVictim, vBatch)) {
+                    Run(vBatch);
+                    continue;
+                }
+                boost::unique_lock<boost::mutex> lock(mutexIdle);
+                if (nQueued > 0)
+                    continue;
+                condWorker.wait(lock); // wait, an interruption point
+            }
+        } catch (...) {
+            // stop dealing checks to the deque of a worker that is gone
+            nWorkers--;
+            throw;
+        }
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        unsigned int nVictim = 0;
+        std::vector<T> vBatch;
+        vBatch.reserve(nBatchSize);
+        while (true) {
+            if (TakeWork(0, nVictim, vBatch)) {
+                Run(vBatch);
+                continue;
+            }
+            boost::unique_lock<boost::mutex> lock(mutexIdle);
+            if (nTodo == 0)
+                break;
+            // the workers are still running their last batches
+            if (nQueued == 0)
+                condMaster.wait(lock);
+        }
+        // reset the status for new work later
+        bool fRet = fAllOk;
+        fAllOk = true;
+        nNextDeque = 0;
+        return fRet;
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty())
+            return;
         nTodo += vChecks.size();
+        nQueued += vChecks.size();
+        // Deal the checks over the deques in runs of up to nBatchSize, so that
+        // every worker starts on its own deque and only steals near the end
+        unsigned int nActive = ActiveDeques();
+        if (nActive > nDealtDeques)
+            nDealtDeques = nActive;
+        size_t nRun = std::max<size_t>(1, std::min<size_t>(nBatchSize, vChecks.size() / nActive));
+        for (size_t i = 0; i < vChecks.size(); i += nRun) {
+            WorkDeque& work = deques[nNextDeque % nActive];
+            nNextDeque = (nNextDeque + 1) % nActive;
+            boost::unique_lock<boost::mutex> lock(work.mutex);
+            for (size_t j = i; j < std::min(vChecks.size(), i + nRun); j++) {
+                work.checks.push_back(T());
+                vChecks[j].swap(work.checks.back());
+            }
+        }
+        boost::unique_lock<boost::mutex> lock(mutexIdle);
         if (vChecks.size() == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else
             condWorker.notify_all();
     }
 
@@ -163,13 +241,17 @@ public:
 
     bool IsIdle()
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return nTodo == 0 && nQueued == 0 && fAllOk;
+    }
+
+    unsigned int GetWorkers() const
+    {
+        return nWorkers;
     }
 
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
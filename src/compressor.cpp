@@ -183,3 +183,55 @@ uint64_t CTxOutCompressor::DecompressAmount(uint64_t x)
     }
     return n;
 }
+
+/**
+ * App ids common enough to be left out of the reserve encoding: the SAFE
+ * asset app (g_strSafeAssetId) and the SAFE pay app (g_strSafePayId).
+ * The position in this list is stored on disk, so it may only be appended to.
+ */
+static const uint256 specialAppIds[] = {
+    uint256S("cfe2450bf016e2ad8130e4996960a32e0686c1704b62a6ad02e49ee805a9b288"),
+    uint256S("a4bea6705cd38d535e873da1c9ad897048b6bbc8e286ca9b28bd18bb22eedcc9"),
+};
+
+unsigned int CReserveCompressor::GetSpecialAppIds()
+{
+    return sizeof(specialAppIds) / sizeof(specialAppIds[0]);
+}
+
+const uint256& CReserveCompressor::GetSpecialAppId(unsigned int nIndex)
+{
+    assert(nIndex < GetSpecialAppIds());
+    return specialAppIds[nIndex];
+}
+
+unsigned int CReserveCompressor::GetReserveType() const
+{
+    const std::vector<unsigned char>& vReserve = txout.vReserve;
+    if (vReserve.size() < TXOUT_RESERVE_MIN_SIZE || memcmp(&vReserve[0], "safe", TXOUT_RESERVE_MIN_SIZE) != 0)
+        return RESERVE_RAW;
+    if (vReserve.size() == TXOUT_RESERVE_MIN_SIZE)
+        return RESERVE_SAFE;
+    if (vReserve.size() < nAppHeaderSize)
+        return RESERVE_RAW;
+
+    const unsigned char* pAppId = &vReserve[TXOUT_RESERVE_MIN_SIZE + sizeof(uint16_t)];
+    for (unsigned int i = 0; i < GetSpecialAppIds(); i++) {
+        if (memcmp(pAppId, specialAppIds[i].begin(), 32) == 0)
+            return RESERVE_SPECIAL_APP + i;
+    }
+    return RESERVE_APP;
+}
+
+void CReserveCompressor::SetAppReserve(uint16_t nAppVersion, const uint256& appId, uint32_t nAppCmd, unsigned int nDataSize)
+{
+    std::vector<unsigned char>& vReserve = txout.vReserve;
+    vReserve.assign(nAppHeaderSize + nDataSize, 0);
+    memcpy(&vReserve[0], "safe", TXOUT_RESERVE_MIN_SIZE);
+    unsigned int nOffset = TXOUT_RESERVE_MIN_SIZE;
+    WriteLE16(&vReserve[nOffset], nAppVersion);
+    nOffset += sizeof(uint16_t);
+    memcpy(&vReserve[nOffset], appId.begin(), 32);
+    nOffset += 32;
+    WriteLE32(&vReserve[nOffset], nAppCmd);
+}
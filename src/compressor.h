@@ -6,6 +6,7 @@
 #ifndef BITCOIN_COMPRESSOR_H
 #define BITCOIN_COMPRESSOR_H
 
+#include "crypto/common.h"
 #include "primitives/transaction.h"
 #include "script/script.h"
 #include "serialize.h"
@@ -91,6 +92,137 @@ public:
     }
 };
 
+/**
+ * Serialization version flag selecting the CTxOutCompressor encoding used
+ * before the output extension was compacted, with nUnlockedHeight as a plain
+ * int64 and vReserve as a raw byte vector. Set when reading per-transaction
+ * chainstate records and the undo data of blocks without BLOCK_UNDO_COMPACT.
+ */
+static const int SERIALIZE_TXOUT_LEGACY = 0x20000000;
+
+/** Compact serializer for the output extension (nUnlockedHeight and vReserve).
+ *
+ *  Both are described by a single VARINT code. Its lowest 2 bits encode
+ *  the lock height:
+ *  * 0: not locked
+ *  * 1: VARINT(nUnlockedHeight) follows
+ *  * 2: VARINT(~nUnlockedHeight) follows, for negative heights
+ *
+ *  The higher bits encode the reserve:
+ *  * 0: the plain "safe" marker, nothing follows
+ *  * 1: any other reserve, the raw byte vector follows
+ *  * 2: "safe" and an app header: VARINT(version), the 32 byte app id,
+ *       VARINT(command), then the app data as a byte vector
+ *  * 3 and up: the same, for one of the well-known app ids, which is left out
+ *
+ *  A plain SAFE output thus takes 1 byte instead of 13, and an asset output
+ *  5 bytes plus its data instead of 51.
+ */
+class CReserveCompressor
+{
+private:
+    enum ReserveType {
+        RESERVE_SAFE = 0,
+        RESERVE_RAW = 1,
+        RESERVE_APP = 2,
+        RESERVE_SPECIAL_APP = 3,
+    };
+
+    //! "safe", version (2 bytes), app id (32 bytes), app command (4 bytes)
+    static const unsigned int nAppHeaderSize = TXOUT_RESERVE_MIN_SIZE + sizeof(uint16_t) + 32 + sizeof(uint32_t);
+
+    CTxOut &txout;
+protected:
+    unsigned int GetReserveType() const;
+    static unsigned int GetSpecialAppIds();
+    static const uint256& GetSpecialAppId(unsigned int nIndex);
+    void SetAppReserve(uint16_t nAppVersion, const uint256& appId, uint32_t nAppCmd, unsigned int nDataSize);
+public:
+    CReserveCompressor(CTxOut &txoutIn) : txout(txoutIn) { }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        CSizeComputer s(nType, nVersion);
+        Serialize(s, nType, nVersion);
+        return s.size();
+    }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        uint64_t nLock = 0;
+        unsigned int nLockCode = 0;
+        if (txout.nUnlockedHeight > 0) {
+            nLock = txout.nUnlockedHeight;
+            nLockCode = 1;
+        } else if (txout.nUnlockedHeight < 0) {
+            nLock = ~txout.nUnlockedHeight;
+            nLockCode = 2;
+        }
+        unsigned int nReserveType = GetReserveType();
+        unsigned int nCode = nReserveType * 4 + nLockCode;
+        s << VARINT(nCode);
+        if (nLockCode != 0)
+            s << VARINT(nLock);
+        if (nReserveType == RESERVE_RAW) {
+            s << txout.vReserve;
+        } else if (nReserveType >= RESERVE_APP) {
+            const std::vector<unsigned char>& vReserve = txout.vReserve;
+            unsigned int nOffset = TXOUT_RESERVE_MIN_SIZE;
+            uint16_t nAppVersion = ReadLE16(&vReserve[nOffset]);
+            s << VARINT(nAppVersion);
+            nOffset += sizeof(uint16_t);
+            if (nReserveType == RESERVE_APP)
+                s.write((const char*)&vReserve[nOffset], 32);
+            nOffset += 32;
+            uint32_t nAppCmd = ReadLE32(&vReserve[nOffset]);
+            s << VARINT(nAppCmd);
+            nOffset += sizeof(uint32_t);
+            WriteCompactSize(s, vReserve.size() - nOffset);
+            if (vReserve.size() > nOffset)
+                s.write((const char*)&vReserve[nOffset], vReserve.size() - nOffset);
+        }
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        unsigned int nCode = 0;
+        s >> VARINT(nCode);
+        unsigned int nLockCode = nCode & 3;
+        unsigned int nReserveType = nCode >> 2;
+        txout.nUnlockedHeight = 0;
+        if (nLockCode != 0) {
+            uint64_t nLock = 0;
+            s >> VARINT(nLock);
+            if (nLockCode == 1)
+                txout.nUnlockedHeight = nLock;
+            else if (nLockCode == 2)
+                txout.nUnlockedHeight = ~(int64_t)nLock;
+            else
+                throw std::ios_base::failure("Unknown lock height encoding");
+        }
+        if (nReserveType == RESERVE_SAFE) {
+            txout.vReserve.assign((const unsigned char*)"safe", (const unsigned char*)"safe" + TXOUT_RESERVE_MIN_SIZE);
+        } else if (nReserveType == RESERVE_RAW) {
+            s >> txout.vReserve;
+        } else {
+            if (nReserveType >= RESERVE_SPECIAL_APP + GetSpecialAppIds())
+                throw std::ios_base::failure("Unknown reserve encoding");
+            uint16_t nAppVersion = 0;
+            s >> VARINT(nAppVersion);
+            uint256 appId;
+            if (nReserveType == RESERVE_APP)
+                s >> FLATDATA(appId);
+            else
+                appId = GetSpecialAppId(nReserveType - RESERVE_SPECIAL_APP);
+            uint32_t nAppCmd = 0;
+            s >> VARINT(nAppCmd);
+            unsigned int nDataSize = ReadCompactSize(s);
+            SetAppReserve(nAppVersion, appId, nAppCmd, nDataSize);
+            if (nDataSize > 0)
+                s.read((char*)&txout.vReserve[nAppHeaderSize], nDataSize);
+        }
+    }
+};
+
 /** wrapper for CTxOut that provides a more compact serialization */
 class CTxOutCompressor
 {
@@ -117,8 +249,13 @@ public:
         }
         CScriptCompressor cscript(REF(txout.scriptPubKey));
         READWRITE(cscript);
-        READWRITE(txout.nUnlockedHeight);
-        READWRITE(txout.vReserve);
+        if (nVersion & SERIALIZE_TXOUT_LEGACY) {
+            READWRITE(txout.nUnlockedHeight);
+            READWRITE(txout.vReserve);
+        } else {
+            CReserveCompressor creserve(REF(txout));
+            READWRITE(creserve);
+        }
     }
 };
 
@@ -22,7 +22,7 @@ static inline size_t RecursiveDynamicUsage(const CTxIn& in) {
 }
 
 static inline size_t RecursiveDynamicUsage(const CTxOut& out) {
-    return RecursiveDynamicUsage(out.scriptPubKey);
+    return RecursiveDynamicUsage(out.scriptPubKey) + memusage::DynamicUsage(out.vReserve);
 }
 
 static inline size_t RecursiveDynamicUsage(const CTransaction& tx) {
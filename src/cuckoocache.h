@@ -0,0 +1,256 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SAFE_CUCKOOCACHE_H
+#define SAFE_CUCKOOCACHE_H
+
+#include "uint256.h"
+
+#include <algorithm>
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+#include <boost/scoped_array.hpp>
+
+/** Slots per bucket; an entry can live in any slot of its two buckets */
+static const unsigned int CUCKOOCACHE_BUCKET_SLOTS = 4;
+
+/** Counters of a CCuckooCache, read with relaxed ordering */
+struct CCuckooCacheStats
+{
+    uint64_t nBytes;
+    uint64_t nSlots;
+    uint64_t nEntries;
+    uint32_t nGeneration;
+    uint64_t nLookups;
+    uint64_t nHits;
+    uint64_t nInserts;
+    uint64_t nEvictions;
+
+    CCuckooCacheStats() : nBytes(0), nSlots(0), nEntries(0), nGeneration(0), nLookups(0), nHits(0), nInserts(0), nEvictions(0) {}
+};
+
+/**
+ * Fixed size set of uint256 entries that can be read and written by any number
+ * of threads without a lock. The entries must already be uniformly distributed
+ * (e.g. salted hashes), their words are used directly to pick the buckets.
+ *
+ * Every entry hashes to two buckets of CUCKOOCACHE_BUCKET_SLOTS slots. A slot is
+ * guarded by a sequence number: a writer claims it by making the number odd
+ * with a compare-and-swap. Readers don't retry: a slot that is being written,
+ * or that changed while it was read, is taken as not matching. A miss only
+ * costs a signature check, so contention never makes anyone wait.
+ *
+ * Instead of moving entries around on insert, every slot carries the generation
+ * it was written in. The generation goes up every time a quarter of the slots
+ * has been written, and an insert takes the slot of the oldest generation among
+ * the candidates, so empty slots (generation 0) go first and old entries are
+ * evicted before recent ones. Memory use is fixed at Setup().
+ */
+class CCuckooCache
+{
+private:
+    struct Slot
+    {
+        //! Odd while a writer owns the slot
+        std::atomic<uint32_t> nSequence;
+        //! Generation the entry was written in, 0 for an empty slot
+        std::atomic<uint32_t> nGeneration;
+        std::atomic<uint64_t> vWord[4];
+
+        Slot() : nSequence(0), nGeneration(0)
+        {
+            for (int i = 0; i < 4; i++)
+                vWord[i].store(0, std::memory_order_relaxed);
+        }
+    };
+
+    boost::scoped_array<Slot> slots;
+    uint32_t nBuckets;
+
+    std::atomic<uint32_t> nGeneration;
+    //! Inserts left until the generation goes up
+    std::atomic<int64_t> nGenerationLeft;
+
+    std::atomic<uint64_t> nLookups;
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nInserts;
+    std::atomic<uint64_t> nEvictions;
+
+    static void Split(const uint256& entry, uint64_t vWord[4])
+    {
+        memcpy(vWord, entry.begin(), 32);
+    }
+
+    //! Map 32 bits of the entry onto [0, nBuckets) without a division
+    uint32_t Bucket(uint64_t nWord) const
+    {
+        return (uint32_t)(((nWord & 0xffffffff) * (uint64_t)nBuckets) >> 32);
+    }
+
+    void Candidates(const uint64_t vWord[4], uint32_t vBucket[2]) const
+    {
+        vBucket[0] = Bucket(vWord[0]);
+        vBucket[1] = Bucket(vWord[1]);
+        if (vBucket[1] == vBucket[0] && nBuckets > 1)
+            vBucket[1] = (vBucket[0] + 1) % nBuckets;
+    }
+
+    /**
+     * Read a slot. Returns false when a writer owned it or replaced it while it
+     * was read; otherwise nGenerationOut is the slot's generation and fMatch tells
+     * whether it holds the entry.
+     */
+    static bool Read(const Slot& slot, const uint64_t vWord[4], uint32_t& nSequenceOut, uint32_t& nGenerationOut, bool& fMatch)
+    {
+        uint32_t nSequence = slot.nSequence.load(std::memory_order_acquire);
+        if (nSequence & 1)
+            return false;
+        nGenerationOut = slot.nGeneration.load(std::memory_order_relaxed);
+        fMatch = nGenerationOut != 0;
+        for (int i = 0; i < 4; i++)
+            if (slot.vWord[i].load(std::memory_order_relaxed) != vWord[i])
+                fMatch = false;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.nSequence.load(std::memory_order_relaxed) != nSequence)
+            return false;
+        nSequenceOut = nSequence;
+        return true;
+    }
+
+    //! Overwrite a slot if it still has sequence number nSequence
+    static bool Write(Slot& slot, uint32_t nSequence, const uint64_t vWord[4], uint32_t nGenerationIn)
+    {
+        if (!slot.nSequence.compare_exchange_strong(nSequence, nSequence + 1, std::memory_order_acquire))
+            return false;
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.nGeneration.store(nGenerationIn, std::memory_order_relaxed);
+        for (int i = 0; i < 4; i++)
+            slot.vWord[i].store(vWord[i], std::memory_order_relaxed);
+        slot.nSequence.store(nSequence + 2, std::memory_order_release);
+        return true;
+    }
+
+    uint64_t Slots() const
+    {
+        return (uint64_t)nBuckets * CUCKOOCACHE_BUCKET_SLOTS;
+    }
+
+public:
+    CCuckooCache() : nBuckets(0), nGeneration(1), nGenerationLeft(0), nLookups(0), nHits(0), nInserts(0), nEvictions(0) {}
+
+    /**
+     * Allocate as many slots as fit in nBytes and clear the cache. Not thread
+     * safe: must be called before the cache is shared.
+     */
+    void Setup(size_t nBytes)
+    {
+        nBuckets = (uint32_t)std::min<uint64_t>(nBytes / (sizeof(Slot) * CUCKOOCACHE_BUCKET_SLOTS), 0xffffffff);
+        slots.reset(nBuckets ? new Slot[Slots()] : NULL);
+        nGeneration = 1;
+        nGenerationLeft = Slots() / 4 + 1;
+        nLookups = nHits = nInserts = nEvictions = 0;
+    }
+
+    //! Memory taken by the slots
+    size_t DynamicMemoryUsage() const
+    {
+        return Slots() * sizeof(Slot);
+    }
+
+    //! Whether the entry is in the cache. With fErase it is also removed.
+    bool Contains(const uint256& entry, bool fErase)
+    {
+        if (nBuckets == 0)
+            return false;
+        nLookups.fetch_add(1, std::memory_order_relaxed);
+        uint64_t vWord[4];
+        Split(entry, vWord);
+        uint32_t vBucket[2];
+        Candidates(vWord, vBucket);
+        for (int b = 0; b < 2; b++) {
+            for (unsigned int i = 0; i < CUCKOOCACHE_BUCKET_SLOTS; i++) {
+                Slot& slot = slots[(uint64_t)vBucket[b] * CUCKOOCACHE_BUCKET_SLOTS + i];
+                uint32_t nSequence, nGen;
+                bool fMatch;
+                if (!Read(slot, vWord, nSequence, nGen, fMatch) || !fMatch)
+                    continue;
+                nHits.fetch_add(1, std::memory_order_relaxed);
+                if (fErase) {
+                    // losing the race only means the entry stays until it is evicted
+                    static const uint64_t vEmpty[4] = {0, 0, 0, 0};
+                    Write(slot, nSequence, vEmpty, 0);
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //! Add an entry, evicting the oldest one of its buckets if they are full
+    void Insert(const uint256& entry)
+    {
+        if (nBuckets == 0)
+            return;
+        uint64_t vWord[4];
+        Split(entry, vWord);
+        uint32_t vBucket[2];
+        Candidates(vWord, vBucket);
+        uint32_t nGen = nGeneration.load(std::memory_order_relaxed);
+
+        // a slot can be claimed by another writer between the scan and the write,
+        // so look again a few times before giving up on this entry
+        for (int nTry = 0; nTry < 4; nTry++) {
+            Slot* pslotBest = NULL;
+            uint32_t nSequenceBest = 0, nGenBest = 0;
+            for (int b = 0; b < 2; b++) {
+                for (unsigned int i = 0; i < CUCKOOCACHE_BUCKET_SLOTS; i++) {
+                    Slot& slot = slots[(uint64_t)vBucket[b] * CUCKOOCACHE_BUCKET_SLOTS + i];
+                    uint32_t nSequence, nGenSlot;
+                    bool fMatch;
+                    if (!Read(slot, vWord, nSequence, nGenSlot, fMatch))
+                        continue;
+                    if (fMatch)
+                        return;
+                    if (pslotBest == NULL || nGenSlot < nGenBest) {
+                        pslotBest = &slot;
+                        nSequenceBest = nSequence;
+                        nGenBest = nGenSlot;
+                    }
+                }
+            }
+            if (pslotBest == NULL)
+                continue;
+            if (!Write(*pslotBest, nSequenceBest, vWord, nGen))
+                continue;
+            nInserts.fetch_add(1, std::memory_order_relaxed);
+            if (nGenBest != 0)
+                nEvictions.fetch_add(1, std::memory_order_relaxed);
+            if (nGenerationLeft.fetch_sub(1, std::memory_order_relaxed) == 1) {
+                nGenerationLeft.store(Slots() / 4 + 1, std::memory_order_relaxed);
+                nGeneration.fetch_add(1, std::memory_order_relaxed);
+            }
+            return;
+        }
+    }
+
+    //! Fill in the counters. nEntries takes a walk over all slots.
+    void GetStats(CCuckooCacheStats& stats) const
+    {
+        stats.nBytes = DynamicMemoryUsage();
+        stats.nSlots = Slots();
+        stats.nEntries = 0;
+        for (uint64_t i = 0; i < stats.nSlots; i++)
+            if (slots[i].nGeneration.load(std::memory_order_relaxed) != 0)
+                stats.nEntries++;
+        stats.nGeneration = nGeneration.load(std::memory_order_relaxed);
+        stats.nLookups = nLookups.load(std::memory_order_relaxed);
+        stats.nHits = nHits.load(std::memory_order_relaxed);
+        stats.nInserts = nInserts.load(std::memory_order_relaxed);
+        stats.nEvictions = nEvictions.load(std::memory_order_relaxed);
+    }
+};
+
+#endif // SAFE_CUCKOOCACHE_H
@@ -112,6 +112,8 @@ public:
     uint256 GetID() const { return id; }
 
     uint256 GetSeedHash();
+    /* derive the key at m/purpose'/coin_type'/account'/change, the parent of all keys of that chain */
+    void DeriveChangeExtKey(uint32_t nAccountIndex, bool fInternal, CExtKey& extKeyRet);
     void DeriveChildExtKey(uint32_t nAccountIndex, bool fInternal, uint32_t nChildIndex, CExtKey& extKeyRet);
 
     void AddAccount();
@@ -14,6 +14,7 @@
 #include "addrman.h"
 #include "amount.h"
 #include "chain.h"
+#include "chainindexer.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
@@ -32,6 +33,7 @@
 #include "script/standard.h"
 #include "script/sigcache.h"
 #include "scheduler.h"
+#include "snapshot.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "torcontrol.h"
@@ -47,6 +49,7 @@
 #endif
 
 #include "activemasternode.h"
+#include "app/candywatch.h"
 #include "dsnotificationinterface.h"
 #include "flat-database.h"
 #include "governance.h"
@@ -177,9 +180,9 @@ class CCoinsViewErrorCatcher : public CCoinsViewBacked
 {
 public:
     CCoinsViewErrorCatcher(CCoinsView* view) : CCoinsViewBacked(view) {}
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
         try {
-            return CCoinsViewBacked::GetCoins(txid, coins);
+            return CCoinsViewBacked::GetCoin(outpoint, coin);
         } catch(const std::runtime_error& e) {
             uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
             LogPrintf("Error reading from database: %s\n", e.what());
@@ -193,7 +196,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
@@ -249,6 +251,8 @@ void PrepareShutdown()
     flatdb3.Dump(governance);
     CFlatDB<CNetFulfilledRequestManager> flatdb4("netfulfilled.dat", "magicFulfilledCache");
     flatdb4.Dump(netfulfilledman);
+    CFlatDB<CCandyWatchSet> flatdb5("candywatch.dat", "magicCandyWatchCache");
+    flatdb5.Dump(candyWatchSet);
 
     UnregisterNodeSignals(GetNodeSignals());
 
@@ -274,9 +278,11 @@ void PrepareShutdown()
         pcoinscatcher = NULL;
         delete pcoinsdbview;
         pcoinsdbview = NULL;
+        chainindexer.Stop();
         delete pblocktree;
         pblocktree = NULL;
     }
+    blockwriter.Stop();
 #ifdef ENABLE_WALLET
     if (pwalletMain)
         pwalletMain->Flush(true);
@@ -406,9 +412,11 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-daemon", _("Run in the background as a daemon and accept commands"));
 #endif
     }
+    strUsage += HelpMessageOpt("-blockcachesize=<n>", strprintf(_("Keep up to <n> megabytes of recently used blocks in memory (default: %u)"), DEFAULT_BLOCK_CACHE_SIZE));
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
+    strUsage += HelpMessageOpt("-loadsnapshot=<file>", _("Start an empty data directory from a snapshot written by dumpsnapshot; requires -prune, -snapshothash and -txindex=0, and cannot run a masternode"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
@@ -422,6 +430,7 @@ std::string HelpMessage(HelpMessageMode mode)
             "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
     strUsage += HelpMessageOpt("-reindex-chainstate", _("Rebuild chain state from the currently indexed blocks"));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild chain state and block index from the blk*.dat files on disk"));
+    strUsage += HelpMessageOpt("-snapshothash=<hex>", _("Checksum of the -loadsnapshot file, as reported by dumpsnapshot; the file is refused if it differs"));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
@@ -482,6 +491,15 @@ std::string HelpMessage(HelpMessageMode mode)
         CURRENCY_UNIT, FormatMoney(DEFAULT_LEGACY_FALLBACK_FEE)));
     strUsage += HelpMessageOpt("-mintxfee=<amt>", strprintf(_("Fees (in %s/KB) smaller than this are considered zero fee for transaction creation (default: %s)"),
             CURRENCY_UNIT, FormatMoney(DEFAULT_LEGACY_TRANSACTION_MINFEE)));
+    strUsage += HelpMessageOpt("-consolidate", strprintf(_("Merge small outputs of each address into one output in the background while fees are low (default: %u)"), DEFAULT_CONSOLIDATE));
+    strUsage += HelpMessageOpt("-consolidateinterval=<n>", strprintf(_("Seconds between consolidation rounds (default: %u)"), DEFAULT_CONSOLIDATE_INTERVAL));
+    strUsage += HelpMessageOpt("-consolidatemaxfeerate=<amt>", strprintf(_("Only consolidate while the estimated fee rate (in %s/kB) is at most this (default: %s)"),
+        CURRENCY_UNIT, FormatMoney(DEFAULT_CONSOLIDATE_MAX_FEERATE)));
+    strUsage += HelpMessageOpt("-consolidatemaxtxs=<n>", strprintf(_("Make at most <n> consolidation transactions per round (default: %u)"), DEFAULT_CONSOLIDATE_MAX_TXS));
+    strUsage += HelpMessageOpt("-consolidateminoutputs=<n>", strprintf(_("Consolidate an address once it has at least <n> small outputs (default: %u)"), DEFAULT_CONSOLIDATE_MIN_OUTPUTS));
+    strUsage += HelpMessageOpt("-consolidatethreshold=<amt>", strprintf(_("SAFE outputs below this amount (in %s), and asset outputs below as many units of the asset, count as small (default: %s)"),
+        CURRENCY_UNIT, FormatMoney(DEFAULT_CONSOLIDATE_THRESHOLD)));
+    strUsage += HelpMessageOpt("-bnbcoinselection", strprintf(_("Search for coin selections that need no change output and no more inputs (default: %u)"), DEFAULT_SELECT_COINS_BNB));
     strUsage += HelpMessageOpt("-paytxfee=<amt>", strprintf(_("Fee (in %s/KB) to add to transactions you send (default: %s)"),
         CURRENCY_UNIT, FormatMoney(payTxFee.GetFeePerK())));
     strUsage += HelpMessageOpt("-rescan", _("Rescan the block chain for missing wallet transactions on startup"));
@@ -497,6 +515,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-hdseed", _("User defined seed for HD wallet (should be in hex). Only has effect during wallet creation/first start (default: randomly generated)"));
     strUsage += HelpMessageOpt("-upgradewallet", _("Upgrade wallet to latest format on startup"));
     strUsage += HelpMessageOpt("-wallet=<file>", _("Specify wallet file (within data directory)") + " " + strprintf(_("(default: %s)"), "wallet.dat"));
+    strUsage += HelpMessageOpt("-walletloadthreads=<n>", strprintf(_("Number of threads decoding wallet transactions on startup, 1 decodes them while reading the database (default: %d, 0 = one per core)"), DEFAULT_WALLET_LOAD_THREADS));
     strUsage += HelpMessageOpt("-walletbroadcast", _("Make the wallet broadcast transactions") + " " + strprintf(_("(default: %u)"), DEFAULT_WALLETBROADCAST));
     strUsage += HelpMessageOpt("-walletnotify=<cmd>", _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)"));
     strUsage += HelpMessageOpt("-zapwallettxes=<mode>", _("Delete all wallet transactions and only recover those parts of the blockchain through -rescan on startup") +
@@ -567,7 +586,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-mocktime=<n>", "Replace actual time with <n> seconds since epoch (default: 0)");
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", DEFAULT_LIMITFREERELAY));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", DEFAULT_RELAYPRIORITY));
-        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB, 0 to disable it (default: %u, maximum: %u)", DEFAULT_MAX_SIG_CACHE_SIZE, MAX_MAX_SIG_CACHE_SIZE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/KB) smaller than this are considered zero fee for relaying, mining and transaction creation (default: %s)"),
         CURRENCY_UNIT, FormatMoney(DEFAULT_LEGACY_MIN_RELAY_TX_FEE)));
@@ -1019,6 +1038,22 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler, bool have
 #endif
     }
 
+    // a node loaded from a snapshot has no blocks below it
+    if (mapArgs.count("-loadsnapshot")) {
+        if (!GetArg("-prune", 0))
+            return InitError(_("-loadsnapshot requires -prune."));
+        if (GetBoolArg("-reindex", false) || GetBoolArg("-reindex-chainstate", false))
+            return InitError(_("-loadsnapshot cannot be combined with -reindex or -reindex-chainstate."));
+        // nothing else in the file is authenticated: its headers are not checked against any work
+        if (!mapArgs.count("-snapshothash"))
+            return InitError(_("-loadsnapshot requires -snapshothash, the checksum dumpsnapshot reported for the file."));
+        if (!IsHex(GetArg("-snapshothash", "")) || GetArg("-snapshothash", "").size() != 64 || uint256S(GetArg("-snapshothash", "")).IsNull())
+            return InitError(strprintf(_("Invalid -snapshothash: '%s'"), GetArg("-snapshothash", "")));
+        // masternodes need -txindex, which cannot be built without the blocks below the snapshot
+        if (GetBoolArg("-masternode", false))
+            return InitError(_("-loadsnapshot cannot be used with -masternode: a masternode needs -txindex, and a node loaded from a snapshot has no blocks to build it from."));
+    }
+
     // Make sure enough file descriptors are available
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     int nUserMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
@@ -1180,6 +1215,19 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler, bool have
     nTxConfirmTarget = GetArg("-txconfirmtarget", DEFAULT_TX_CONFIRM_TARGET);
     bSpendZeroConfChange = GetBoolArg("-spendzeroconfchange", DEFAULT_SPEND_ZEROCONF_CHANGE);
     fSendFreeTransactions = GetBoolArg("-sendfreetransactions", DEFAULT_SEND_FREE_TRANSACTIONS);
+    fSelectCoinsBnB = GetBoolArg("-bnbcoinselection", DEFAULT_SELECT_COINS_BNB);
+    CAmount nConsolidateThreshold = DEFAULT_CONSOLIDATE_THRESHOLD;
+    if (mapArgs.count("-consolidatethreshold"))
+    {
+        if (!ParseMoney(mapArgs["-consolidatethreshold"], nConsolidateThreshold) || nConsolidateThreshold <= 0)
+            return InitError(strprintf(_("Invalid amount for -consolidatethreshold=<amount>: '%s'"), mapArgs["-consolidatethreshold"]));
+    }
+    CAmount nConsolidateMaxFeeRate = DEFAULT_CONSOLIDATE_MAX_FEERATE;
+    if (mapArgs.count("-consolidatemaxfeerate"))
+    {
+        if (!ParseMoney(mapArgs["-consolidatemaxfeerate"], nConsolidateMaxFeeRate))
+            return InitError(strprintf(_("Invalid amount for -consolidatemaxfeerate=<amount>: '%s'"), mapArgs["-consolidatemaxfeerate"]));
+    }
 
     std::string strWalletFile = GetArg("-wallet", "wallet.dat");
 #endif // ENABLE_WALLET
@@ -1217,6 +1265,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler, bool have
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
 
+    // Allocate the signature cache before any script is checked
+    InitSignatureCache();
+
     // Sanity check
     if (!InitSanityCheck())
         return InitError(_("Initialization sanity check failed. Safe Core is shutting down."));
@@ -1268,6 +1319,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler, bool have
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadAppCheck);
+        // Header batches and orphan lock votes take milliseconds to check, a few workers are enough
+        int nAuxCheckThreads = std::min(nScriptCheckThreads - 1, MAX_AUX_CHECK_THREADS);
+        for (int i=0; i<nAuxCheckThreads; i++)
+            threadGroup.create_thread(&ThreadHeaderHashCheck);
+        for (int i=0; i<nAuxCheckThreads; i++)
+            threadGroup.create_thread(&ThreadTxLockVoteCheck);
     }
 
     if (mapArgs.count("-sporkkey")) // spork priv key
@@ -1523,10 +1582,17 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler, bool have
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
+    int64_t nBlockCacheUsage = std::max(GetArg("-blockcachesize", DEFAULT_BLOCK_CACHE_SIZE), (int64_t)0) << 20;
+    blockcache.SetMaxUsage(nBlockCacheUsage);
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for recently used blocks\n", nBlockCacheUsage * (1.0 / 1024 / 1024));
+
+    blockwriter.Start();
+    // blocks connected while loading (e.g. by -checkblocks) are indexed inline
+    RegisterValidationInterface(&chainindexer);
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -1557,11 +1623,30 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler, bool have
                     boost::filesystem::remove_all(GetDataDir() / "height");
                 }
 
+                if (mapArgs.count("-loadsnapshot")) {
+                    uiInterface.InitMessage(_("Loading snapshot..."));
+                    CSnapshotStats stats;
+                    std::string strError;
+                    if (!LoadSnapshot(GetArg("-loadsnapshot", ""), uint256S(GetArg("-snapshothash", "")), stats, strError))
+                        return InitError(strError);
+                }
+
                 if (!LoadBlockIndex()) {
                     strLoadError = _("Error loading block database");
                     break;
                 }
 
+                if (!pblocktree->UpgradeAddressKeys()) {
+                    strLoadError = _("Error upgrading block database");
+                    break;
+                }
+
+                // The on-disk coinsdb used to store one record per transaction
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
+
                 // If the loaded chain has a wrong genesis, bail out immediately
                 // (we're likely using a testnet datadir, or the other way around).
                 if (!mapBlockIndex.empty() && mapBlockIndex.count(chainparams.GetConsensus().hashGenesisBlock) == 0)
@@ -1637,6 +1722,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler, bool have
         }
     }
 
+    chainindexer.Start();
+
     if(!VerifyDetailFile())
         return error("Verify detail.dat failed. Exiting");
     if(!LoadChangeInfoToList())
@@ -1999,6 +2086,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler, bool have
         return InitError(_("Failed to load fulfilled requests cache from") + "\n" + (pathDB / strDBName).string());
     }
 
+    strDBName = "candywatch.dat";
+    uiInterface.InitMessage(_("Loading candy watch addresses..."));
+    CFlatDB<CCandyWatchSet> flatdb5(strDBName, "magicCandyWatchCache");
+    if(!flatdb5.Load(candyWatchSet)) {
+        return InitError(_("Failed to load candy watch addresses from") + "\n" + (pathDB / strDBName).string());
+    }
+
     // ********************************************************* Step 11c: update block tip in Safe modules
 
     // force UpdatedBlockTip to initialize nCachedBlockHeight for DS, MN payments and budgets
@@ -2089,6 +2183,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler, bool have
 
         // Run a thread to get available candy list
         threadGroup.create_thread(boost::bind(&ThreadGetAllCandyInfo));
+
+        // Run a thread to merge small outputs while fees are low
+        if (GetBoolArg("-consolidate", DEFAULT_CONSOLIDATE))
+            threadGroup.create_thread(boost::bind(&ThreadConsolidateWallet, pwalletMain, nConsolidateThreshold, nConsolidateMaxFeeRate));
     }
 #endif
 
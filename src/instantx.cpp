@@ -4,6 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "activemasternode.h"
+#include "checkqueue.h"
 #include "instantx.h"
 #include "key.h"
 #include "validation.h"
@@ -417,8 +418,35 @@ bool CInstantSend::ProcessTxLockVote(CNode* pfrom, CTxLockVote& vote, CConnman&
     return true;
 }
 
+static CCheckQueue<CTxLockVoteCheck> votecheckqueue(32);
+//! Only one caller at a time may add checks to votecheckqueue
+static CCriticalSection cs_votecheckqueue;
+
+void ThreadTxLockVoteCheck()
+{
+    RenameThread("safe-votecheck");
+    votecheckqueue.Thread();
+}
+
 void CInstantSend::ProcessOrphanTxLockVotes(CConnman& connman)
 {
+    // Verify the signatures not seen yet in parallel, on copies of the votes and
+    // before taking cs_main, so that the check threads don't hold up the node
+    std::vector<std::pair<uint256, CTxLockVote> > vVotes;
+    if(nScriptCheckThreads) {
+        LOCK(cs_instantsend);
+        vVotes.assign(mapTxLockVotesOrphan.begin(), mapTxLockVotesOrphan.end());
+    }
+    if(vVotes.size() > 1) {
+        std::vector<CTxLockVoteCheck> vChecks;
+        for(unsigned int i = 0; i < vVotes.size(); i++)
+            vChecks.push_back(CTxLockVoteCheck(vVotes[i].second));
+        LOCK(cs_votecheckqueue);
+        CCheckQueueControl<CTxLockVoteCheck> control(&votecheckqueue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+
     LOCK(cs_main);
 #ifdef ENABLE_WALLET
     if (pwalletMain)
@@ -426,6 +454,14 @@ void CInstantSend::ProcessOrphanTxLockVotes(CConnman& connman)
 #endif
     LOCK(cs_instantsend);
 
+    // The orphan votes take over the good signatures, so that the serial
+    // validation below does not verify them again
+    for(unsigned int i = 0; i < vVotes.size(); i++) {
+        std::map<uint256, CTxLockVote>::iterator it = mapTxLockVotesOrphan.find(vVotes[i].first);
+        if(it != mapTxLockVotesOrphan.end())
+            it->second.SetSignatureVerified(vVotes[i].second);
+    }
+
     std::map<uint256, CTxLockVote>::iterator it = mapTxLockVotesOrphan.begin();
     while(it != mapTxLockVotesOrphan.end()) {
         if(ProcessTxLockVote(NULL, it->second, connman)) {
@@ -611,8 +647,8 @@ bool CInstantSend::ResolveConflicts(const CTxLockCandidate& txLockCandidate)
     }
     // Not in block yet, make sure all its inputs are still unspent
     BOOST_FOREACH(const CTxIn& txin, txLockCandidate.txLockRequest.vin) {
-        CCoins coins;
-        if(!GetUTXOCoins(txin.prevout, coins)) {
+        Coin coin;
+        if(!GetUTXOCoin(txin.prevout, coin)) {
             // Not in UTXO anymore? A conflicting tx was mined while we were waiting for votes.
             LogPrintf("CInstantSend::ResolveConflicts -- ERROR: Failed to find UTXO %s, can't complete Transaction Lock\n", txin.prevout.ToStringShort());
             return false;
@@ -949,14 +985,14 @@ bool CTxLockRequest::IsValid() const
 
     BOOST_FOREACH(const CTxIn& txin, vin) {
 
-        CCoins coins;
+        Coin coin;
 
-        if(!GetUTXOCoins(txin.prevout, coins)) {
+        if(!GetUTXOCoin(txin.prevout, coin)) {
             LogPrint("instantsend", "CTxLockRequest::IsValid -- Failed to find UTXO %s\n", txin.prevout.ToStringShort());
             return false;
         }
 
-        int nTxAge = chainActive.Height() - coins.nHeight + 1;
+        int nTxAge = chainActive.Height() - coin.nHeight + 1;
         // 1 less than the "send IX" gui requires, in case of a block propagating the network at the time
         int nConfirmationsRequired = INSTANTSEND_CONFIRMATIONS_REQUIRED - 1;
 
@@ -966,7 +1002,7 @@ bool CTxLockRequest::IsValid() const
             return false;
         }
 
-        const CTxOut& in_txout = coins.vout[txin.prevout.n];
+        const CTxOut& in_txout = coin.out;
         if(in_txout.IsSafeOnly() || in_txout.IsApp())
             nValueIn += in_txout.nValue;
     }
@@ -1009,13 +1045,13 @@ bool CTxLockVote::IsValid(CNode* pnode, CConnman& connman) const
         return false;
     }
 
-    CCoins coins;
-    if(!GetUTXOCoins(outpoint, coins)) {
+    Coin coin;
+    if(!GetUTXOCoin(outpoint, coin)) {
         LogPrint("instantsend", "CTxLockVote::IsValid -- Failed to find UTXO %s\n", outpoint.ToStringShort());
         return false;
     }
 
-    int nLockInputHeight = coins.nHeight + 4;
+    int nLockInputHeight = coin.nHeight + 4;
 
     int nRank;
     if(!mnodeman.GetMasternodeRank(outpointMasternode, nRank, nLockInputHeight, MIN_INSTANTSEND_PROTO_VERSION)) {
@@ -1051,6 +1087,9 @@ uint256 CTxLockVote::GetHash() const
 
 bool CTxLockVote::CheckSignature() const
 {
+    if(fSignatureVerified)
+        return true;
+
     std::string strError;
     std::string strMessage = txHash.ToString() + outpoint.ToStringShort();
 
@@ -1066,6 +1105,7 @@ bool CTxLockVote::CheckSignature() const
         return false;
     }
 
+    fSignatureVerified = true;
     return true;
 }
 
@@ -1074,6 +1114,7 @@ bool CTxLockVote::Sign()
     std::string strError;
     std::string strMessage = txHash.ToString() + outpoint.ToStringShort();
 
+    fSignatureVerified = false;
     if(!CMessageSigner::SignMessage(strMessage, vchMasternodeSignature, activeMasternode.keyMasternode)) {
         LogPrintf("CTxLockVote::Sign -- SignMessage() failed\n");
         return false;
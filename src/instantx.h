@@ -151,6 +151,7 @@ private:
     // local memory only
     int nConfirmedHeight; // when corresponding tx is 0-confirmed or conflicted, nConfirmedHeight is -1
     int64_t nTimeCreated;
+    mutable bool fSignatureVerified; // orphan votes are revalidated on every new lock request
 
 public:
     CTxLockVote() :
@@ -159,7 +160,8 @@ public:
         outpointMasternode(),
         vchMasternodeSignature(),
         nConfirmedHeight(-1),
-        nTimeCreated(GetTime())
+        nTimeCreated(GetTime()),
+        fSignatureVerified(false)
         {}
 
     CTxLockVote(const uint256& txHashIn, const COutPoint& outpointIn, const COutPoint& outpointMasternodeIn) :
@@ -168,7 +170,8 @@ public:
         outpointMasternode(outpointMasternodeIn),
         vchMasternodeSignature(),
         nConfirmedHeight(-1),
-        nTimeCreated(GetTime())
+        nTimeCreated(GetTime()),
+        fSignatureVerified(false)
         {}
 
     ADD_SERIALIZE_METHODS;
@@ -179,6 +182,8 @@ public:
         READWRITE(outpoint);
         READWRITE(outpointMasternode);
         READWRITE(vchMasternodeSignature);
+        if (ser_action.ForRead())
+            fSignatureVerified = false;
     }
 
     uint256 GetHash() const;
@@ -195,10 +200,40 @@ public:
 
     bool Sign();
     bool CheckSignature() const;
+    //! Take over the signature check done on a copy of this vote
+    void SetSignatureVerified(const CTxLockVote& vote) const
+    {
+        if(vote.fSignatureVerified && vote.vchMasternodeSignature == vchMasternodeSignature)
+            fSignatureVerified = true;
+    }
 
     void Relay(CConnman& connman) const;
 };
 
+/** Checks the signature of a lock vote on a script check thread, see CInstantSend::ProcessOrphanTxLockVotes */
+class CTxLockVoteCheck
+{
+private:
+    const CTxLockVote* pvote;
+
+public:
+    CTxLockVoteCheck() : pvote(NULL) {}
+    CTxLockVoteCheck(const CTxLockVote& voteIn) : pvote(&voteIn) {}
+
+    bool operator()()
+    {
+        pvote->CheckSignature(); // a bad vote is reported by the serial validation, never stop the others
+        return true;
+    }
+
+    void swap(CTxLockVoteCheck& check)
+    {
+        std::swap(pvote, check.pvote);
+    }
+};
+
+void ThreadTxLockVoteCheck();
+
 class COutPointLock
 {
 private:
@@ -112,6 +112,19 @@ int GetTxHeight(const uint256& txHash, uint256* pBlockHash)
             return (*mi).second->nHeight;
         }
     }
+
+    // without the block, as below a -loadsnapshot start, an unspent output of
+    // the tx still records its height; put candy outputs are never spent
+    if(pcoinsTip)
+    {
+        const Coin& coin = AccessByTxid(*pcoinsTip, txHash);
+        if(!coin.IsSpent() && chainActive[coin.nHeight])
+        {
+            if(pBlockHash)
+                *pBlockHash = chainActive[coin.nHeight]->GetBlockHash();
+            return coin.nHeight;
+        }
+    }
     return g_nChainHeight + 1;
 }
 
@@ -125,24 +125,24 @@ CMasternode::CollateralStatus CMasternode::CheckCollateral(const COutPoint& outp
 {
     AssertLockHeld(cs_main);
 
-    CCoins coins;
-    if(!GetUTXOCoins(outpoint, coins)) {
+    Coin coin;
+    if(!GetUTXOCoin(outpoint, coin)) {
         return COLLATERAL_UTXO_NOT_FOUND;
     }
 
-    const CTxOut& in_txout = coins.vout[outpoint.n];
+    const CTxOut& in_txout = coin.out;
     if(!in_txout.IsSafeOnly()) {
         return COLLATERAL_UTXO_NOT_FOUND;
     }
 
-    if(coins.vout[outpoint.n].nValue != 1000 * COIN) {
+    if(coin.out.nValue != 1000 * COIN) {
         return COLLATERAL_INVALID_AMOUNT;
     }
 
     if(GetLockedMonth(outpoint.hash, in_txout) < MIN_MN_LOCKED_MONTH)
         return COLLATERAL_INVALID_LOCKED_MONTH;
 
-    nHeightRet = coins.nHeight;
+    nHeightRet = coin.nHeight;
     return COLLATERAL_OK;
 }
 
@@ -194,9 +194,9 @@ void CPrivateSendServer::ProcessMessage(CNode* pfrom, std::string& strCommand, C
 
                 LogPrint("privatesend", "DSVIN -- txin=%s\n", txin.ToString());
 
-                CCoins coins;
-                if(GetUTXOCoins(txin.prevout, coins)) {
-                    const CTxOut& in_txout = coins.vout[txin.prevout.n];
+                Coin coin;
+                if(GetUTXOCoin(txin.prevout, coin)) {
+                    const CTxOut& in_txout = coin.out;
                     if(in_txout.IsSafeOnly() || in_txout.IsApp())
                         nValueIn += in_txout.nValue;
                 } else {
@@ -190,12 +190,12 @@ bool CPrivateSend::IsCollateralValid(const CTransaction& txCollateral)
     }
 
     BOOST_FOREACH(const CTxIn txin, txCollateral.vin) {
-        CCoins coins;
-        if(!GetUTXOCoins(txin.prevout, coins)) {
+        Coin coin;
+        if(!GetUTXOCoin(txin.prevout, coin)) {
             LogPrint("privatesend", "CPrivateSend::IsCollateralValid -- Unknown inputs in collateral transaction, txCollateral=%s", txCollateral.ToString());
             return false;
         }
-        const CTxOut& in_txout = coins.vout[txin.prevout.n];
+        const CTxOut& in_txout = coin.out;
         if(in_txout.IsSafeOnly() || in_txout.IsApp())
             nValueIn += in_txout.nValue;
     }
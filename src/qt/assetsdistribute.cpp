@@ -7,6 +7,7 @@
 #include "utilmoneystr.h"
 #include "main.h"
 #include "app/app.h"
+#include "assetamount.h"
 #include "guiconstants.h"
 #include "guiutil.h"
 #include "validation.h"
@@ -251,51 +252,22 @@ void AssetsDistribute::updateCandyValue()
     if(!ui->distributeCheckBox->isChecked())
         return;
     int decimal = ui->decimalEdit->text().toInt();
-    string totalAssetsStr = ui->totalAssetsEdit->text().toStdString();
-    string memoryAssetsStr = "";
+    string totalAssetsStr = ui->totalAssetsEdit->text().trimmed().toStdString();
     int pos = totalAssetsStr.find(".");
-    if(pos<0)
-    {
-        memoryAssetsStr = totalAssetsStr;
-        for(int i=0;i<decimal;i++)
-            memoryAssetsStr.push_back('0');
-    }else
-    {
-        memoryAssetsStr = totalAssetsStr.substr(0,pos);
-        int decimalIndex = pos+1;
-        int strSize = totalAssetsStr.size();
-        for(int i=0;i<decimal;i++)
-        {
-            if(decimalIndex<strSize)
-                memoryAssetsStr.push_back(totalAssetsStr[decimalIndex]);
-            else
-                memoryAssetsStr.push_back('0');
-            decimalIndex++;
-        }
-    }
-    string memoryCandyStr = mulstring(memoryAssetsStr,QString::number(ui->assetsCandyRatioSlider->value()).toStdString());
-
-    int addDecimal = 3;//10% is 1,slider max 100 is 2,total 3
-    int totalDecimal = decimal+addDecimal;
-    int size = memoryCandyStr.size();
-    if(decimal==0||size==0)
+    if(pos>=0&&decimal>=0&&(int)totalAssetsStr.size()>pos+1+decimal)
+        totalAssetsStr.erase(pos+1+decimal);
+    if(pos>=0&&pos+1==(int)totalAssetsStr.size())
+        totalAssetsStr.erase(pos);
+    CAssetAmount totalAssets;
+    CAmount nTotalAssets = 0;
+    if(decimal<=0||decimal>MAX_ASSETDECIMALS_VALUE||!CAssetAmount::Parse(totalAssetsStr,decimal,totalAssets)||!totalAssets.GetAmount(nTotalAssets))
     {
         ui->candyTotalValueLabel->clear();
         return;
     }
-    if(size<=totalDecimal)
-    {
-        string resultStr = "0.";
-        int zeroCount = totalDecimal-size;
-        for(int i=0;i<zeroCount;i++)
-            resultStr.push_back('0');
-        resultStr.append(memoryCandyStr.substr(0,decimal-zeroCount));
-        ui->candyTotalValueLabel->setText(QString::fromStdString(resultStr));
-    }else
-    {
-        string resultStr = numtofloatstring(memoryCandyStr,totalDecimal);
-        ui->candyTotalValueLabel->setText(QString::fromStdString(resultStr.substr(0,resultStr.size()-addDecimal)));
-    }
+    // slider is in per mille of the total amount
+    CAssetAmount candyTotal = CAssetAmount::Mul(nTotalAssets,ui->assetsCandyRatioSlider->value()).Div(1000);
+    ui->candyTotalValueLabel->setText(QString::fromStdString(candyTotal.ToString(decimal)));
 }
 
 void AssetsDistribute::initFirstDistribute()
@@ -5,6 +5,7 @@
 #include "walletmodel.h"
 #include "transactiontablemodel.h"
 #include "validation.h"
+#include "assetamount.h"
 #include "init.h"
 #include "net.h"
 #include "utilmoneystr.h"
@@ -337,15 +338,8 @@ void GetCandyWorker::doGetCandy()
     //btn->setText(tr("get candying..."));
     //btn->setEnabled(false);
 
-    map<CKeyID, int64_t> mapKeyBirth;
-    pwalletMain->GetKeyBirthTimes(mapKeyBirth);
-
-    std::vector<std::string> vaddress;
-    for (map<CKeyID, int64_t>::const_iterator tempit = mapKeyBirth.begin(); tempit != mapKeyBirth.end(); tempit++)
-    {
-        std::string saddress = CBitcoinAddress(tempit->first).ToString();
-        vaddress.push_back(saddress);
-    }
+    boost::shared_ptr<const std::vector<CKeyAddressEntry> > pKeyAddresses = pwalletMain->GetKeyAddresses();
+    const std::vector<CKeyAddressEntry>& vaddress = *pKeyAddresses;
 
     CAppHeader appHeader(g_nAppHeaderVersion, uint256S(g_strSafeAssetId), GET_CANDY_CMD);
     CPutCandy_IndexKey assetIdCandyInfo;
@@ -365,18 +359,18 @@ void GetCandyWorker::doGetCandy()
     CAmount nNowGetCandyTotalAmount = 0;
 
     vector<CRecipient> vecSend;
-    std::vector<std::string>::iterator addit = vaddress.begin();
+    std::vector<CKeyAddressEntry>::const_iterator addit = vaddress.begin();
     bool bGottenCandy = false;
     for (; addit != vaddress.end(); addit++)
     {
         CAmount nSafe = 0;
-        if(!GetAddressAmountByHeight(nTxHeight, *addit, nSafe))
+        if(!GetAddressAmountByHeight(nTxHeight, addit->strAddress, nSafe))
             continue;
         if (nSafe < 1 * COIN || nSafe > nTotalSafe)
             continue;
 
         CAmount nTempAmount = 0;
-        CAmount nCandyAmount = (CAmount)(1.0 * nSafe / nTotalSafe * candyInfo.nAmount);
+        CAmount nCandyAmount = GetCandyShareAmount(nSafe, nTotalSafe, candyInfo.nAmount);
         CAmount amount;
         if(!parnt->amountFromString("0.0001", parnt->strGetCandy,assetInfo.assetData.nDecimals, amount))
         {
@@ -399,16 +393,15 @@ void GetCandyWorker::doGetCandy()
         
         if(nCandyAmount < amount)
             continue;
-        if(GetGetCandyAmount(assetId, out, *addit, nTempAmount))
+        if(GetGetCandyAmount(assetId, out, addit->strAddress, nTempAmount))
         {
             bGottenCandy = true;
             continue;
         }
         else
             bGottenCandy = false;
-        LogPrint("asset", "qt-getcandy: candy-height: %d, address: %s, total_safe: %lld, user_safe: %lld, total_candy_amount: %lld, can_get_candy_amount: %lld, out: %s\n", nTxHeight, *addit, nTotalSafe, nSafe, candyInfo.nAmount, nCandyAmount, out.ToString());
-        CBitcoinAddress recvAddress(*addit);
-        CRecipient recvRecipient = {GetScriptForDestination(recvAddress.Get()), nCandyAmount, 0, false, true,""};
+        LogPrint("asset", "qt-getcandy: candy-height: %d, address: %s, total_safe: %lld, user_safe: %lld, total_candy_amount: %lld, can_get_candy_amount: %lld, out: %s\n", nTxHeight, addit->strAddress, nTotalSafe, nSafe, candyInfo.nAmount, nCandyAmount, out.ToString());
+        CRecipient recvRecipient = {addit->scriptPubKey, nCandyAmount, 0, false, true,""};
         vecSend.push_back(recvRecipient);
 
         nNowGetCandyTotalAmount += nCandyAmount;
@@ -675,20 +668,9 @@ void CandyPage::on_okButton_clicked()
 
 void CandyPage::updateCandyValue()
 {
-    char amountStr[64] = "";
-#ifdef WIN32
-    snprintf(amountStr,sizeof(amountStr),"%lld",currAssetTotalAmount);
-#else
-    snprintf(amountStr,sizeof(amountStr),"%ld",currAssetTotalAmount);
-#endif
-    string multiStr = mulstring(amountStr,QString::number(ui->candyRatioSlider->value()).toStdString());
-    int addDecimal = 3;//10% is 1,slider max 100 is 2,total 3
-    int totalDecimal = currAssetDecimal+addDecimal;
-    int size = multiStr.size();
-    if( size <= totalDecimal)
-        multiStr = "0" + multiStr;
-    string resultStr = numtofloatstring(multiStr,totalDecimal);
-    ui->candyValueLabel->setText(QString::fromStdString(resultStr.substr(0,resultStr.size()-addDecimal)));
+    // slider is in per mille of the total amount
+    CAssetAmount candyValue = CAssetAmount::Mul(currAssetTotalAmount, ui->candyRatioSlider->value()).Div(1000);
+    ui->candyValueLabel->setText(QString::fromStdString(candyValue.ToString(currAssetDecimal)));
     ui->candyValueLabel->setVisible(true);
 }
 
@@ -701,16 +701,6 @@ void CoinControlDialog::updateLabels(WalletModel *model, QDialog* dialog)
         label->setVisible(nChange < 0);
 }
 
-bool CoinControlDialog::isLockedTxOut(const COutPoint& outpoint,const uint256& txhash)
-{
-    CTransaction txTmp;
-    uint256 hashBlock = uint256();
-    if(GetTransaction(outpoint.hash, txTmp, Params().GetConsensus(), hashBlock, true))
-        if(IsLockedTxOut(txhash,txTmp.vout[outpoint.n]))
-            return true;
-    return false;
-}
-
 bool CoinControlDialog::isItemLocked(const QTreeWidgetItem *item)
 {
     return item->data(COLUMN_CHECKBOX,COLUMN_ROLE_LOCKED).toString()==QString(" ");
@@ -842,7 +832,7 @@ void CoinControlDialog::updateView()
             if (coinControl->IsSelected(COutPoint(txhash, out.i)))
                 itemOutput->setCheckState(COLUMN_CHECKBOX, Qt::Checked);
 
-            if(isLockedTxOut(outpoint,txhash))
+            if(out.tx->IsLockedOutput(out.i))
             {
                 COutPoint outpt(txhash, out.i);
                 coinControl->UnSelect(outpt); // just to be sure
@@ -64,7 +64,6 @@ private:
     QString strPad(QString, int, QString);
     void sortView(int, Qt::SortOrder);
     void updateView();
-    bool isLockedTxOut(const COutPoint& outpoint,const uint256& txhash);
     bool isItemLocked(const QTreeWidgetItem* item);
 
     enum COLUMN_ROLE
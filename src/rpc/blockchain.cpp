@@ -15,6 +15,9 @@
 #include "policy/policy.h"
 #include "primitives/transaction.h"
 #include "rpc/server.h"
+#include "cuckoocache.h"
+#include "script/sigcache.h"
+#include "snapshot.h"
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
@@ -531,14 +534,15 @@ UniValue getblock(const UniValue& params, bool fHelp)
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlock block;
+    boost::shared_ptr<const CBlock> pblock;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
-    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+    if(!ReadBlockFromDisk(pblock, pblockindex, Params().GetConsensus()))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    const CBlock& block = *pblock;
 
     if (!fVerbose)
     {
@@ -589,6 +593,47 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue dumpsnapshot(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumpsnapshot \"filename\"\n"
+            "\nWrites the chain state, the app/asset/candy indexes and the height files at the current tip to a file.\n"
+            "A new node started with -prune -txindex=0 -loadsnapshot=<file> continues from that block without downloading history.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"filename\"    (string, required) The snapshot file, which must not exist yet\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"bestblock\": \"hex\",      (string) the block the snapshot was taken at\n"
+            "  \"height\": n,              (numeric) the height of that block\n"
+            "  \"blockindex\": n,          (numeric) the number of block index entries\n"
+            "  \"indexrecords\": n,        (numeric) the number of app, asset and candy index records\n"
+            "  \"coinrecords\": n,         (numeric) the number of unspent output records\n"
+            "  \"files\": n,               (numeric) the number of height files\n"
+            "  \"hash\": \"hex\"            (string) the checksum to pass to -snapshothash\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumpsnapshot", "\"snapshot.dat\"")
+            + HelpExampleRpc("dumpsnapshot", "\"snapshot.dat\"")
+        );
+
+    CSnapshotStats stats;
+    std::string strError;
+    if (!DumpSnapshot(params[0].get_str(), stats, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("height", stats.nHeight));
+    ret.push_back(Pair("blockindex", (int64_t)stats.nBlockIndex));
+    ret.push_back(Pair("indexrecords", (int64_t)stats.nIndexRecords));
+    ret.push_back(Pair("coinrecords", (int64_t)stats.nCoinRecords));
+    ret.push_back(Pair("files", (int64_t)stats.nFiles));
+    ret.push_back(Pair("hash", stats.hashSnapshot.GetHex()));
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -614,9 +659,8 @@ UniValue gettxout(const UniValue& params, bool fHelp)
             "        ,...\n"
             "     ]\n"
             "  },\n"
-            "  \"unlockedHeight\" : x,     (numeric) Display unlocked height if version is not little than SAFE_TX_VERSION_1\n"
-            "  \"reserve\" : xxxxxxx,      (string) Display reserve if version is not little than SAFE_TX_VERSION_1\n"
-            "  \"version\" : n,            (numeric) The version\n"
+            "  \"unlockedHeight\" : x,     (numeric) The height at which the output unlocks\n"
+            "  \"reserve\" : xxxxxxx,      (string) The reserve data of the output\n"
             "  \"coinbase\" : true|false   (boolean) Coinbase or not\n"
             "}\n"
 
@@ -640,38 +684,32 @@ UniValue gettxout(const UniValue& params, bool fHelp)
     if (params.size() > 2)
         fMempool = params[2].get_bool();
 
-    CCoins coins;
+    COutPoint out(hash, n);
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        if (!view.GetCoin(out, coin) || mempool.isSpent(out)) // TODO: filtering spent coins should be done by the CCoinsViewMemPool
             return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin))
             return NullUniValue;
     }
-    if (n<0 || (unsigned int)n>=coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex *pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if (coin.nHeight == MEMPOOL_HEIGHT)
         ret.push_back(Pair("confirmations", 0));
     else
-        ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
-    if(coins.nVersion >= SAFE_TX_VERSION_1)
-    {
-        ret.push_back(Pair("unlockedHeight", coins.vout[n].nUnlockedHeight));
-        ret.push_back(Pair("reserve", HexStr(coins.vout[n].vReserve)));
-    }
+        ret.push_back(Pair("confirmations", (int64_t)(pindex->nHeight - coin.nHeight + 1)));
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
+    ret.push_back(Pair("unlockedHeight", coin.out.nUnlockedHeight));
+    ret.push_back(Pair("reserve", HexStr(coin.out.vReserve)));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
+    ret.push_back(Pair("coinbase", (bool)coin.fCoinBase));
 
     return ret;
 }
@@ -766,6 +804,14 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
             "  \"pruned\": xx,             (boolean) if the blocks are subject to pruning\n"
             "  \"pruneheight\": xxxxxx,    (numeric) heighest block available\n"
+            "  \"blockcache\": {          (object) recently used blocks kept in memory\n"
+            "     \"blocks\": xx,           (numeric) number of cached blocks\n"
+            "     \"usage\": xx,            (numeric) memory used, in bytes\n"
+            "     \"maxusage\": xx,         (numeric) memory limit, in bytes (-blockcachesize)\n"
+            "     \"hits\": xx,             (numeric) block reads served from memory\n"
+            "     \"misses\": xx,           (numeric) block reads that went to disk\n"
+            "     \"hitrate\": x.xxx        (numeric) hits / (hits + misses)\n"
+            "  },\n"
             "  \"softforks\": [            (array) status of softforks in progress\n"
             "     {\n"
             "        \"id\": \"xxxx\",        (string) name of softfork\n"
@@ -804,6 +850,17 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("chainwork",             chainActive.Tip()->nChainWork.GetHex()));
     obj.push_back(Pair("pruned",                fPruneMode));
 
+    CBlockCacheStats cachestats = blockcache.GetStats();
+    UniValue blockcacheObj(UniValue::VOBJ);
+    blockcacheObj.push_back(Pair("blocks",      (uint64_t)cachestats.nBlocks));
+    blockcacheObj.push_back(Pair("usage",       (uint64_t)cachestats.nUsage));
+    blockcacheObj.push_back(Pair("maxusage",    (uint64_t)cachestats.nMaxUsage));
+    blockcacheObj.push_back(Pair("hits",        cachestats.nHits));
+    blockcacheObj.push_back(Pair("misses",      cachestats.nMisses));
+    uint64_t nReads = cachestats.nHits + cachestats.nMisses;
+    blockcacheObj.push_back(Pair("hitrate",     nReads > 0 ? (double)cachestats.nHits / nReads : 0.0));
+    obj.push_back(Pair("blockcache",            blockcacheObj));
+
     const Consensus::Params& consensusParams = Params().GetConsensus();
     CBlockIndex* tip = chainActive.Tip();
     UniValue softforks(UniValue::VARR);
@@ -988,6 +1045,46 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     return mempoolInfoToJSON();
 }
 
+UniValue getsigcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "\nReturns the size and hit rate of the signature cache since startup.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"usage\": xxxxx,              (numeric) Memory taken by the cache in bytes, fixed at startup\n"
+            "  \"capacity\": xxxxx,           (numeric) Number of signatures the cache can hold\n"
+            "  \"size\": xxxxx,               (numeric) Number of signatures in the cache\n"
+            "  \"generation\": xxxxx,         (numeric) Current eviction generation\n"
+            "  \"lookups\": xxxxx,            (numeric) Signatures looked up\n"
+            "  \"hits\": xxxxx,               (numeric) Lookups that found the signature\n"
+            "  \"hitrate\": x.xxx,            (numeric) Hits divided by lookups\n"
+            "  \"inserts\": xxxxx,            (numeric) Signatures added\n"
+            "  \"evictions\": xxxxx           (numeric) Signatures that made room for a newer one\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsigcacheinfo", "")
+            + HelpExampleRpc("getsigcacheinfo", "")
+        );
+
+    CCuckooCacheStats stats;
+    GetSignatureCacheStats(stats);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("usage", (int64_t)stats.nBytes));
+    ret.push_back(Pair("capacity", (int64_t)stats.nSlots));
+    ret.push_back(Pair("size", (int64_t)stats.nEntries));
+    ret.push_back(Pair("generation", (int64_t)stats.nGeneration));
+    ret.push_back(Pair("lookups", (int64_t)stats.nLookups));
+    ret.push_back(Pair("hits", (int64_t)stats.nHits));
+    ret.push_back(Pair("hitrate", stats.nLookups ? (double)stats.nHits / stats.nLookups : 0.0));
+    ret.push_back(Pair("inserts", (int64_t)stats.nInserts));
+    ret.push_back(Pair("evictions", (int64_t)stats.nEvictions));
+
+    return ret;
+}
+
 UniValue invalidateblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -69,6 +69,10 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "listtransactions", 1 },
     { "listtransactions", 2 },
     { "listtransactions", 3 },
+    { "listaddresstransactions", 1 },
+    { "listaddresstransactions", 2 },
+    { "listaddresstransactions", 3 },
+    { "listaddresstransactions", 4 },
     { "listaccounts", 0 },
     { "listaccounts", 1 },
     { "listaccounts", 2 },
@@ -109,6 +113,10 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "gettxoutproof", 0 },
     { "freezeunspent", 0 },
     { "freezeunspent", 1 },
+    { "consolidatewallet", 0 },
+    { "consolidatewallet", 1 },
+    { "consolidatewallet", 2 },
+    { "consolidatewallet", 3 },
     { "importprivkey", 2 },
     { "importelectrumwallet", 1 },
     { "importaddress", 2 },
@@ -166,7 +174,17 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getaddressamountbyheight", 0},
     { "sendmanywithlock", 0},
     { "transfermanyasset", 1},
+    { "getcandy", 1},
+    { "addcandywatchaddresses", 0},
+    { "removecandywatchaddresses", 0},
+    { "getcandywatchamounts", 2},
+    { "bulktransferasset", 1},
+    { "bulktransferasset", 2},
     { "getassetlocaltxlist", 1},
+    { "getassetlocaltxlist", 2},
+    { "getassetlocaltxlist", 3},
+    { "getassetlocaltxlist", 4},
+    { "getassetlocaltxlist", 5},
 };
 
 class CRPCConvertTable
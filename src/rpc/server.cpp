@@ -358,11 +358,13 @@ static const CRPCCommand vRPCCommands[] =
     { "blockchain",         "getchaintips",           &getchaintips,                true  },
     { "blockchain",         "getdifficulty",          &getdifficulty,               true  },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,              true  },
+    { "blockchain",         "getsigcacheinfo",        &getsigcacheinfo,             true  },
     { "blockchain",         "getrawmempool",          &getrawmempool,               true  },
     { "blockchain",         "gettxout",               &gettxout,                    true  },
     { "blockchain",         "gettxoutproof",          &gettxoutproof,               true  },
     { "blockchain",         "verifytxoutproof",       &verifytxoutproof,            true  },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,             true  },
+    { "blockchain",         "dumpsnapshot",           &dumpsnapshot,                true  },
     { "blockchain",         "verifychain",            &verifychain,                 true  },
     { "blockchain",         "getspentinfo",           &getspentinfo,                false },
 
@@ -463,8 +465,10 @@ static const CRPCCommand vRPCCommands[] =
     { "wallet",             "listreceivedbyaddress",  &listreceivedbyaddress,       false },
     { "wallet",             "listsinceblock",         &listsinceblock,              false },
     { "wallet",             "listtransactions",       &listtransactions,            false },
+    { "wallet",             "listaddresstransactions", &listaddresstransactions,    false },
     { "wallet",             "listunspent",            &listunspent,                 false },
     { "wallet",             "freezeunspent",          &freezeunspent,               true  },
+    { "wallet",             "consolidatewallet",      &consolidatewallet,           false },
     { "wallet",             "move",                   &movecmd,                     false },
     { "wallet",             "sendfrom",               &sendfrom,                    false },
     { "wallet",             "sendmany",               &sendmany,                    false },
@@ -505,6 +509,10 @@ static const CRPCCommand vRPCCommands[] =
     { "asset",              "getaddrassetbalance",    &getaddrassetbalance,         true  },
     { "asset",              "getassetdetails",        &getassetdetails,             true  },
     { "asset",              "getcandy",               &getcandy,                    true  },
+    { "asset",              "getcandyjob",            &getcandyjob,                 true  },
+    { "asset",              "addcandywatchaddresses", &addcandywatchaddresses,      true  },
+    { "asset",              "removecandywatchaddresses", &removecandywatchaddresses, true  },
+    { "asset",              "getcandywatchamounts",   &getcandywatchamounts,        true  },
     { "asset",              "getassetlist",           &getassetlist,                true  },
     { "asset",              "getassetlistbyaddress",  &getassetlistbyaddress,       true  },
     { "asset",            "getaddressamountbyheight", &getaddressamountbyheight,    true  },
@@ -513,6 +521,7 @@ static const CRPCCommand vRPCCommands[] =
     { "asset",              "getavailablecandylist",  &getavailablecandylist,       true  },
     { "asset",              "getlocalassetlist",      &getlocalassetlist,           true  },
     { "asset",              "transfermanyasset",      &transfermanyasset,           true  },
+    { "asset",              "bulktransferasset",      &bulktransferasset,           true  },
     { "asset",              "getassetlocaltxlist",    &getassetlocaltxlist,         true  },
 
 #endif // ENABLE_WALLET
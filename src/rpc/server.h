@@ -238,6 +238,7 @@ extern UniValue createmultisig(const UniValue& params, bool fHelp);
 extern UniValue listreceivedbyaddress(const UniValue& params, bool fHelp);
 extern UniValue listreceivedbyaccount(const UniValue& params, bool fHelp);
 extern UniValue listtransactions(const UniValue& params, bool fHelp);
+extern UniValue listaddresstransactions(const UniValue& params, bool fHelp);
 extern UniValue listaddressgroupings(const UniValue& params, bool fHelp);
 extern UniValue listaccounts(const UniValue& params, bool fHelp);
 extern UniValue listsinceblock(const UniValue& params, bool fHelp);
@@ -262,6 +263,7 @@ extern UniValue resendwallettransactions(const UniValue& params, bool fHelp);
 extern UniValue getrawtransaction(const UniValue& params, bool fHelp); // in rpc/rawtransaction.cpp
 extern UniValue listunspent(const UniValue& params, bool fHelp);
 extern UniValue freezeunspent(const UniValue& params, bool fHelp);
+extern UniValue consolidatewallet(const UniValue& params, bool fHelp);
 extern UniValue listfrozenunspent(const UniValue& params, bool fHelp);
 extern UniValue createrawtransaction(const UniValue& params, bool fHelp);
 extern UniValue decoderawtransaction(const UniValue& params, bool fHelp);
@@ -289,6 +291,7 @@ extern UniValue getbestblockhash(const UniValue& params, bool fHelp);
 extern UniValue getdifficulty(const UniValue& params, bool fHelp);
 extern UniValue settxfee(const UniValue& params, bool fHelp);
 extern UniValue getmempoolinfo(const UniValue& params, bool fHelp);
+extern UniValue getsigcacheinfo(const UniValue& params, bool fHelp);
 extern UniValue getrawmempool(const UniValue& params, bool fHelp);
 extern UniValue getblockhashes(const UniValue& params, bool fHelp);
 extern UniValue getblockhash(const UniValue& params, bool fHelp);
@@ -296,6 +299,7 @@ extern UniValue getblockheader(const UniValue& params, bool fHelp);
 extern UniValue getblockheaders(const UniValue& params, bool fHelp);
 extern UniValue getblock(const UniValue& params, bool fHelp);
 extern UniValue gettxoutsetinfo(const UniValue& params, bool fHelp);
+extern UniValue dumpsnapshot(const UniValue& params, bool fHelp);
 extern UniValue gettxout(const UniValue& params, bool fHelp);
 extern UniValue verifychain(const UniValue& params, bool fHelp);
 extern UniValue getchaintips(const UniValue& params, bool fHelp);
@@ -331,6 +335,10 @@ extern UniValue getaddrassettxids(const UniValue& params, bool fHelp);
 extern UniValue getaddrassetbalance(const UniValue& params, bool fHelp);
 extern UniValue getassetdetails(const UniValue& params, bool fHelp);
 extern UniValue getcandy(const UniValue& params, bool fHelp);
+extern UniValue getcandyjob(const UniValue& params, bool fHelp);
+extern UniValue addcandywatchaddresses(const UniValue& params, bool fHelp);
+extern UniValue removecandywatchaddresses(const UniValue& params, bool fHelp);
+extern UniValue getcandywatchamounts(const UniValue& params, bool fHelp);
 extern UniValue getassetlist(const UniValue& params, bool fHelp);
 extern UniValue getassetlistbyaddress(const UniValue& params, bool fHelp);
 extern UniValue getaddressamountbyheight(const UniValue& params, bool fHelp);
@@ -339,6 +347,7 @@ extern UniValue getaddresscandylist(const UniValue& params, bool fHelp);
 extern UniValue getavailablecandylist(const UniValue& params, bool fHelp);
 extern UniValue getlocalassetlist(const UniValue& params, bool fHelp);
 extern UniValue transfermanyasset(const UniValue& params, bool fHelp);
+extern UniValue bulktransferasset(const UniValue& params, bool fHelp);
 extern UniValue getassetlocaltxlist(const UniValue& params, bool fHelp);
 
 
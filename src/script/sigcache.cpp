@@ -5,29 +5,14 @@
 
 #include "sigcache.h"
 
-#include "memusage.h"
+#include "cuckoocache.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
-#include <boost/thread.hpp>
-#include <boost/unordered_set.hpp>
-
 namespace {
 
-/**
- * We're hashing a nonce into the entries themselves, so we don't need extra
- * blinding in the set hash computation.
- */
-class CSignatureCacheHasher
-{
-public:
-    size_t operator()(const uint256& key) const {
-        return key.GetCheapHash();
-    }
-};
-
 /**
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
@@ -38,17 +23,9 @@ class CSignatureCache
 private:
      //! Entries are SHA256(nonce || signature hash || public key || signature):
     uint256 nonce;
-    typedef boost::unordered_set<uint256, CSignatureCacheHasher> map_type;
-    map_type setValid;
-    boost::shared_mutex cs_sigcache;
-
+    CCuckooCache setValid;
 
 public:
-    CSignatureCache()
-    {
-        GetRandBytes(nonce.begin(), 32);
-    }
-
     void
     ComputeEntry(uint256& entry, const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey)
     {
@@ -56,52 +33,57 @@ public:
     }
 
     bool
-    Get(const uint256& entry)
+    Get(const uint256& entry, bool fErase)
+    {
+        return setValid.Contains(entry, fErase);
+    }
+
+    void Set(const uint256& entry)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.count(entry);
+        setValid.Insert(entry);
     }
 
-    void Erase(const uint256& entry)
+    //! Seeds the nonce here rather than at static initialization, where the RNG may not be usable yet
+    void Setup(size_t nBytes)
     {
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.erase(entry);
+        GetRandBytes(nonce.begin(), 32);
+        setValid.Setup(nBytes);
     }
 
-    void Set(const uint256& entry)
+    void GetStats(CCuckooCacheStats& stats) const
     {
-        size_t nMaxCacheSize = GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        while (memusage::DynamicUsage(setValid) > nMaxCacheSize)
-        {
-            map_type::size_type s = GetRand(setValid.bucket_count());
-            map_type::local_iterator it = setValid.begin(s);
-            if (it != setValid.end(s)) {
-                setValid.erase(*it);
-            }
-        }
-
-        setValid.insert(entry);
+        setValid.GetStats(stats);
     }
 };
 
+/* No lock is needed around the cache: it is set up, nonce included, once in
+ * InitSignatureCache before any script is checked, and is lock-free from then on. */
+static CSignatureCache signatureCache;
+
 }
 
-bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+void InitSignatureCache()
 {
-    static CSignatureCache signatureCache;
+    size_t nMaxCacheSize = std::max<int64_t>(0, std::min<int64_t>(GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE), MAX_MAX_SIG_CACHE_SIZE)) * ((size_t) 1 << 20);
+    signatureCache.Setup(nMaxCacheSize);
+    CCuckooCacheStats stats;
+    signatureCache.GetStats(stats);
+    LogPrintf("Using %zu MiB out of %zu requested for signature cache, able to store %u elements\n",
+              stats.nBytes >> 20, nMaxCacheSize >> 20, stats.nSlots);
+}
+
+void GetSignatureCacheStats(CCuckooCacheStats& stats)
+{
+    signatureCache.GetStats(stats);
+}
 
+bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+{
     uint256 entry;
     signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
 
-    if (signatureCache.Get(entry)) {
-        if (!store) {
-            signatureCache.Erase(entry);
-        }
+    if (signatureCache.Get(entry, !store))
         return true;
-    }
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
@@ -10,11 +10,14 @@
 
 #include <vector>
 
-// DoS prevention: limit cache size to less than 40MB (over 500000
-// entries on 64-bit systems).
+// DoS prevention: limit cache size to 40MB (over 1000000 entries of
+// 40 bytes each).
 static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 40;
+// Maximum sig cache size allowed
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
 
 class CPubKey;
+struct CCuckooCacheStats;
 
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
@@ -27,4 +30,9 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/** Allocate the signature cache at its -maxsigcachesize size; call once at startup */
+void InitSignatureCache();
+/** Size and hit counters of the signature cache */
+void GetSignatureCacheStats(CCuckooCacheStats& stats);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -0,0 +1,536 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "snapshot.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "dbwrapper.h"
+#include "hash.h"
+#include "main.h"
+#include "streams.h"
+#include "txdb.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
+extern boost::shared_mutex g_mutexChangeFile;
+
+namespace {
+
+/** Types of the records following the snapshot header */
+enum SnapshotRecordType
+{
+    SNAPSHOT_BLOCK_INDEX = 'b',
+    SNAPSHOT_CHANGE_INFO = 'h',
+    SNAPSHOT_FILE = 'f',
+    SNAPSHOT_INDEX = 'i',
+    SNAPSHOT_COIN = 'c',
+    SNAPSHOT_END = 'e',
+};
+
+static const char SNAPSHOT_MAGIC[8] = {'s', 'a', 'f', 'e', 's', 'n', 'a', 'p'};
+//! Database records written per batch while loading
+static const unsigned int SNAPSHOT_BATCH_RECORDS = 50000;
+
+struct CSnapshotHeader
+{
+    char pchMagic[8];
+    uint32_t nSnapshotVersion;
+    CMessageHeader::MessageStartChars pchMessageStart;
+    uint256 hashBlock;
+    int32_t nHeight;
+
+    CSnapshotHeader() : nSnapshotVersion(SNAPSHOT_VERSION), nHeight(-1)
+    {
+        memcpy(pchMagic, SNAPSHOT_MAGIC, sizeof(pchMagic));
+        memcpy(pchMessageStart, Params().MessageStart(), sizeof(pchMessageStart));
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(FLATDATA(pchMagic));
+        READWRITE(nSnapshotVersion);
+        READWRITE(FLATDATA(pchMessageStart));
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+    }
+};
+
+/** Writes to a file while hashing everything written */
+class CHashedFileWriter : public CHashWriter
+{
+private:
+    CAutoFile& file;
+
+public:
+    CHashedFileWriter(CAutoFile& fileIn) : CHashWriter(fileIn.GetType(), fileIn.GetVersion()), file(fileIn) {}
+
+    CHashedFileWriter& write(const char* pch, size_t nSize)
+    {
+        file.write(pch, nSize);
+        CHashWriter::write(pch, nSize);
+        return (*this);
+    }
+
+    template<typename T>
+    CHashedFileWriter& operator<<(const T& obj)
+    {
+        ::Serialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+bool ReadRawRecord(CDBIterator* pcursor, std::vector<char>& vKey, std::vector<char>& vValue)
+{
+    vKey.resize(pcursor->GetKeySize());
+    vValue.resize(pcursor->GetValueSize());
+    CFlatData key(vKey), value(vValue);
+    return pcursor->GetKey(key) && pcursor->GetValue(value);
+}
+
+void WriteRawRecord(CDBWrapper& db, boost::scoped_ptr<CDBBatch>& pbatch, unsigned int& nBatch, std::vector<char>& vKey, std::vector<char>& vValue)
+{
+    if (!pbatch)
+        pbatch.reset(new CDBBatch(&db.GetObfuscateKey()));
+    pbatch->Write(CFlatData(vKey), CFlatData(vValue));
+    if (++nBatch >= SNAPSHOT_BATCH_RECORDS) {
+        db.WriteBatch(*pbatch);
+        pbatch.reset();
+        nBatch = 0;
+    }
+}
+
+void FlushRawRecords(CDBWrapper& db, boost::scoped_ptr<CDBBatch>& pbatch, unsigned int& nBatch)
+{
+    if (pbatch)
+        db.WriteBatch(*pbatch, true);
+    pbatch.reset();
+    nBatch = 0;
+}
+
+bool IsAppIndexKey(const std::vector<char>& vKey)
+{
+    const std::vector<std::string>& vPrefix = CBlockTreeDB::GetAppIndexPrefixes();
+    for (std::vector<std::string>::const_iterator it = vPrefix.begin(); it != vPrefix.end(); it++) {
+        CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+        ssPrefix << *it;
+        if (vKey.size() > ssPrefix.size() && std::equal(ssPrefix.begin(), ssPrefix.end(), vKey.begin()))
+            return true;
+    }
+    return false;
+}
+
+bool IsCoinKey(const std::vector<char>& vKey)
+{
+    return vKey.size() > 1 && vKey[0] == CCoinsViewDB::GetCoinKeyPrefix();
+}
+
+/**
+ * Keep the change info that is not in the height files yet and belongs to the active chain,
+ * and check that together with detail.dat it covers every block up to the tip exactly once.
+ */
+bool SelectChangeInfo(int nLastHeight, int nTipHeight, std::list<CChangeInfo>& listChangeInfo)
+{
+    // Entries above the tip were made for blocks that have since been disconnected
+    while (!listChangeInfo.empty() && listChangeInfo.back().nHeight > nTipHeight)
+        listChangeInfo.pop_back();
+
+    if (nTipHeight < g_nCriticalHeight)
+        return listChangeInfo.empty();
+    if (nLastHeight > nTipHeight)
+        return false;
+
+    int nNextHeight = nLastHeight + 1;
+    for (std::list<CChangeInfo>::const_iterator it = listChangeInfo.begin(); it != listChangeInfo.end(); it++, nNextHeight++) {
+        if (it->nHeight != nNextHeight)
+            return false;
+    }
+    return nNextHeight == nTipHeight + 1;
+}
+
+void WriteHeightFiles(CHashedFileWriter& writer, CSnapshotStats& stats, uint64_t& nRecords)
+{
+    boost::filesystem::path heightDir = GetDataDir() / "height";
+    if (!boost::filesystem::exists(heightDir))
+        return;
+
+    std::vector<char> vData;
+    boost::filesystem::directory_iterator end_iter;
+    for (boost::filesystem::directory_iterator iter(heightDir); iter != end_iter; ++iter) {
+        if (!boost::filesystem::is_regular_file(iter->status()))
+            continue;
+
+        std::string strName = iter->path().filename().string();
+        FILE* pFile = fopen(iter->path().string().c_str(), "rb");
+        if (!pFile)
+            throw std::runtime_error(strprintf("cannot open height file %s", strName));
+
+        // Every file gets at least one record, so that empty files are recreated too
+        bool fFirst = true;
+        while (true) {
+            vData.resize(SNAPSHOT_FILE_CHUNK_SIZE);
+            size_t nRead = fread(&vData[0], 1, vData.size(), pFile);
+            vData.resize(nRead);
+            if (nRead == 0 && !fFirst)
+                break;
+            writer << (unsigned char)SNAPSHOT_FILE << strName << vData;
+            nRecords++;
+            fFirst = false;
+            if (nRead < SNAPSHOT_FILE_CHUNK_SIZE)
+                break;
+        }
+        bool fError = ferror(pFile);
+        fclose(pFile);
+        if (fError)
+            throw std::runtime_error(strprintf("cannot read height file %s", strName));
+        stats.nFiles++;
+    }
+}
+
+/**
+ * Read a snapshot from front to back, checking its structure and checksum. With fApply,
+ * its contents are written into the databases and the height directory as they are read.
+ */
+bool ReadSnapshot(const boost::filesystem::path& path, bool fApply, CSnapshotStats& stats, std::string& strError)
+{
+    FILE* pFile = fopen(path.string().c_str(), "rb");
+    if (!pFile) {
+        strError = strprintf(_("Cannot open snapshot %s"), path.string());
+        return false;
+    }
+    CAutoFile file(pFile, SER_DISK, CLIENT_VERSION);
+    CHashVerifier<CAutoFile> verifier(&file);
+
+    try {
+        CSnapshotHeader header;
+        verifier >> header;
+        if (memcmp(header.pchMagic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)))
+            throw std::runtime_error("not a snapshot file");
+        if (header.nSnapshotVersion > SNAPSHOT_VERSION)
+            throw std::runtime_error(strprintf("unsupported snapshot version %u", header.nSnapshotVersion));
+        if (memcmp(header.pchMessageStart, Params().MessageStart(), sizeof(header.pchMessageStart)))
+            throw std::runtime_error("snapshot is for a different network");
+        stats.hashBlock = header.hashBlock;
+        stats.nHeight = header.nHeight;
+
+        boost::filesystem::path heightDir = GetDataDir() / "height";
+        if (fApply) {
+            boost::filesystem::remove_all(heightDir);
+            boost::filesystem::create_directories(heightDir);
+        }
+
+        std::vector<CDiskBlockIndex> vIndex;
+        std::list<CChangeInfo> listChangeInfo;
+        boost::scoped_ptr<CDBBatch> pbatchIndex, pbatchCoins;
+        unsigned int nBatchIndex = 0, nBatchCoins = 0;
+        uint256 hashPrev;
+        int nPrevHeight = -1;
+        uint64_t nRecords = 0;
+        std::vector<char> vKey, vValue;
+        std::string strName, strLastName;
+
+        while (true) {
+            unsigned char chType;
+            verifier >> chType;
+            if (chType == SNAPSHOT_END)
+                break;
+            nRecords++;
+
+            switch (chType) {
+            case SNAPSHOT_BLOCK_INDEX: {
+                CDiskBlockIndex diskindex;
+                verifier >> diskindex;
+                CDiskBlockIndex check(diskindex);
+                check.hash = uint256();
+                if (check.GetBlockHash() != diskindex.hash || diskindex.hashPrev != hashPrev || diskindex.nHeight != nPrevHeight + 1 ||
+                    (nPrevHeight < 0 && diskindex.hash != Params().GetConsensus().hashGenesisBlock))
+                    throw std::runtime_error(strprintf("block index entry %s does not extend the chain", diskindex.hash.ToString()));
+                hashPrev = diskindex.hash;
+                nPrevHeight = diskindex.nHeight;
+                stats.nBlockIndex++;
+                if (fApply) {
+                    vIndex.push_back(diskindex);
+                    if (vIndex.size() >= SNAPSHOT_BATCH_RECORDS) {
+                        if (!pblocktree->WriteBlockIndex(vIndex))
+                            throw std::runtime_error("failed to write block index");
+                        vIndex.clear();
+                    }
+                }
+                break;
+            }
+            case SNAPSHOT_CHANGE_INFO: {
+                CChangeInfo changeInfo;
+                verifier >> changeInfo;
+                stats.nChangeInfo++;
+                if (fApply)
+                    listChangeInfo.push_back(changeInfo);
+                break;
+            }
+            case SNAPSHOT_FILE: {
+                verifier >> strName >> vValue;
+                if (strName.empty() || strName == "." || strName == ".." || boost::filesystem::path(strName).filename().string() != strName)
+                    throw std::runtime_error(strprintf("invalid height file name %s", SanitizeString(strName)));
+                if (strName != strLastName)
+                    stats.nFiles++;
+                strLastName = strName;
+                if (fApply) {
+                    FILE* pHeightFile = fopen((heightDir / strName).string().c_str(), "ab");
+                    if (!pHeightFile)
+                        throw std::runtime_error(strprintf("cannot create height file %s", strName));
+                    bool fWritten = vValue.empty() || fwrite(&vValue[0], 1, vValue.size(), pHeightFile) == vValue.size();
+                    fclose(pHeightFile);
+                    if (!fWritten)
+                        throw std::runtime_error(strprintf("cannot write height file %s", strName));
+                }
+                break;
+            }
+            case SNAPSHOT_INDEX: {
+                verifier >> vKey >> vValue;
+                if (!IsAppIndexKey(vKey))
+                    throw std::runtime_error("unexpected index record");
+                stats.nIndexRecords++;
+                if (fApply)
+                    WriteRawRecord(*pblocktree, pbatchIndex, nBatchIndex, vKey, vValue);
+                break;
+            }
+            case SNAPSHOT_COIN: {
+                verifier >> vKey >> vValue;
+                if (!IsCoinKey(vKey))
+                    throw std::runtime_error("unexpected coin record");
+                stats.nCoinRecords++;
+                if (fApply)
+                    WriteRawRecord(pcoinsdbview->GetDB(), pbatchCoins, nBatchCoins, vKey, vValue);
+                break;
+            }
+            default:
+                throw std::runtime_error(strprintf("unknown record type %d", chType));
+            }
+        }
+
+        uint64_t nRecordsWritten;
+        verifier >> nRecordsWritten;
+        stats.hashSnapshot = verifier.GetHash();
+        uint256 hashStored;
+        file >> hashStored;
+        if (hashStored != stats.hashSnapshot)
+            throw std::runtime_error("checksum mismatch");
+        if (nRecordsWritten != nRecords || fgetc(file.Get()) != EOF)
+            throw std::runtime_error("truncated or trailing records");
+        if (hashPrev != header.hashBlock || nPrevHeight != header.nHeight)
+            throw std::runtime_error("block index does not end at the snapshot block");
+
+        if (fApply) {
+            if (!vIndex.empty() && !pblocktree->WriteBlockIndex(vIndex))
+                throw std::runtime_error("failed to write block index");
+            FlushRawRecords(*pblocktree, pbatchIndex, nBatchIndex);
+            FlushRawRecords(pcoinsdbview->GetDB(), pbatchCoins, nBatchCoins);
+            // Bring detail.dat up to the snapshot block, which the change thread would only do 20 blocks later
+            if (!WriteChangeInfoToFiles(listChangeInfo))
+                throw std::runtime_error("failed to write height files");
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf(_("Error reading snapshot %s: %s"), path.string(), e.what());
+        return false;
+    }
+
+    return true;
+}
+
+} // anon namespace
+
+bool DumpSnapshot(const boost::filesystem::path& path, CSnapshotStats& stats, std::string& strError)
+{
+    if (boost::filesystem::exists(path)) {
+        strError = strprintf("%s already exists", path.string());
+        return false;
+    }
+
+    CSnapshotHeader header;
+    std::vector<CDiskBlockIndex> vIndex;
+    std::list<CChangeInfo> listChangeInfo;
+    boost::scoped_ptr<CDBIterator> pcursorIndex, pcursorCoins;
+    boost::shared_lock<boost::shared_mutex> lockFiles(g_mutexChangeFile, boost::defer_lock);
+    // The change thread pops an entry before it takes the file lock to write it, so for a
+    // moment the height files and the entries still queued can miss a block. Retry until they
+    // cover each block exactly once, letting the chain move on between attempts.
+    for (int nTry = 0; ; nTry++) {
+        {
+            LOCK(cs_main);
+            FlushStateToDisk();
+
+            CBlockIndex* pindexTip = chainActive.Tip();
+            if (!pindexTip) {
+                strError = "no active chain";
+                return false;
+            }
+
+            lockFiles.lock();
+            int nLastHeight = GetPendingChangeInfo(listChangeInfo);
+            if (SelectChangeInfo(nLastHeight, pindexTip->nHeight, listChangeInfo)) {
+                header.hashBlock = pindexTip->GetBlockHash();
+                header.nHeight = pindexTip->nHeight;
+                for (CBlockIndex* pindex = pindexTip; pindex; pindex = pindex->pprev) {
+                    CDiskBlockIndex diskindex(pindex);
+                    // The loading node has no block files, so drop the positions in them
+                    diskindex.nStatus &= ~(BLOCK_HAVE_MASK | BLOCK_UNDO_COMPACT);
+                    diskindex.nFile = 0;
+                    diskindex.nDataPos = 0;
+                    diskindex.nUndoPos = 0;
+                    vIndex.push_back(diskindex);
+                }
+                std::reverse(vIndex.begin(), vIndex.end());
+
+                // LevelDB iterators read a consistent view of the database as of their creation,
+                // so the records below match the tip even though blocks connect while they are written
+                pcursorIndex.reset(pblocktree->NewIterator());
+                pcursorCoins.reset(pcoinsdbview->GetDB().NewIterator());
+                break;
+            }
+            lockFiles.unlock();
+        }
+
+        if (nTry == 50) {
+            strError = "height files do not match the active chain, try again later";
+            return false;
+        }
+        MilliSleep(100);
+    }
+
+    stats = CSnapshotStats();
+    stats.hashBlock = header.hashBlock;
+    stats.nHeight = header.nHeight;
+
+    FILE* pFile = fopen(path.string().c_str(), "wb");
+    if (!pFile) {
+        strError = strprintf("cannot create %s", path.string());
+        return false;
+    }
+    CAutoFile file(pFile, SER_DISK, CLIENT_VERSION);
+
+    try {
+        CHashedFileWriter writer(file);
+        uint64_t nRecords = 0;
+        writer << header;
+
+        for (std::vector<CDiskBlockIndex>::const_iterator it = vIndex.begin(); it != vIndex.end(); it++) {
+            writer << (unsigned char)SNAPSHOT_BLOCK_INDEX << *it;
+            stats.nBlockIndex++;
+            nRecords++;
+        }
+        for (std::list<CChangeInfo>::const_iterator it = listChangeInfo.begin(); it != listChangeInfo.end(); it++) {
+            writer << (unsigned char)SNAPSHOT_CHANGE_INFO << *it;
+            stats.nChangeInfo++;
+            nRecords++;
+        }
+        WriteHeightFiles(writer, stats, nRecords);
+        lockFiles.unlock();
+
+        std::vector<char> vKey, vValue;
+        const std::vector<std::string>& vPrefix = CBlockTreeDB::GetAppIndexPrefixes();
+        for (std::vector<std::string>::const_iterator it = vPrefix.begin(); it != vPrefix.end(); it++) {
+            CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+            ssPrefix << *it;
+            for (pcursorIndex->Seek(*it); pcursorIndex->Valid(); pcursorIndex->Next()) {
+                boost::this_thread::interruption_point();
+                if (!ReadRawRecord(pcursorIndex.get(), vKey, vValue))
+                    throw std::runtime_error("cannot read index record");
+                if (vKey.size() < ssPrefix.size() || !std::equal(ssPrefix.begin(), ssPrefix.end(), vKey.begin()))
+                    break;
+                writer << (unsigned char)SNAPSHOT_INDEX << vKey << vValue;
+                stats.nIndexRecords++;
+                nRecords++;
+            }
+        }
+
+        for (pcursorCoins->Seek(CCoinsViewDB::GetCoinKeyPrefix()); pcursorCoins->Valid(); pcursorCoins->Next()) {
+            boost::this_thread::interruption_point();
+            if (!ReadRawRecord(pcursorCoins.get(), vKey, vValue))
+                throw std::runtime_error("cannot read coin record");
+            if (!IsCoinKey(vKey))
+                break;
+            writer << (unsigned char)SNAPSHOT_COIN << vKey << vValue;
+            stats.nCoinRecords++;
+            nRecords++;
+        }
+
+        writer << (unsigned char)SNAPSHOT_END << nRecords;
+        stats.hashSnapshot = writer.GetHash();
+        file << stats.hashSnapshot;
+        FileCommit(file.Get());
+    } catch (const std::exception& e) {
+        file.fclose();
+        boost::system::error_code ec;
+        boost::filesystem::remove(path, ec);
+        strError = strprintf("cannot write snapshot: %s", e.what());
+        return false;
+    }
+
+    LogPrintf("%s: wrote snapshot of block %s (height %d) to %s, checksum %s\n", __func__,
+        stats.hashBlock.ToString(), stats.nHeight, path.string(), stats.hashSnapshot.ToString());
+    return true;
+}
+
+bool LoadSnapshot(const boost::filesystem::path& path, const uint256& hashExpected, CSnapshotStats& stats, std::string& strError)
+{
+    if (!pcoinsdbview->GetBestBlock().IsNull()) {
+        LogPrintf("%s: chain state already present, ignoring -loadsnapshot\n", __func__);
+        return true;
+    }
+    int nLastFile;
+    if (pblocktree->ReadLastBlockFile(nLastFile)) {
+        strError = _("-loadsnapshot requires an empty data directory");
+        return false;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    LogPrintf("Verifying snapshot %s\n", path.string());
+    CSnapshotStats statsVerified;
+    if (!ReadSnapshot(path, false, statsVerified, strError))
+        return false;
+    if (!hashExpected.IsNull() && statsVerified.hashSnapshot != hashExpected) {
+        strError = strprintf(_("Snapshot checksum %s does not match -snapshothash"), statsVerified.hashSnapshot.ToString());
+        return false;
+    }
+
+    LogPrintf("Loading snapshot of block %s (height %d)\n", statsVerified.hashBlock.ToString(), statsVerified.nHeight);
+    if (!ReadSnapshot(path, true, stats, strError))
+        return false;
+    if (stats.hashSnapshot != statsVerified.hashSnapshot) {
+        strError = strprintf(_("Snapshot %s changed while it was loaded"), path.string());
+        return false;
+    }
+
+    // There are no blocks below the snapshot, so the node continues as a pruned node without
+    // the indexes that need them
+    if (!pblocktree->WriteFlag("txindex", false) || !pblocktree->WriteFlag("addressindex", false) ||
+        !pblocktree->WriteFlag("timestampindex", false) || !pblocktree->WriteFlag("spentindex", false) ||
+        !pblocktree->WriteFlag("prunedblockfiles", true)) {
+        strError = _("Failed to write block database flags");
+        return false;
+    }
+
+    // The best block is written last: until it is, a restart loads the snapshot again
+    CCoinsMap mapCoins;
+    if (!pcoinsdbview->BatchWrite(mapCoins, stats.hashBlock)) {
+        strError = _("Failed to write chainstate database");
+        return false;
+    }
+
+    LogPrintf("Loaded snapshot: %u block index entries, %u index records, %u coin records, %u height files, %dms\n",
+        stats.nBlockIndex, stats.nIndexRecords, stats.nCoinRecords, stats.nFiles, GetTimeMillis() - nStart);
+    return true;
+}
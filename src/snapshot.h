@@ -0,0 +1,54 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SAFE_SNAPSHOT_H
+#define SAFE_SNAPSHOT_H
+
+#include "uint256.h"
+
+#include <stdint.h>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+/** Format version written to new snapshots */
+static const uint32_t SNAPSHOT_VERSION = 1;
+/** Height files are stored in records of at most this many bytes */
+static const unsigned int SNAPSHOT_FILE_CHUNK_SIZE = 1 << 20;
+
+/** Summary of a snapshot, filled in when one is written or loaded */
+struct CSnapshotStats
+{
+    uint256 hashBlock;
+    int nHeight;
+    uint64_t nBlockIndex;
+    uint64_t nChangeInfo;
+    uint64_t nFiles;
+    uint64_t nIndexRecords;
+    uint64_t nCoinRecords;
+    //! Checksum of the snapshot file, stored at its end
+    uint256 hashSnapshot;
+
+    CSnapshotStats() : nHeight(-1), nBlockIndex(0), nChangeInfo(0), nFiles(0), nIndexRecords(0), nCoinRecords(0) {}
+};
+
+/**
+ * Write a snapshot of the active chain at its current tip: the block index entries of the
+ * chain (without block file positions), the app/asset/candy indexes, the UTXO set and the
+ * height/ directory, followed by a double-SHA256 of everything before it.
+ * Must be called without cs_main held.
+ */
+bool DumpSnapshot(const boost::filesystem::path& path, CSnapshotStats& stats, std::string& strError);
+
+/**
+ * Fill an empty data directory from a snapshot written by DumpSnapshot, so that the node
+ * starts at the snapshot block as a pruned node. The checksum is verified before anything
+ * is written, and must equal hashExpected unless that is null; startup always passes the
+ * -snapshothash the operator got from the node that wrote the file. Called during startup once
+ * the databases are open and before the block index is loaded; does nothing when a chain
+ * state is already present.
+ */
+bool LoadSnapshot(const boost::filesystem::path& path, const uint256& hashExpected, CSnapshotStats& stats, std::string& strError);
+
+#endif // SAFE_SNAPSHOT_H
@@ -0,0 +1,264 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "app/app.h"
+#include "base58.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "coins.h"
+#include "main.h"
+#include "random.h"
+#include "script/standard.h"
+#include "txdb.h"
+#include "util.h"
+#include "validation.h"
+
+#include "test/test_safe.h"
+
+#include <stdio.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+static const CAmount CANDY_AMOUNT = 1000 * 10000; // 1000 assets with 4 decimals
+static const CAmount ADDRESS_SAFE = 100 * COIN;
+static const CAmount TOTAL_SAFE = 1000 * COIN;
+static const unsigned int CANDY_COUNT = 2;
+
+/** A put candy tx confirmed on disk at nCandyHeight, with the index records and
+ * address amount files the get candy check reads, and the tip a day later */
+struct AppCheckSetup : public TestingSetup {
+    int nCandyHeight;
+    int nChainHeightPrev;
+    uint256 assetId;
+    CTransaction txPut;
+    CCoinsView viewDummy;
+    CCoinsViewCache view;
+
+    AppCheckSetup() : view(&viewDummy)
+    {
+        // detail.dat stays empty, so the candy height is the last one before it
+        nCandyHeight = g_nCriticalHeight - 1;
+        nChainHeightPrev = g_nChainHeight;
+        g_nChainHeight = nCandyHeight + BLOCKS_PER_DAY;
+
+        CAssetData assetData("TST", "TestAsset", "candy test asset", "tst", 10 * CANDY_AMOUNT, 10 * CANDY_AMOUNT, 10 * CANDY_AMOUNT, 4, false, true, CANDY_AMOUNT, 1, "");
+        assetId = assetData.GetHash();
+        std::vector<std::pair<uint256, CAssetId_AssetInfo_IndexValue> > vAsset;
+        vAsset.push_back(std::make_pair(assetId, CAssetId_AssetInfo_IndexValue(Address(0), assetData, nCandyHeight - 1)));
+        BOOST_CHECK(pblocktree->Write_AssetId_AssetInfo_Index(vAsset));
+
+        CMutableTransaction tx;
+        tx.nVersion = SAFE_TX_VERSION_2;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        for (unsigned int i = 0; i < CANDY_COUNT; i++) {
+            CTxOut txout(CANDY_AMOUNT, GetScriptForDestination(CBitcoinAddress(g_strPutCandyAddress).Get()));
+            txout.vReserve = FillPutCandyData(CAppHeader(g_nAppHeaderVersion, uint256S(g_strSafeAssetId), PUT_CANDY_CMD), CPutCandyData(assetId, CANDY_AMOUNT, 1, ""));
+            tx.vout.push_back(txout);
+        }
+        txPut = tx;
+
+        // the claims read the height of the put candy tx through the tx index
+        CBlock block;
+        block.nTime = 1500000000;
+        block.vtx.push_back(txPut);
+        CDiskBlockPos pos(1, 0);
+        BOOST_CHECK(WriteBlockToDisk(block, pos, Params().MessageStart()));
+        std::vector<std::pair<uint256, CDiskTxPos> > vTxPos;
+        vTxPos.push_back(std::make_pair(txPut.GetHash(), CDiskTxPos(pos, GetSizeOfCompactSize(block.vtx.size()))));
+        BOOST_CHECK(pblocktree->WriteTxIndex(vTxPos));
+        CBlockIndex* pindex = new CBlockIndex(block);
+        pindex->nHeight = nCandyHeight;
+        pindex->phashBlock = &mapBlockIndex.insert(std::make_pair(block.GetHash(), pindex)).first->first;
+
+        std::vector<std::pair<CPutCandy_IndexKey, CPutCandy_IndexValue> > vCandy;
+        for (unsigned int i = 0; i < CANDY_COUNT; i++) {
+            COutPoint out(txPut.GetHash(), i);
+            vCandy.push_back(std::make_pair(CPutCandy_IndexKey(assetId, out, CCandyInfo(CANDY_AMOUNT, 1)), CPutCandy_IndexValue(nCandyHeight, block.GetHash(), 0)));
+            view.AddCoin(out, Coin(txPut.vout[i], nCandyHeight, false), false);
+        }
+        BOOST_CHECK(pblocktree->Write_PutCandy_Index(vCandy));
+        BOOST_CHECK(pblocktree->Write_CandyHeight_Index(nCandyHeight));
+
+        // safe of the claiming addresses at the candy height, sorted as the lookup expects
+        boost::filesystem::path pathHeight = GetDataDir() / "height";
+        boost::filesystem::create_directories(pathHeight);
+        FILE* file = fopen((pathHeight / "detail.dat").string().c_str(), "wb");
+        BOOST_REQUIRE(file);
+        fclose(file);
+        std::map<std::string, CAmount> mapSafe;
+        for (unsigned char n = 1; n <= 4; n++)
+            mapSafe[Address(n)] = ADDRESS_SAFE;
+        file = fopen((pathHeight / "all.dat").string().c_str(), "wb");
+        BOOST_REQUIRE(file);
+        for (std::map<std::string, CAmount>::const_iterator it = mapSafe.begin(); it != mapSafe.end(); it++) {
+            CAddressAmount amount(it->first.c_str(), it->second);
+            BOOST_CHECK(fwrite(&amount, sizeof(amount), 1, file) == 1);
+        }
+        fclose(file);
+    }
+
+    ~AppCheckSetup()
+    {
+        g_nChainHeight = nChainHeightPrev;
+    }
+
+    static CKeyID KeyId(unsigned char n)
+    {
+        return CKeyID(uint160(std::vector<unsigned char>(20, n)));
+    }
+
+    static std::string Address(unsigned char n)
+    {
+        return CBitcoinAddress(KeyId(n)).ToString();
+    }
+
+    /** The candy block has been handled, so claims against it can be checked */
+    void IndexCandyTotal()
+    {
+        BOOST_CHECK(pblocktree->Write_CandyHeight_TotalAmount_Index(nCandyHeight, TOTAL_SAFE));
+    }
+
+    CAmount ClaimAmount() const
+    {
+        return GetCandyShareAmount(ADDRESS_SAFE, TOTAL_SAFE, CANDY_AMOUNT);
+    }
+
+    /** Address n claims its share of candy output nCandy, paying the fee from a coin of its own */
+    CTransaction Claim(unsigned char n, unsigned int nCandy)
+    {
+        CScript script = GetScriptForDestination(KeyId(n));
+        CMutableTransaction tx;
+        tx.nVersion = SAFE_TX_VERSION_2;
+        tx.vin.resize(2);
+        tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        tx.vin[1].prevout = COutPoint(txPut.GetHash(), nCandy);
+        view.AddCoin(tx.vin[0].prevout, Coin(CTxOut(COIN, script), nCandyHeight, false), false);
+
+        CTxOut txout(ClaimAmount(), script);
+        txout.vReserve = FillGetCandyData(CAppHeader(g_nAppHeaderVersion, uint256S(g_strSafeAssetId), GET_CANDY_CMD), CGetCandyData(assetId, ClaimAmount(), ""));
+        tx.vout.push_back(txout);
+        tx.vout.push_back(CTxOut(COIN - COIN / 100, script));
+        return tx;
+    }
+};
+
+static CBlock MakeBlock(const std::vector<CTransaction>& vtx)
+{
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vout.resize(1);
+
+    CBlock block;
+    block.vtx.push_back(coinbase);
+    block.vtx.insert(block.vtx.end(), vtx.begin(), vtx.end());
+    return block;
+}
+
+/** The app checks of ConnectBlock in block order: the reject reason of every tx, empty if valid */
+static std::vector<std::string> CheckBlockApps(const CBlock& block, const CCoinsViewCache& view, std::map<CPutCandy_IndexKey, CAmount>& mapAssetGetCandy)
+{
+    LOCK(cs_main);
+    std::vector<CAppTxCheckResult> vResult;
+    CheckBlockAppTransactions(block, view, vResult);
+
+    std::vector<std::string> vReject;
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        CValidationState state;
+        vReject.push_back(CheckBlockAppTransaction(block.vtx[i], state, view, mapAssetGetCandy, vResult[i]) ? "" : state.GetRejectReason());
+    }
+    return vReject;
+}
+
+BOOST_FIXTURE_TEST_SUITE(app_tests, AppCheckSetup)
+
+BOOST_AUTO_TEST_CASE(app_check_duplicate_candy_claim)
+{
+    IndexCandyTotal();
+
+    // earlier claims leave room for one more share of the first candy only
+    COutPoint outCandy(txPut.GetHash(), 0);
+    BOOST_CHECK(pblocktree->Write_GetCandyCount_Index(CGetCandyCount_IndexKey(assetId, outCandy), CGetCandyCount_IndexValue(CANDY_AMOUNT - ClaimAmount() * 3 / 2)));
+
+    std::vector<CTransaction> vtx;
+    vtx.push_back(Claim(1, 0));
+    vtx.push_back(Claim(2, 1));
+    vtx.push_back(Claim(3, 0));
+    CBlock block = MakeBlock(vtx);
+
+    int nScriptCheckThreadsPrev = nScriptCheckThreads;
+    nScriptCheckThreads = 0;
+    std::map<CPutCandy_IndexKey, CAmount> mapSerial;
+    std::vector<std::string> vSerial = CheckBlockApps(block, view, mapSerial);
+
+    nScriptCheckThreads = 3;
+    boost::thread_group threads;
+    for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        threads.create_thread(&ThreadAppCheck);
+
+    // the first claim on each candy goes to the workers, the second claim on the first candy does not
+    std::vector<CAppTxCheckResult> vResult;
+    {
+        LOCK(cs_main);
+        CheckBlockAppTransactions(block, view, vResult);
+    }
+    BOOST_CHECK(vResult[1].fChecked && vResult[1].fValid);
+    BOOST_CHECK(vResult[2].fChecked && vResult[2].fValid);
+    BOOST_CHECK(!vResult[3].fChecked);
+
+    std::map<CPutCandy_IndexKey, CAmount> mapParallel;
+    std::vector<std::string> vParallel = CheckBlockApps(block, view, mapParallel);
+
+    threads.interrupt_all();
+    threads.join_all();
+    nScriptCheckThreads = nScriptCheckThreadsPrev;
+
+    BOOST_CHECK_EQUAL(vSerial[0], "");
+    BOOST_CHECK_EQUAL(vSerial[1], "");
+    BOOST_CHECK_EQUAL(vSerial[2], "");
+    BOOST_CHECK_EQUAL(vSerial[3], "get_candy: more than the total number of candy issued");
+    BOOST_CHECK(vParallel == vSerial);
+    BOOST_CHECK(mapParallel == mapSerial);
+    BOOST_CHECK_EQUAL(mapSerial.size(), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(app_check_candy_total_pending)
+{
+    // the candy block is still being handled: nothing is handed to the workers
+    std::vector<CTransaction> vtx;
+    vtx.push_back(Claim(1, 0));
+    vtx.push_back(Claim(2, 1));
+    CBlock block = MakeBlock(vtx);
+
+    int nScriptCheckThreadsPrev = nScriptCheckThreads;
+    nScriptCheckThreads = 3;
+    std::vector<CAppTxCheckResult> vResult;
+    {
+        LOCK(cs_main);
+        CheckBlockAppTransactions(block, view, vResult);
+    }
+    nScriptCheckThreads = nScriptCheckThreadsPrev;
+    for (unsigned int i = 0; i < vResult.size(); i++)
+        BOOST_CHECK(!vResult[i].fChecked);
+
+    // and a worker that gets there first fails instead of waiting
+    std::map<CPutCandy_IndexKey, CAmount> mapAssetGetCandy;
+    CAppTxChainInfo chainInfo;
+    chainInfo.nTxHeight = g_nChainHeight + 1;
+    chainInfo.nPrevTxHeight = nCandyHeight;
+    CValidationState state;
+    BOOST_CHECK(!CheckAppTransaction(block.vtx[1], state, view, mapAssetGetCandy, false, &chainInfo));
+    BOOST_CHECK(mapAssetGetCandy.empty());
+
+    IndexCandyTotal();
+    CValidationState stateIndexed;
+    BOOST_CHECK(CheckAppTransaction(block.vtx[1], stateIndexed, view, mapAssetGetCandy, false, &chainInfo));
+    BOOST_CHECK_EQUAL(mapAssetGetCandy.size(), 1U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
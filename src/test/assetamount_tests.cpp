@@ -0,0 +1,64 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "assetamount.h"
+#include "validation.h"
+#include "test/test_safe.h"
+
+#include <limits>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(assetamount_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(assetamount_arithmetic)
+{
+    CAmount n = 0;
+    CAssetAmount a = CAssetAmount::Mul(MAX_ASSETS, MAX_ASSETS);
+    BOOST_CHECK_EQUAL(a.ToString(0), "4000000000000000000000000000000000000");
+    BOOST_CHECK(!a.GetAmount(n));
+    BOOST_CHECK(a.Div(MAX_ASSETS) == CAssetAmount(MAX_ASSETS));
+
+    BOOST_CHECK((CAssetAmount(5) - 7).GetAmount(n) && n == -2);
+    BOOST_CHECK(CAssetAmount(std::numeric_limits<int64_t>::min()).GetAmount(n) && n == std::numeric_limits<int64_t>::min());
+    BOOST_CHECK(CAssetAmount::Mul(-3, 7) == CAssetAmount(-21));
+    BOOST_CHECK(CAssetAmount::Mul(-3, 7).Div(-2) == CAssetAmount(10));
+    BOOST_CHECK(CAssetAmount(-3) < CAssetAmount(1));
+    BOOST_CHECK(!(CAssetAmount(3) - 3).IsNegative());
+}
+
+BOOST_AUTO_TEST_CASE(assetamount_format_parse)
+{
+    BOOST_CHECK_EQUAL(CAssetAmount(0).ToString(4), "0.0000");
+    BOOST_CHECK_EQUAL(CAssetAmount(-5).ToString(4), "-0.0005");
+    BOOST_CHECK_EQUAL(CAssetAmount(123456789).ToString(8), "1.23456789");
+    BOOST_CHECK_EQUAL(CAssetAmount(MAX_ASSETS).ToString(10), "200000000.0000000000");
+
+    CAssetAmount a;
+    BOOST_CHECK(CAssetAmount::Parse("-12.5", 4, a));
+    BOOST_CHECK(a == CAssetAmount(-125000));
+    BOOST_CHECK(CAssetAmount::Parse("7", 4, a));
+    BOOST_CHECK(a == CAssetAmount(70000));
+    BOOST_CHECK(!CAssetAmount::Parse("1.12345", 4, a));
+    BOOST_CHECK(!CAssetAmount::Parse("1.", 4, a));
+    BOOST_CHECK(!CAssetAmount::Parse(".1", 4, a));
+    BOOST_CHECK(!CAssetAmount::Parse("-", 4, a));
+    BOOST_CHECK(!CAssetAmount::Parse("1e3", 4, a));
+    BOOST_CHECK(!CAssetAmount::Parse("100000000000000000000000000000000000000000", 4, a));
+}
+
+BOOST_AUTO_TEST_CASE(candy_amount_range)
+{
+    BOOST_CHECK(IsCandyAmountInRange(1000000, 1000));
+    BOOST_CHECK(IsCandyAmountInRange(1000000, 100000));
+    BOOST_CHECK(!IsCandyAmountInRange(1000000, 999));
+    BOOST_CHECK(!IsCandyAmountInRange(1000000, 100001));
+    // integer parts only: 0.001 * 1999 = 1.999 compares as 1
+    BOOST_CHECK(IsCandyAmountInRange(1999, 1));
+    BOOST_CHECK(IsCandyAmountInRange(999, 0));
+    BOOST_CHECK(!IsCandyAmountInRange(9, 0));
+    BOOST_CHECK(!IsCandyAmountInRange(1000000, -1));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,79 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+#include "random.h"
+
+#include "test/test_safe.h"
+
+#include <boost/make_shared.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockcache_tests, BasicTestingSetup)
+
+static boost::shared_ptr<const CBlock> MakeBlock(unsigned int nTx)
+{
+    boost::shared_ptr<CBlock> pblock = boost::make_shared<CBlock>();
+    for (unsigned int i = 0; i < nTx; i++) {
+        CMutableTransaction tx;
+        tx.nLockTime = i;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey.assign((size_t)100, 0);
+        pblock->vtx.push_back(tx);
+    }
+    return pblock;
+}
+
+BOOST_AUTO_TEST_CASE(blockcache_lru)
+{
+    std::vector<uint256> vHash;
+    std::vector<boost::shared_ptr<const CBlock> > vBlock;
+    for (int i = 0; i < 4; i++) {
+        vHash.push_back(GetRandHash());
+        vBlock.push_back(MakeBlock(10));
+    }
+
+    // measure one block, then size the cache for three of them
+    CBlockCache cache(1 << 20);
+    cache.Insert(vHash[0], vBlock[0]);
+    size_t nBlockUsage = cache.GetStats().nUsage;
+    BOOST_CHECK(nBlockUsage > 10 * 100);
+    cache.SetMaxUsage(3 * nBlockUsage);
+
+    cache.Insert(vHash[1], vBlock[1]);
+    cache.Insert(vHash[2], vBlock[2]);
+    BOOST_CHECK_EQUAL(cache.GetStats().nBlocks, 3U);
+
+    // reading block 0 makes block 1 the least recently used one
+    boost::shared_ptr<const CBlock> pblock;
+    BOOST_CHECK(cache.Get(vHash[0], pblock));
+    BOOST_CHECK(pblock == vBlock[0]);
+    cache.Insert(vHash[3], vBlock[3]);
+    BOOST_CHECK(!cache.Get(vHash[1], pblock));
+    BOOST_CHECK(cache.Get(vHash[0], pblock));
+    BOOST_CHECK(cache.Get(vHash[2], pblock));
+    BOOST_CHECK(cache.Get(vHash[3], pblock));
+
+    CBlockCacheStats stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.nBlocks, 3U);
+    BOOST_CHECK_EQUAL(stats.nUsage, 3 * nBlockUsage);
+    BOOST_CHECK_EQUAL(stats.nHits, 4U);
+    BOOST_CHECK_EQUAL(stats.nMisses, 1U);
+
+    // blocks larger than the whole cache are not kept
+    cache.Insert(GetRandHash(), MakeBlock(100));
+    BOOST_CHECK_EQUAL(cache.GetStats().nBlocks, 3U);
+
+    cache.Erase(vHash[2]);
+    BOOST_CHECK_EQUAL(cache.GetStats().nUsage, 2 * nBlockUsage);
+
+    // a limit of zero disables the cache
+    cache.SetMaxUsage(0);
+    BOOST_CHECK_EQUAL(cache.GetStats().nBlocks, 0U);
+    BOOST_CHECK_EQUAL(cache.GetStats().nUsage, 0U);
+    cache.Insert(vHash[0], vBlock[0]);
+    BOOST_CHECK(!cache.Get(vHash[0], pblock));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,98 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockimport.h"
+#include "clientversion.h"
+#include "streams.h"
+
+#include "test/test_safe.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockimport_tests, BasicTestingSetup)
+
+static const CMessageHeader::MessageStartChars pchTestStart = {0xaa, 0xbb, 0xcc, 0xdd};
+
+static CBlock MakeBlock(int n)
+{
+    CBlock block;
+    block.nNonce = n;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << n;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = n;
+    block.vtx.push_back(tx);
+    return block;
+}
+
+/**
+ * Write nBlocks block records, overstating the size of the fifth record
+ * and following every seventh one with junk starting like a header.
+ */
+static FILE* WriteBlockFile(int nBlocks, bool fDamaged, std::vector<uint256>& vHash)
+{
+    CAutoFile file(tmpfile(), SER_DISK, CLIENT_VERSION);
+    for (int i = 0; i < nBlocks; i++) {
+        CBlock block = MakeBlock(i);
+        vHash.push_back(block.GetHash());
+        unsigned int nSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        if (fDamaged && i == 5)
+            nSize += 100;
+        file << FLATDATA(pchTestStart) << nSize << block;
+        if (fDamaged && i % 7 == 0)
+            for (int j = 0; j < 13; j++)
+                file << pchTestStart[0];
+    }
+    // zero padding like a preallocated blk file
+    for (int i = 0; i < 1000; i++)
+        file << (unsigned char)0;
+    FILE* fileOut = file.release();
+    rewind(fileOut);
+    return fileOut;
+}
+
+static std::vector<uint256> ReadBlockFile(FILE* fileIn, int nThreads)
+{
+    std::vector<uint256> vHash;
+    CBlockImportReader reader(fileIn, 3, pchTestStart, 1000000, nThreads);
+    CImportedBlock block;
+    while (reader.Next(block)) {
+        BOOST_CHECK(block.pblock);
+        BOOST_CHECK_EQUAL(block.pos.nFile, 3);
+        if (block.pblock) {
+            BOOST_CHECK(block.hash == block.pblock->GetHash());
+            // the decoded block takes more memory than its serialization
+            BOOST_CHECK(block.nMemUsage > block.nSize);
+            vHash.push_back(block.hash);
+        }
+    }
+    return vHash;
+}
+
+BOOST_AUTO_TEST_CASE(blockimport_order)
+{
+    std::vector<uint256> vHash;
+    FILE* file = WriteBlockFile(2000, false, vHash);
+    BOOST_CHECK(ReadBlockFile(file, 4) == vHash);
+}
+
+BOOST_AUTO_TEST_CASE(blockimport_resync)
+{
+    std::vector<uint256> vHash;
+    FILE* file = WriteBlockFile(200, true, vHash);
+    BOOST_CHECK(ReadBlockFile(file, 2) == vHash);
+}
+
+BOOST_AUTO_TEST_CASE(blockimport_interrupt)
+{
+    std::vector<uint256> vHash;
+    FILE* file = WriteBlockFile(2000, false, vHash);
+    CBlockImportReader reader(file, -1, pchTestStart, 1000000, 2);
+    CImportedBlock block;
+    BOOST_CHECK(reader.Next(block));
+    BOOST_CHECK(block.hash == vHash[0]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,75 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockwriter.h"
+#include "clientversion.h"
+#include "streams.h"
+#include "validation.h"
+
+#include "test/test_safe.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockwriter_tests, TestingSetup)
+
+static std::vector<char> ReadFile(int nFile, bool fUndo, size_t nSize)
+{
+    CDiskBlockPos pos(nFile, 0);
+    CAutoFile file(fUndo ? OpenUndoFile(pos, true) : OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    std::vector<char> vData(nSize);
+    if (file.IsNull() || fread(&vData[0], 1, nSize, file.Get()) != nSize)
+        vData.clear();
+    return vData;
+}
+
+static void WriteRecords(CBlockFileWriter& writer, int nFile, bool fUndo)
+{
+    // a queue bound smaller than the records exercises waiting for the writer
+    std::vector<char> vExpected;
+    for (int i = 0; i < 200; i++) {
+        CDiskBlockPos pos(nFile, vExpected.size());
+        std::vector<char> vRecord(100 + i, (char)i);
+        vExpected.insert(vExpected.end(), vRecord.begin(), vRecord.end());
+        BOOST_CHECK(writer.Write(pos, fUndo, vRecord));
+
+        // a record reads back the same whether it is still queued or not
+        std::vector<char> vRead;
+        pos.nPos += 10;
+        if (writer.ReadPending(pos, fUndo, vRead))
+            BOOST_CHECK(vRead == std::vector<char>(vExpected.begin() + pos.nPos, vExpected.end()));
+        else
+            BOOST_CHECK(ReadFile(nFile, fUndo, vExpected.size()) == vExpected);
+    }
+
+    BOOST_CHECK(writer.Flush());
+    std::vector<char> vRead;
+    BOOST_CHECK(!writer.ReadPending(CDiskBlockPos(nFile, 0), fUndo, vRead));
+    BOOST_CHECK(ReadFile(nFile, fUndo, vExpected.size()) == vExpected);
+}
+
+BOOST_AUTO_TEST_CASE(blockwriter_inline)
+{
+    CBlockFileWriter writer(1000);
+    WriteRecords(writer, 5, false);
+    WriteRecords(writer, 5, true);
+}
+
+BOOST_AUTO_TEST_CASE(blockwriter_thread)
+{
+    CBlockFileWriter writer(1000);
+    writer.Start();
+    WriteRecords(writer, 6, false);
+    WriteRecords(writer, 6, true);
+
+    // committing a finished file truncates it to its final size
+    std::vector<char> vRecord(50, 'x');
+    BOOST_CHECK(writer.Write(CDiskBlockPos(7, 0), false, vRecord));
+    writer.Commit(7, true, 20, 0);
+    BOOST_CHECK(writer.Flush());
+    BOOST_CHECK(ReadFile(7, false, 20) == std::vector<char>(20, 'x'));
+    BOOST_CHECK(ReadFile(7, false, 21).empty());
+    writer.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
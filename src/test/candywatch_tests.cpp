@@ -0,0 +1,154 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "app/candywatch.h"
+#include "base58.h"
+#include "flat-database.h"
+#include "random.h"
+#include "util.h"
+
+#include "test/test_safe.h"
+
+#ifdef ENABLE_WALLET
+#include "rpc/server.h"
+#include <univalue.h>
+#endif
+
+#include <stdio.h>
+#include <algorithm>
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+#ifdef ENABLE_WALLET
+extern UniValue CallRPC(std::string args);
+#endif
+
+static CIndexAddress RandomWatchAddress(bool fScript)
+{
+    uint256 hash = GetRandHash();
+    uint160 hash160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20));
+    if (fScript)
+        return CIndexAddress(CTxDestination(CScriptID(hash160)));
+    return CIndexAddress(CTxDestination(CKeyID(hash160)));
+}
+
+static std::vector<unsigned char> Serialized(const CCandyWatchSet& watchSet)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << watchSet;
+    return std::vector<unsigned char>(ss.begin(), ss.end());
+}
+
+BOOST_FIXTURE_TEST_SUITE(candywatch_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(candywatch_round_trip)
+{
+    // key and script addresses, some of them twice
+    std::vector<CIndexAddress> vAddress;
+    for (int i = 0; i < 60; i++)
+        vAddress.push_back(RandomWatchAddress(i % 6 == 0));
+    std::vector<CIndexAddress> vAdd(vAddress);
+    vAdd.insert(vAdd.end(), vAddress.begin(), vAddress.begin() + 10);
+    std::random_shuffle(vAdd.begin(), vAdd.end(), GetRandInt);
+
+    CCandyWatchSet watchSet;
+    BOOST_CHECK_EQUAL(watchSet.Add(vAdd), vAddress.size());
+    BOOST_CHECK_EQUAL(watchSet.Add(std::vector<CIndexAddress>(vAddress.begin(), vAddress.begin() + 20)), 0U);
+    BOOST_CHECK_EQUAL(watchSet.Remove(std::vector<CIndexAddress>(vAddress.begin(), vAddress.begin() + 5)), 5U);
+    BOOST_CHECK_EQUAL(watchSet.Remove(std::vector<CIndexAddress>(vAddress.begin(), vAddress.begin() + 5)), 0U);
+    BOOST_CHECK_EQUAL(watchSet.Size(), vAddress.size() - 5);
+
+    // the encoded addresses are the remaining ones, in set order
+    std::vector<CIndexAddress> vExpected(vAddress.begin() + 5, vAddress.end());
+    std::sort(vExpected.begin(), vExpected.end());
+    std::vector<std::string> vEncoded = watchSet.GetAddresses();
+    BOOST_REQUIRE_EQUAL(vEncoded.size(), vExpected.size());
+    for (unsigned int i = 0; i < vEncoded.size(); i++) {
+        BOOST_CHECK_EQUAL(vEncoded[i], vExpected[i].ToString());
+        BOOST_CHECK(CIndexAddress(CBitcoinAddress(vEncoded[i]).Get()) == vExpected[i]);
+    }
+
+    // written to candywatch.dat and read back unchanged
+    CFlatDB<CCandyWatchSet> flatdb("candywatch.dat", "magicCandyWatchCache");
+    BOOST_REQUIRE(flatdb.Dump(watchSet));
+    CCandyWatchSet watchSetLoaded;
+    BOOST_REQUIRE(flatdb.Load(watchSetLoaded));
+    BOOST_CHECK(watchSetLoaded.GetAddresses() == vEncoded);
+    BOOST_CHECK(Serialized(watchSetLoaded) == Serialized(watchSet));
+
+    // the loaded set keeps merging in order
+    CIndexAddress addressNew = RandomWatchAddress(true);
+    BOOST_CHECK_EQUAL(watchSetLoaded.Add(std::vector<CIndexAddress>(1, addressNew)), 1U);
+    vExpected.push_back(addressNew);
+    std::sort(vExpected.begin(), vExpected.end());
+    BOOST_CHECK_EQUAL(watchSetLoaded.GetAddresses()[std::find(vExpected.begin(), vExpected.end(), addressNew) - vExpected.begin()], addressNew.ToString());
+
+    // another cache's magic message and a damaged file are refused
+    CFlatDB<CCandyWatchSet> flatdbOther("candywatch.dat", "magicFulfilledCache");
+    CCandyWatchSet watchSetOther;
+    BOOST_CHECK(!flatdbOther.Load(watchSetOther));
+    boost::filesystem::path path = GetDataDir() / "candywatch.dat";
+    FILE* file = fopen(path.string().c_str(), "r+b");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE(fseek(file, boost::filesystem::file_size(path) / 2, SEEK_SET) == 0);
+    int ch = fgetc(file);
+    BOOST_REQUIRE(fseek(file, -1, SEEK_CUR) == 0);
+    fputc(ch ^ 0xff, file);
+    fclose(file);
+    CCandyWatchSet watchSetDamaged;
+    BOOST_CHECK(!flatdb.Load(watchSetDamaged));
+
+    // a missing file is an empty set
+    boost::filesystem::remove(path);
+    CCandyWatchSet watchSetMissing;
+    BOOST_CHECK(flatdb.Load(watchSetMissing));
+    BOOST_CHECK_EQUAL(watchSetMissing.Size(), 0U);
+}
+
+#ifdef ENABLE_WALLET
+static bool IsNegativeVoutError(const std::runtime_error& e)
+{
+    return std::string(e.what()) == "Invalid parameter, vout must be positive";
+}
+
+BOOST_AUTO_TEST_CASE(candywatch_rpc_persists)
+{
+    std::vector<CIndexAddress> vAddress;
+    for (int i = 0; i < 6; i++)
+        vAddress.push_back(RandomWatchAddress(i == 0));
+
+    // from a JSON array and from a file with comments and blank lines
+    UniValue r = CallRPC("addcandywatchaddresses [\"" + vAddress[0].ToString() + "\",\"" + vAddress[1].ToString() + "\",\"" + vAddress[0].ToString() + "\"]");
+    BOOST_CHECK_EQUAL(find_value(r, "added").get_int(), 2);
+    boost::filesystem::path pathList = GetDataDir() / "watch.txt";
+    {
+        std::ofstream list(pathList.string().c_str());
+        list << "# deposit addresses\n";
+        for (unsigned int i = 1; i < vAddress.size(); i++)
+            list << vAddress[i].ToString() << "\n\n";
+    }
+    r = CallRPC("addcandywatchaddresses \"" + pathList.string() + "\"");
+    BOOST_CHECK_EQUAL(find_value(r, "added").get_int(), 4);
+    r = CallRPC("removecandywatchaddresses [\"" + vAddress[2].ToString() + "\"]");
+    BOOST_CHECK_EQUAL(find_value(r, "removed").get_int(), 1);
+    BOOST_CHECK_EQUAL(find_value(r, "size").get_int(), 5);
+    BOOST_CHECK_THROW(CallRPC("addcandywatchaddresses [\"notanaddress\"]"), std::runtime_error);
+    BOOST_CHECK_EXCEPTION(CallRPC("getcandywatchamounts " + GetRandHash().GetHex() + " " + GetRandHash().GetHex() + " -1"), std::runtime_error, IsNegativeVoutError);
+
+    // every change is on disk
+    CCandyWatchSet watchSetLoaded;
+    CFlatDB<CCandyWatchSet> flatdb("candywatch.dat", "magicCandyWatchCache");
+    BOOST_REQUIRE(flatdb.Load(watchSetLoaded));
+    BOOST_CHECK(Serialized(watchSetLoaded) == Serialized(candyWatchSet));
+    BOOST_CHECK_EQUAL(watchSetLoaded.Size(), 5U);
+    std::vector<std::string> vLoaded = watchSetLoaded.GetAddresses();
+    BOOST_CHECK(std::find(vLoaded.begin(), vLoaded.end(), vAddress[2].ToString()) == vLoaded.end());
+
+    candyWatchSet.Clear();
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,125 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "chainindexer.h"
+#include "txdb.h"
+#include "validation.h"
+
+#include "test/test_safe.h"
+
+#include <boost/make_shared.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(chainindexer_tests, TestingSetup)
+
+// Gives the tests access to the validation interface callbacks
+class CTestIndexer : public CChainIndexer
+{
+public:
+    CTestIndexer() : CChainIndexer(1000) {}
+
+    void Connect(const CBlock& block, const CBlockIndex* pindex) { BlockConnected(block, pindex, boost::make_shared<const CBlockUndo>()); }
+    void Disconnect(const CBlock& block, const CBlockIndex* pindex) { BlockDisconnected(block, pindex, boost::make_shared<const CBlockUndo>()); }
+};
+
+struct CTestBlock
+{
+    CBlock block;
+    uint256 hash;
+    CBlockIndex index;
+};
+
+static void MakeBlocks(std::vector<CTestBlock>& vBlock, size_t nBlocks)
+{
+    vBlock.resize(nBlocks);
+    for (size_t i = 0; i < nBlocks; i++) {
+        CTestBlock& test = vBlock[i];
+        for (int j = 0; j < 3; j++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout.n = i * 3 + j;
+            tx.vout.resize(1);
+            tx.vout[0].nValue = j;
+            test.block.vtx.push_back(tx);
+        }
+        test.block.nNonce = i;
+        test.hash = test.block.GetHash();
+        test.index = CBlockIndex(test.block);
+        test.index.phashBlock = &test.hash;
+        test.index.pprev = i ? &vBlock[i-1].index : NULL;
+        test.index.nHeight = i;
+        test.index.nFile = 0;
+        test.index.nDataPos = i * 1000;
+        test.index.nStatus |= BLOCK_HAVE_DATA;
+    }
+}
+
+static void CheckTxIndex(CChainIndexer& indexer, const CTestBlock& test, bool fOnDisk)
+{
+    for (size_t i = 0; i < test.block.vtx.size(); i++) {
+        CDiskTxPos pos;
+        BOOST_CHECK(indexer.ReadTxIndex(test.block.vtx[i].GetHash(), pos));
+        BOOST_CHECK_EQUAL(pos.nPos, test.index.nDataPos);
+        if (fOnDisk) {
+            CDiskTxPos posDisk;
+            BOOST_CHECK(pblocktree->ReadTxIndex(test.block.vtx[i].GetHash(), posDisk));
+            BOOST_CHECK(posDisk == pos && posDisk.nTxOffset == pos.nTxOffset);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(chainindexer_inline)
+{
+    CTestIndexer indexer;
+    std::vector<CTestBlock> vBlock;
+    MakeBlocks(vBlock, 2);
+
+    // without a thread every block is written before the callback returns
+    indexer.Connect(vBlock[0].block, &vBlock[0].index);
+    indexer.Connect(vBlock[1].block, &vBlock[1].index);
+    CheckTxIndex(indexer, vBlock[0], true);
+    CheckTxIndex(indexer, vBlock[1], true);
+    uint256 hashBest;
+    BOOST_CHECK(pblocktree->ReadIndexBestBlock(hashBest));
+    BOOST_CHECK(hashBest == vBlock[1].hash);
+
+    // the tx index keeps the entries of a disconnected block
+    indexer.Disconnect(vBlock[1].block, &vBlock[1].index);
+    CheckTxIndex(indexer, vBlock[1], true);
+    BOOST_CHECK(pblocktree->ReadIndexBestBlock(hashBest));
+    BOOST_CHECK(hashBest == vBlock[0].hash);
+    BOOST_CHECK(indexer.GetBestBlock() == vBlock[0].hash);
+}
+
+BOOST_AUTO_TEST_CASE(chainindexer_thread)
+{
+    CTestIndexer indexer;
+    indexer.Start();
+    std::vector<CTestBlock> vBlock;
+    MakeBlocks(vBlock, 100);
+
+    // positions are visible as soon as the block is connected, written or not
+    for (size_t i = 0; i < vBlock.size(); i++) {
+        indexer.Connect(vBlock[i].block, &vBlock[i].index);
+        CheckTxIndex(indexer, vBlock[i], false);
+    }
+    BOOST_CHECK(indexer.GetBestBlock() == vBlock.back().hash);
+
+    BOOST_CHECK(indexer.Sync());
+    for (size_t i = 0; i < vBlock.size(); i++)
+        CheckTxIndex(indexer, vBlock[i], true);
+    BOOST_CHECK(indexer.Flush());
+    uint256 hashBest;
+    BOOST_CHECK(pblocktree->ReadIndexBestBlock(hashBest));
+    BOOST_CHECK(hashBest == vBlock.back().hash);
+
+    // stopping writes whatever is still queued
+    indexer.Disconnect(vBlock.back().block, &vBlock.back().index);
+    indexer.Stop();
+    BOOST_CHECK(pblocktree->ReadIndexBestBlock(hashBest));
+    BOOST_CHECK(hashBest == vBlock[vBlock.size() - 2].hash);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,90 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+
+#include "test/test_safe.h"
+
+#include <atomic>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+static std::atomic<int> nChecksRun(0);
+
+struct CCountingCheck
+{
+    bool fOk;
+
+    CCountingCheck(bool fOkIn = true) : fOk(fOkIn) {}
+
+    bool operator()()
+    {
+        nChecksRun++;
+        return fOk;
+    }
+
+    void swap(CCountingCheck& check)
+    {
+        std::swap(fOk, check.fOk);
+    }
+};
+
+static void RunRounds(CCheckQueue<CCountingCheck>& queue, int nRounds)
+{
+    for (int nRound = 0; nRound < nRounds; nRound++) {
+        nChecksRun = 0;
+        int nAdded = 0;
+        CCheckQueueControl<CCountingCheck> control(&queue);
+        // uneven batch sizes, like the inputs of the transactions of a block
+        for (int i = 0; i < 50; i++) {
+            std::vector<CCountingCheck> vChecks((nRound * 7 + i * 13) % 40);
+            nAdded += vChecks.size();
+            control.Add(vChecks);
+        }
+        BOOST_CHECK(control.Wait());
+        BOOST_CHECK_EQUAL(nChecksRun, nAdded);
+        BOOST_CHECK(queue.IsIdle());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_master_only)
+{
+    CCheckQueue<CCountingCheck> queue(16);
+    RunRounds(queue, 20);
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_workers)
+{
+    // more workers than deques, so some of them share one
+    CCheckQueue<CCountingCheck> queue(16, 4);
+    boost::thread_group threads;
+    for (int i = 0; i < 6; i++)
+        threads.create_thread(boost::bind(&CCheckQueue<CCountingCheck>::Thread, boost::ref(queue)));
+
+    RunRounds(queue, 200);
+
+    // a failure is reported once and does not stick to the next round
+    {
+        CCheckQueueControl<CCountingCheck> control(&queue);
+        std::vector<CCountingCheck> vChecks(500);
+        vChecks[250].fOk = false;
+        control.Add(vChecks);
+        BOOST_CHECK(!control.Wait());
+    }
+    BOOST_CHECK(queue.IsIdle());
+    RunRounds(queue, 5);
+
+    threads.interrupt_all();
+    threads.join_all();
+
+    // the master carries on alone once the workers are gone
+    BOOST_CHECK_EQUAL(queue.GetWorkers(), 0U);
+    RunRounds(queue, 5);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,7 +4,10 @@
 
 #include "coins.h"
 #include "random.h"
+#include "script/standard.h"
+#include "streams.h"
 #include "uint256.h"
+#include "undo.h"
 #include "test/test_safe.h"
 #include "validation.h"
 #include "consensus/validation.h"
@@ -14,34 +17,36 @@
 
 #include <boost/test/unit_test.hpp>
 
+bool operator==(const Coin &a, const Coin &b) {
+    // Empty Coin objects are always equal.
+    if (a.IsSpent() && b.IsSpent()) return true;
+    return a.fCoinBase == b.fCoinBase &&
+           a.nHeight == b.nHeight &&
+           a.out == b.out;
+}
+
 namespace
 {
 class CCoinsViewTest : public CCoinsView
 {
     uint256 hashBestBlock_;
-    std::map<uint256, CCoins> map_;
+    std::map<COutPoint, Coin> map_;
 
 public:
-    bool GetCoins(const uint256& txid, CCoins& coins) const
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
     {
-        std::map<uint256, CCoins>::const_iterator it = map_.find(txid);
+        std::map<COutPoint, Coin>::const_iterator it = map_.find(outpoint);
         if (it == map_.end()) {
             return false;
         }
-        coins = it->second;
-        if (coins.IsPruned() && insecure_rand() % 2 == 0) {
+        coin = it->second;
+        if (coin.IsSpent() && insecure_rand() % 2 == 0) {
             // Randomly return false in case of an empty entry.
             return false;
         }
         return true;
     }
 
-    bool HaveCoins(const uint256& txid) const
-    {
-        CCoins coins;
-        return GetCoins(txid, coins);
-    }
-
     uint256 GetBestBlock() const { return hashBestBlock_; }
 
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
@@ -49,8 +54,8 @@ public:
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
                 // Same optimization used in CCoinsViewDB is to only write dirty entries.
-                map_[it->first] = it->second.coins;
-                if (it->second.coins.IsPruned() && insecure_rand() % 3 == 0) {
+                map_[it->first] = it->second.coin;
+                if (it->second.coin.IsSpent() && insecure_rand() % 3 == 0) {
                     // Randomly delete empty entries on write.
                     map_.erase(it->first);
                 }
@@ -63,6 +68,8 @@ public:
     }
 
     bool GetStats(CCoinsStats& stats) const { return false; }
+
+    size_t Size() const { return map_.size(); }
 };
 
 class CCoinsViewCacheTest : public CCoinsViewCache
@@ -74,9 +81,12 @@ public:
     {
         // Manually recompute the dynamic usage of the whole data, and compare it.
         size_t ret = memusage::DynamicUsage(cacheCoins);
+        size_t count = 0;
         for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
-            ret += it->second.coins.DynamicMemoryUsage();
+            ret += it->second.coin.DynamicMemoryUsage();
+            ++count;
         }
+        BOOST_CHECK_EQUAL(GetCacheSize(), count);
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
 
@@ -91,7 +101,7 @@ static const unsigned int NUM_SIMULATION_ITERATIONS = 40000;
 // This is a large randomized insert/remove simulation test on a variable-size
 // stack of caches on top of CCoinsViewTest.
 //
-// It will randomly create/update/delete CCoins entries to a tip of caches, with
+// It will randomly create/update/delete Coin entries to a tip of caches, with
 // txids picked from a limited list of random 256-bit hashes. Occasionally, a
 // new tip is added to the stack of caches, or the tip is flushed and removed.
 //
@@ -103,13 +113,15 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool removed_all_caches = false;
     bool reached_4_caches = false;
     bool added_an_entry = false;
+    bool added_an_unspendable_entry = false;
     bool removed_an_entry = false;
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool uncached_an_entry = false;
 
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
@@ -127,36 +139,54 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
         // Do a random modification.
         {
             uint256 txid = txids[insecure_rand() % txids.size()]; // txid we're going to modify in this iteration.
-            CCoins& coins = result[txid];
-            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
-            BOOST_CHECK(coins == *entry);
-            if (insecure_rand() % 5 == 0 || coins.IsPruned()) {
-                if (coins.IsPruned()) {
-                    added_an_entry = true;
+            Coin& coin = result[COutPoint(txid, 0)];
+            const Coin& entry = (insecure_rand() % 500 == 0) ? AccessByTxid(*stack.back(), txid) : stack.back()->AccessCoin(COutPoint(txid, 0));
+            BOOST_CHECK(coin == entry);
+
+            if (insecure_rand() % 5 == 0 || coin.IsSpent()) {
+                Coin newcoin;
+                newcoin.out.nValue = insecure_rand();
+                newcoin.nHeight = 1;
+                if (insecure_rand() % 16 == 0 && coin.IsSpent()) {
+                    newcoin.out.scriptPubKey.assign(1 + (insecure_rand() & 0x3F), OP_RETURN);
+                    BOOST_CHECK(newcoin.out.scriptPubKey.IsUnspendable());
+                    added_an_unspendable_entry = true;
                 } else {
-                    updated_an_entry = true;
+                    newcoin.out.scriptPubKey.assign(insecure_rand() & 0x3F, 0); // Random sizes so we can test memory usage accounting
+                    if (coin.IsSpent())
+                        added_an_entry = true;
+                    else
+                        updated_an_entry = true;
+                    coin = newcoin;
                 }
-                coins.nVersion = insecure_rand();
-                coins.vout.resize(1);
-                coins.vout[0].nValue = insecure_rand();
-                *entry = coins;
+                stack.back()->AddCoin(COutPoint(txid, 0), std::move(newcoin), !coin.IsSpent() || insecure_rand() & 1);
             } else {
-                coins.Clear();
-                entry->Clear();
                 removed_an_entry = true;
+                coin.Clear();
+                stack.back()->SpendCoin(COutPoint(txid, 0));
             }
         }
 
+        // One every 10 iterations, remove a random entry from the cache
+        if (insecure_rand() % 10 == 0) {
+            COutPoint out(txids[insecure_rand() % txids.size()], 0);
+            int cacheid = insecure_rand() % stack.size();
+            stack[cacheid]->Uncache(out);
+            uncached_an_entry |= !stack[cacheid]->HaveCoinInCache(out);
+        }
+
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                    found_an_entry = true;
-                } else {
-                    BOOST_CHECK(it->second.IsPruned());
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
+                if (coin.IsSpent()) {
                     missed_an_entry = true;
+                } else {
+                    BOOST_CHECK(stack.back()->HaveCoinInCache(it->first));
+                    found_an_entry = true;
                 }
             }
             BOOST_FOREACH(const CCoinsViewCacheTest *test, stack) {
@@ -205,10 +235,12 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(removed_all_caches);
     BOOST_CHECK(reached_4_caches);
     BOOST_CHECK(added_an_entry);
+    BOOST_CHECK(added_an_unspendable_entry);
     BOOST_CHECK(removed_an_entry);
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(uncached_an_entry);
 }
 
 // This test is similar to the previous test
@@ -220,7 +252,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
 {
     bool spent_a_duplicate_coinbase = false;
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
@@ -238,6 +270,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
             tx.vin.resize(1);
             tx.vout.resize(1);
             tx.vout[0].nValue = i; //Keep txs unique unless intended to duplicate
+            tx.vout[0].scriptPubKey.assign(insecure_rand() & 0x3F, 0); // Random sizes so we can test memory usage accounting
             unsigned int height = insecure_rand();
 
             // 1/10 times create a coinbase
@@ -249,7 +282,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
                         coinbaseIt = coinbaseids.begin();
                     }
                     //Use same random value to have same hash and be a true duplicate
-                    tx.vout[0].nValue = coinbaseIt->second;
+                    tx.vout[0] = result[COutPoint(coinbaseIt->first, 0)].out;
                     assert(tx.GetHash() == coinbaseIt->first);
                     duplicateids.insert(coinbaseIt->first);
                 }
@@ -273,8 +306,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
                 tx.vin[0].prevout.n = 0;
 
                 // Update the expected result of prevouthash to know these coins are spent
-                CCoins& oldcoins = result[prevouthash];
-                oldcoins.Clear();
+                result[COutPoint(prevouthash, 0)].Clear();
 
                 // It is of particular importance here that once we spend a coinbase tx hash
                 // it is no longer available to be duplicated (or spent again)
@@ -294,8 +326,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
             alltxids.insert(tx.GetHash());
 
             // Update the expected result to know about the new output coins
-            CCoins &coins = result[tx.GetHash()];
-            coins.FromTx(tx, height);
+            result[COutPoint(tx.GetHash(), 0)] = Coin(tx.vout[0], height, CTransaction(tx).IsCoinBase());
 
             CValidationState dummy;
             UpdateCoins(tx, dummy, *(stack.back()), height);
@@ -303,13 +334,14 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
 
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                 } else {
-                    BOOST_CHECK(it->second.IsPruned());
-                 }
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
+            }
+            BOOST_FOREACH(const CCoinsViewCacheTest *test, stack) {
+                test->SelfTest();
             }
         }
 
@@ -347,4 +379,86 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
     BOOST_CHECK(spent_a_duplicate_coinbase);
 }
 
+// Spending one output of a wide payout only touches that output's entry
+BOOST_AUTO_TEST_CASE(coins_spend_single_output)
+{
+    CCoinsViewTest base;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vout.resize(200);
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        tx.vout[i].nValue = i + 1;
+        tx.vout[i].scriptPubKey = GetScriptForDestination(CKeyID(uint160(std::vector<unsigned char>(20, i))));
+    }
+    const uint256 txid = tx.GetHash();
+    {
+        CCoinsViewCacheTest cache(&base);
+        AddCoins(cache, tx, 100);
+        BOOST_CHECK_EQUAL(cache.GetCacheSize(), tx.vout.size());
+        cache.SelfTest();
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK_EQUAL(base.Size(), tx.vout.size());
+
+    CCoinsViewCacheTest cache(&base);
+    Coin spent;
+    BOOST_CHECK(cache.SpendCoin(COutPoint(txid, 7), &spent));
+    BOOST_CHECK(spent.out == tx.vout[7]);
+    BOOST_CHECK_EQUAL(spent.nHeight, 100U);
+    BOOST_CHECK(!spent.IsCoinBase());
+    // only the spent output was loaded
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+    cache.SelfTest();
+    BOOST_CHECK(!cache.SpendCoin(COutPoint(txid, 7)));
+    BOOST_CHECK(!cache.HaveCoin(COutPoint(txid, 7)));
+    BOOST_CHECK(cache.HaveCoin(COutPoint(txid, 8)));
+    BOOST_CHECK(!AccessByTxid(cache, txid).IsSpent());
+    BOOST_CHECK(cache.Flush());
+
+    Coin coin;
+    BOOST_CHECK(!base.GetCoin(COutPoint(txid, 7), coin) || coin.IsSpent());
+    BOOST_CHECK(base.GetCoin(COutPoint(txid, 199), coin) && coin.out == tx.vout[199]);
+}
+
+BOOST_AUTO_TEST_CASE(coin_serialization)
+{
+    CTxOut out(123456789, GetScriptForDestination(CKeyID(uint160(std::vector<unsigned char>(20, 0x42)))), 5000);
+    out.vReserve.assign(90, 0x17);
+    Coin coin(out, 4242, true);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << coin;
+    BOOST_CHECK_EQUAL(ss.size(), coin.GetSerializeSize(SER_DISK, CLIENT_VERSION));
+    Coin coin2;
+    ss >> coin2;
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK(coin2 == coin);
+    BOOST_CHECK_EQUAL(coin2.out.nUnlockedHeight, 5000);
+    BOOST_CHECK(coin2.out.vReserve == out.vReserve);
+
+    // Undo records written before the UTXO set was keyed by outpoint carry the
+    // transaction version after the height; it is skipped when read back.
+    unsigned int nCode = 4242 * 2 + 1;
+    int nTxVersion = SAFE_TX_VERSION_1;
+    CDataStream ssUndo(SER_DISK, CLIENT_VERSION | SERIALIZE_TXOUT_LEGACY);
+    ssUndo << VARINT(nCode) << VARINT(nTxVersion) << CTxOutCompressor(REF(out));
+    Coin undo;
+    TxInUndoDeserializer deserializer(&undo);
+    ssUndo >> deserializer;
+    BOOST_CHECK(ssUndo.empty());
+    BOOST_CHECK(undo == coin);
+
+    // and a record written now reads back the same way
+    CTxUndo txundo;
+    txundo.vprevout.push_back(coin);
+    CDataStream ssTxUndo(SER_DISK, CLIENT_VERSION);
+    ssTxUndo << txundo;
+    BOOST_CHECK_EQUAL(ssTxUndo.size(), txundo.GetSerializeSize(SER_DISK, CLIENT_VERSION));
+    CTxUndo txundo2;
+    ssTxUndo >> txundo2;
+    BOOST_CHECK_EQUAL(txundo2.vprevout.size(), 1U);
+    BOOST_CHECK(txundo2.vprevout[0] == coin);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
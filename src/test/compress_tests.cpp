@@ -3,7 +3,10 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "compressor.h"
+#include "random.h"
+#include "streams.h"
 #include "util.h"
+#include "version.h"
 #include "test/test_safe.h"
 
 #include <stdint.h>
@@ -62,4 +65,85 @@ BOOST_AUTO_TEST_CASE(compress_amounts)
         BOOST_CHECK(TestDecode(i));
 }
 
+static std::vector<unsigned char> MakeAppReserve(const uint256& appId, uint32_t nAppCmd, unsigned int nDataSize)
+{
+    std::vector<unsigned char> vReserve(TXOUT_RESERVE_MIN_SIZE + sizeof(uint16_t) + 32 + sizeof(uint32_t), 0);
+    memcpy(&vReserve[0], "safe", 4);
+    WriteLE16(&vReserve[4], 1);
+    memcpy(&vReserve[6], appId.begin(), 32);
+    WriteLE32(&vReserve[38], nAppCmd);
+    for (unsigned int i = 0; i < nDataSize; i++)
+        vReserve.push_back(i);
+    return vReserve;
+}
+
+// Round trips txout through both encodings and returns the compact size
+static unsigned int CheckReserveRoundTrip(const CTxOut& txout, int nLegacySavings)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << CTxOutCompressor(REF(txout));
+    unsigned int nSize = ss.size();
+    BOOST_CHECK_EQUAL(nSize, ::GetSerializeSize(CTxOutCompressor(REF(txout)), SER_DISK, CLIENT_VERSION));
+    CTxOut txout2;
+    ss >> REF(CTxOutCompressor(txout2));
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK(txout2 == txout);
+
+    CDataStream ssLegacy(SER_DISK, CLIENT_VERSION | SERIALIZE_TXOUT_LEGACY);
+    ssLegacy << CTxOutCompressor(REF(txout));
+    if (nLegacySavings >= 0)
+        BOOST_CHECK_EQUAL(ssLegacy.size() - nSize, (unsigned int)nLegacySavings);
+    CTxOut txout3;
+    ssLegacy >> REF(CTxOutCompressor(txout3));
+    BOOST_CHECK(ssLegacy.empty());
+    BOOST_CHECK(txout3 == txout);
+    return nSize;
+}
+
+BOOST_AUTO_TEST_CASE(compress_txout_reserve)
+{
+    CScript script = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0x11) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    // plain SAFE output: 12 bytes smaller
+    CTxOut txout(COIN, script);
+    BOOST_CHECK_EQUAL(CheckReserveRoundTrip(txout, 12), 1U + 21 + 1);
+
+    // locked outputs
+    txout.nUnlockedHeight = 123456;
+    CheckReserveRoundTrip(txout, 12 - 3);
+    txout.nUnlockedHeight = -5;
+    CheckReserveRoundTrip(txout, -1);
+    txout.nUnlockedHeight = std::numeric_limits<int64_t>::min();
+    CheckReserveRoundTrip(txout, -1);
+    txout.nUnlockedHeight = 0;
+
+    // reserves that are not an app header are stored as they are
+    txout.vReserve.clear();
+    CheckReserveRoundTrip(txout, -1);
+    txout.vReserve.assign(3, 's');
+    CheckReserveRoundTrip(txout, -1);
+    txout.vReserve = MakeAppReserve(uint256(), TRANSFER_SAFE_CMD, 0);
+    txout.vReserve[0] = 'S';
+    CheckReserveRoundTrip(txout, -1);
+
+    // app outputs drop the marker, and the app id when it is well known
+    txout.vReserve = MakeAppReserve(GetRandHash(), REGISTER_APP_CMD, 100);
+    CheckReserveRoundTrip(txout, 15);
+    txout.vReserve = MakeAppReserve(uint256S("cfe2450bf016e2ad8130e4996960a32e0686c1704b62a6ad02e49ee805a9b288"), TRANSFER_ASSET_CMD, 60);
+    CheckReserveRoundTrip(txout, 46);
+    txout.vReserve = MakeAppReserve(uint256S("a4bea6705cd38d535e873da1c9ad897048b6bbc8e286ca9b28bd18bb22eedcc9"), 0xffffffff, 0);
+    CheckReserveRoundTrip(txout, -1);
+
+    // unknown codes are rejected
+    unsigned int nCode = 3;
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << VARINT(nCode);
+    CTxOut txout2;
+    BOOST_CHECK_THROW(ss >> REF(CReserveCompressor(txout2)), std::ios_base::failure);
+    nCode = 100 * 4;
+    ss.clear();
+    ss << VARINT(nCode);
+    BOOST_CHECK_THROW(ss >> REF(CReserveCompressor(txout2)), std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,125 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+#include "random.h"
+
+#include "test/test_safe.h"
+
+#include <atomic>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+static std::vector<uint256> RandomEntries(size_t n)
+{
+    std::vector<uint256> vEntry(n);
+    for (size_t i = 0; i < n; i++)
+        vEntry[i] = GetRandHash();
+    return vEntry;
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_basic)
+{
+    CCuckooCache cache;
+    BOOST_CHECK(!cache.Contains(GetRandHash(), false));
+    cache.Insert(GetRandHash()); // no slots, nothing happens
+
+    cache.Setup(1 << 20);
+    std::vector<uint256> vEntry = RandomEntries(1000);
+    for (size_t i = 0; i < vEntry.size(); i++)
+        cache.Insert(vEntry[i]);
+    for (size_t i = 0; i < vEntry.size(); i++)
+        BOOST_CHECK(cache.Contains(vEntry[i], false));
+    BOOST_CHECK(!cache.Contains(GetRandHash(), false));
+
+    // erasing on lookup
+    BOOST_CHECK(cache.Contains(vEntry[0], true));
+    BOOST_CHECK(!cache.Contains(vEntry[0], false));
+
+    CCuckooCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nEntries, 999U);
+    BOOST_CHECK_EQUAL(stats.nInserts, 1000U);
+    BOOST_CHECK_EQUAL(stats.nEvictions, 0U);
+    BOOST_CHECK_EQUAL(stats.nLookups, 1003U);
+    BOOST_CHECK_EQUAL(stats.nHits, 1001U);
+    BOOST_CHECK(stats.nBytes <= (1 << 20));
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_eviction)
+{
+    CCuckooCache cache;
+    cache.Setup(1 << 20);
+    CCuckooCacheStats stats;
+    cache.GetStats(stats);
+    const size_t nSlots = stats.nSlots;
+
+    // four times as many entries as slots: memory stays the same and the
+    // entries of the last generation are kept rather than the old ones
+    std::vector<uint256> vEntry = RandomEntries(nSlots * 4);
+    for (size_t i = 0; i < vEntry.size(); i++)
+        cache.Insert(vEntry[i]);
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nSlots, nSlots);
+    BOOST_CHECK(stats.nEntries <= nSlots);
+    BOOST_CHECK(stats.nEntries > nSlots * 9 / 10);
+    BOOST_CHECK(stats.nGeneration > 10);
+
+    size_t nOld = 0, nRecent = 0;
+    for (size_t i = 0; i < nSlots / 4; i++) {
+        nOld += cache.Contains(vEntry[i], false);
+        nRecent += cache.Contains(vEntry[vEntry.size() - 1 - i], false);
+    }
+    BOOST_CHECK(nOld < nSlots / 40);
+    BOOST_CHECK(nRecent > nSlots / 4 * 95 / 100);
+}
+
+static void InsertThread(CCuckooCache& cache, const std::vector<uint256>& vEntry, size_t nBegin, size_t nEnd)
+{
+    for (size_t i = nBegin; i < nEnd; i++) {
+        cache.Insert(vEntry[i]);
+        cache.Contains(vEntry[i - nBegin], false);
+    }
+}
+
+static void LookupThread(CCuckooCache& cache, const std::vector<uint256>& vMissing, std::atomic<int>& nFalseHits)
+{
+    for (int nRound = 0; nRound < 20; nRound++)
+        for (size_t i = 0; i < vMissing.size(); i++)
+            if (cache.Contains(vMissing[i], false))
+                nFalseHits++;
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_concurrent)
+{
+    // a small cache, so that writers keep evicting each other's entries
+    CCuckooCache cache;
+    cache.Setup(1 << 16);
+    std::vector<uint256> vEntry = RandomEntries(40000);
+    std::vector<uint256> vMissing = RandomEntries(5000);
+    std::atomic<int> nFalseHits(0);
+
+    boost::thread_group threads;
+    for (int i = 0; i < 4; i++)
+        threads.create_thread(boost::bind(&InsertThread, boost::ref(cache), boost::cref(vEntry), i * 10000, (i + 1) * 10000));
+    for (int i = 0; i < 4; i++)
+        threads.create_thread(boost::bind(&LookupThread, boost::ref(cache), boost::cref(vMissing), boost::ref(nFalseHits)));
+    threads.join_all();
+
+    // a torn read must never look like an entry that was not inserted
+    BOOST_CHECK_EQUAL(nFalseHits.load(), 0);
+    CCuckooCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK(stats.nEntries <= stats.nSlots);
+    uint64_t nFound = 0;
+    for (size_t i = 0; i < vEntry.size(); i++)
+        nFound += cache.Contains(vEntry[i], false);
+    BOOST_CHECK_EQUAL(nFound, stats.nEntries);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,292 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "app/app.h"
+#include "base58.h"
+#include "chain.h"
+#include "key.h"
+#include "keystore.h"
+#include "main.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "txdb.h"
+#include "validation.h"
+#include "test/test_safe.h"
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+
+/** Index keys as written before addresses were stored as CIndexAddress */
+struct LegacyTxKey
+{
+    uint256 id;
+    std::string strAddress;
+    uint8_t nTxClass;
+    COutPoint out;
+
+    LegacyTxKey(const uint256& idIn, const std::string& strAddressIn, uint8_t nTxClassIn, const COutPoint& outIn)
+        : id(idIn), strAddress(strAddressIn), nTxClass(nTxClassIn), out(outIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(id);
+        READWRITE(LIMITED_STRING(strAddress, MAX_ADDRESS_SIZE));
+        READWRITE(nTxClass);
+        READWRITE(out);
+    }
+};
+
+struct LegacyAuthKey
+{
+    uint256 id;
+    std::string strAddress;
+    uint32_t nAuth;
+
+    LegacyAuthKey(const uint256& idIn, const std::string& strAddressIn, uint32_t nAuthIn)
+        : id(idIn), strAddress(strAddressIn), nAuth(nAuthIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(id);
+        READWRITE(LIMITED_STRING(strAddress, MAX_ADDRESS_SIZE));
+        READWRITE(nAuth);
+    }
+};
+
+struct LegacyGetCandyKey
+{
+    uint256 id;
+    COutPoint out;
+    std::string strAddress;
+
+    LegacyGetCandyKey(const uint256& idIn, const COutPoint& outIn, const std::string& strAddressIn)
+        : id(idIn), out(outIn), strAddress(strAddressIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(id);
+        READWRITE(out);
+        READWRITE(LIMITED_STRING(strAddress, MAX_ADDRESS_SIZE));
+    }
+};
+
+static size_t CountKeys(CBlockTreeDB& db, const std::string& strPrefix)
+{
+    size_t nCount = 0;
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(std::make_pair(strPrefix, uint256()));
+    std::pair<std::string, uint256> key;
+    while (pcursor->Valid() && pcursor->GetKey(key) && key.first == strPrefix) {
+        nCount++;
+        pcursor->Next();
+    }
+    return nCount;
+}
+
+/** Spend output n of txPrev, paid to key, to vout */
+static CMutableTransaction Spend(const CKey& key, const CTransaction& txPrev, unsigned int n, const std::vector<CTxOut>& vout)
+{
+    CMutableTransaction tx;
+    tx.vin.push_back(CTxIn(COutPoint(txPrev.GetHash(), n)));
+    tx.vout = vout;
+    CBasicKeyStore keystore;
+    keystore.AddKey(key);
+    BOOST_CHECK(SignSignature(keystore, txPrev, tx, 0));
+    return tx;
+}
+
+/** Extend data of appId under nAuth, sent by the owner of output 0 of txPrev */
+static CMutableTransaction ExtendData(const CKey& key, const CTransaction& txPrev, const uint256& appId, uint32_t nAuth)
+{
+    CScript script = GetScriptForDestination(key.GetPubKey().GetID());
+    std::vector<CTxOut> vout;
+    vout.push_back(CTxOut(APP_OUT_VALUE, script));
+    vout[0].vReserve = FillExtendData(CAppHeader(g_nAppHeaderVersion, appId, CREATE_EXTEND_TX_CMD), CExtendData(nAuth, "extend data"));
+    vout.push_back(CTxOut(txPrev.vout[0].nValue - APP_OUT_VALUE - COIN / 100, script));
+    return Spend(key, txPrev, 0, vout);
+}
+
+BOOST_FIXTURE_TEST_SUITE(indexaddress_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(indexaddress_roundtrip)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CKeyID keyID = key.GetPubKey().GetID();
+    CScriptID scriptID(GetScriptForDestination(keyID));
+
+    std::string strKeyAddress = CBitcoinAddress(keyID).ToString();
+    CIndexAddress keyAddress(strKeyAddress);
+    BOOST_CHECK(keyAddress == CIndexAddress(CTxDestination(keyID)));
+    BOOST_CHECK_EQUAL(keyAddress.type, 1);
+    BOOST_CHECK_EQUAL(keyAddress.ToString(), strKeyAddress);
+
+    std::string strScriptAddress = CBitcoinAddress(scriptID).ToString();
+    CIndexAddress scriptAddress(strScriptAddress);
+    BOOST_CHECK(scriptAddress == CIndexAddress(CTxDestination(scriptID)));
+    BOOST_CHECK_EQUAL(scriptAddress.type, 2);
+    BOOST_CHECK_EQUAL(scriptAddress.ToString(), strScriptAddress);
+    BOOST_CHECK(keyAddress != scriptAddress);
+
+    BOOST_CHECK(CIndexAddress(std::string("not an address")).IsNull());
+    BOOST_CHECK(CIndexAddress(CTxDestination(CNoDestination())).IsNull());
+
+    // the grantee of auths given to every user keeps a key of its own
+    CIndexAddress allUser(std::string("ALL_USER"));
+    BOOST_CHECK(!allUser.IsNull() && allUser.IsAllUser());
+    BOOST_CHECK_EQUAL(allUser.ToString(), "ALL_USER");
+    BOOST_CHECK(allUser != keyAddress && allUser != scriptAddress);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << allUser;
+    CIndexAddress decoded;
+    ss >> decoded;
+    BOOST_CHECK(decoded == allUser);
+}
+
+BOOST_AUTO_TEST_CASE(indexaddress_key_size)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CIndexAddress address(CTxDestination(key.GetPubKey().GetID()));
+
+    // appId/assetId + (type, hash160) + tx class + outpoint
+    CAssetTx_IndexKey assetTxKey(uint256S("01"), address, TRANSFER_TXOUT, COutPoint(uint256S("02"), 1));
+    BOOST_CHECK_EQUAL(GetSerializeSize(assetTxKey, SER_DISK, CLIENT_VERSION), 32 + 21 + 1 + 36);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << assetTxKey;
+    CAssetTx_IndexKey decoded;
+    ss >> decoded;
+    BOOST_CHECK(decoded == assetTxKey);
+}
+
+BOOST_FIXTURE_TEST_CASE(indexaddress_upgrade_keys, TestingSetup)
+{
+    CBlockTreeDB db(1 << 20, true);
+    uint256 appId = uint256S("0a"), assetId = uint256S("0b");
+    CKey key;
+    key.MakeNewKey(true);
+    std::string strAddress = CBitcoinAddress(key.GetPubKey().GetID()).ToString();
+    key.MakeNewKey(true);
+    std::string strOther = CBitcoinAddress(key.GetPubKey().GetID()).ToString();
+
+    // the readers skip records above the tip
+    int nChainHeightPrev = g_nChainHeight;
+    g_nChainHeight = 100;
+
+    // more app tx records than fit in one upgrade batch
+    static const unsigned int APPTX_COUNT = 10000 + 2500;
+    CDBBatch batch(&db.GetObfuscateKey());
+    for (unsigned int i = 0; i < APPTX_COUNT; i++)
+        batch.Write(std::make_pair(std::string("apptx"), LegacyTxKey(appId, i % 5 ? strAddress : strOther, REGISTER_TXOUT, COutPoint(uint256S("01"), i))), 0);
+    batch.Write(std::make_pair(std::string("auth"), LegacyAuthKey(appId, strAddress, 1001)), 7);
+    batch.Write(std::make_pair(std::string("auth"), LegacyAuthKey(appId, strOther, 1002)), 8);
+    batch.Write(std::make_pair(std::string("auth"), LegacyAuthKey(appId, "ALL_USER", 1003)), 9);
+    batch.Write(std::make_pair(std::string("assettx"), LegacyTxKey(assetId, strAddress, TRANSFER_TXOUT, COutPoint(uint256S("02"), 3))), 0);
+    COutPoint outCandy(uint256S("03"), 1);
+    batch.Write(std::make_pair(std::string("getcandy"), LegacyGetCandyKey(assetId, outCandy, strAddress)), CGetCandy_IndexValue(12345, 10, uint256S("04"), 2));
+    BOOST_CHECK(db.WriteBatch(batch));
+
+    BOOST_CHECK(db.UpgradeAddressKeys());
+
+    BOOST_CHECK_EQUAL(CountKeys(db, "apptx"), 0U);
+    BOOST_CHECK_EQUAL(CountKeys(db, "auth"), 0U);
+    BOOST_CHECK_EQUAL(CountKeys(db, "assettx"), 0U);
+    BOOST_CHECK_EQUAL(CountKeys(db, "getcandy"), 0U);
+    BOOST_CHECK_EQUAL(CountKeys(db, "apptx2"), APPTX_COUNT);
+
+    std::vector<COutPoint> vOut, vOther;
+    BOOST_CHECK(db.Read_AppTx_Index(appId, strAddress, vOut));
+    BOOST_CHECK(db.Read_AppTx_Index(appId, strOther, vOther));
+    BOOST_CHECK_EQUAL(vOut.size(), APPTX_COUNT * 4 / 5);
+    BOOST_CHECK_EQUAL(vOther.size(), APPTX_COUNT / 5);
+
+    std::map<uint32_t, int> mapAuth;
+    BOOST_CHECK(db.Read_Auth_Index(appId, strAddress, mapAuth));
+    BOOST_CHECK_EQUAL(mapAuth.size(), 1U);
+    BOOST_CHECK_EQUAL(mapAuth[1001], 7);
+    mapAuth.clear();
+    BOOST_CHECK(db.Read_Auth_Index(appId, "ALL_USER", mapAuth));
+    BOOST_CHECK(mapAuth.size() == 1 && mapAuth[1003] == 9);
+
+    std::vector<COutPoint> vAssetOut;
+    BOOST_CHECK(db.Read_AssetTx_Index(assetId, strAddress, TRANSFER_TXOUT, vAssetOut));
+    BOOST_CHECK(vAssetOut.size() == 1 && vAssetOut[0] == COutPoint(uint256S("02"), 3));
+
+    CAmount nAmount = 0;
+    BOOST_CHECK(db.Read_GetCandy_Index(assetId, outCandy, strAddress, nAmount));
+    BOOST_CHECK_EQUAL(nAmount, 12345);
+
+    // a second run finds no legacy keys and leaves the upgraded ones alone
+    BOOST_CHECK(db.UpgradeAddressKeys());
+    BOOST_CHECK_EQUAL(CountKeys(db, "apptx"), 0U);
+    BOOST_CHECK_EQUAL(CountKeys(db, "apptx2"), APPTX_COUNT);
+    vOut.clear();
+    BOOST_CHECK(db.Read_AppTx_Index(appId, strAddress, vOut));
+    BOOST_CHECK_EQUAL(vOut.size(), APPTX_COUNT * 4 / 5);
+    mapAuth.clear();
+    BOOST_CHECK(db.Read_Auth_Index(appId, strOther, mapAuth));
+    BOOST_CHECK(mapAuth.size() == 1 && mapAuth[1002] == 8);
+
+    g_nChainHeight = nChainHeightPrev;
+}
+
+BOOST_FIXTURE_TEST_CASE(indexaddress_all_user_auth, TestChain100Setup)
+{
+    // app txs go in protocol v1 blocks
+    int nProtocolV1HeightPrev = g_nProtocolV1Height;
+    g_nProtocolV1Height = chainActive.Height() + 1;
+
+    CScript scriptAdmin = GetScriptForDestination(coinbaseKey.GetPubKey().GetID());
+    std::string strAdmin = CBitcoinAddress(coinbaseKey.GetPubKey().GetID()).ToString();
+    CAppData appData("AllUserApp", "all user auth test app", 1, "dev", "", "", "");
+    uint256 appId = appData.GetHash();
+    std::vector<std::pair<uint256, CAppId_AppInfo_IndexValue> > vApp;
+    vApp.push_back(std::make_pair(appId, CAppId_AppInfo_IndexValue(strAdmin, appData, chainActive.Height())));
+    BOOST_REQUIRE(pblocktree->Write_AppId_AppInfo_Index(vApp));
+
+    // the admin grants an auth to every user, and funds a user who has none
+    static const uint32_t nAuth = 1001;
+    CKey keyUser;
+    keyUser.MakeNewKey(true);
+    std::vector<CTxOut> vout;
+    vout.push_back(CTxOut(APP_OUT_VALUE, scriptAdmin));
+    vout[0].vReserve = FillAuthData(strAdmin, CAppHeader(g_nAppHeaderVersion, appId, ADD_AUTH_CMD), CAuthData(1, "ALL_USER", nAuth));
+    vout.push_back(CTxOut(coinbaseTxns[0].vout[0].nValue - APP_OUT_VALUE - COIN / 100, scriptAdmin));
+    std::vector<CMutableTransaction> vtx;
+    vtx.push_back(Spend(coinbaseKey, coinbaseTxns[0], 0, vout));
+    vout.assign(1, CTxOut(coinbaseTxns[1].vout[0].nValue - COIN / 100, GetScriptForDestination(keyUser.GetPubKey().GetID())));
+    CTransaction txFund = Spend(coinbaseKey, coinbaseTxns[1], 0, vout);
+    vtx.push_back(txFund);
+
+    int nHeight = chainActive.Height();
+    CreateAndProcessBlock(vtx, scriptAdmin);
+    BOOST_REQUIRE_EQUAL(chainActive.Height(), nHeight + 1);
+
+    std::map<uint32_t, int> mapAuth;
+    BOOST_CHECK(GetAuthByAppIdAddress(appId, "ALL_USER", mapAuth));
+    BOOST_CHECK(mapAuth.size() == 1 && mapAuth[nAuth] == nHeight + 1);
+
+    // an auth nobody was given is refused, the one given to every user is accepted
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(1, ExtendData(keyUser, txFund, appId, nAuth + 1)), scriptAdmin);
+    BOOST_CHECK_EQUAL(chainActive.Height(), nHeight + 1);
+    CMutableTransaction txExtend = ExtendData(keyUser, txFund, appId, nAuth);
+    CBlock block = CreateAndProcessBlock(std::vector<CMutableTransaction>(1, txExtend), scriptAdmin);
+    BOOST_CHECK_EQUAL(chainActive.Height(), nHeight + 2);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    BOOST_CHECK(block.vtx.size() == 2 && block.vtx[1].GetHash() == txExtend.GetHash());
+
+    g_nProtocolV1Height = nProtocolV1HeightPrev;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,12 +6,18 @@
 #include "rpc/client.h"
 
 #include "base58.h"
+#include "random.h"
+#include "script/standard.h"
+#include "utiltime.h"
 #include "validation.h"
 #include "wallet/wallet.h"
 
 #include "test/test_safe.h"
 
+#include <algorithm>
+
 #include <boost/algorithm/string.hpp>
+#include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
 
 #include <univalue.h>
@@ -226,4 +232,104 @@ BOOST_AUTO_TEST_CASE(rpc_wallet)
     BOOST_CHECK_THROW(CallRPC("fundrawtransaction 01000000000180969800000000001976a91450ce0a4b0ee0ddeb633da85199728b940ac3fe9488ac00000000"), runtime_error);
 }
 
+static std::vector<uint256> ListedTxids(const UniValue& result, const std::string& strAddress)
+{
+    std::vector<uint256> vTxid;
+    int64_t nTimePrev = 0;
+    for (unsigned int i = 0; i < result.size(); i++) {
+        BOOST_CHECK_EQUAL(find_value(result[i], "address").get_str(), strAddress);
+        int64_t nTime = find_value(result[i], "time").get_int64();
+        BOOST_CHECK(nTime >= nTimePrev);
+        nTimePrev = nTime;
+        vTxid.push_back(uint256S(find_value(result[i], "txid").get_str()));
+    }
+    return vTxid;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_listaddresstransactions)
+{
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    {
+        LOCK(pwalletMain->cs_wallet);
+        pwalletMain->AddKey(key);
+        pwalletMain->AddKey(keyOther);
+    }
+    const std::string strAddress = CBitcoinAddress(key.GetPubKey().GetID()).ToString();
+
+    // 25 payments received out of time order, two of them in the same second,
+    // and payments to another wallet address in between
+    const int64_t nBase = 1500000000;
+    std::vector<std::pair<int64_t, uint256> > vPayment;
+    for (int i = 0; i < 25; i++) {
+        const int64_t nTime = nBase + (i == 24 ? 3 : (i * 7) % 24);
+        for (int nOther = 0; nOther < (i % 5 == 0 ? 2 : 1); nOther++) {
+            CMutableTransaction mtx;
+            mtx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+            mtx.vout.push_back(CTxOut(COIN + i, GetScriptForDestination((nOther ? keyOther : key).GetPubKey().GetID())));
+            SetMockTime(nTime);
+            CWalletTx wtx(pwalletMain, CTransaction(mtx));
+            BOOST_REQUIRE(pwalletMain->AddToWallet(wtx, false, NULL));
+            if (!nOther)
+                vPayment.push_back(std::make_pair(nTime, wtx.GetHash()));
+        }
+    }
+    SetMockTime(0);
+    // time order, transactions of the same second by txid
+    std::sort(vPayment.begin(), vPayment.end());
+    std::vector<uint256> vSorted;
+    for (unsigned int i = 0; i < vPayment.size(); i++)
+        vSorted.push_back(vPayment[i].second);
+
+    // the 10 newest by default, oldest first
+    UniValue r;
+    BOOST_CHECK_NO_THROW(r = CallRPC("listaddresstransactions " + strAddress));
+    BOOST_CHECK(ListedTxids(r, strAddress) == std::vector<uint256>(vSorted.end() - 10, vSorted.end()));
+
+    // pages skip the newest ones
+    BOOST_CHECK_NO_THROW(r = CallRPC("listaddresstransactions " + strAddress + " 5 3"));
+    BOOST_CHECK(ListedTxids(r, strAddress) == std::vector<uint256>(vSorted.end() - 8, vSorted.end() - 3));
+    std::vector<uint256> vPaged;
+    for (int nFrom = 20; nFrom >= 0; nFrom -= 5) {
+        BOOST_CHECK_NO_THROW(r = CallRPC("listaddresstransactions " + strAddress + " 5 " + strprintf("%d", nFrom)));
+        std::vector<uint256> vPage = ListedTxids(r, strAddress);
+        vPaged.insert(vPaged.end(), vPage.begin(), vPage.end());
+    }
+    BOOST_CHECK(vPaged == vSorted);
+    BOOST_CHECK_NO_THROW(r = CallRPC("listaddresstransactions " + strAddress + " 5 25"));
+    BOOST_CHECK(r.empty());
+
+    // so do pages keyed by the first txid of the newer page, through the
+    // transactions of the same second
+    std::vector<uint256> vKeyed;
+    std::string strBefore;
+    for (int nPage = 0; nPage < 10; nPage++) {
+        BOOST_CHECK_NO_THROW(r = CallRPC("listaddresstransactions " + strAddress + strprintf(" 4 0 0 %d", nBase + 100) + strBefore));
+        std::vector<uint256> vPage = ListedTxids(r, strAddress);
+        if (vPage.empty())
+            break;
+        vKeyed.insert(vKeyed.begin(), vPage.begin(), vPage.end());
+        strBefore = " " + vPage.front().GetHex();
+    }
+    BOOST_CHECK(vKeyed == vSorted);
+    BOOST_CHECK_NO_THROW(r = CallRPC("listaddresstransactions " + strAddress + strprintf(" 3 1 0 %d ", nBase + 100) + vSorted[10].GetHex()));
+    BOOST_CHECK(ListedTxids(r, strAddress) == std::vector<uint256>(vSorted.begin() + 6, vSorted.begin() + 9));
+
+    // the time range is inclusive at both ends
+    BOOST_CHECK_NO_THROW(r = CallRPC("listaddresstransactions " + strAddress + strprintf(" 100 0 %d %d", nBase + 3, nBase + 10)));
+    std::vector<uint256> vRange;
+    for (unsigned int i = 0; i < vPayment.size(); i++) {
+        if (vPayment[i].first >= nBase + 3 && vPayment[i].first <= nBase + 10)
+            vRange.push_back(vPayment[i].second);
+    }
+    BOOST_CHECK_EQUAL(vRange.size(), 9U);
+    BOOST_CHECK(ListedTxids(r, strAddress) == vRange);
+
+    BOOST_CHECK_THROW(CallRPC("listaddresstransactions " + strAddress + " -1"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("listaddresstransactions " + strAddress + " 10 -1"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("listaddresstransactions XnhQgp2Y11hPGWaCB7rdGF5xLxjf2kBZC"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("listaddresstransactions " + strAddress + strprintf(" 10 0 0 %d ", nBase + 100) + GetRandHash().GetHex()), runtime_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
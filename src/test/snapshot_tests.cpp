@@ -0,0 +1,243 @@
+// Copyright (c) 2018 The Safe Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "snapshot.h"
+#include "app/app.h"
+#include "base58.h"
+#include "chain.h"
+#include "clientversion.h"
+#include "dbwrapper.h"
+#include "hash.h"
+#include "main.h"
+#include "random.h"
+#include "script/standard.h"
+#include "txdb.h"
+#include "validation.h"
+
+#include "test/test_safe.h"
+
+#include <stdio.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+
+/** Hash of every coin record in a chainstate database, independent of its obfuscation key */
+static uint256 HashCoins(CCoinsViewDB& view, uint64_t& nCoins)
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    nCoins = 0;
+    boost::scoped_ptr<CDBIterator> pcursor(view.GetDB().NewIterator());
+    for (pcursor->Seek(CCoinsViewDB::GetCoinKeyPrefix()); pcursor->Valid(); pcursor->Next()) {
+        std::vector<char> vKey(pcursor->GetKeySize()), vValue(pcursor->GetValueSize());
+        CFlatData key(vKey), value(vValue);
+        BOOST_REQUIRE(pcursor->GetKey(key) && pcursor->GetValue(value));
+        if (vKey.empty() || vKey[0] != CCoinsViewDB::GetCoinKeyPrefix())
+            break;
+        ss << vKey << vValue;
+        nCoins++;
+    }
+    return ss.GetHash();
+}
+
+/** Empty in-memory block tree and chainstate databases, as a new data directory has */
+class CFreshChainState
+{
+private:
+    CBlockTreeDB* pblocktreePrev;
+    CCoinsViewDB* pcoinsdbviewPrev;
+
+public:
+    CBlockTreeDB blocktree;
+    CCoinsViewDB coinsdbview;
+
+    CFreshChainState() : blocktree(1 << 20, true), coinsdbview(1 << 23, true)
+    {
+        pblocktreePrev = pblocktree;
+        pcoinsdbviewPrev = pcoinsdbview;
+        pblocktree = &blocktree;
+        pcoinsdbview = &coinsdbview;
+    }
+
+    ~CFreshChainState()
+    {
+        pblocktree = pblocktreePrev;
+        pcoinsdbview = pcoinsdbviewPrev;
+    }
+};
+
+static void FlipByte(const boost::filesystem::path& path, long nOffset, int nOrigin)
+{
+    FILE* file = fopen(path.string().c_str(), "r+b");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE(fseek(file, nOffset, nOrigin) == 0);
+    long nPos = ftell(file);
+    int ch = fgetc(file);
+    BOOST_REQUIRE(ch != EOF);
+    BOOST_REQUIRE(fseek(file, nPos, SEEK_SET) == 0);
+    fputc(ch ^ 0xff, file);
+    fclose(file);
+}
+
+BOOST_FIXTURE_TEST_SUITE(snapshot_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(snapshot_round_trip)
+{
+    // the setup keeps its chainstate database to itself, the snapshot code reads the global one
+    ::pcoinsdbview = pcoinsdbview;
+
+    boost::filesystem::path path = pathTemp / "snapshot.dat";
+    CSnapshotStats statsDump;
+    std::string strError;
+    BOOST_REQUIRE_MESSAGE(DumpSnapshot(path, statsDump, strError), strError);
+
+    uint256 hashTip;
+    {
+        LOCK(cs_main);
+        hashTip = chainActive.Tip()->GetBlockHash();
+        BOOST_CHECK_EQUAL(statsDump.nHeight, chainActive.Height());
+        BOOST_CHECK_EQUAL(statsDump.nBlockIndex, (uint64_t)chainActive.Height() + 1);
+    }
+    BOOST_CHECK(statsDump.hashBlock == hashTip);
+    BOOST_CHECK(pcoinsdbview->GetBestBlock() == hashTip);
+    uint64_t nCoins;
+    uint256 hashCoins = HashCoins(*pcoinsdbview, nCoins);
+    BOOST_CHECK(nCoins > 0);
+    BOOST_CHECK_EQUAL(statsDump.nCoinRecords, nCoins);
+
+    // an existing file is never overwritten
+    CSnapshotStats statsAgain;
+    BOOST_CHECK(!DumpSnapshot(path, statsAgain, strError));
+
+    {
+        CFreshChainState fresh;
+        CSnapshotStats statsLoad;
+        BOOST_REQUIRE_MESSAGE(LoadSnapshot(path, statsDump.hashSnapshot, statsLoad, strError), strError);
+        BOOST_CHECK(statsLoad.hashSnapshot == statsDump.hashSnapshot);
+        BOOST_CHECK(statsLoad.hashBlock == hashTip);
+        BOOST_CHECK_EQUAL(statsLoad.nHeight, statsDump.nHeight);
+        BOOST_CHECK_EQUAL(statsLoad.nBlockIndex, statsDump.nBlockIndex);
+        BOOST_CHECK_EQUAL(statsLoad.nIndexRecords, statsDump.nIndexRecords);
+        BOOST_CHECK_EQUAL(statsLoad.nCoinRecords, statsDump.nCoinRecords);
+
+        BOOST_CHECK(fresh.coinsdbview.GetBestBlock() == hashTip);
+        uint64_t nCoinsLoaded;
+        BOOST_CHECK(HashCoins(fresh.coinsdbview, nCoinsLoaded) == hashCoins);
+        BOOST_CHECK_EQUAL(nCoinsLoaded, nCoins);
+        bool fPruned = false;
+        BOOST_CHECK(fresh.blocktree.ReadFlag("prunedblockfiles", fPruned) && fPruned);
+
+        // once the best block is written, loading again leaves the chain state alone
+        CSnapshotStats statsIgnored;
+        BOOST_CHECK(LoadSnapshot(path, uint256(), statsIgnored, strError));
+        BOOST_CHECK_EQUAL(statsIgnored.nCoinRecords, 0U);
+    }
+
+    {
+        // a checksum other than the expected one is refused before anything is written
+        CFreshChainState fresh;
+        CSnapshotStats statsLoad;
+        BOOST_CHECK(!LoadSnapshot(path, GetRandHash(), statsLoad, strError));
+        BOOST_CHECK(fresh.coinsdbview.GetBestBlock().IsNull());
+    }
+
+    ::pcoinsdbview = NULL;
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_corrupted)
+{
+    ::pcoinsdbview = pcoinsdbview;
+
+    boost::filesystem::path path = pathTemp / "snapshot.dat";
+    CSnapshotStats statsDump;
+    std::string strError;
+    BOOST_REQUIRE_MESSAGE(DumpSnapshot(path, statsDump, strError), strError);
+
+    // a damaged stored checksum
+    boost::filesystem::path pathChecksum = pathTemp / "snapshot_checksum.dat";
+    boost::filesystem::copy_file(path, pathChecksum);
+    FlipByte(pathChecksum, -1, SEEK_END);
+    {
+        CFreshChainState fresh;
+        CSnapshotStats statsLoad;
+        strError.clear();
+        BOOST_CHECK(!LoadSnapshot(pathChecksum, uint256(), statsLoad, strError));
+        BOOST_CHECK(strError.find("checksum mismatch") != std::string::npos);
+        BOOST_CHECK(fresh.coinsdbview.GetBestBlock().IsNull());
+        uint64_t nCoins;
+        HashCoins(fresh.coinsdbview, nCoins);
+        BOOST_CHECK_EQUAL(nCoins, 0U);
+    }
+
+    // a damaged record in the middle, which the stored checksum no longer covers
+    boost::filesystem::path pathBody = pathTemp / "snapshot_body.dat";
+    boost::filesystem::copy_file(path, pathBody);
+    FlipByte(pathBody, boost::filesystem::file_size(path) / 2, SEEK_SET);
+    {
+        CFreshChainState fresh;
+        CSnapshotStats statsLoad;
+        BOOST_CHECK(!LoadSnapshot(pathBody, uint256(), statsLoad, strError));
+        BOOST_CHECK(fresh.coinsdbview.GetBestBlock().IsNull());
+        uint64_t nCoins;
+        HashCoins(fresh.coinsdbview, nCoins);
+        BOOST_CHECK_EQUAL(nCoins, 0U);
+    }
+
+    ::pcoinsdbview = NULL;
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_candy_height)
+{
+    ::pcoinsdbview = pcoinsdbview;
+
+    // a put candy output from below the snapshot, which the candy address never spends
+    static const int nCandyHeight = 50;
+    CMutableTransaction tx;
+    tx.nVersion = SAFE_TX_VERSION_2;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    CTxOut txout(1000, GetScriptForDestination(CBitcoinAddress(g_strPutCandyAddress).Get()));
+    txout.vReserve = FillPutCandyData(CAppHeader(g_nAppHeaderVersion, uint256S(g_strSafeAssetId), PUT_CANDY_CMD), CPutCandyData(GetRandHash(), 1000, 1, ""));
+    tx.vout.push_back(txout);
+    CTransaction txPut(tx);
+    uint256 hashCandyBlock;
+    {
+        LOCK(cs_main);
+        pcoinsTip->AddCoin(COutPoint(txPut.GetHash(), 0), Coin(txPut.vout[0], nCandyHeight, false), false);
+        BOOST_REQUIRE(pcoinsTip->Flush());
+        hashCandyBlock = chainActive[nCandyHeight]->GetBlockHash();
+    }
+
+    boost::filesystem::path path = pathTemp / "snapshot.dat";
+    CSnapshotStats statsDump;
+    std::string strError;
+    BOOST_REQUIRE_MESSAGE(DumpSnapshot(path, statsDump, strError), strError);
+
+    {
+        CFreshChainState fresh;
+        CSnapshotStats statsLoad;
+        BOOST_REQUIRE_MESSAGE(LoadSnapshot(path, statsDump.hashSnapshot, statsLoad, strError), strError);
+
+        // the loaded node has no tx index, and the candy tx is in no block it can read,
+        // yet claims against the candy still see the height it was put at
+        CCoinsViewCache coinsTip(&fresh.coinsdbview);
+        CCoinsViewCache* pcoinsTipPrev = pcoinsTip;
+        bool fTxIndexPrev = fTxIndex;
+        pcoinsTip = &coinsTip;
+        fTxIndex = false;
+        {
+            LOCK(cs_main);
+            uint256 hashBlock;
+            BOOST_CHECK_EQUAL(GetTxHeight(txPut.GetHash(), &hashBlock), nCandyHeight);
+            BOOST_CHECK(hashBlock == hashCandyBlock);
+            BOOST_CHECK_EQUAL(GetTxHeight(GetRandHash()), g_nChainHeight + 1);
+        }
+        pcoinsTip = pcoinsTipPrev;
+        fTxIndex = fTxIndexPrev;
+    }
+
+    ::pcoinsdbview = NULL;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
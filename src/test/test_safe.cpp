@@ -7,6 +7,7 @@
 
 #include "test/test_safe.h"
 
+#include "chainindexer.h"
 #include "chainparams.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
@@ -16,6 +17,7 @@
 #include "net_processing.h"
 #include "pubkey.h"
 #include "random.h"
+#include "script/sigcache.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "ui_interface.h"
@@ -46,6 +48,7 @@ BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
         fCheckBlockIndex = true;
         SelectParams(chainName);
         noui_connect();
+        InitSignatureCache();
 }
 
 BasicTestingSetup::~BasicTestingSetup()
@@ -67,6 +70,7 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
         pblocktree = new CBlockTreeDB(1 << 20, true);
         pcoinsdbview = new CCoinsViewDB(1 << 23, true);
         pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+        RegisterValidationInterface(&chainindexer);
         InitBlockIndex(chainparams);
 #ifdef ENABLE_WALLET
         bool fFirstRun;
@@ -92,6 +96,7 @@ TestingSetup::~TestingSetup()
         delete pwalletMain;
         pwalletMain = NULL;
 #endif
+        UnregisterValidationInterface(&chainindexer);
         UnloadBlockIndex();
         delete pcoinsTip;
         delete pcoinsdbview;
@@ -20,6 +20,7 @@
 
 using namespace std;
 
+static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
@@ -33,31 +34,124 @@ static const char DB_BEST_BLOCK = 'B';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_INDEX_BEST_BLOCK = 'I';
 
 static const string DB_APPID_APPINFO_INDEX = "appid_appinfo";
 static const string DB_APPNAME_APPID_INDEX = "appname_appid";
-static const string DB_APPTX_INDEX = "apptx";
-static const string DB_AUTH_INDEX = "auth";
+static const string DB_APPTX_INDEX = "apptx2";
+static const string DB_AUTH_INDEX = "auth2";
 static const string DB_ASSETID_ASSETINFO_INDEX = "assetid_assetinfo";
 static const string DB_SHORTNAME_ASSETID_INDEX = "shortname_assetid";
 static const string DB_ASSETNAME_ASSETID_INDEX = "assetname_assetid";
-static const string DB_ASSETTX_INDEX = "assettx";
+static const string DB_ASSETTX_INDEX = "assettx2";
 static const string DB_PUTCANDY_INDEX = "putcandy";
-static const string DB_GETCANDY_INDEX = "getcandy";
+static const string DB_GETCANDY_INDEX = "getcandy2";
 static const string DB_CANDYHEIGHT_TOTALAMOUNT_INDEX = "candyheight_totalamount";
 static const string DB_CANDYHEIGHT_INDEX = "candyheight";
 static const string DB_GETCANDYCOUNT_INDEX = "getcandycount";
 
+// Indexes whose keys embedded base58 address strings, see UpgradeAddressKeys
+static const string DB_APPTX_INDEX_LEGACY = "apptx";
+static const string DB_AUTH_INDEX_LEGACY = "auth";
+static const string DB_ASSETTX_INDEX_LEGACY = "assettx";
+static const string DB_GETCANDY_INDEX_LEGACY = "getcandy";
+
+namespace {
+
+/** Chainstate key of a single unspent output */
+struct CoinEntry
+{
+    char key;
+    uint256 hash;
+    uint32_t n;
+
+    CoinEntry() : key(DB_COIN), n(0) {}
+    CoinEntry(const COutPoint& outpoint) : key(DB_COIN), hash(outpoint.hash), n(outpoint.n) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(key);
+        READWRITE(hash);
+        READWRITE(VARINT(n));
+    }
+};
+
+/**
+ * Per-transaction chainstate record written before the UTXO set was keyed
+ * by outpoint, see CCoinsViewDB::Upgrade. Only ever read.
+ *
+ * Serialized format:
+ * - VARINT(nVersion)
+ * - VARINT(nCode)
+ * - unspentness bitvector, for vout[2] and further; least significant byte first
+ * - the non-spent CTxOuts (via CTxOutCompressor, in its SERIALIZE_TXOUT_LEGACY form)
+ * - VARINT(nHeight)
+ *
+ * The nCode value consists of:
+ * - bit 0: IsCoinBase()
+ * - bit 1: vout[0] is not spent
+ * - bit 2: vout[1] is not spent
+ * - The higher bits encode N, the number of non-zero bytes in the following bitvector.
+ */
+class CLegacyCoins
+{
+public:
+    bool fCoinBase;
+    std::vector<CTxOut> vout;
+    int nHeight;
+
+    CLegacyCoins() : fCoinBase(false), nHeight(0) {}
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        unsigned int nCode = 0;
+        // version
+        int nVersionDummy;
+        ::Unserialize(s, VARINT(nVersionDummy), nType, nVersion);
+        // header code
+        ::Unserialize(s, VARINT(nCode), nType, nVersion);
+        fCoinBase = nCode & 1;
+        std::vector<bool> vAvail(2, false);
+        vAvail[0] = (nCode & 2) != 0;
+        vAvail[1] = (nCode & 4) != 0;
+        unsigned int nMaskCode = (nCode / 8) + ((nCode & 6) != 0 ? 0 : 1);
+        // spentness bitmask
+        while (nMaskCode > 0) {
+            unsigned char chAvail = 0;
+            ::Unserialize(s, chAvail, nType, nVersion);
+            for (unsigned int p = 0; p < 8; p++) {
+                bool f = (chAvail & (1 << p)) != 0;
+                vAvail.push_back(f);
+            }
+            if (chAvail != 0)
+                nMaskCode--;
+        }
+        // txouts themself
+        vout.assign(vAvail.size(), CTxOut());
+        for (unsigned int i = 0; i < vAvail.size(); i++) {
+            if (vAvail[i])
+                ::Unserialize(s, REF(CTxOutCompressor(vout[i])), nType, nVersion | SERIALIZE_TXOUT_LEGACY);
+        }
+        // coinbase height
+        ::Unserialize(s, VARINT(nHeight), nType, nVersion);
+    }
+};
+
+} // namespace
+
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true)
 {
 }
 
-bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    return db.Read(CoinEntry(outpoint), coin);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    return db.Exists(CoinEntry(outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -73,10 +167,11 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(make_pair(DB_COINS, it->first));
+            CoinEntry entry(it->first);
+            if (it->second.coin.IsSpent())
+                batch.Erase(entry);
             else
-                batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
+                batch.Write(entry, it->second.coin);
             changed++;
         }
         count++;
@@ -86,10 +181,61 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed coins (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
+bool CCoinsViewDB::Upgrade()
+{
+    // every legacy record is replaced by its outputs within the same batch,
+    // so an interrupted upgrade simply resumes from the remaining records
+    static const size_t UPGRADE_BATCH_SIZE = 10000;
+
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(make_pair(DB_COINS, uint256()));
+    if (!pcursor->Valid())
+        return true;
+
+    LogPrintf("Upgrading UTXO database to per-output records...\n");
+    int64_t nStart = GetTimeMillis();
+    size_t nTransactions = 0, nCoins = 0, nBatch = 0;
+    CDBBatch batch(&db.GetObfuscateKey());
+    while (pcursor->Valid())
+    {
+        boost::this_thread::interruption_point();
+        std::pair<char, uint256> key;
+        if (!pcursor->GetKey(key) || key.first != DB_COINS)
+            break;
+
+        CLegacyCoins coins;
+        if (!pcursor->GetValue(coins))
+            return error("%s: failed to read legacy coins record", __func__);
+
+        for (unsigned int i = 0; i < coins.vout.size(); i++)
+        {
+            if (coins.vout[i].IsNull() || coins.vout[i].scriptPubKey.IsUnspendable())
+                continue;
+            batch.Write(CoinEntry(COutPoint(key.second, i)), Coin(std::move(coins.vout[i]), coins.nHeight, coins.fCoinBase));
+            nCoins++;
+        }
+        batch.Erase(key);
+        nTransactions++;
+        if (++nBatch == UPGRADE_BATCH_SIZE)
+        {
+            if (!db.WriteBatch(batch))
+                return false;
+            batch = CDBBatch(&db.GetObfuscateKey());
+            nBatch = 0;
+        }
+        pcursor->Next();
+    }
+
+    if (nBatch > 0 && !db.WriteBatch(batch))
+        return false;
+    LogPrintf("Upgraded %u transactions to %u UTXO records in %dms\n", nTransactions, nCoins, GetTimeMillis() - nStart);
+    return true;
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
 }
 
@@ -113,35 +259,46 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
 
+static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const std::map<uint32_t, Coin>& outputs)
+{
+    stats.nTransactions++;
+    for (std::map<uint32_t, Coin>::const_iterator it = outputs.begin(); it != outputs.end(); ++it) {
+        stats.nTransactionOutputs++;
+        ss << VARINT(it->first + 1);
+        ss << it->second.out;
+        stats.nTotalAmount += it->second.out.nValue;
+    }
+    ss << VARINT(0);
+}
+
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
     boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
-    pcursor->Seek(DB_COINS);
+    pcursor->Seek(DB_COIN);
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
+    stats.nTotalAmount = 0;
+    // outputs are hashed grouped by transaction, as in the per-transaction
+    // layout, so hash_serialized doesn't depend on how the set is stored
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && key.first == DB_COINS) {
-            if (pcursor->GetValue(coins)) {
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
+        CoinEntry key;
+        Coin coin;
+        if (pcursor->GetKey(key) && key.key == DB_COIN) {
+            if (pcursor->GetValue(coin)) {
+                if (!outputs.empty() && key.hash != prevkey) {
+                    ApplyStats(stats, ss, outputs);
+                    outputs.clear();
                 }
+                prevkey = key.hash;
+                outputs[key.n] = coin;
                 stats.nSerializedSize += 32 + pcursor->GetValueSize();
-                ss << VARINT(0);
             } else {
                 return error("CCoinsViewDB::GetStats() : unable to read value");
             }
@@ -150,12 +307,13 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
         }
         pcursor->Next();
     }
+    if (!outputs.empty())
+        ApplyStats(stats, ss, outputs);
     {
         LOCK(cs_main);
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     }
     stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
@@ -171,15 +329,37 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     return WriteBatch(batch, true);
 }
 
+bool CBlockTreeDB::WriteBlockIndex(const std::vector<CDiskBlockIndex>& vIndex) {
+    CDBBatch batch(&GetObfuscateKey());
+    for (std::vector<CDiskBlockIndex>::const_iterator it=vIndex.begin(); it != vIndex.end(); it++) {
+        batch.Write(make_pair(DB_BLOCK_INDEX, it->GetBlockHash()), *it);
+    }
+    return WriteBatch(batch);
+}
+
+const std::vector<std::string>& CBlockTreeDB::GetAppIndexPrefixes() {
+    static const std::string prefixes[] = {
+        DB_APPID_APPINFO_INDEX, DB_APPNAME_APPID_INDEX, DB_APPTX_INDEX, DB_AUTH_INDEX,
+        DB_ASSETID_ASSETINFO_INDEX, DB_SHORTNAME_ASSETID_INDEX, DB_ASSETNAME_ASSETID_INDEX, DB_ASSETTX_INDEX,
+        DB_PUTCANDY_INDEX, DB_GETCANDY_INDEX, DB_CANDYHEIGHT_TOTALAMOUNT_INDEX, DB_CANDYHEIGHT_INDEX, DB_GETCANDYCOUNT_INDEX
+    };
+    static const std::vector<std::string> vPrefix(prefixes, prefixes + sizeof(prefixes) / sizeof(prefixes[0]));
+    return vPrefix;
+}
+
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(make_pair(DB_TXINDEX, txid), pos);
 }
 
 bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
     CDBBatch batch(&GetObfuscateKey());
+    BatchTxIndex(batch, vect);
+    return WriteBatch(batch);
+}
+
+void CBlockTreeDB::BatchTxIndex(CDBBatch& batch, const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
     for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Write(make_pair(DB_TXINDEX, it->first), it->second);
-    return WriteBatch(batch);
 }
 
 bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
@@ -188,6 +368,11 @@ bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
 
 bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect) {
     CDBBatch batch(&GetObfuscateKey());
+    BatchSpentIndex(batch, vect);
+    return WriteBatch(batch);
+}
+
+void CBlockTreeDB::BatchSpentIndex(CDBBatch& batch, const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect) {
     for (std::vector<std::pair<CSpentIndexKey,CSpentIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
             batch.Erase(make_pair(DB_SPENTINDEX, it->first));
@@ -195,11 +380,15 @@ bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey,
             batch.Write(make_pair(DB_SPENTINDEX, it->first), it->second);
         }
     }
-    return WriteBatch(batch);
 }
 
 bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
     CDBBatch batch(&GetObfuscateKey());
+    BatchAddressUnspentIndex(batch, vect);
+    return WriteBatch(batch);
+}
+
+void CBlockTreeDB::BatchAddressUnspentIndex(CDBBatch& batch, const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
     for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
             batch.Erase(make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
@@ -207,7 +396,6 @@ bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddres
             batch.Write(make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
         }
     }
-    return WriteBatch(batch);
 }
 
 bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
@@ -238,18 +426,25 @@ bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
 
 bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
     CDBBatch batch(&GetObfuscateKey());
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
+    BatchAddressIndex(batch, vect, false);
     return WriteBatch(batch);
 }
 
 bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
     CDBBatch batch(&GetObfuscateKey());
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
+    BatchAddressIndex(batch, vect, true);
     return WriteBatch(batch);
 }
 
+void CBlockTreeDB::BatchAddressIndex(CDBBatch& batch, const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect, bool fErase) {
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        if (fErase)
+            batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
+        else
+            batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
+    }
+}
+
 bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
                                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
                                     int start, int end) {
@@ -286,10 +481,14 @@ bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
 
 bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex) {
     CDBBatch batch(&GetObfuscateKey());
-    batch.Write(make_pair(DB_TIMESTAMPINDEX, timestampIndex), 0);
+    BatchTimestampIndex(batch, timestampIndex);
     return WriteBatch(batch);
 }
 
+void CBlockTreeDB::BatchTimestampIndex(CDBBatch& batch, const CTimestampIndexKey &timestampIndex) {
+    batch.Write(make_pair(DB_TIMESTAMPINDEX, timestampIndex), 0);
+}
+
 bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &hashes) {
 
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
@@ -310,6 +509,14 @@ bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned i
     return true;
 }
 
+bool CBlockTreeDB::ReadIndexBestBlock(uint256 &hash) {
+    return Read(DB_INDEX_BEST_BLOCK, hash);
+}
+
+void CBlockTreeDB::BatchIndexBestBlock(CDBBatch& batch, const uint256 &hash) {
+    batch.Write(DB_INDEX_BEST_BLOCK, hash);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -502,16 +709,20 @@ bool CBlockTreeDB::Read_AppTx_Index(const uint256& appId, std::vector<COutPoint>
 
 bool CBlockTreeDB::Read_AppTx_Index(const uint256& appId, const std::string& strAddress, std::vector<COutPoint>& vOut)
 {
+    CIndexAddress address(strAddress);
+    if(address.IsNull())
+        return false;
+
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    pcursor->Seek(make_pair(DB_APPTX_INDEX, CIterator_IdAddressKey(appId, strAddress)));
+    pcursor->Seek(make_pair(DB_APPTX_INDEX, CIterator_IdAddressKey(appId, address)));
 
     int nCurHeight = g_nChainHeight;
     while (pcursor->Valid())
     {
         boost::this_thread::interruption_point();
         std::pair<std::string, CAppTx_IndexKey> key;
-        if (pcursor->GetKey(key) && key.first == DB_APPTX_INDEX && key.second.appId == appId && key.second.strAddress == strAddress)
+        if (pcursor->GetKey(key) && key.first == DB_APPTX_INDEX && key.second.appId == appId && key.second.address == address)
         {
             int nHeight;
             if(pcursor->GetValue(nHeight))
@@ -536,6 +747,10 @@ bool CBlockTreeDB::Read_AppTx_Index(const uint256& appId, const std::string& str
 
 bool CBlockTreeDB::Read_AppList_Index(const std::string& strAddress, std::vector<uint256>& vAppId)
 {
+    CIndexAddress address(strAddress);
+    if(address.IsNull())
+        return false;
+
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
     pcursor->Seek(make_pair(DB_APPTX_INDEX, CIterator_IdAddressKey()));
@@ -551,7 +766,7 @@ bool CBlockTreeDB::Read_AppList_Index(const std::string& strAddress, std::vector
             int nHeight;
             if(pcursor->GetValue(nHeight))
             {
-                if(nCurHeight >= nHeight && key.second.strAddress == strAddress)
+                if(nCurHeight >= nHeight && key.second.address == address)
                     mapAppId[key.second.appId] = 1;
                 pcursor->Next();
             }
@@ -586,15 +801,19 @@ bool CBlockTreeDB::Update_Auth_Index(const std::vector<std::pair<CAuth_IndexKey,
 }
 bool CBlockTreeDB::Read_Auth_Index(const uint256& appId, const std::string& strAddress, std::map<uint32_t, int>& mapAuth)
 {
+    CIndexAddress address(strAddress);
+    if(address.IsNull())
+        return false;
+
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    pcursor->Seek(make_pair(DB_AUTH_INDEX, CIterator_IdAddressKey(appId, strAddress)));
+    pcursor->Seek(make_pair(DB_AUTH_INDEX, CIterator_IdAddressKey(appId, address)));
 
     while (pcursor->Valid())
     {
         boost::this_thread::interruption_point();
         std::pair<std::string, CAuth_IndexKey> key;
-        if (pcursor->GetKey(key) && key.first == DB_AUTH_INDEX && key.second.appId == appId && key.second.strAddress == strAddress)
+        if (pcursor->GetKey(key) && key.first == DB_AUTH_INDEX && key.second.appId == appId && key.second.address == address)
         {
             int nHeight;
             if(pcursor->GetValue(nHeight))
@@ -785,9 +1004,13 @@ bool CBlockTreeDB::Read_AssetTx_Index(const uint256& assetId, const uint8_t& nTx
 
 bool CBlockTreeDB::Read_AssetTx_Index(const uint256& assetId, const std::string& strAddress, const uint8_t& nTxClass, std::vector<COutPoint>& vOut)
 {
+    CIndexAddress address(strAddress);
+    if(address.IsNull())
+        return false;
+
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    pcursor->Seek(make_pair(DB_ASSETTX_INDEX, CIterator_IdAddressKey(assetId, strAddress)));
+    pcursor->Seek(make_pair(DB_ASSETTX_INDEX, CIterator_IdAddressKey(assetId, address)));
 
     int nCurHeight = g_nChainHeight;
     multimap<int, COutPoint> tmpMap;
@@ -795,7 +1018,7 @@ bool CBlockTreeDB::Read_AssetTx_Index(const uint256& assetId, const std::string&
     {
         boost::this_thread::interruption_point();
         std::pair<std::string, CAssetTx_IndexKey> key;
-        if (pcursor->GetKey(key) && key.first == DB_ASSETTX_INDEX && key.second.assetId == assetId && key.second.strAddress == strAddress)
+        if (pcursor->GetKey(key) && key.first == DB_ASSETTX_INDEX && key.second.assetId == assetId && key.second.address == address)
         {
             int nHeight;
             if(pcursor->GetValue(nHeight))
@@ -839,6 +1062,10 @@ bool CBlockTreeDB::Read_AssetTx_Index(const uint256& assetId, const std::string&
 
 bool CBlockTreeDB::Read_AssetList_Index(const std::string& strAddress, std::vector<uint256>& vAssetId)
 {
+    CIndexAddress address(strAddress);
+    if(address.IsNull())
+        return false;
+
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
     pcursor->Seek(make_pair(DB_ASSETTX_INDEX, CIterator_IdAddressKey()));
@@ -854,7 +1081,7 @@ bool CBlockTreeDB::Read_AssetList_Index(const std::string& strAddress, std::vect
             int nHeight;
             if(pcursor->GetValue(nHeight))
             {
-                if(nCurHeight >= nHeight && key.second.strAddress == strAddress)
+                if(nCurHeight >= nHeight && key.second.address == address)
                     mapAssetId[key.second.assetId] = 1;
                 pcursor->Next();
             }
@@ -1014,16 +1241,20 @@ bool CBlockTreeDB::Erase_GetCandy_Index(const std::vector<std::pair<CGetCandy_In
 
 bool CBlockTreeDB::Read_GetCandy_Index(const uint256& assetId, const COutPoint& out, const std::string& strAddress, CAmount& nAmount)
 {
+    CIndexAddress address(strAddress);
+    if(address.IsNull())
+        return false;
+
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    pcursor->Seek(make_pair(DB_GETCANDY_INDEX, CGetCandy_IndexKey(assetId, out, strAddress)));
+    pcursor->Seek(make_pair(DB_GETCANDY_INDEX, CGetCandy_IndexKey(assetId, out, address)));
 
     int nCurHeight = g_nChainHeight;
     while (pcursor->Valid())
     {
         boost::this_thread::interruption_point();
         std::pair<std::string, CGetCandy_IndexKey> key;
-        if (pcursor->GetKey(key) && key.first == DB_GETCANDY_INDEX && key.second.assetId == assetId && key.second.out == out && key.second.strAddress == strAddress)
+        if (pcursor->GetKey(key) && key.first == DB_GETCANDY_INDEX && key.second.assetId == assetId && key.second.out == out && key.second.address == address)
         {
             CGetCandy_IndexValue value;
             if(pcursor->GetValue(value))
@@ -1067,16 +1298,17 @@ bool CBlockTreeDB::Read_GetCandy_Index(const uint256& assetId, std::map<COutPoin
             {
                 if(nCurHeight >= value.nHeight)
                 {
+                    std::string strAddress = key.second.address.ToString();
                     if (mapOutAddress.end() == mapOutAddress.find(key.second.out))
                     {
                         std::vector<std::string> vAddress;
-                        vAddress.push_back(key.second.strAddress);
+                        vAddress.push_back(strAddress);
                         mapOutAddress[key.second.out] = vAddress;
                     }
                     else
                     {
-                        if (mapOutAddress[key.second.out].end() == find(mapOutAddress[key.second.out].begin(), mapOutAddress[key.second.out].end(), key.second.strAddress))
-                            mapOutAddress[key.second.out].push_back(key.second.strAddress);
+                        if (mapOutAddress[key.second.out].end() == find(mapOutAddress[key.second.out].begin(), mapOutAddress[key.second.out].end(), strAddress))
+                            mapOutAddress[key.second.out].push_back(strAddress);
                     }
                 }
                 pcursor->Next();
@@ -1097,6 +1329,10 @@ bool CBlockTreeDB::Read_GetCandy_Index(const uint256& assetId, std::map<COutPoin
 
 bool CBlockTreeDB::Read_GetCandy_Index(const uint256& assetId, const std::string& straddress, std::vector<COutPoint>& vOut)
 {
+    CIndexAddress address(straddress);
+    if(address.IsNull())
+        return false;
+
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
     pcursor->Seek(make_pair(DB_GETCANDY_INDEX, CIterator_IdKey(assetId)));
@@ -1111,7 +1347,7 @@ bool CBlockTreeDB::Read_GetCandy_Index(const uint256& assetId, const std::string
             CGetCandy_IndexValue value;
             if(pcursor->GetValue(value))
             {
-                if(nCurHeight >= value.nHeight && key.second.strAddress == straddress)
+                if(nCurHeight >= value.nHeight && key.second.address == address)
                     vOut.push_back(key.second.out);
                 pcursor->Next();
             }
@@ -1260,3 +1496,128 @@ bool CBlockTreeDB::Read_GetCandyCount_Index(const uint256& assetId, const COutPo
 
     return ret;
 }
+
+namespace {
+
+/** Key layouts of the indexes before addresses were stored as CIndexAddress */
+struct CLegacyAddress_IndexKey
+{
+    uint256 id;
+    std::string strAddress;
+};
+
+struct CLegacyAppTx_IndexKey : public CLegacyAddress_IndexKey
+{
+    uint8_t nTxClass;
+    COutPoint out;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(id);
+        READWRITE(LIMITED_STRING(strAddress, MAX_ADDRESS_SIZE));
+        READWRITE(nTxClass);
+        READWRITE(out);
+    }
+
+    CAppTx_IndexKey Upgrade() const { return CAppTx_IndexKey(id, CIndexAddress(strAddress), nTxClass, out); }
+};
+
+struct CLegacyAssetTx_IndexKey : public CLegacyAppTx_IndexKey
+{
+    CAssetTx_IndexKey Upgrade() const { return CAssetTx_IndexKey(id, CIndexAddress(strAddress), nTxClass, out); }
+};
+
+struct CLegacyAuth_IndexKey : public CLegacyAddress_IndexKey
+{
+    uint32_t nAuth;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(id);
+        READWRITE(LIMITED_STRING(strAddress, MAX_ADDRESS_SIZE));
+        READWRITE(nAuth);
+    }
+
+    CAuth_IndexKey Upgrade() const { return CAuth_IndexKey(id, CIndexAddress(strAddress), nAuth); }
+};
+
+struct CLegacyGetCandy_IndexKey : public CLegacyAddress_IndexKey
+{
+    COutPoint out;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(id);
+        READWRITE(out);
+        READWRITE(LIMITED_STRING(strAddress, MAX_ADDRESS_SIZE));
+    }
+
+    CGetCandy_IndexKey Upgrade() const { return CGetCandy_IndexKey(id, out, CIndexAddress(strAddress)); }
+};
+
+/** Move every entry under strLegacyPrefix to strPrefix, re-keyed by binary address */
+template <typename LegacyKey, typename Value>
+bool UpgradeAddressIndex(CBlockTreeDB& db, const std::string& strLegacyPrefix, const std::string& strPrefix, size_t& nUpgraded)
+{
+    // each batch both writes the new key and erases the old one, so an
+    // interrupted upgrade simply resumes from the remaining legacy entries
+    static const size_t UPGRADE_BATCH_SIZE = 10000;
+
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(make_pair(strLegacyPrefix, uint256()));
+
+    CDBBatch batch(&db.GetObfuscateKey());
+    size_t nBatch = 0;
+    while (pcursor->Valid())
+    {
+        boost::this_thread::interruption_point();
+        std::pair<std::string, LegacyKey> key;
+        if (!pcursor->GetKey(key) || key.first != strLegacyPrefix)
+            break;
+
+        Value value;
+        if (!pcursor->GetValue(value))
+            return error("%s: failed to read %s index value", __func__, strLegacyPrefix);
+
+        batch.Write(make_pair(strPrefix, key.second.Upgrade()), value);
+        batch.Erase(key);
+        if (++nBatch == UPGRADE_BATCH_SIZE)
+        {
+            if (!db.WriteBatch(batch))
+                return false;
+            batch = CDBBatch(&db.GetObfuscateKey());
+            nUpgraded += nBatch;
+            nBatch = 0;
+        }
+        pcursor->Next();
+    }
+
+    nUpgraded += nBatch;
+    return nBatch == 0 || db.WriteBatch(batch);
+}
+
+} // namespace
+
+bool CBlockTreeDB::UpgradeAddressKeys()
+{
+    size_t nUpgraded = 0;
+    int64_t nStart = GetTimeMillis();
+    if (!UpgradeAddressIndex<CLegacyAppTx_IndexKey, int>(*this, DB_APPTX_INDEX_LEGACY, DB_APPTX_INDEX, nUpgraded)
+        || !UpgradeAddressIndex<CLegacyAuth_IndexKey, int>(*this, DB_AUTH_INDEX_LEGACY, DB_AUTH_INDEX, nUpgraded)
+        || !UpgradeAddressIndex<CLegacyAssetTx_IndexKey, int>(*this, DB_ASSETTX_INDEX_LEGACY, DB_ASSETTX_INDEX, nUpgraded)
+        || !UpgradeAddressIndex<CLegacyGetCandy_IndexKey, CGetCandy_IndexValue>(*this, DB_GETCANDY_INDEX_LEGACY, DB_GETCANDY_INDEX, nUpgraded))
+        return error("%s: failed to upgrade app/asset address index", __func__);
+
+    if (nUpgraded > 0)
+        LogPrintf("Upgraded %u app/asset index entries to binary address keys in %dms\n", nUpgraded, GetTimeMillis() - nStart);
+    return true;
+}
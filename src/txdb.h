@@ -17,6 +17,7 @@
 
 class CBlockFileInfo;
 class CBlockIndex;
+class CDiskBlockIndex;
 struct CDiskTxPos;
 struct CAddressUnspentKey;
 struct CAddressUnspentValue;
@@ -55,11 +56,18 @@ protected:
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
+
+    //! Convert per-transaction records of an older chainstate to per-outpoint ones
+    bool Upgrade();
+
+    //! Underlying database and the leading key byte of its coin records, for snapshots
+    CDBWrapper& GetDB() { return db; }
+    static char GetCoinKeyPrefix() { return 'C'; }
 };
 
 /** Access to the block database (blocks/index/) */
@@ -90,9 +98,24 @@ public:
                           int start = 0, int end = 0);
     bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
     bool ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &vect);
+    //! Add tx, address, spent and timestamp index updates to a batch, to be written with WriteBatch
+    void BatchTxIndex(CDBBatch& batch, const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    void BatchSpentIndex(CDBBatch& batch, const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &vect);
+    void BatchAddressUnspentIndex(CDBBatch& batch, const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
+    void BatchAddressIndex(CDBBatch& batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, bool fErase);
+    void BatchTimestampIndex(CDBBatch& batch, const CTimestampIndexKey &timestampIndex);
+    //! Block the tx, address, spent and timestamp indexes were last written for
+    bool ReadIndexBestBlock(uint256 &hash);
+    void BatchIndexBestBlock(CDBBatch& batch, const uint256 &hash);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts();
+    //! Re-key app/asset indexes written with base58 address strings
+    bool UpgradeAddressKeys();
+    //! Write block index entries as they are, without touching the block file records
+    bool WriteBlockIndex(const std::vector<CDiskBlockIndex>& vIndex);
+    //! Key prefixes of the app, asset and candy indexes
+    static const std::vector<std::string>& GetAppIndexPrefixes();
 
     bool Write_AppId_AppInfo_Index(const std::vector<std::pair<uint256, CAppId_AppInfo_IndexValue> > &vect);
     bool Erase_AppId_AppInfo_Index(const std::vector<std::pair<uint256, CAppId_AppInfo_IndexValue> > &vect);
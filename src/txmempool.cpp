@@ -347,17 +347,10 @@ CTxMemPool::~CTxMemPool()
     delete minerPolicyEstimator;
 }
 
-void CTxMemPool::pruneSpent(const uint256 &hashTx, CCoins &coins)
+bool CTxMemPool::isSpent(const COutPoint& outpoint)
 {
     LOCK(cs);
-
-    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.lower_bound(COutPoint(hashTx, 0));
-
-    // iterate over all COutPoints in mapNextTx whose hash equals the provided hashTx
-    while (it != mapNextTx.end() && it->first.hash == hashTx) {
-        coins.Spend(it->first.n); // and remove those outputs from coins
-        it++;
-    }
+    return mapNextTx.count(outpoint);
 }
 
 unsigned int CTxMemPool::GetTransactionsUpdated() const
@@ -401,10 +394,10 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     std::set<uint256> setParentTransactions;
     for (unsigned int i = 0; i < tx.vin.size(); i++) {
         const CTxIn& txin = tx.vin[i];
-        CCoins coins;
-        if(view.GetCoins(txin.prevout.hash, coins))
+        const Coin& coin = view.AccessCoin(txin.prevout);
+        if(!coin.IsSpent())
         {
-            const CTxOut& in_txout = coins.vout[txin.prevout.n];
+            const CTxOut& in_txout = coin.out;
             uint32_t nAppCmd = 0;
             if(in_txout.IsAsset(&nAppCmd) && nAppCmd == PUT_CANDY_CMD && txin.scriptSig.empty())
             {
@@ -703,13 +696,13 @@ bool CAppTx_IndexKeyCompare::operator()(const CAppTx_IndexKey& a, const CAppTx_I
 {
     if(a.appId == b.appId)
     {
-        if(a.strAddress == b.strAddress)
+        if(a.address == b.address)
         {
             if(a.nTxClass == b.nTxClass)
                 return a.out < b.out;
             return a.nTxClass < b.nTxClass;
         }
-        return a.strAddress < b.strAddress;
+        return a.address < b.address;
     }
     return a.appId < b.appId;
 }
@@ -745,7 +738,7 @@ void CTxMemPool::add_AppTx_Index(const CTxMemPoolEntry& entry, const CCoinsViewC
             else
                 continue;
 
-            CAppTx_IndexKey key(header.appId, CBitcoinAddress(dest).ToString(), nTxClass, COutPoint(txhash, i));
+            CAppTx_IndexKey key(header.appId, CIndexAddress(dest), nTxClass, COutPoint(txhash, i));
             mapAppTx.insert(make_pair(key, -1));
             inserted.push_back(key);
         }
@@ -768,9 +761,10 @@ bool CTxMemPool::get_AppTx_Index(const uint256& appId, std::vector<COutPoint>& v
 bool CTxMemPool::get_AppTx_Index(const uint256& appId, const std::string& strAddress, std::vector<COutPoint>& vOut)
 {
     LOCK(cs);
+    CIndexAddress address(strAddress);
     for(mapAppTx_Index::const_iterator it = mapAppTx.begin(); it != mapAppTx.end(); it++)
     {
-        if(it->first.appId == appId && it->first.strAddress == strAddress)
+        if(it->first.appId == appId && it->first.address == address)
             vOut.push_back(it->first.out);
     }
     return vOut.size();
@@ -779,9 +773,10 @@ bool CTxMemPool::get_AppTx_Index(const uint256& appId, const std::string& strAdd
 bool CTxMemPool::getAppList(const std::string& strAddress, std::vector<uint256>& vAppId)
 {
     LOCK(cs);
+    CIndexAddress address(strAddress);
     for(mapAppTx_Index::const_iterator it = mapAppTx.begin(); it != mapAppTx.end(); it++)
     {
-        if(it->first.strAddress == strAddress)
+        if(it->first.address == address)
             vAppId.push_back(it->first.appId);
     }
     return vAppId.size();
@@ -808,9 +803,9 @@ bool CAuth_IndexKeyCompare::operator()(const CAuth_IndexKey& a, const CAuth_Inde
 {
     if(a.appId == b.appId)
     {
-        if(a.strAddress == b.strAddress)
+        if(a.address == b.address)
             return a.nAuth < b.nAuth;
-        return a.strAddress < b.strAddress;
+        return a.address < b.address;
     }
     return a.appId < b.appId;
 }
@@ -835,7 +830,7 @@ void CTxMemPool::add_Auth_Index(const CTxMemPoolEntry& entry, const CCoinsViewCa
                 CAuthData authData;
                 if(ParseAuthData(vData, authData))
                 {
-                    CAuth_IndexKey key(header.appId, authData.strUserAddress, authData.nAuth);
+                    CAuth_IndexKey key(header.appId, CIndexAddress(authData.strUserAddress), authData.nAuth);
                     mapAuth.insert(make_pair(key, -1));
                     inserted.push_back(key);
                 }
@@ -849,9 +844,10 @@ void CTxMemPool::add_Auth_Index(const CTxMemPoolEntry& entry, const CCoinsViewCa
 bool CTxMemPool::get_Auth_Index(const uint256& appId, const std::string& strAddress, std::vector<uint32_t>& vAuth)
 {
     LOCK(cs);
+    CIndexAddress address(strAddress);
     for(mapAuth_Index::const_iterator it = mapAuth.begin(); it != mapAuth.end(); it++)
     {
-        if(it->first.appId == appId && it->first.strAddress == strAddress)
+        if(it->first.appId == appId && it->first.address == address)
             vAuth.push_back(it->first.nAuth);
     }
 
@@ -1008,13 +1004,13 @@ bool CAssetTx_IndexKeyCompare::operator()(const CAssetTx_IndexKey& a, const CAss
 {
     if(a.assetId == b.assetId)
     {
-        if(a.strAddress == b.strAddress)
+        if(a.address == b.address)
         {
             if(a.nTxClass == b.nTxClass)
                 return a.out < b.out;
             return a.nTxClass < b.nTxClass;
         }
-        return a.strAddress < b.strAddress;
+        return a.address < b.address;
     }
     return a.assetId < b.assetId;
 }
@@ -1043,7 +1039,7 @@ void CTxMemPool::add_AssetTx_Index(const CTxMemPoolEntry& entry, const CCoinsVie
                 CAssetData assetData;
                 if(ParseIssueData(vData, assetData))
                 {
-                    CAssetTx_IndexKey key(assetData.GetHash(), CBitcoinAddress(dest).ToString(), ISSUE_TXOUT, COutPoint(txhash, i));
+                    CAssetTx_IndexKey key(assetData.GetHash(), CIndexAddress(dest), ISSUE_TXOUT, COutPoint(txhash, i));
                     mapAssetTx.insert(make_pair(key, -1));
                     inserted.push_back(key);
                 }
@@ -1055,13 +1051,13 @@ void CTxMemPool::add_AssetTx_Index(const CTxMemPoolEntry& entry, const CCoinsVie
                 {
                     if (header.nAppCmd == ADD_ASSET_CMD)
                     {
-                        CAssetTx_IndexKey key(commonData.assetId, CBitcoinAddress(dest).ToString(), ADD_ISSUE_TXOUT, COutPoint(txhash, i));
+                        CAssetTx_IndexKey key(commonData.assetId, CIndexAddress(dest), ADD_ISSUE_TXOUT, COutPoint(txhash, i));
                         mapAssetTx.insert(make_pair(key, -1));
                         inserted.push_back(key);
                     }
                     else if (header.nAppCmd == DESTORY_ASSET_CMD)
                     {
-                        CAssetTx_IndexKey key(commonData.assetId, CBitcoinAddress(dest).ToString(), DESTORY_TXOUT, COutPoint(txhash, i));
+                        CAssetTx_IndexKey key(commonData.assetId, CIndexAddress(dest), DESTORY_TXOUT, COutPoint(txhash, i));
                         mapAssetTx.insert(make_pair(key, -1));
                         inserted.push_back(key);
                     }
@@ -1069,13 +1065,13 @@ void CTxMemPool::add_AssetTx_Index(const CTxMemPoolEntry& entry, const CCoinsVie
                     {
                         if(txout.nUnlockedHeight > 0)
                         {
-                            CAssetTx_IndexKey key(commonData.assetId, CBitcoinAddress(dest).ToString(), LOCKED_TXOUT, COutPoint(txhash, i));
+                            CAssetTx_IndexKey key(commonData.assetId, CIndexAddress(dest), LOCKED_TXOUT, COutPoint(txhash, i));
                             mapAssetTx.insert(make_pair(key, -1));
                             inserted.push_back(key);
                         }
                         else
                         {
-                            CAssetTx_IndexKey key(commonData.assetId, CBitcoinAddress(dest).ToString(), TRANSFER_TXOUT, COutPoint(txhash, i));
+                            CAssetTx_IndexKey key(commonData.assetId, CIndexAddress(dest), TRANSFER_TXOUT, COutPoint(txhash, i));
                             mapAssetTx.insert(make_pair(key, -1));
                             inserted.push_back(key);
                         }
@@ -1087,7 +1083,7 @@ void CTxMemPool::add_AssetTx_Index(const CTxMemPoolEntry& entry, const CCoinsVie
                 CPutCandyData candyData;
                 if(ParsePutCandyData(vData, candyData))
                 {
-                    CAssetTx_IndexKey key(candyData.assetId, CBitcoinAddress(dest).ToString(), PUT_CANDY_TXOUT, COutPoint(txhash, i));
+                    CAssetTx_IndexKey key(candyData.assetId, CIndexAddress(dest), PUT_CANDY_TXOUT, COutPoint(txhash, i));
                     mapAssetTx.insert(make_pair(key, -1));
                     inserted.push_back(key);
                 }
@@ -1097,7 +1093,7 @@ void CTxMemPool::add_AssetTx_Index(const CTxMemPoolEntry& entry, const CCoinsVie
                 CGetCandyData candyData;
                 if(ParseGetCandyData(vData, candyData))
                 {
-                    CAssetTx_IndexKey key(candyData.assetId, CBitcoinAddress(dest).ToString(), GET_CANDY_TXOUT, COutPoint(txhash, i));
+                    CAssetTx_IndexKey key(candyData.assetId, CIndexAddress(dest), GET_CANDY_TXOUT, COutPoint(txhash, i));
                     mapAssetTx.insert(make_pair(key, -1));
                     inserted.push_back(key);
                 }
@@ -1143,10 +1139,11 @@ bool CTxMemPool::get_AssetTx_Index(const uint256& assetId, const uint8_t& nTxCla
 bool CTxMemPool::get_AssetTx_Index(const uint256& assetId, const std::string& strAddress, const uint8_t& nTxClass, std::vector<COutPoint>& vOut)
 {
     LOCK(cs);
+    CIndexAddress address(strAddress);
     multimap<int, COutPoint> tmpMap;
     for(mapAssetTx_Index::const_iterator it = mapAssetTx.begin(); it != mapAssetTx.end(); it++)
     {
-        if(it->first.assetId != assetId || it->first.strAddress != strAddress)
+        if(it->first.assetId != assetId || it->first.address != address)
             continue;
 
         if(nTxClass == ALL_TXOUT)
@@ -1177,9 +1174,10 @@ bool CTxMemPool::get_AssetTx_Index(const uint256& assetId, const std::string& st
 bool CTxMemPool::getAssetList(const std::string& strAddress, std::vector<uint256>& vAssetId)
 {
     LOCK(cs);
+    CIndexAddress address(strAddress);
     for(mapAssetTx_Index::const_iterator it = mapAssetTx.begin(); it != mapAssetTx.end(); it++)
     {
-        if (it->first.strAddress == strAddress)
+        if (it->first.address == address)
             vAssetId.push_back(it->first.assetId);
     }
     return vAssetId.size();
@@ -1205,10 +1203,11 @@ bool CTxMemPool::remove_AssetTx_Index(const uint256& txhash)
 int CTxMemPool::get_PutCandy_count(const uint256 &assetId)
 {
     LOCK(cs);
+    CIndexAddress putCandyAddress(g_strPutCandyAddress);
     int nCount = 0;
     for(mapAssetTx_Index::const_iterator it = mapAssetTx.begin(); it != mapAssetTx.end(); it++)
     {
-        if(it->first.assetId != assetId || it->first.strAddress != g_strPutCandyAddress || it->first.nTxClass != PUT_CANDY_TXOUT)
+        if(it->first.assetId != assetId || it->first.address != putCandyAddress || it->first.nTxClass != PUT_CANDY_TXOUT)
             continue;
         nCount++;
     }
@@ -1221,7 +1220,7 @@ bool CGetCandy_IndexKeyCompare::operator()(const CGetCandy_IndexKey& a, const CG
     {
         if(a.out == b.out)
         {
-            return a.strAddress < b.strAddress;
+            return a.address < b.address;
         }
         return a.out < b.out;
     }
@@ -1240,6 +1239,7 @@ void CTxMemPool::add_GetCandy_Index(const CTxMemPoolEntry& entry, const CCoinsVi
     LOCK(cs);
     const CTransaction& tx = entry.GetTx();
     std::vector<CGetCandy_IndexKey> getCandy_inserted;
+    CIndexAddress putCandyAddress(g_strPutCandyAddress);
 
     uint256 txhash = tx.GetHash();
     for(unsigned int i = 0; i < tx.vout.size(); i++)
@@ -1265,9 +1265,9 @@ void CTxMemPool::add_GetCandy_Index(const CTxMemPoolEntry& entry, const CCoinsVi
                         CTxDestination in_dest;
                         if(!ExtractDestination(in_txout.scriptPubKey, in_dest))
                             continue;
-                        if(CBitcoinAddress(in_dest).ToString() == g_strPutCandyAddress)
+                        if(CIndexAddress(in_dest) == putCandyAddress)
                         {
-                            CGetCandy_IndexKey key(candyData.assetId, txin.prevout, CBitcoinAddress(dest).ToString());
+                            CGetCandy_IndexKey key(candyData.assetId, txin.prevout, CIndexAddress(dest));
                             mapGetCandy.insert(make_pair(key, CGetCandy_IndexValue(candyData.nAmount)));
                             getCandy_inserted.push_back(key);
                         }
@@ -1283,10 +1283,11 @@ void CTxMemPool::add_GetCandy_Index(const CTxMemPoolEntry& entry, const CCoinsVi
 bool CTxMemPool::get_GetCandy_Index(const uint256& assetId, const COutPoint& out, const std::string& strAddress, CAmount& nAmount)
 {
     LOCK(cs);
+    CIndexAddress address(strAddress);
     for(mapGetCandy_Index::const_iterator it = mapGetCandy.begin(); it != mapGetCandy.end(); it++)
     {
         const CGetCandy_IndexKey& key = it->first;
-        if(key.assetId == assetId && key.out == out && key.strAddress == strAddress)
+        if(key.assetId == assetId && key.out == out && key.address == address)
         {
             nAmount = it->second.nAmount;
             return true;
@@ -1296,6 +1297,17 @@ bool CTxMemPool::get_GetCandy_Index(const uint256& assetId, const COutPoint& out
     return false;
 }
 
+void CTxMemPool::get_GetCandy_Index(const uint256& assetId, const COutPoint& out, std::set<std::string>& setAddress)
+{
+    LOCK(cs);
+    for(mapGetCandy_Index::const_iterator it = mapGetCandy.begin(); it != mapGetCandy.end(); it++)
+    {
+        const CGetCandy_IndexKey& key = it->first;
+        if(key.assetId == assetId && key.out == out)
+            setAddress.insert(key.address.ToString());
+    }
+}
+
 bool CTxMemPool::remove_GetCandy_Index(const uint256& txhash)
 {
     LOCK(cs);
@@ -1320,6 +1332,7 @@ void CTxMemPool::add_GetCandyCount_Index(const CTxMemPoolEntry& entry, const CCo
     LOCK(cs);
     const CTransaction& tx = entry.GetTx();
     std::vector<std::pair<CGetCandyCount_IndexKey,CGetCandyCount_IndexValue> > getCandyCount_inserted;
+    CIndexAddress putCandyAddress(g_strPutCandyAddress);
 
     uint256 txhash = tx.GetHash();
     for(unsigned int i = 0; i < tx.vout.size(); i++)
@@ -1345,7 +1358,7 @@ void CTxMemPool::add_GetCandyCount_Index(const CTxMemPoolEntry& entry, const CCo
                         CTxDestination in_dest;
                         if(!ExtractDestination(in_txout.scriptPubKey, in_dest))
                             continue;
-                        if(CBitcoinAddress(in_dest).ToString() == g_strPutCandyAddress)
+                        if(CIndexAddress(in_dest) == putCandyAddress)
                         {
                             //XJTODO test
                             CGetCandyCount_IndexKey key(candyData.assetId,txin.prevout);
@@ -1519,9 +1532,9 @@ void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMem
                 indexed_transaction_set::const_iterator it2 = mapTx.find(txin.prevout.hash);
                 if (it2 != mapTx.end())
                     continue;
-                const CCoins *coins = pcoins->AccessCoins(txin.prevout.hash);
-		if (nCheckFrequency != 0) assert(coins);
-                if (!coins || (coins->IsCoinBase() && ((signed long)nMemPoolHeight) - coins->nHeight < COINBASE_MATURITY)) {
+                const Coin &coin = pcoins->AccessCoin(txin.prevout);
+		if (nCheckFrequency != 0) assert(!coin.IsSpent());
+                if (coin.IsSpent() || (coin.IsCoinBase() && ((signed long)nMemPoolHeight) - coin.nHeight < COINBASE_MATURITY)) {
                     transactionsToRemove.push_back(tx);
                     break;
                 }
@@ -1640,8 +1653,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                 fDependsWait = true;
                 setParentCheck.insert(it2);
             } else {
-                const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
-                assert(coins && coins->IsAvailable(txin.prevout.n));
+                assert(pcoins->HaveCoin(txin.prevout));
             }
             // Check whether its inputs are marked in mapNextTx.
             std::map<COutPoint, CInPoint>::const_iterator it3 = mapNextTx.find(txin.prevout);
@@ -1836,20 +1848,24 @@ bool CTxMemPool::HasNoInputsOf(const CTransaction &tx) const
 
 CCoinsViewMemPool::CCoinsViewMemPool(CCoinsView *baseIn, CTxMemPool &mempoolIn) : CCoinsViewBacked(baseIn), mempool(mempoolIn) { }
 
-bool CCoinsViewMemPool::GetCoins(const uint256 &txid, CCoins &coins) const {
+bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     // If an entry in the mempool exists, always return that one, as it's guaranteed to never
     // conflict with the underlying cache, and it cannot have pruned entries (as it contains full)
     // transactions. First checking the underlying cache risks returning a pruned entry instead.
     CTransaction tx;
-    if (mempool.lookup(txid, tx)) {
-        coins = CCoins(tx, MEMPOOL_HEIGHT);
-        return true;
+    if (mempool.lookup(outpoint.hash, tx)) {
+        if (outpoint.n < tx.vout.size()) {
+            coin = Coin(tx.vout[outpoint.n], MEMPOOL_HEIGHT, false);
+            return true;
+        } else {
+            return false;
+        }
     }
-    return (base->GetCoins(txid, coins) && !coins.IsPruned());
+    return (base->GetCoin(outpoint, coin) && !coin.IsSpent());
 }
 
-bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
-    return mempool.exists(txid) || base->HaveCoins(txid);
+bool CCoinsViewMemPool::HaveCoin(const COutPoint &outpoint) const {
+    return mempool.exists(outpoint) || base->HaveCoin(outpoint);
 }
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
@@ -1968,7 +1984,7 @@ void CTxMemPool::trackPackageRemoved(const CFeeRate& rate) {
     }
 }
 
-void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRemaining) {
+void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining) {
     LOCK(cs);
 
     unsigned nTxnRemoved = 0;
@@ -2001,9 +2017,8 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRe
                 BOOST_FOREACH(const CTxIn& txin, tx.vin) {
                     if (exists(txin.prevout.hash))
                         continue;
-                    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.lower_bound(COutPoint(txin.prevout.hash, 0));
-                    if (it == mapNextTx.end() || it->first.hash != txin.prevout.hash)
-                        pvNoSpendsRemaining->push_back(txin.prevout.hash);
+                    if (!mapNextTx.count(txin.prevout))
+                        pvNoSpendsRemaining->push_back(txin.prevout);
                 }
             }
         }
@@ -132,6 +132,9 @@ public:
      * @note This hash is not stable between little and big endian.
      */
     uint64_t GetHash(const uint256& salt) const;
+
+    /** Salted hash of this value together with a 32-bit extra word, such as an output index */
+    uint64_t GetHash(const uint256& salt, uint32_t nExtra) const;
 };
 
 /* uint256 from const char *.
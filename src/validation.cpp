@@ -9,6 +9,9 @@
 
 #include "alert.h"
 #include "arith_uint256.h"
+#include "assetamount.h"
+#include "blockimport.h"
+#include "chainindexer.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -55,6 +58,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/math/distributions/poisson.hpp>
 #include <boost/thread.hpp>
 
@@ -105,10 +109,6 @@ std::vector<CCandy_BlockTime_Info> gTmpAllCandyInfoVec;
 bool fUpdateAllCandyInfoFinished = false;
 unsigned int nCandyPageCount = 20;//display 20 candy info per page
 
-const static int M = 2000; //Maximum number of digits
-int numA[M];
-int numB[M];
-
 std::atomic<bool> fDIP0001WasLockedIn{false};
 std::atomic<bool> fDIP0001ActiveAtTip{false};
 
@@ -126,6 +126,8 @@ uint256 hashAssumeValid;
 CFeeRate minRelayTxFee = CFeeRate(DEFAULT_LEGACY_MIN_RELAY_TX_FEE);
 
 CTxMemPool mempool(::minRelayTxFee);
+CBlockCache blockcache;
+CBlockFileWriter blockwriter;
 map<uint256, int64_t> mapRejectedBlocks GUARDED_BY(cs_main);
 
 /**
@@ -140,7 +142,7 @@ CScript COINBASE_FLAGS;
 
 const string strMessageMagic = "DarkCoin Signed Message:\n";
 
-std::mutex g_mutexChangeFile;
+boost::shared_mutex g_mutexChangeFile;
 
 std::mutex g_mutexChangeInfo;
 static std::list<CChangeInfo> g_listChangeInfo;
@@ -235,6 +237,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 enum FlushStateMode {
@@ -422,15 +425,15 @@ bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp, bool
         prevheights.resize(tx.vin.size());
         for (size_t txinIndex = 0; txinIndex < tx.vin.size(); txinIndex++) {
             const CTxIn& txin = tx.vin[txinIndex];
-            CCoins coins;
-            if (!viewMemPool.GetCoins(txin.prevout.hash, coins)) {
+            Coin coin;
+            if (!viewMemPool.GetCoin(txin.prevout, coin)) {
                 return error("%s: Missing input", __func__);
             }
-            if (coins.nHeight == MEMPOOL_HEIGHT) {
+            if (coin.nHeight == MEMPOOL_HEIGHT) {
                 // Assume all mempool transaction confirm in the next block
                 prevheights[txinIndex] = tip->nHeight + 1;
             } else {
-                prevheights[txinIndex] = coins.nHeight;
+                prevheights[txinIndex] = coin.nHeight;
             }
         }
         lockPair = CalculateSequenceLocks(tx, flags, &prevheights, index);
@@ -493,19 +496,17 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& in
     return nSigOps;
 }
 
-bool GetUTXOCoins(const COutPoint& outpoint, CCoins& coins)
+bool GetUTXOCoin(const COutPoint& outpoint, Coin& coin)
 {
     LOCK(cs_main);
-    return !(!pcoinsTip->GetCoins(outpoint.hash, coins) ||
-             (unsigned int)outpoint.n>=coins.vout.size() ||
-             coins.vout[outpoint.n].IsNull());
+    return pcoinsTip->GetCoin(outpoint, coin) && !coin.IsSpent();
 }
 
 int GetUTXOHeight(const COutPoint& outpoint)
 {
     // -1 means UTXO is yet unknown or already spent
-    CCoins coins;
-    return GetUTXOCoins(outpoint, coins) ? coins.nHeight : -1;
+    Coin coin;
+    return GetUTXOCoin(outpoint, coin) ? coin.nHeight : -1;
 }
 
 int GetUTXOConfirmations(const COutPoint& outpoint)
@@ -516,6 +517,42 @@ int GetUTXOConfirmations(const COutPoint& outpoint)
     return (nPrevoutHeight > -1 && chainActive.Tip()) ? chainActive.Height() - nPrevoutHeight + 1 : -1;
 }
 
+CIndexAddress::CIndexAddress(const CTxDestination& dest) : type(0)
+{
+    if(const CKeyID* pKeyID = boost::get<CKeyID>(&dest))
+    {
+        type = 1;
+        hashBytes = *pKeyID;
+    }
+    else if(const CScriptID* pScriptID = boost::get<CScriptID>(&dest))
+    {
+        type = 2;
+        hashBytes = *pScriptID;
+    }
+}
+
+CIndexAddress::CIndexAddress(const std::string& strAddress) : type(0)
+{
+    int nAddressType = 0;
+    if(strAddress == "ALL_USER")
+        type = TYPE_ALL_USER;
+    else if(CBitcoinAddress(strAddress).GetIndexKey(hashBytes, nAddressType))
+        type = nAddressType;
+    else
+        hashBytes.SetNull();
+}
+
+std::string CIndexAddress::ToString() const
+{
+    if(type == 1)
+        return CBitcoinAddress(CKeyID(hashBytes)).ToString();
+    if(type == 2)
+        return CBitcoinAddress(CScriptID(hashBytes)).ToString();
+    if(type == TYPE_ALL_USER)
+        return "ALL_USER";
+    return "";
+}
+
 bool GetTxOutAddress(const CTxOut& txout, string* pAddress)
 {
     CTxDestination dest;
@@ -700,7 +737,7 @@ bool CheckTransaction(const CTransaction& tx, CValidationState &state, const enu
     return true;
 }
 
-bool CheckAppTransaction(const CTransaction& tx, CValidationState &state, const CCoinsViewCache& view, map<CPutCandy_IndexKey, CAmount>& mapAssetGetCandy, const bool fWithMempool)
+bool CheckAppTransaction(const CTransaction& tx, CValidationState &state, const CCoinsViewCache& view, map<CPutCandy_IndexKey, CAmount>& mapAssetGetCandy, const bool fWithMempool, const CAppTxChainInfo* pChainInfo)
 {
     if(tx.IsCoinBase())
         return true;
@@ -851,10 +888,10 @@ bool CheckAppTransaction(const CTransaction& tx, CValidationState &state, const
     for(unsigned int i = 0; i < tx.vin.size(); i++)
     {
         const CTxIn& txin = tx.vin[i];
-        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if(!coins || !coins->IsAvailable(txin.prevout.n))
+        const Coin& coin = view.AccessCoin(txin.prevout);
+        if(coin.IsSpent())
             return state.Invalid(false, REJECT_DUPLICATE, "3-bad-txns-inputs-spent");
-        const CTxOut& txout = coins->vout[txin.prevout.n];
+        const CTxOut& txout = coin.out;
 
         if(!txout.IsAsset())
             continue;
@@ -930,7 +967,7 @@ bool CheckAppTransaction(const CTransaction& tx, CValidationState &state, const
     if(mapInAssetId.size() > 1 || mapInAssetId2.size() > 1)
         return state.DoS(50, false, REJECT_INVALID, "asset_tx: vin can contain 1 asset only, " + tx.GetHash().GetHex());
 
-    int nTxHeight = GetTxHeight(tx.GetHash());
+    int nTxHeight = pChainInfo ? pChainInfo->nTxHeight : GetTxHeight(tx.GetHash());
 
     for(unsigned int i = 0; i < tx.vout.size(); i++)
     {
@@ -1041,11 +1078,11 @@ bool CheckAppTransaction(const CTransaction& tx, CValidationState &state, const
             for(unsigned int m = 0; m < tx.vin.size(); m++)
             {
                 const CTxIn& txin = tx.vin[m];
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                if (!coins)
+                const Coin& coin = view.AccessCoin(txin.prevout);
+                if (coin.IsSpent())
                     return state.DoS(10, false, REJECT_INVALID, "register_app: missing txin, " + txin.ToString());
 
-                const CTxOut& in_txout = coins->vout[txin.prevout.n];
+                const CTxOut& in_txout = coin.out;
                 if(in_txout.IsAsset()) // forbid asset txin
                     return state.DoS(50, false, REJECT_INVALID, "register_app: txin cannot be asset txout, " + txin.ToString());
             }
@@ -1135,11 +1172,11 @@ bool CheckAppTransaction(const CTransaction& tx, CValidationState &state, const
             for(unsigned int m = 0; m < tx.vin.size(); m++)
             {
                 const CTxIn& txin = tx.vin[m];
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                if (!coins)
+                const Coin& coin = view.AccessCoin(txin.prevout);
+                if (coin.IsSpent())
                     return state.DoS(10, false, REJECT_INVALID, "set_auth: missing txin, " + txin.ToString());
 
-                const CTxOut& in_txout = coins->vout[txin.prevout.n];
+                const CTxOut& in_txout = coin.out;
                 if(in_txout.IsAsset()) // forbid asset txin
                     return state.DoS(50, false, REJECT_INVALID, "set_auth: txin cannot be asset txout, " + txin.ToString());
 
@@ -1270,11 +1307,11 @@ bool CheckAppTransaction(const CTransaction& tx, CValidationState &state, const
             for(unsigned int m = 0; m < tx.vin.size(); m++)
             {
                 const CTxIn& txin = tx.vin[m];
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                if (!coins)
+                const Coin& coin = view.AccessCoin(txin.prevout);
+                if (coin.IsSpent())
                     return state.DoS(10, false, REJECT_INVALID, "extenddata: missing txin, " + txin.ToString());
 
-                const CTxOut& in_txout = coins->vout[txin.prevout.n];
+                const CTxOut& in_txout = coin.out;
                 if(in_txout.IsAsset()) // forbid asset txin
                     return state.DoS(50, false, REJECT_INVALID, "extenddata: txin cannot be asset txout, " + txin.ToString());
 
@@ -1339,12 +1376,7 @@ bool CheckAppTransaction(const CTransaction& tx, CValidationState &state, const
 
             if(assetData.bPayCandy)
             {
-                char totalAmountStr[64] = "",candyAmountStr[64]="";
-                snprintf(totalAmountStr,sizeof(totalAmountStr),"%lld",assetData.nTotalAmount);
-                snprintf(candyAmountStr,sizeof(candyAmountStr),"%lld",assetData.nCandyAmount);
-                string candyMinStr = numtofloatstring(totalAmountStr,3); // 1‰
-                string candyMaxStr = numtofloatstring(totalAmountStr,1); // 10%
-                if(compareFloatString(candyAmountStr,candyMinStr)<0 || compareFloatString(candyAmountStr,candyMaxStr)>0)
+                if(!IsCandyAmountInRange(assetData.nTotalAmount, assetData.nCandyAmount))
                     return state.DoS(10, false, REJECT_INVALID, "issue_asset: candy amount out of range (min: 0.001 * total, max: 0.1 * total)");
                 if(assetData.nCandyAmount >= assetData.nFirstIssueAmount)
                     return state.DoS(10, false, REJECT_INVALID, "issue_asset: candy amount exceed first issue amount");
@@ -1419,11 +1451,11 @@ bool CheckAppTransaction(const CTransaction& tx, CValidationState &state, const
             for(unsigned int m = 0; m < tx.vin.size(); m++)
             {
                 const CTxIn& txin = tx.vin[m];
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                if (!coins)
+                const Coin& coin = view.AccessCoin(txin.prevout);
+                if (coin.IsSpent())
                     return state.DoS(10, false, REJECT_INVALID, "issue_asset: missing txin, " + txin.ToString());
 
-                const CTxOut& in_txout = coins->vout[txin.prevout.n];
+                const CTxOut& in_txout = coin.out;
                 if(in_txout.IsAsset()) // forbid asset txin
                     return state.DoS(50, false, REJECT_INVALID, "issue_asset: txin cannot be asset txout, " + txin.ToString());
             }
@@ -1473,11 +1505,11 @@ bool CheckAppTransaction(const CTransaction& tx, CValidationState &state, const
             for(unsigned int m = 0; m < tx.vin.size(); m++)
             {
                 const CTxIn& txin = tx.vin[m];
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                if (!coins)
+                const Coin& coin = view.AccessCoin(txin.prevout);
+                if (coin.IsSpent())
                     return state.DoS(10, false, REJECT_INVALID, "add_asset: missing txin, " + txin.ToString());
 
-                const CTxOut& in_txout = coins->vout[txin.prevout.n];
+                const CTxOut& in_txout = coin.out;
                 if(in_txout.IsAsset()) // forbid asset txin
                     return state.DoS(50, false, REJECT_INVALID, "add_asset: txin cannot be asset txout, " + txin.ToString());
 
@@ -1755,12 +1787,7 @@ bool CheckAppTransaction(const CTransaction& tx, CValidationState &state, const
                 if(candyData.nAmount != assetData.nCandyAmount)
                     return state.DoS(10, false, REJECT_INVALID, "put_candy: candy amount is different from candy amount of asset data");
 
-                char totalAmountStr[64] = "",candyAmountStr[64]="";
-                snprintf(totalAmountStr,sizeof(totalAmountStr),"%lld",assetData.nTotalAmount);
-                snprintf(candyAmountStr,sizeof(candyAmountStr),"%lld",assetData.nCandyAmount);
-                string candyMinStr = numtofloatstring(totalAmountStr,3); // 1‰
-                string candyMaxStr = numtofloatstring(totalAmountStr,1); // 10%
-                if(compareFloatString(candyAmountStr,candyMinStr)<0 || compareFloatString(candyAmountStr,candyMaxStr)>0)
+                if(!IsCandyAmountInRange(assetData.nTotalAmount, assetData.nCandyAmount))
                     return state.DoS(10, false, REJECT_INVALID, "put_candy: candy amount out of range (min: 0.001 * total, max: 0.1 * total)");
 
                 if(candyData.nAmount != assetData.nFirstIssueAmount - assetData.nFirstActualAmount)
@@ -1775,12 +1802,7 @@ bool CheckAppTransaction(const CTransaction& tx, CValidationState &state, const
                 if(!GetAssetInfoByAssetId(candyData.assetId, assetInfo, false))
                     return state.DoS(10, false, REJECT_INVALID, "put_candy: non-existent asset");
 
-                char totalAmountStr[64] = "",candyAmountStr[64]="";
-                snprintf(totalAmountStr,sizeof(totalAmountStr),"%lld",assetInfo.assetData.nTotalAmount);
-                snprintf(candyAmountStr,sizeof(candyAmountStr),"%lld",candyData.nAmount);
-                string candyMinStr = numtofloatstring(totalAmountStr,3); // 1‰
-                string candyMaxStr = numtofloatstring(totalAmountStr,1); // 10%
-                if(compareFloatString(candyAmountStr,candyMinStr)<0||compareFloatString(candyAmountStr,candyMaxStr)>0)
+                if(!IsCandyAmountInRange(assetInfo.assetData.nTotalAmount, candyData.nAmount))
                     return state.DoS(10, false, REJECT_INVALID, "put_candy: candy amount out of range (min: 0.001 * total, max: 0.1 * total)");
 
                 strAdminAddress = assetInfo.strAdminAddress;
@@ -1795,11 +1817,11 @@ bool CheckAppTransaction(const CTransaction& tx, CValidationState &state, const
             for(unsigned int m = 0; m < tx.vin.size(); m++)
             {
                 const CTxIn& txin = tx.vin[m];
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                if (!coins)
+                const Coin& coin = view.AccessCoin(txin.prevout);
+                if (coin.IsSpent())
                     return state.DoS(10, false, REJECT_INVALID, "put_candy: missing txin, " + txin.ToString());
 
-                const CTxOut& in_txout = coins->vout[txin.prevout.n];
+                const CTxOut& in_txout = coin.out;
                 uint32_t nAppCmd = 0;
                 if(in_txout.IsAsset(&nAppCmd)) // forbid invalid asset txin
                 {
@@ -1855,7 +1877,7 @@ bool CheckAppTransaction(const CTransaction& tx, CValidationState &state, const
             if(GetGetCandyAmount(candyData.assetId, out, strAddress, nAmount, fWithMempool))
                 return state.DoS(10, false, REJECT_INVALID, "get_candy: current user got candy already, " + out.ToString());
 
-            int nPrevTxHeight = GetTxHeight(out.hash);
+            int nPrevTxHeight = pChainInfo ? pChainInfo->nPrevTxHeight : GetTxHeight(out.hash);
             //if(fWithMempool)
             {
                 if(nPrevTxHeight >= nTxHeight)
@@ -1889,6 +1911,12 @@ bool CheckAppTransaction(const CTransaction& tx, CValidationState &state, const
                     return state.DoS(10, false, REJECT_INVALID, strprintf("get_candy: get total safe amount failed at %d\n", nPrevTxHeight));
                 }
             }
+            else if(pChainInfo)
+            {
+                // An app check worker never waits: the master holds cs_main, so the serial check does the waiting
+                if(!GetTotalAmountByHeight(nPrevTxHeight, nTotalSafe))
+                    return false;
+            }
             else
             {
                 while(!GetTotalAmountByHeight(nPrevTxHeight, nTotalSafe)) // Waitting for candy block handle finished, when program is downloading block
@@ -1911,7 +1939,7 @@ bool CheckAppTransaction(const CTransaction& tx, CValidationState &state, const
                 return state.DoS(10, false, REJECT_INVALID, strprintf("get_candy: safe amount of address[%s] is more than total safe amount at %d\n", strAddress, nPrevTxHeight));
             }
 
-            CAmount nCandyAmount = (CAmount)(1.0 * nSafe / nTotalSafe * candyInfo.nAmount);
+            CAmount nCandyAmount = GetCandyShareAmount(nSafe, nTotalSafe, candyInfo.nAmount);
             if(nCandyAmount < AmountFromValue("0.0001", assetInfo.assetData.nDecimals, true))
             {
                 LogPrint("asset", "check-getcandy: candy-height: %d, address: %s, total_safe: %lld, user_safe: %lld, total_candy_amount: %lld, can_get_candy_amount: %lld, out: %s\n", nPrevTxHeight, strAddress, nTotalSafe, nSafe, candyInfo.nAmount, nCandyAmount, out.ToString());
@@ -1983,11 +2011,11 @@ bool CheckAppTransaction(const CTransaction& tx, CValidationState &state, const
             for(unsigned int m = 0; m < tx.vin.size(); m++)
             {
                 const CTxIn& txin = tx.vin[m];
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                if (!coins)
+                const Coin& coin = view.AccessCoin(txin.prevout);
+                if (coin.IsSpent())
                     return state.DoS(10, false, REJECT_INVALID, "get_candy: missing txin, " + txin.ToString());
 
-                const CTxOut& in_txout = coins->vout[txin.prevout.n];
+                const CTxOut& in_txout = coin.out;
                 if(in_txout.IsAsset()) // forbid invalid asset txin
                 {
                     CAppHeader in_header;
@@ -2021,6 +2049,182 @@ bool CheckAppTransaction(const CTransaction& tx, CValidationState &state, const
     return true;
 }
 
+/** Read-only coins of a block's inputs, captured before any of its transactions is applied */
+class CCoinsViewAppCheck : public CCoinsView
+{
+private:
+    const std::map<COutPoint, Coin>& mapCoins;
+
+public:
+    CCoinsViewAppCheck(const std::map<COutPoint, Coin>& mapCoinsIn) : mapCoins(mapCoinsIn) {}
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
+    {
+        std::map<COutPoint, Coin>::const_iterator it = mapCoins.find(outpoint);
+        if(it == mapCoins.end())
+            return false;
+        coin = it->second;
+        return true;
+    }
+
+    bool HaveCoin(const COutPoint& outpoint) const
+    {
+        return mapCoins.count(outpoint) != 0;
+    }
+};
+
+/** A CheckAppTransaction run on a worker thread, with its own coins cache over the shared snapshot */
+class CAppTxCheck
+{
+private:
+    const CTransaction* ptx;
+    const std::map<COutPoint, Coin>* pmapCoins;
+    CAppTxCheckResult* pResult;
+
+public:
+    CAppTxCheck() : ptx(NULL), pmapCoins(NULL), pResult(NULL) {}
+    CAppTxCheck(const CTransaction& txIn, const std::map<COutPoint, Coin>& mapCoinsIn, CAppTxCheckResult& resultIn) :
+        ptx(&txIn), pmapCoins(&mapCoinsIn), pResult(&resultIn) {}
+
+    bool operator()()
+    {
+        // Index lookups are interruption points, but a job left half done would keep the master waiting forever
+        boost::this_thread::disable_interruption di;
+        try {
+            CCoinsViewAppCheck viewSnapshot(*pmapCoins);
+            CCoinsViewCache view(&viewSnapshot);
+            CValidationState state;
+            pResult->fValid = CheckAppTransaction(*ptx, state, view, pResult->mapAssetGetCandy, false, &pResult->chainInfo);
+            pResult->fChecked = true;
+        } catch (const std::exception& e) {
+            // leave it to the serial check, which reports the failure in block order
+            LogPrint("asset", "%s: %s\n", __func__, e.what());
+        }
+        return true; // results are per tx, never stop the other jobs
+    }
+
+    void swap(CAppTxCheck& check)
+    {
+        std::swap(ptx, check.ptx);
+        std::swap(pmapCoins, check.pmapCoins);
+        std::swap(pResult, check.pResult);
+    }
+};
+
+static CCheckQueue<CAppTxCheck> appcheckqueue(16);
+
+void ThreadAppCheck() {
+    RenameThread("safe-appcheck");
+    appcheckqueue.Thread();
+}
+
+void CheckBlockAppTransactions(const CBlock& block, const CCoinsViewCache& view, std::vector<CAppTxCheckResult>& vResult)
+{
+    AssertLockHeld(cs_main);
+
+    vResult.clear();
+    vResult.resize(block.vtx.size());
+    if(!nScriptCheckThreads)
+        return;
+
+    set<uint256> setBlockTx;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        setBlockTx.insert(tx.GetHash());
+
+    std::map<COutPoint, Coin> mapCoins;
+    std::map<uint256, int> mapTxHeight;
+    set<COutPoint> setSpent;
+    vector<CAppTxCheck> vChecks;
+    for(unsigned int i = 0; i < block.vtx.size(); i++)
+    {
+        const CTransaction& tx = block.vtx[i];
+        if(tx.IsCoinBase())
+            continue;
+
+        // Only a tx whose inputs are untouched by earlier txs of the block sees the same coins as the serial check
+        bool fIndependent = true;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            if(!setSpent.insert(txin.prevout).second || setBlockTx.count(txin.prevout.hash))
+                fIndependent = false;
+        }
+
+        bool fApp = false, fGetCandy = false;
+        BOOST_FOREACH(const CTxOut& txout, tx.vout)
+        {
+            uint32_t nAppCmd = 0;
+            if(txout.IsSafeOnly(&nAppCmd))
+                continue;
+            fApp = true;
+            if(nAppCmd == ADD_ASSET_CMD) // added amount is read through GetTransaction, which takes cs_main
+                fIndependent = false;
+            else if(nAppCmd == GET_CANDY_CMD)
+                fGetCandy = true;
+        }
+        if(!fApp || !fIndependent)
+            continue;
+
+        bool fHaveInputs = true;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            const Coin& coin = view.AccessCoin(txin.prevout);
+            if(coin.IsSpent())
+            {
+                fHaveInputs = false;
+                break;
+            }
+            mapCoins.insert(make_pair(txin.prevout, coin));
+        }
+        if(!fHaveInputs)
+            continue;
+
+        CAppTxCheckResult& result = vResult[i];
+        result.chainInfo.nTxHeight = GetTxHeight(tx.GetHash());
+        if(fGetCandy)
+        {
+            // many get candy txs of a block claim from the same put candy tx
+            const uint256& hashPrev = tx.vin.back().prevout.hash;
+            std::map<uint256, int>::iterator it = mapTxHeight.find(hashPrev);
+            if(it == mapTxHeight.end())
+                it = mapTxHeight.insert(make_pair(hashPrev, GetTxHeight(hashPrev))).first;
+            result.chainInfo.nPrevTxHeight = it->second;
+
+            // the candy block is still being handled, only the serial check may wait for it
+            CAmount nTotalSafe = 0;
+            if(!GetTotalAmountByHeight(result.chainInfo.nPrevTxHeight, nTotalSafe))
+                continue;
+        }
+        vChecks.push_back(CAppTxCheck(tx, mapCoins, result));
+    }
+
+    if(vChecks.size() < 2) // not worth the hand-off, the serial check picks it up
+        return;
+
+    int64_t nTimeStart = GetTimeMicros();
+    CCheckQueueControl<CAppTxCheck> control(&appcheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+    LogPrint("bench", "    - Parallel app checks: %u txs, %.2fms\n", vResult.size(), 0.001 * (GetTimeMicros() - nTimeStart));
+}
+
+bool CheckBlockAppTransaction(const CTransaction& tx, CValidationState &state, const CCoinsViewCache& view, map<CPutCandy_IndexKey, CAmount>& mapAssetGetCandy, const CAppTxCheckResult& result)
+{
+    // A failed or skipped check, or candy claimed earlier in the block, is redone in block order
+    // so the first failure and the claim totals are exactly those of a serial check.
+    bool fReuse = result.fChecked && result.fValid;
+    for(map<CPutCandy_IndexKey, CAmount>::const_iterator it = result.mapAssetGetCandy.begin(); fReuse && it != result.mapAssetGetCandy.end(); it++)
+    {
+        if(mapAssetGetCandy.count(it->first))
+            fReuse = false;
+    }
+
+    if(!fReuse)
+        return CheckAppTransaction(tx, state, view, mapAssetGetCandy, false);
+
+    mapAssetGetCandy.insert(result.mapAssetGetCandy.begin(), result.mapAssetGetCandy.end());
+    return true;
+}
+
 bool ContextualCheckTransaction(const CTransaction& tx, CValidationState &state, CBlockIndex * const pindexPrev)
 {
     bool fDIP0001Active_context = (VersionBitsState(pindexPrev, Params().GetConsensus(), Consensus::DEPLOYMENT_DIP0001, versionbitscache) == THRESHOLD_ACTIVE);
@@ -2037,9 +2241,9 @@ void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age) {
     if (expired != 0)
         LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
 
-    std::vector<uint256> vNoSpendsRemaining;
+    std::vector<COutPoint> vNoSpendsRemaining;
     pool.TrimToSize(limit, &vNoSpendsRemaining);
-    BOOST_FOREACH(const uint256& removed, vNoSpendsRemaining)
+    BOOST_FOREACH(const COutPoint& removed, vNoSpendsRemaining)
         pcoinsTip->Uncache(removed);
 }
 
@@ -2066,9 +2270,12 @@ bool ExistForbidTxin(const int nHeight, const std::vector<int>& prevheights)
     return false;
 }
 
+/** Verify the scripts of a transaction, spreading its inputs over the script check threads */
+static bool CheckInputsParallel(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view, unsigned int flags);
+
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                               bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee,
-                              std::vector<uint256>& vHashTxnToUncache, bool fDryRun)
+                              std::vector<COutPoint>& coins_to_uncache, bool fDryRun)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -2187,21 +2394,18 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
         CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
         view.SetBackend(viewMemPool);
 
-        // do we already have it?
-        bool fHadTxInCache = pcoinsTip->HaveCoinsInCache(hash);
-        if (view.HaveCoins(hash)) {
-            if (!fHadTxInCache)
-                vHashTxnToUncache.push_back(hash);
-            return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
-        }
-
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent).
         BOOST_FOREACH(const CTxIn txin, tx.vin) {
-            if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
-                vHashTxnToUncache.push_back(txin.prevout.hash);
-            if (!view.HaveCoins(txin.prevout.hash)) {
+            if (!pcoinsTip->HaveCoinInCache(txin.prevout))
+                coins_to_uncache.push_back(txin.prevout);
+            if (!view.HaveCoin(txin.prevout)) {
+                // Are inputs missing because we already have the tx?
+                for (size_t out = 0; out < tx.vout.size(); out++) {
+                    // Optimistically just do efficient check of cache for outputs
+                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out)))
+                        return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+                }
+                // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
                 if (pfMissingInputs)
                     *pfMissingInputs = true;
                 return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
@@ -2250,8 +2454,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
         // during reorgs to ensure COINBASE_MATURITY is still met.
         bool fSpendsCoinbase = false;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            const CCoins *coins = view.AccessCoins(txin.prevout.hash);
-            if (coins->IsCoinBase()) {
+            const Coin &coin = view.AccessCoin(txin.prevout);
+            if (coin.IsCoinBase()) {
                 fSpendsCoinbase = true;
                 break;
             }
@@ -2261,20 +2465,20 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
         std::vector<int> prevheights;
         BOOST_FOREACH(const CTxIn &txin, tx.vin)
         {
-            const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-            if(!coins || !coins->IsAvailable(txin.prevout.n))
+            const Coin& coin = view.AccessCoin(txin.prevout);
+            if(coin.IsSpent())
                 return state.Invalid(false, REJECT_DUPLICATE, "2-bad-txns-inputs-spent");
 
-            prevheights.push_back(coins->nHeight);
+            prevheights.push_back(coin.nHeight);
 
-            const CTxOut& txout = coins->vout[txin.prevout.n];
+            const CTxOut& txout = coin.out;
             if(txout.nUnlockedHeight <= 0)
                 continue;
 
             if(txout.nUnlockedHeight <= g_nChainHeight) // unlocked
                 continue;
 
-            int64_t nOffset = txout.nUnlockedHeight - coins->nHeight;
+            int64_t nOffset = txout.nUnlockedHeight - coin.nHeight;
             if(nOffset <= 28 * BLOCKS_PER_DAY || nOffset > 120 * BLOCKS_PER_MONTH)
                 continue;
 
@@ -2506,7 +2710,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true))
+        if (!CheckInputsParallel(tx, state, view, STANDARD_SCRIPT_VERIFY_FLAGS))
             return false;
 
         // Check again against just the consensus-critical mandatory script
@@ -2518,7 +2722,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+        if (!CheckInputsParallel(tx, state, view, MANDATORY_SCRIPT_VERIFY_FLAGS))
         {
             return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
                 __func__, hash.ToString(), FormatStateMessage(state));
@@ -2573,12 +2777,12 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee, bool fDryRun)
 {
-    std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, fRejectAbsurdFee, vHashTxToUncache, fDryRun);
+    std::vector<COutPoint> coins_to_uncache;
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, fRejectAbsurdFee, coins_to_uncache, fDryRun);
     if (!res || fDryRun) {
         if(!res) LogPrint("mempool", "%s: %s %s\n", __func__, tx.GetHash().ToString(), state.GetRejectReason());
-        BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
-            pcoinsTip->Uncache(hashTx);
+        BOOST_FOREACH(const COutPoint& outpoint, coins_to_uncache)
+            pcoinsTip->Uncache(outpoint);
     }
     // After we've (potentially) uncached entries, ensure our coins cache is still within its size limits
     CValidationState stateDummy;
@@ -2591,6 +2795,8 @@ bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, std::v
     if (!fTimestampIndex)
         return error("Timestamp index not enabled");
 
+    if (!chainindexer.Sync())
+        return error("Unable to catch up the timestamp index");
     if (!pblocktree->ReadTimestampIndex(high, low, hashes))
         return error("Unable to get hashes for timestamps");
 
@@ -2605,6 +2811,8 @@ bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
     if (mempool.getSpentIndex(key, value))
         return true;
 
+    if (!chainindexer.Sync())
+        return error("unable to catch up the spent index");
     if (!pblocktree->ReadSpentIndex(key, value))
         return false;
 
@@ -2617,6 +2825,8 @@ bool GetAddressIndex(uint160 addressHash, int type,
     if (!fAddressIndex)
         return error("address index not enabled");
 
+    if (!chainindexer.Sync())
+        return error("unable to catch up the address index");
     if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end))
         return error("unable to get txids for address");
 
@@ -2629,6 +2839,8 @@ bool GetAddressUnspent(uint160 addressHash, int type,
     if (!fAddressIndex)
         return error("address index not enabled");
 
+    if (!chainindexer.Sync())
+        return error("unable to catch up the address index");
     if (!pblocktree->ReadAddressUnspentIndex(addressHash, type, unspentOutputs))
         return error("unable to get txids for address");
 
@@ -2649,7 +2861,8 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
 
     if (fTxIndex) {
         CDiskTxPos postx;
-        if (pblocktree->ReadTxIndex(hash, postx)) {
+        if (chainindexer.ReadTxIndex(hash, postx)) {
+            blockwriter.WaitForFile(postx.nFile, false);
             CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
             if (file.IsNull())
                 return error("%s: OpenBlockFile failed", __func__);
@@ -2671,19 +2884,18 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
         int nHeight = -1;
         {
-            CCoinsViewCache &view = *pcoinsTip;
-            const CCoins* coins = view.AccessCoins(hash);
-            if (coins)
-                nHeight = coins->nHeight;
+            const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+            if (!coin.IsSpent())
+                nHeight = coin.nHeight;
         }
         if (nHeight > 0)
             pindexSlow = chainActive[nHeight];
     }
 
     if (pindexSlow) {
-        CBlock block;
-        if (ReadBlockFromDisk(block, pindexSlow, consensusParams)) {
-            BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+        boost::shared_ptr<const CBlock> pblock;
+        if (ReadBlockFromDisk(pblock, pindexSlow, consensusParams)) {
+            BOOST_FOREACH(const CTransaction &tx, pblock->vtx) {
                 if (tx.GetHash() == hash) {
                     txOut = tx;
                     hashBlock = pindexSlow->GetBlockHash();
@@ -2708,21 +2920,17 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
 
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("WriteBlockToDisk: OpenBlockFile failed");
+    // Index header and block, appended to the history file by blockwriter
+    CDataStream ssRecord(SER_DISK, CLIENT_VERSION);
+    unsigned int nSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    ssRecord << FLATDATA(messageStart) << nSize;
+    unsigned int nHeaderSize = ssRecord.size();
+    ssRecord << block;
 
-    // Write index header
-    unsigned int nSize = fileout.GetSerializeSize(block);
-    fileout << FLATDATA(messageStart) << nSize;
-
-    // Write block
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("WriteBlockToDisk: ftell failed");
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+    std::vector<char> vRecord(ssRecord.begin(), ssRecord.end());
+    if (!blockwriter.Write(pos, false, vRecord))
+        return error("WriteBlockToDisk: writing %s failed", pos.ToString());
+    pos.nPos += nHeaderSize;
 
     return true;
 }
@@ -2731,17 +2939,29 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    // Blocks that are still queued for writing are read from blockwriter
+    std::vector<char> vPending;
+    if (blockwriter.ReadPending(pos, false, vPending)) {
+        try {
+            CDataStream ssBlock(vPending, SER_DISK, CLIENT_VERSION);
+            ssBlock >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
 
-    // Read block
-    try {
-        filein >> block;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        // Read block
+        try {
+            filein >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
     }
 
     // Check the header
@@ -2751,8 +2971,14 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
     return true;
 }
 
+// Doesn't fill blockcache, so that scans over old blocks don't evict the recent ones
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
+    boost::shared_ptr<const CBlock> pblock;
+    if (blockcache.Get(pindex->GetBlockHash(), pblock)) {
+        block = *pblock;
+        return true;
+    }
     if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
@@ -2761,6 +2987,22 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadBlockFromDisk(boost::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
+{
+    if (blockcache.Get(pindex->GetBlockHash(), pblock))
+        return true;
+
+    boost::shared_ptr<CBlock> pblockRead = boost::make_shared<CBlock>();
+    if (!ReadBlockFromDisk(*pblockRead, pindex->GetBlockPos(), consensusParams))
+        return false;
+    if (pblockRead->GetHash() != pindex->GetBlockHash())
+        return error("%s: GetHash() doesn't match index for %s at %s", __func__,
+                pindex->ToString(), pindex->GetBlockPos().ToString());
+    pblock = pblockRead;
+    blockcache.Insert(pindex->GetBlockHash(), pblock);
+    return true;
+}
+
 double ConvertBitsToDouble(unsigned int nBits)
 {
     int nShift = (nBits >> 24) & 0xff;
@@ -3001,41 +3243,25 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
-            unsigned nPos = txin.prevout.n;
-
-            if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
-                assert(false);
+            const Coin& coin = inputs.AccessCoin(txin.prevout);
+            assert(!coin.IsSpent());
 
             uint32_t nAppCmd = 0;
-            if(coins->vout[nPos].IsAsset(&nAppCmd) && nAppCmd == PUT_CANDY_CMD && txin.scriptSig.empty())
+            if(coin.out.IsAsset(&nAppCmd) && nAppCmd == PUT_CANDY_CMD && txin.scriptSig.empty())
             {
                 string strAddress = "";
-                if(GetTxOutAddress(coins->vout[nPos], &strAddress) && strAddress == g_strPutCandyAddress)
+                if(GetTxOutAddress(coin.out, &strAddress) && strAddress == g_strPutCandyAddress)
                     continue;
             }
 
             // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
-            coins->Spend(nPos);
-            if (coins->vout.size() == 0) {
-                CTxInUndo& undo = txundo.vprevout.back();
-                undo.nHeight = coins->nHeight;
-                undo.fCoinBase = coins->fCoinBase;
-                undo.nVersion = coins->nVersion;
-            }
+            txundo.vprevout.push_back(Coin());
+            bool is_spent = inputs.SpendCoin(txin.prevout, &txundo.vprevout.back());
+            assert(is_spent);
         }
-        // add outputs
-        inputs.ModifyNewCoins(tx.GetHash())->FromTx(tx, nHeight);
-    }
-    else {
-        // add outputs for coinbase tx
-        // In this case call the full ModifyCoins which will do a database
-        // lookup to be sure the coins do not already exist otherwise we do not
-        // know whether to mark them fresh or not.  We want the duplicate coinbases
-        // before BIP30 to still be properly overwritten.
-        inputs.ModifyCoins(tx.GetHash())->FromTx(tx, nHeight);
     }
+    // add outputs
+    AddCoins(inputs, tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, int nHeight)
@@ -3072,18 +3298,18 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase()) {
-                if (nSpendHeight - coins->nHeight < COINBASE_MATURITY)
+            if (coin.IsCoinBase()) {
+                if (nSpendHeight - coin.nHeight < COINBASE_MATURITY)
                     return state.Invalid(false,
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase",
-                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight));
+                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coin.nHeight));
             }
 
-            const CTxOut& in_txout = coins->vout[prevout.n];
+            const CTxOut& in_txout = coin.out;
             CAppHeader header;
             vector<unsigned char> vData;
             if(ParseReserve(in_txout.vReserve, header, vData))
@@ -3097,7 +3323,7 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
 
                 if(header.nAppCmd == REGISTER_APP_CMD || header.nAppCmd == ADD_AUTH_CMD || header.nAppCmd == DELETE_AUTH_CMD || header.nAppCmd == ISSUE_ASSET_CMD || header.nAppCmd == ADD_ASSET_CMD || header.nAppCmd == DESTORY_ASSET_CMD || header.nAppCmd == PUT_CANDY_CMD || header.nAppCmd == GET_CANDY_CMD)
                 {
-                    if(coins->nHeight <= 0)
+                    if(coin.nHeight <= 0)
                         return state.DoS(10, false, REJECT_INVALID, "app_tx/asset_tx: txin need 1 confirmation at least, " + prevout.ToString());
                 }
             }
@@ -3147,13 +3373,13 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 {
                     CAppHeader in_header;
                     vector<unsigned char> vInData;
-                    const CTxOut& in_txout = coins->vout[prevout.n];
+                    const CTxOut& in_txout = coin.out;
                     uint256 in_assetId;
                     if(ParseReserve(in_txout.vReserve, in_header, vInData))
                     {
@@ -3231,7 +3457,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                 }
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -3243,7 +3469,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check2(*coins, tx, i,
+                        CScriptCheck check2(coin.out, tx, i,
                                 flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -3268,42 +3494,36 @@ namespace {
 
 bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
-
-    // Write index header
-    unsigned int nSize = fileout.GetSerializeSize(blockundo);
-    fileout << FLATDATA(messageStart) << nSize;
-
-    // Write undo data
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("%s: ftell failed", __func__);
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
+    // Index header and undo data, appended to the undo file by blockwriter
+    CDataStream ssRecord(SER_DISK, CLIENT_VERSION);
+    unsigned int nSize = ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION);
+    ssRecord << FLATDATA(messageStart) << nSize;
+    unsigned int nHeaderSize = ssRecord.size();
+    ssRecord << blockundo;
 
     // calculate & write checksum
     CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
     hasher << hashBlock;
     hasher << blockundo;
-    fileout << hasher.GetHash();
+    ssRecord << hasher.GetHash();
+
+    std::vector<char> vRecord(ssRecord.begin(), ssRecord.end());
+    if (!blockwriter.Write(pos, true, vRecord))
+        return error("%s: writing %s failed", __func__, pos.ToString());
+    pos.nPos += nHeaderSize;
 
     return true;
 }
 
-bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
+template <typename Stream>
+bool UndoReadFromStream(CBlockUndo& blockundo, Stream& filein, const CBlockIndex* pindex)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenBlockFile failed", __func__);
-
     // Read block
     uint256 hashChecksum;
+    CHashVerifier<Stream> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
     try {
-        filein >> blockundo;
+        verifier << pindex->pprev->GetBlockHash();
+        verifier >> blockundo;
         filein >> hashChecksum;
     }
     catch (const std::exception& e) {
@@ -3311,15 +3531,38 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     }
 
     // Verify checksum
-    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
-    hasher << hashBlock;
-    hasher << blockundo;
-    if (hashChecksum != hasher.GetHash())
+    if (hashChecksum != verifier.GetHash())
         return error("%s: Checksum mismatch", __func__);
 
     return true;
 }
 
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    CDiskBlockPos pos = pindex->GetUndoPos();
+    if (pos.IsNull())
+        return error("%s: no undo data available", __func__);
+
+    // Undo data written before BLOCK_UNDO_COMPACT stores the output extension uncompressed
+    int nVersion = CLIENT_VERSION;
+    if (!(pindex->nStatus & BLOCK_UNDO_COMPACT))
+        nVersion |= SERIALIZE_TXOUT_LEGACY;
+
+    // Undo data that is still queued for writing is read from blockwriter
+    std::vector<char> vPending;
+    if (blockwriter.ReadPending(pos, true, vPending)) {
+        CDataStream ssUndo(vPending, SER_DISK, nVersion);
+        return UndoReadFromStream(blockundo, ssUndo, pindex);
+    }
+
+    // Open history file to read
+    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, nVersion);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed", __func__);
+
+    return UndoReadFromStream(blockundo, filein, pindex);
+}
+
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -3340,37 +3583,70 @@ bool AbortNode(CValidationState& state, const std::string& strMessage, const std
 
 } // anon namespace
 
+bool ReadBlockSpentCoins(const CBlock& block, const CBlockIndex* pindex, CBlockUndo& blockSpent)
+{
+    blockSpent.vtxundo.clear();
+    if (block.vtx.size() <= 1)
+        return true;
+
+    CBlockUndo blockUndo;
+    if (!UndoReadFromDisk(blockUndo, pindex))
+        return false;
+    if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
+        return error("%s: block and undo data inconsistent", __func__);
+
+    blockSpent.vtxundo.resize(blockUndo.vtxundo.size());
+    for (unsigned int i = 1; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        const CTxUndo& txundo = blockUndo.vtxundo[i-1];
+        std::vector<Coin>& vprevout = blockSpent.vtxundo[i-1].vprevout;
+        vprevout.reserve(tx.vin.size());
+        unsigned int nUndo = 0;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            // put-candy inputs have no undo entry, their coin stays in the UTXO set
+            Coin coin;
+            uint32_t nAppCmd = 0;
+            if (txin.scriptSig.empty() && GetUTXOCoin(txin.prevout, coin) && coin.out.IsAsset(&nAppCmd) && nAppCmd == PUT_CANDY_CMD) {
+                string strAddress = "";
+                if (GetTxOutAddress(coin.out, &strAddress) && strAddress == g_strPutCandyAddress) {
+                    vprevout.push_back(coin);
+                    continue;
+                }
+            }
+            if (nUndo >= txundo.vprevout.size())
+                return error("%s: transaction and undo data inconsistent", __func__);
+            vprevout.push_back(txundo.vprevout[nUndo++]);
+        }
+    }
+    return true;
+}
+
 /**
- * Apply the undo operation of a CTxInUndo to the given chain state.
- * @param undo The undo object.
+ * Restore a coin spent by a tx input to the given chain state.
+ * @param undo The spent coin, as recorded in the undo data.
  * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
- * @return True on success.
+ * @param fClean Cleared if the restored coin overwrote an unspent one.
+ * @return False if the coin could not be restored.
  */
-static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+static bool ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out, bool& fClean)
 {
-    bool fClean = true;
+    if (view.HaveCoin(out))
+        fClean = fClean && error("%s: undo data overwriting existing output", __func__);
 
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
+    if (undo.nHeight == 0) {
+        // Missing undo metadata (height and coinbase). Older versions included this
+        // information only in undo records for the last spend of a transactions'
+        // outputs. This implies that it must be present for some other output of the same tx.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (alternate.IsSpent())
+            return error("%s: undo data adding output to missing transaction", __func__);
+        undo.nHeight = alternate.nHeight;
+        undo.fCoinBase = alternate.fCoinBase;
     }
-    if (coins->IsAvailable(out.n))
-        fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
+    view.AddCoin(out, std::move(undo), !fClean);
 
-    return fClean;
+    return true;
 }
 
 bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
@@ -3383,18 +3659,17 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
     bool fClean = true;
 
     CBlockUndo blockUndo;
-    CDiskBlockPos pos = pindex->GetUndoPos();
-    if (pos.IsNull())
-        return error("DisconnectBlock(): no undo data available");
-    if (!UndoReadFromDisk(blockUndo, pos, pindex->pprev->GetBlockHash()))
+    if (!UndoReadFromDisk(blockUndo, pindex))
         return error("DisconnectBlock(): failure reading undo data");
 
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock(): block and undo data inconsistent");
 
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
-    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
+    // coins restored for every input, null for the put-candy ones; shared
+    // with the chain indexer, which applies them after cs_main is released
+    boost::shared_ptr<CBlockUndo> pblockSpent = boost::make_shared<CBlockUndo>();
+    CBlockUndo& blockSpent = *pblockSpent;
+    blockSpent.vtxundo.resize(blockUndo.vtxundo.size());
     std::vector<std::pair<uint256, CAppId_AppInfo_IndexValue> > appId_appInfo_index;
     std::vector<std::pair<std::string, CName_Id_IndexValue> > appName_appId_index;
     std::vector<std::pair<CAppTx_IndexKey, int> > appTx_index;
@@ -3411,71 +3686,23 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
         const CTransaction &tx = block.vtx[i];
         uint256 hash = tx.GetHash();
 
-        if (fAddressIndex) {
-
-            for (unsigned int k = tx.vout.size(); k-- > 0;) {
-                const CTxOut &out = tx.vout[k];
-
-                if(out.IsAsset())
-                    continue;
-
-                if (out.scriptPubKey.IsPayToScriptHash()) {
-                    vector<unsigned char> hashBytes(out.scriptPubKey.begin()+2, out.scriptPubKey.begin()+22);
-
-                    // undo receiving activity
-                    addressIndex.push_back(make_pair(CAddressIndexKey(2, uint160(hashBytes), pindex->nHeight, i, hash, k, false), out.nValue));
-
-                    // undo unspent index
-                    addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(2, uint160(hashBytes), hash, k), CAddressUnspentValue()));
-
-                } else if (out.scriptPubKey.IsPayToPublicKeyHash()) {
-                    vector<unsigned char> hashBytes(out.scriptPubKey.begin()+3, out.scriptPubKey.begin()+23);
-
-                    // undo receiving activity
-                    addressIndex.push_back(make_pair(CAddressIndexKey(1, uint160(hashBytes), pindex->nHeight, i, hash, k, false), out.nValue));
-
-                    // undo unspent index
-                    addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(1, uint160(hashBytes), hash, k), CAddressUnspentValue()));
-
-                } else if (out.scriptPubKey.IsPayToPublicKey()) {
-                    uint160 hashBytes(Hash160(out.scriptPubKey.begin()+1, out.scriptPubKey.end()-1));
-
-                    // undo receiving activity
-                    addressIndex.push_back(make_pair(CAddressIndexKey(1, hashBytes, pindex->nHeight, i, hash, k, false), out.nValue));
-
-                    // undo unspent index
-                    addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(1, hashBytes, hash, k), CAddressUnspentValue()));
-                } else {
-                    continue;
-                }
-
-            }
-
-        }
-
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
-
-        // remove outputs
-        outs->Clear();
+        for (unsigned int o = 0; o < tx.vout.size(); o++) {
+            if (tx.vout[o].scriptPubKey.IsUnspendable())
+                continue;
+            Coin coin;
+            bool is_spent = view.SpendCoin(COutPoint(hash, o), &coin);
+            if (!is_spent || tx.vout[o] != coin.out || (uint32_t)pindex->nHeight != coin.nHeight || tx.IsCoinBase() != coin.IsCoinBase())
+                fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
         }
 
         // restore inputs
         if (i > 0) { // not coinbases
             const CTxUndo &txundo = blockUndo.vtxundo[i-1];
+            CTxUndo &txspent = blockSpent.vtxundo[i-1];
+            if (fAddressIndex || fSpentIndex)
+                txspent.vprevout.resize(tx.vin.size());
             if (txundo.vprevout.size() != tx.vin.size())
             {
                 bool fPutCandy = false;
@@ -3484,15 +3711,15 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
                 {
                     const CTxIn& input = tx.vin[j];
                     const COutPoint& out = input.prevout;
-                    CCoins coins;
-                    if(!GetUTXOCoins(out, coins))
+                    Coin coin;
+                    if(!GetUTXOCoin(out, coin))
                         continue;
 
                     uint32_t nAppCmd = 0;
-                    if(coins.vout[out.n].IsAsset(&nAppCmd) && nAppCmd == PUT_CANDY_CMD && input.scriptSig.empty())
+                    if(coin.out.IsAsset(&nAppCmd) && nAppCmd == PUT_CANDY_CMD && input.scriptSig.empty())
                     {
                         string strAddress = "";
-                        if(GetTxOutAddress(coins.vout[out.n], &strAddress) && strAddress == g_strPutCandyAddress)
+                        if(GetTxOutAddress(coin.out, &strAddress) && strAddress == g_strPutCandyAddress)
                         {
                             if(++nPutCandyTxInCount > 1)
                             {
@@ -3512,63 +3739,24 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
                 const CTxIn& input = tx.vin[j];
                 const COutPoint &out = input.prevout;
 
-                CCoins coins;
-                if(GetUTXOCoins(out, coins))
+                Coin coin;
+                if(GetUTXOCoin(out, coin))
                 {
                     uint32_t nAppCmd = 0;
-                    if(coins.vout[out.n].IsAsset(&nAppCmd) && nAppCmd == PUT_CANDY_CMD && input.scriptSig.empty())
+                    if(coin.out.IsAsset(&nAppCmd) && nAppCmd == PUT_CANDY_CMD && input.scriptSig.empty())
                     {
                         string strAddress = "";
-                        if(GetTxOutAddress(coins.vout[out.n], &strAddress) && strAddress == g_strPutCandyAddress)
+                        if(GetTxOutAddress(coin.out, &strAddress) && strAddress == g_strPutCandyAddress)
                             continue;
                     }
                 }
 
-                const CTxInUndo &undo = txundo.vprevout[j];
-                if (!ApplyTxInUndo(undo, view, out))
-                    fClean = false;
-
-                if (fSpentIndex) {
-                    // undo and delete the spent index
-                    spentIndex.push_back(std::make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n), CSpentIndexValue()));
-                }
-
-                const CTxOut &prevout = view.GetOutputFor(input);
-                if(prevout.IsAsset())
-                    continue;
-
-                if (fAddressIndex) {
-                    if (prevout.scriptPubKey.IsPayToScriptHash()) {
-                        vector<unsigned char> hashBytes(prevout.scriptPubKey.begin()+2, prevout.scriptPubKey.begin()+22);
-
-                        // undo spending activity
-                        addressIndex.push_back(make_pair(CAddressIndexKey(2, uint160(hashBytes), pindex->nHeight, i, hash, j, true), prevout.nValue * -1));
-
-                        // restore unspent index
-                        addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(2, uint160(hashBytes), input.prevout.hash, input.prevout.n), CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, undo.nHeight)));
-
-
-                    } else if (prevout.scriptPubKey.IsPayToPublicKeyHash()) {
-                        vector<unsigned char> hashBytes(prevout.scriptPubKey.begin()+3, prevout.scriptPubKey.begin()+23);
-
-                        // undo spending activity
-                        addressIndex.push_back(make_pair(CAddressIndexKey(1, uint160(hashBytes), pindex->nHeight, i, hash, j, true), prevout.nValue * -1));
-
-                        // restore unspent index
-                        addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(1, uint160(hashBytes), input.prevout.hash, input.prevout.n), CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, undo.nHeight)));
-
-                    } else if (prevout.scriptPubKey.IsPayToPublicKey()) {
-                        uint160 hashBytes(Hash160(prevout.scriptPubKey.begin()+1, prevout.scriptPubKey.end()-1));
-
-                        // undo spending activity
-                        addressIndex.push_back(make_pair(CAddressIndexKey(1, hashBytes, pindex->nHeight, i, hash, j, true), prevout.nValue * -1));
+                Coin undo = txundo.vprevout[j];
+                if (!ApplyTxInUndo(std::move(undo), view, out, fClean))
+                    return error("DisconnectBlock(): failed to restore input %s", out.ToString());
 
-                        // restore unspent index
-                        addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(1, hashBytes, input.prevout.hash, input.prevout.n), CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, undo.nHeight)));
-                    } else {
-                        continue;
-                    }
-                }
+                if (fAddressIndex || fSpentIndex)
+                    txspent.vprevout[j] = view.AccessCoin(out);
             }
         }
 
@@ -3584,7 +3772,7 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
                 if(!ExtractDestination(txout.scriptPubKey, dest))
                     continue;
 
-                std::string strAddress = CBitcoinAddress(dest).ToString();
+                CIndexAddress address(dest);
 
                 if(header.nAppCmd == REGISTER_APP_CMD)
                 {
@@ -3593,18 +3781,18 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
                     {
                         appId_appInfo_index.push_back(make_pair(header.appId, CAppId_AppInfo_IndexValue()));
                         appName_appId_index.push_back(make_pair(appData.strAppName, CName_Id_IndexValue()));
-                        appTx_index.push_back(make_pair(CAppTx_IndexKey(header.appId, strAddress, REGISTER_TXOUT, COutPoint(hash, m)), -1));
+                        appTx_index.push_back(make_pair(CAppTx_IndexKey(header.appId, address, REGISTER_TXOUT, COutPoint(hash, m)), -1));
                     }
                 }
                 else if(header.nAppCmd == ADD_AUTH_CMD || header.nAppCmd == DELETE_AUTH_CMD)
                 {
                     CAuthData authData;
                     if(ParseAuthData(vData, authData))
-                        appTx_index.push_back(make_pair(CAppTx_IndexKey(header.appId, strAddress, header.nAppCmd == ADD_AUTH_CMD ? ADD_AUTH_TXOUT : DELETE_AUTH_TXOUT, COutPoint(hash, m)), -1));
+                        appTx_index.push_back(make_pair(CAppTx_IndexKey(header.appId, address, header.nAppCmd == ADD_AUTH_CMD ? ADD_AUTH_TXOUT : DELETE_AUTH_TXOUT, COutPoint(hash, m)), -1));
                 }
                 else if(header.nAppCmd == CREATE_EXTEND_TX_CMD)
                 {
-                    appTx_index.push_back(make_pair(CAppTx_IndexKey(header.appId, strAddress, CREATE_EXTENDDATA_TXOUT, COutPoint(hash, m)), -1));
+                    appTx_index.push_back(make_pair(CAppTx_IndexKey(header.appId, address, CREATE_EXTENDDATA_TXOUT, COutPoint(hash, m)), -1));
                 }
                 else if(header.nAppCmd == ISSUE_ASSET_CMD)
                 {
@@ -3615,14 +3803,14 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
                         assetId_assetInfo_index.push_back(make_pair(assetId, CAssetId_AssetInfo_IndexValue()));
                         shortName_assetId_index.push_back(make_pair(assetData.strShortName, CName_Id_IndexValue()));
                         assetName_assetId_index.push_back(make_pair(assetData.strAssetName, CName_Id_IndexValue()));
-                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(assetId, strAddress, ISSUE_TXOUT, COutPoint(hash, m)), -1));
+                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(assetId, address, ISSUE_TXOUT, COutPoint(hash, m)), -1));
                     }
                 }
                 else if(header.nAppCmd == ADD_ASSET_CMD)
                 {
                     CCommonData addData;
                     if(ParseCommonData(vData, addData))
-                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(addData.assetId, strAddress, ADD_ISSUE_TXOUT, COutPoint(hash, m)), -1));
+                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(addData.assetId, address, ADD_ISSUE_TXOUT, COutPoint(hash, m)), -1));
                 }
                 else if(header.nAppCmd == TRANSFER_ASSET_CMD)
                 {
@@ -3630,9 +3818,9 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
                     if(ParseCommonData(vData, transferData))
                     {
                         if(txout.nUnlockedHeight > 0)
-                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(transferData.assetId, strAddress, LOCKED_TXOUT, COutPoint(hash, m)), -1));
+                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(transferData.assetId, address, LOCKED_TXOUT, COutPoint(hash, m)), -1));
                         else
-                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(transferData.assetId, strAddress, TRANSFER_TXOUT, COutPoint(hash, m)), -1));
+                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(transferData.assetId, address, TRANSFER_TXOUT, COutPoint(hash, m)), -1));
 
                         for(unsigned int x = 0; x < tx.vin.size(); x++)
                         {
@@ -3640,10 +3828,10 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
                             const CTxOut& in_txout = view.GetOutputFor(txin);
                             if(!in_txout.IsAsset())
                                 continue;
-                            std::string strInAddress = "";
-                            if(!GetTxOutAddress(in_txout, &strInAddress))
+                            CTxDestination inDest;
+                            if(!ExtractDestination(in_txout.scriptPubKey, inDest))
                                 continue;
-                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(transferData.assetId, strInAddress, TRANSFER_TXOUT, COutPoint(hash, -1)), -1));
+                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(transferData.assetId, CIndexAddress(inDest), TRANSFER_TXOUT, COutPoint(hash, -1)), -1));
                         }
                     }
                 }
@@ -3652,17 +3840,17 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
                     CCommonData destoryData;
                     if(ParseCommonData(vData, destoryData))
                     {
-                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(destoryData.assetId, strAddress, DESTORY_TXOUT, COutPoint(hash, m)), -1));
+                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(destoryData.assetId, address, DESTORY_TXOUT, COutPoint(hash, m)), -1));
                         for(unsigned int x = 0; x < tx.vin.size(); x++)
                         {
                             const CTxIn& txin = tx.vin[x];
                             const CTxOut& in_txout = view.GetOutputFor(txin);
                             if(!in_txout.IsAsset())
                                 continue;
-                            std::string strInAddress = "";
-                            if(!GetTxOutAddress(in_txout, &strInAddress))
+                            CTxDestination inDest;
+                            if(!ExtractDestination(in_txout.scriptPubKey, inDest))
                                 continue;
-                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(destoryData.assetId, strInAddress, DESTORY_TXOUT, COutPoint(hash, -1)), -1));
+                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(destoryData.assetId, CIndexAddress(inDest), DESTORY_TXOUT, COutPoint(hash, -1)), -1));
                         }
                     }
                 }
@@ -3672,11 +3860,11 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
                     if(ParsePutCandyData(vData, candyData))
                     {
                         putCandy_index.push_back(make_pair(CPutCandy_IndexKey(candyData.assetId, COutPoint(hash, m), CCandyInfo(candyData.nAmount, candyData.nExpired)), CPutCandy_IndexValue()));
-                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(candyData.assetId, strAddress, PUT_CANDY_TXOUT, COutPoint(hash, m)), -1));
+                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(candyData.assetId, address, PUT_CANDY_TXOUT, COutPoint(hash, m)), -1));
 
                         CAssetId_AssetInfo_IndexValue assetInfo;
                         if(GetAssetInfoByAssetId(candyData.assetId, assetInfo))
-                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(candyData.assetId, assetInfo.strAdminAddress, PUT_CANDY_TXOUT, COutPoint(hash, -1)), -1));
+                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(candyData.assetId, CIndexAddress(assetInfo.strAdminAddress), PUT_CANDY_TXOUT, COutPoint(hash, -1)), -1));
                     }
                 }
                 else if(header.nAppCmd == GET_CANDY_CMD)
@@ -3687,8 +3875,8 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
                         CGetCandyCount_IndexKey key(candyData.assetId,tx.vin.back().prevout);
                         CGetCandyCount_IndexValue& value = getCandyCount_index[key];
                         value.nGetCandyCount += candyData.nAmount;
-                        getCandy_index.push_back(make_pair(CGetCandy_IndexKey(candyData.assetId, tx.vin.back().prevout, strAddress), CGetCandy_IndexValue()));
-                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(candyData.assetId, strAddress, GET_CANDY_TXOUT, COutPoint(hash, m)), -1));
+                        getCandy_index.push_back(make_pair(CGetCandy_IndexKey(candyData.assetId, tx.vin.back().prevout, address), CGetCandy_IndexValue()));
+                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(candyData.assetId, address, GET_CANDY_TXOUT, COutPoint(hash, m)), -1));
                     }
                 }
             }
@@ -3703,19 +3891,6 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
         return true;
     }
 
-    if (fAddressIndex) {
-        if (!pblocktree->EraseAddressIndex(addressIndex)) {
-            return AbortNode(state, "Failed to delete address index");
-        }
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            return AbortNode(state, "Failed to write address unspent index");
-        }
-    }
-
-    if (fSpentIndex)
-        if (!pblocktree->UpdateSpentIndex(spentIndex))
-            return AbortNode(state, "Failed to delete spent index");
-
     if(appId_appInfo_index.size() && !pblocktree->Erase_AppId_AppInfo_Index(appId_appInfo_index))
         return AbortNode(state, "Failed to delete appId_appInfo index");
 
@@ -3770,30 +3945,18 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
             ++iter;
         }
     }
+    // the address and spent indexes are updated by the chain indexer
+    GetMainSignals().BlockDisconnected(block, pindex, pblockSpent);
+
     return fClean;
 }
 
+/** Queue syncing the last block and undo file, behind the records already queued for them */
 void static FlushBlockFile(bool fFinalize = false)
 {
     LOCK(cs_LastBlockFile);
 
-    CDiskBlockPos posOld(nLastBlockFile, 0);
-
-    FILE *fileOld = OpenBlockFile(posOld);
-    if (fileOld) {
-        if (fFinalize)
-            TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
-        FileCommit(fileOld);
-        fclose(fileOld);
-    }
-
-    fileOld = OpenUndoFile(posOld);
-    if (fileOld) {
-        if (fFinalize)
-            TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
-        FileCommit(fileOld);
-        fclose(fileOld);
-    }
+    blockwriter.Commit(nLastBlockFile, fFinalize, vinfoBlockFile[nLastBlockFile].nSize, vinfoBlockFile[nLastBlockFile].nUndoSize);
 }
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
@@ -3805,6 +3968,25 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+static bool CheckInputsParallel(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view, unsigned int flags)
+{
+    AssertLockHeld(cs_main);
+
+    if (!nScriptCheckThreads || tx.vin.size() < MIN_PARALLEL_SCRIPT_INPUTS)
+        return CheckInputs(tx, state, view, true, flags, true);
+
+    std::vector<CScriptCheck> vChecks;
+    if (!CheckInputs(tx, state, view, true, flags, true, &vChecks))
+        return false;
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    if (control.Wait())
+        return true;
+
+    // A failed batch only says that some input is invalid, redo the checks for the exact error
+    return CheckInputs(tx, state, view, true, flags, true);
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -3968,10 +4150,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (fEnforceBIP30) {
         BOOST_FOREACH(const CTransaction& tx, block.vtx) {
-            const CCoins* coins = view.AccessCoins(tx.GetHash());
-            if (coins && !coins->IsPruned())
-                return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                                 REJECT_INVALID, "bad-txns-BIP30");
+            for (unsigned int o = 0; o < tx.vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(tx.GetHash(), o)))
+                    return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
+                                     REJECT_INVALID, "bad-txns-BIP30");
+            }
         }
     }
 
@@ -4012,13 +4195,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CAmount nFees = 0;
     int nInputs = 0;
     unsigned int nSigOps = 0;
-    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
-    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
-    vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
-    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+    // coins spent by every input, for the address and spent indexes; shared
+    // with the chain indexer, which applies them after cs_main is released
+    boost::shared_ptr<CBlockUndo> pblockspent = boost::make_shared<CBlockUndo>();
+    CBlockUndo& blockspent = *pblockspent;
     std::vector<std::pair<uint256, CAppId_AppInfo_IndexValue> > appId_appInfo_index;
     std::vector<std::pair<std::string, CName_Id_IndexValue> > appName_appId_index;
     std::vector<std::pair<CAuth_IndexKey, int> > auth_index;
@@ -4035,13 +4216,17 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     bool fDIP0001Active_context = (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_DIP0001, versionbitscache) == THRESHOLD_ACTIVE);
 
+    std::vector<CAppTxCheckResult> vAppCheck(block.vtx.size());
+    if(!fJustCheck)
+        CheckBlockAppTransactions(block, view, vAppCheck);
+
     map<CPutCandy_IndexKey, CAmount> mapAssetGetCandy;
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction& tx = block.vtx[i];
         const uint256& txhash = tx.GetHash();
 
-        if(!fJustCheck && !CheckAppTransaction(tx, state, view, mapAssetGetCandy, false))
+        if(!fJustCheck && !CheckBlockAppTransaction(tx, state, view, mapAssetGetCandy, vAppCheck[i]))
             return error("ConnectBlock(): CheckAppTransaction on %s failed with %s", txhash.ToString(), FormatStateMessage(state));
 
         nInputs += tx.vin.size();
@@ -4062,8 +4247,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             prevheights.resize(tx.vin.size());
             calprevheights.resize(tx.vin.size());
             for (size_t j = 0; j < tx.vin.size(); j++) {
-                prevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
-                calprevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
+                prevheights[j] = view.AccessCoin(tx.vin[j].prevout).nHeight;
+                calprevheights[j] = prevheights[j];
             }
 
             if(!fJustCheck && ExistForbidTxin((uint32_t)g_nChainHeight, calprevheights))
@@ -4074,6 +4259,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                                  REJECT_INVALID, "bad-txns-nonfinal");
             }
 
+            if (fAddressIndex || fSpentIndex)
+                blockspent.vtxundo.push_back(CTxUndo());
             for (size_t j = 0; j < tx.vin.size(); j++) {
                 const CTxIn input = tx.vin[j];
                 const CTxOut& prevout = view.GetOutputFor(input);
@@ -4098,38 +4285,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 }
 
                 if (fAddressIndex || fSpentIndex)
-                {
-                    uint160 hashBytes;
-                    int addressType;
-
-                    if (prevout.scriptPubKey.IsPayToScriptHash()) {
-                        hashBytes = uint160(vector <unsigned char>(prevout.scriptPubKey.begin()+2, prevout.scriptPubKey.begin()+22));
-                        addressType = 2;
-                    } else if (prevout.scriptPubKey.IsPayToPublicKeyHash()) {
-                        hashBytes = uint160(vector <unsigned char>(prevout.scriptPubKey.begin()+3, prevout.scriptPubKey.begin()+23));
-                        addressType = 1;
-                    } else if (prevout.scriptPubKey.IsPayToPublicKey()) {
-                        hashBytes = Hash160(prevout.scriptPubKey.begin()+1, prevout.scriptPubKey.end()-1);
-                        addressType = 1;
-                    } else {
-                        hashBytes.SetNull();
-                        addressType = 0;
-                    }
-
-                    if (!prevout.IsAsset() && fAddressIndex && addressType > 0) {
-                        // record spending activity
-                        addressIndex.push_back(make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, txhash, j, true), prevout.nValue * -1));
-
-                        // remove address from unspent index
-                        addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(addressType, hashBytes, input.prevout.hash, input.prevout.n), CAddressUnspentValue()));
-                    }
-
-                    if (fSpentIndex) {
-                        // add the spent index to determine the txid and input that spent an output
-                        // and to find the amount and address from an input
-                        spentIndex.push_back(make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n), CSpentIndexValue(txhash, j, pindex->nHeight, prevout.nValue, addressType, hashBytes)));
-                    }
-                }
+                    blockspent.vtxundo.back().vprevout.push_back(view.AccessCoin(input.prevout));
             }
 
             if (fStrictPayToScriptHash)
@@ -4170,38 +4326,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 else
                     mapAddressAmount[strAddress] = out.nValue;
             }
-
-            if (fAddressIndex) {
-                if (out.scriptPubKey.IsPayToScriptHash()) {
-                    vector<unsigned char> hashBytes(out.scriptPubKey.begin()+2, out.scriptPubKey.begin()+22);
-
-                    // record receiving activity
-                    addressIndex.push_back(make_pair(CAddressIndexKey(2, uint160(hashBytes), pindex->nHeight, i, txhash, k, false), out.nValue));
-
-                    // record unspent output
-                    addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(2, uint160(hashBytes), txhash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
-
-                } else if (out.scriptPubKey.IsPayToPublicKeyHash()) {
-                    vector<unsigned char> hashBytes(out.scriptPubKey.begin()+3, out.scriptPubKey.begin()+23);
-
-                    // record receiving activity
-                    addressIndex.push_back(make_pair(CAddressIndexKey(1, uint160(hashBytes), pindex->nHeight, i, txhash, k, false), out.nValue));
-
-                    // record unspent output
-                    addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(1, uint160(hashBytes), txhash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
-
-                } else if (out.scriptPubKey.IsPayToPublicKey()) {
-                    uint160 hashBytes(Hash160(out.scriptPubKey.begin()+1, out.scriptPubKey.end()-1));
-
-                    // record receiving activity
-                    addressIndex.push_back(make_pair(CAddressIndexKey(1, hashBytes, pindex->nHeight, i, txhash, k, false), out.nValue));
-
-                    // record unspent output
-                    addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(1, hashBytes, txhash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
-                } else {
-                    continue;
-                }
-            }
         }
 
 
@@ -4217,16 +4341,16 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 if(!ExtractDestination(txout.scriptPubKey, dest))
                     continue;
 
-                std::string strAddress = CBitcoinAddress(dest).ToString();
+                CIndexAddress address(dest);
 
                 if(header.nAppCmd == REGISTER_APP_CMD)
                 {
                     CAppData appData;
                     if(ParseRegisterData(vData, appData))
                     {
-                        appId_appInfo_index.push_back(make_pair(header.appId, CAppId_AppInfo_IndexValue(strAddress, appData, pindex->nHeight)));
+                        appId_appInfo_index.push_back(make_pair(header.appId, CAppId_AppInfo_IndexValue(CBitcoinAddress(dest).ToString(), appData, pindex->nHeight)));
                         appName_appId_index.push_back(make_pair(appData.strAppName, CName_Id_IndexValue(header.appId, pindex->nHeight)));
-                        appTx_index.push_back(make_pair(CAppTx_IndexKey(header.appId, strAddress, REGISTER_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
+                        appTx_index.push_back(make_pair(CAppTx_IndexKey(header.appId, address, REGISTER_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
                     }
                 }
                 else if(header.nAppCmd == ADD_AUTH_CMD)
@@ -4234,25 +4358,26 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                     CAuthData authData;
                     if(ParseAuthData(vData, authData))
                     {
-                        appTx_index.push_back(make_pair(CAppTx_IndexKey(header.appId, strAddress, ADD_AUTH_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
+                        appTx_index.push_back(make_pair(CAppTx_IndexKey(header.appId, address, ADD_AUTH_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
 
+                        CIndexAddress userAddress(authData.strUserAddress);
                         std::map<uint32_t, int> mapAuth;
                         GetAuthByAppIdAddress(header.appId, authData.strUserAddress, mapAuth);
                         if(authData.nAuth == 0)
                         {
                             if(mapAuth.count(1) != 0)
-                                auth_index.push_back(make_pair(CAuth_IndexKey(header.appId, authData.strUserAddress, 1), -1));
-                            auth_index.push_back(make_pair(CAuth_IndexKey(header.appId, authData.strUserAddress, 0), pindex->nHeight));
+                                auth_index.push_back(make_pair(CAuth_IndexKey(header.appId, userAddress, 1), -1));
+                            auth_index.push_back(make_pair(CAuth_IndexKey(header.appId, userAddress, 0), pindex->nHeight));
                         }
                         else if(authData.nAuth == 1)
                         {
                             if(mapAuth.count(0) != 0)
-                                auth_index.push_back(make_pair(CAuth_IndexKey(header.appId, authData.strUserAddress, 0), -1));
-                            auth_index.push_back(make_pair(CAuth_IndexKey(header.appId, authData.strUserAddress, 1), pindex->nHeight));
+                                auth_index.push_back(make_pair(CAuth_IndexKey(header.appId, userAddress, 0), -1));
+                            auth_index.push_back(make_pair(CAuth_IndexKey(header.appId, userAddress, 1), pindex->nHeight));
                         }
                         else
                         {
-                            auth_index.push_back(make_pair(CAuth_IndexKey(header.appId, authData.strUserAddress, authData.nAuth), pindex->nHeight));
+                            auth_index.push_back(make_pair(CAuth_IndexKey(header.appId, userAddress, authData.nAuth), pindex->nHeight));
                         }
                     }
                 }
@@ -4261,17 +4386,18 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                     CAuthData authData;
                     if(ParseAuthData(vData, authData))
                     {
-                        appTx_index.push_back(make_pair(CAppTx_IndexKey(header.appId, strAddress, DELETE_AUTH_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
+                        appTx_index.push_back(make_pair(CAppTx_IndexKey(header.appId, address, DELETE_AUTH_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
 
+                        CIndexAddress userAddress(authData.strUserAddress);
                         std::map<uint32_t, int> mapAuth;
                         GetAuthByAppIdAddress(header.appId, authData.strUserAddress, mapAuth);
                         if(mapAuth.count(authData.nAuth) != 0)
-                            auth_index.push_back(make_pair(CAuth_IndexKey(header.appId, authData.strUserAddress, authData.nAuth), -1));
+                            auth_index.push_back(make_pair(CAuth_IndexKey(header.appId, userAddress, authData.nAuth), -1));
                     }
                 }
                 else if(header.nAppCmd == CREATE_EXTEND_TX_CMD)
                 {
-                    appTx_index.push_back(make_pair(CAppTx_IndexKey(header.appId, strAddress, CREATE_EXTENDDATA_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
+                    appTx_index.push_back(make_pair(CAppTx_IndexKey(header.appId, address, CREATE_EXTENDDATA_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
                 }
                 else if(header.nAppCmd == ISSUE_ASSET_CMD)
                 {
@@ -4279,23 +4405,23 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                     if(ParseIssueData(vData, assetData))
                     {
                         uint256 assetId = assetData.GetHash();
-                        assetId_assetInfo_index.push_back(make_pair(assetId, CAssetId_AssetInfo_IndexValue(strAddress, assetData, pindex->nHeight)));
+                        assetId_assetInfo_index.push_back(make_pair(assetId, CAssetId_AssetInfo_IndexValue(CBitcoinAddress(dest).ToString(), assetData, pindex->nHeight)));
                         shortName_assetId_index.push_back(make_pair(assetData.strShortName, CName_Id_IndexValue(assetId, pindex->nHeight)));
                         assetName_assetId_index.push_back(make_pair(assetData.strAssetName, CName_Id_IndexValue(assetId, pindex->nHeight)));
-                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(assetId, strAddress, ISSUE_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
+                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(assetId, address, ISSUE_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
                     }
                 }
                 else if(header.nAppCmd == ADD_ASSET_CMD)
                 {
                     CCommonData addData;
                     if(ParseCommonData(vData, addData))
-                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(addData.assetId, strAddress, ADD_ISSUE_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
+                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(addData.assetId, address, ADD_ISSUE_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
                 }
                 else if (header.nAppCmd == CHANGE_ASSET_CMD)
                 {
                     CCommonData changeData;
                     if(ParseCommonData(vData, changeData))
-                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(changeData.assetId, strAddress, CHANGE_ASSET_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
+                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(changeData.assetId, address, CHANGE_ASSET_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
                 }
                 else if(header.nAppCmd == TRANSFER_ASSET_CMD)
                 {
@@ -4303,9 +4429,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                     if(ParseCommonData(vData, transferData))
                     {
                         if(txout.nUnlockedHeight > 0)
-                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(transferData.assetId, strAddress, LOCKED_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
+                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(transferData.assetId, address, LOCKED_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
                         else
-                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(transferData.assetId, strAddress, TRANSFER_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
+                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(transferData.assetId, address, TRANSFER_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
 
                         for(unsigned int x = 0; x < tx.vin.size(); x++)
                         {
@@ -4313,10 +4439,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                             const CTxOut& in_txout = view.GetOutputFor(txin);
                             if(!in_txout.IsAsset())
                                 continue;
-                            std::string strInAddress = "";
-                            if(!GetTxOutAddress(in_txout, &strInAddress))
+                            CTxDestination inDest;
+                            if(!ExtractDestination(in_txout.scriptPubKey, inDest))
                                 continue;
-                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(transferData.assetId, strInAddress, TRANSFER_TXOUT, COutPoint(txhash, -1)), pindex->nHeight));
+                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(transferData.assetId, CIndexAddress(inDest), TRANSFER_TXOUT, COutPoint(txhash, -1)), pindex->nHeight));
                         }
                     }
                 }
@@ -4325,17 +4451,17 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                     CCommonData destoryData;
                     if(ParseCommonData(vData, destoryData))
                     {
-                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(destoryData.assetId, strAddress, DESTORY_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
+                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(destoryData.assetId, address, DESTORY_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
                         for(unsigned int x = 0; x < tx.vin.size(); x++)
                         {
                             const CTxIn& txin = tx.vin[x];
                             const CTxOut& in_txout = view.GetOutputFor(txin);
                             if(!in_txout.IsAsset())
                                 continue;
-                            std::string strInAddress = "";
-                            if(!GetTxOutAddress(in_txout, &strInAddress))
+                            CTxDestination inDest;
+                            if(!ExtractDestination(in_txout.scriptPubKey, inDest))
                                 continue;
-                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(destoryData.assetId, strInAddress, DESTORY_TXOUT, COutPoint(txhash, -1)), pindex->nHeight));
+                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(destoryData.assetId, CIndexAddress(inDest), DESTORY_TXOUT, COutPoint(txhash, -1)), pindex->nHeight));
                         }
                     }
                 }
@@ -4345,11 +4471,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                     if(ParsePutCandyData(vData, candyData))
                     {
                         putCandy_index.push_back(make_pair(CPutCandy_IndexKey(candyData.assetId, COutPoint(txhash, m), CCandyInfo(candyData.nAmount, candyData.nExpired)), CPutCandy_IndexValue(pindex->nHeight, blockHash, i)));
-                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(candyData.assetId, strAddress, PUT_CANDY_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
+                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(candyData.assetId, address, PUT_CANDY_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
 
                         CAssetId_AssetInfo_IndexValue assetInfo;
                         if(GetAssetInfoByAssetId(candyData.assetId, assetInfo))
-                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(candyData.assetId, assetInfo.strAdminAddress, PUT_CANDY_TXOUT, COutPoint(txhash, -1)), pindex->nHeight));
+                            assetTx_index.push_back(make_pair(CAssetTx_IndexKey(candyData.assetId, CIndexAddress(assetInfo.strAdminAddress), PUT_CANDY_TXOUT, COutPoint(txhash, -1)), pindex->nHeight));
                     }
                 }
                 else if(header.nAppCmd == GET_CANDY_CMD)
@@ -4360,8 +4486,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                         CGetCandyCount_IndexKey key(candyData.assetId,tx.vin.back().prevout);
                         CGetCandyCount_IndexValue& value = getCandyCount_index[key];
                         value.nGetCandyCount += candyData.nAmount;
-                        getCandy_index.push_back(make_pair(CGetCandy_IndexKey(candyData.assetId, tx.vin.back().prevout, strAddress), CGetCandy_IndexValue(candyData.nAmount, pindex->nHeight, blockHash, i)));
-                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(candyData.assetId, strAddress, GET_CANDY_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
+                        getCandy_index.push_back(make_pair(CGetCandy_IndexKey(candyData.assetId, tx.vin.back().prevout, address), CGetCandy_IndexValue(candyData.nAmount, pindex->nHeight, blockHash, i)));
+                        assetTx_index.push_back(make_pair(CAssetTx_IndexKey(candyData.assetId, address, GET_CANDY_TXOUT, COutPoint(txhash, m)), pindex->nHeight));
                     }
                 }
             }
@@ -4372,9 +4498,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             blockundo.vtxundo.push_back(CTxUndo());
         }
         UpdateCoins(tx, state, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
-
-        vPos.push_back(std::make_pair(txhash, pos));
-        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
     }
     int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime3 - nTime2), 0.001 * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * 0.000001);
@@ -4424,35 +4547,13 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             // update nUndoPos in block index
             pindex->nUndoPos = pos.nPos;
-            pindex->nStatus |= BLOCK_HAVE_UNDO;
+            pindex->nStatus |= BLOCK_HAVE_UNDO | BLOCK_UNDO_COMPACT;
         }
 
         pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
         setDirtyBlockIndex.insert(pindex);
     }
 
-    if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
-            return AbortNode(state, "Failed to write transaction index");
-
-    if (fAddressIndex) {
-        if (!pblocktree->WriteAddressIndex(addressIndex)) {
-            return AbortNode(state, "Failed to write address index");
-        }
-
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            return AbortNode(state, "Failed to write address unspent index");
-        }
-    }
-
-    if (fSpentIndex)
-        if (!pblocktree->UpdateSpentIndex(spentIndex))
-            return AbortNode(state, "Failed to write transaction index");
-
-    if (fTimestampIndex)
-        if (!pblocktree->WriteTimestampIndex(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash())))
-            return AbortNode(state, "Failed to write timestamp index");
-
     if(appId_appInfo_index.size() && !pblocktree->Write_AppId_AppInfo_Index(appId_appInfo_index))
         return AbortNode(state, "Failed to write appId_appInfo index");
 
@@ -4519,6 +4620,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
+    // the tx, address, spent and timestamp indexes are written by the chain indexer
+    GetMainSignals().BlockConnected(block, pindex, pblockspent);
+
     if(masternodeSync.IsBlockchainSynced())
     {
         for(std::vector<std::pair<std::string, CName_Id_IndexValue> >::const_iterator it = assetName_assetId_index.begin(); it != assetName_assetId_index.end(); it++)
@@ -4593,7 +4697,8 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         if (!CheckDiskSpace(0))
             return state.Error("out of disk space");
         // First make sure all block and undo data is flushed to disk.
-        FlushBlockFile();
+        if (!blockwriter.Flush())
+            return AbortNode(state, "Failed to write block files");
         // Then update all block file information (which may refer to block and undo files).
         {
             std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
@@ -4619,13 +4724,17 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
     if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+        // Coin records on disk carry app and asset data in vReserve, so
+        // budget around 128 bytes for each.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
         if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
+        // The indexes must not fall behind the chainstate, a restart would not replay their blocks.
+        if (!chainindexer.Flush())
+            return AbortNode(state, "Failed to write chain indexes");
         // Flush the chainstate (which may refer to block index entries).
         if (!pcoinsTip->Flush())
             return AbortNode(state, "Failed to write to coin database");
@@ -4717,9 +4826,10 @@ bool static DisconnectTip(CValidationState& state, const Consensus::Params& cons
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
     // Read block from disk.
-    CBlock block;
-    if (!ReadBlockFromDisk(block, pindexDelete, consensusParams))
+    boost::shared_ptr<const CBlock> pblock;
+    if (!ReadBlockFromDisk(pblock, pindexDelete, consensusParams))
         return AbortNode(state, "Failed to read block");
+    const CBlock& block = *pblock;
     // Apply the block atomically to the chain state.
     int64_t nStart = GetTimeMicros();
     {
@@ -4775,11 +4885,11 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     assert(pindexNew->pprev == chainActive.Tip());
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
-    CBlock block;
+    boost::shared_ptr<const CBlock> pblockRead;
     if (!pblock) {
-        if (!ReadBlockFromDisk(block, pindexNew, chainparams.GetConsensus()))
+        if (!ReadBlockFromDisk(pblockRead, pindexNew, chainparams.GetConsensus()))
             return AbortNode(state, "Failed to read block");
-        pblock = &block;
+        pblock = pblockRead.get();
     }
     // Apply the block atomically to the chain state.
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
@@ -4810,6 +4920,9 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted, !IsInitialBlockDownload());
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
+    // Keep the new tip at hand for the RPC, candy and wallet readers that follow it
+    if (!pblockRead && !IsInitialBlockDownload())
+        blockcache.Insert(pindexNew->GetBlockHash(), boost::make_shared<const CBlock>(*pblock));
     // Tell wallet about transactions that went from mempool
     // to conflicted:
     BOOST_FOREACH(const CTransaction &tx, txConflicted) {
@@ -5171,10 +5284,9 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex) {
     return true;
 }
 
-CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
+CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const uint256& hash)
 {
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator it = mapBlockIndex.find(hash);
     if (it != mapBlockIndex.end())
         return it->second;
@@ -5339,13 +5451,13 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     return true;
 }
 
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW)
+static bool CheckBlockHeader(const CBlockHeader& block, const uint256& hash, CValidationState& state, bool fCheckPOW)
 {
     if(CheckCriticalBlock(block))
         return true;
 
     // Check proof of work matches claimed amount
-    if (fCheckPOW && !CheckProofOfWork(block.GetHash(), block.nBits, Params().GetConsensus()))
+    if (fCheckPOW && !CheckProofOfWork(hash, block.nBits, Params().GetConsensus()))
         return state.DoS(50, error("CheckBlockHeader(): proof of work failed"),
                          REJECT_INVALID, "high-hash");
 
@@ -5357,7 +5469,17 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
     return true;
 }
 
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW)
+{
+    return CheckBlockHeader(block, fCheckPOW ? block.GetHash() : uint256(), state, fCheckPOW);
+}
+
 bool CheckBlock(const CBlock& block, const int& nHeight, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot)
+{
+    return CheckBlock(block, fCheckPOW && !block.fChecked ? block.GetHash() : uint256(), nHeight, state, fCheckPOW, fCheckMerkleRoot);
+}
+
+bool CheckBlock(const CBlock& block, const uint256& hash, const int& nHeight, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     // These are checks that are independent of context.
 
@@ -5366,7 +5488,7 @@ bool CheckBlock(const CBlock& block, const int& nHeight, CValidationState& state
 
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
-    if (!CheckBlockHeader(block, state, fCheckPOW))
+    if (!CheckBlockHeader(block, hash, state, fCheckPOW))
         return false;
 
     // Check the merkle root.
@@ -5568,11 +5690,63 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+/** Computes the X11 hash of one header */
+class CHeaderHashCheck
+{
+private:
+    const CBlockHeader* pheader;
+    uint256* phash;
+
+public:
+    CHeaderHashCheck() : pheader(NULL), phash(NULL) {}
+    CHeaderHashCheck(const CBlockHeader& headerIn, uint256& hashIn) : pheader(&headerIn), phash(&hashIn) {}
+
+    bool operator()()
+    {
+        *phash = pheader->GetHash();
+        return true;
+    }
+
+    void swap(CHeaderHashCheck& check)
+    {
+        std::swap(pheader, check.pheader);
+        std::swap(phash, check.phash);
+    }
+};
+
+static CCheckQueue<CHeaderHashCheck> headerhashqueue(128);
+// A check queue serves one master at a time
+static CCriticalSection cs_headerhashqueue;
+
+void ThreadHeaderHashCheck() {
+    RenameThread("safe-hdrhash");
+    headerhashqueue.Thread();
+}
+
+void HashBlockHeaders(const std::vector<CBlockHeader>& headers, std::vector<uint256>& vHash)
+{
+    vHash.resize(headers.size());
+    if (!nScriptCheckThreads || headers.size() < 2) {
+        for (size_t i = 0; i < headers.size(); i++)
+            vHash[i] = headers[i].GetHash();
+        return;
+    }
+
+    std::vector<CHeaderHashCheck> vChecks;
+    vChecks.reserve(headers.size());
+    for (size_t i = 0; i < headers.size(); i++)
+        vChecks.push_back(CHeaderHashCheck(headers[i], vHash[i]));
+
+    LOCK(cs_headerhashqueue);
+    CCheckQueueControl<CHeaderHashCheck> control(&headerhashqueue);
+    control.Add(vChecks);
+    control.Wait();
+}
+
+static bool AcceptBlockHeader(const CBlockHeader& block, const uint256& hash, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = NULL;
 
@@ -5589,7 +5763,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state))
+        if (!CheckBlockHeader(block, hash, state, true))
             return false;
 
         // Get prev block index
@@ -5609,7 +5783,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return false;
     }
     if (pindex == NULL)
-        pindex = AddToBlockIndex(block);
+        pindex = AddToBlockIndex(block, hash);
 
     if (ppindex)
         *ppindex = pindex;
@@ -5623,12 +5797,13 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
 }
 
 // Exposed wrapper for AcceptBlockHeader
-bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, const std::vector<uint256>& vHash, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
 {
+    assert(vHash.size() == headers.size());
     {
         LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
-            if (!AcceptBlockHeader(header, state, chainparams, ppindex)) {
+        for (size_t i = 0; i < headers.size(); i++) {
+            if (!AcceptBlockHeader(headers[i], vHash[i], state, chainparams, ppindex)) {
                 return false;
             }
         }
@@ -5637,8 +5812,16 @@ bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidatio
     return true;
 }
 
+bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+{
+    // Hash the batch on the worker threads before taking cs_main
+    std::vector<uint256> vHash;
+    HashBlockHeaders(headers, vHash);
+    return ProcessNewBlockHeaders(headers, vHash, state, chainparams, ppindex);
+}
+
 /** Store block on disk. If dbp is non-NULL, the file is known to already reside on disk */
-static bool AcceptBlock(const CBlock& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock)
+static bool AcceptBlock(const CBlock& block, const uint256& hash, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock)
 {
     if (fNewBlock) *fNewBlock = false;
     AssertLockHeld(cs_main);
@@ -5646,7 +5829,7 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     CBlockIndex *pindexDummy = NULL;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    if (!AcceptBlockHeader(block, hash, state, chainparams, &pindex))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -5676,7 +5859,7 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     }
     if (fNewBlock) *fNewBlock = true;
 
-    if ((!CheckBlock(block, pindex->nHeight, state)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
+    if ((!CheckBlock(block, hash, pindex->nHeight, state)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
             setDirtyBlockIndex.insert(pindex);
@@ -5723,6 +5906,11 @@ static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned
 
 
 bool ProcessNewBlock(const CChainParams& chainparams, const CBlock* pblock, bool fForceProcessing, const CDiskBlockPos* dbp, bool *fNewBlock)
+{
+    return ProcessNewBlock(chainparams, pblock, pblock->GetHash(), fForceProcessing, dbp, fNewBlock);
+}
+
+bool ProcessNewBlock(const CChainParams& chainparams, const CBlock* pblock, const uint256& hash, bool fForceProcessing, const CDiskBlockPos* dbp, bool *fNewBlock)
 {
     {
         LOCK(cs_main);
@@ -5731,7 +5919,7 @@ bool ProcessNewBlock(const CChainParams& chainparams, const CBlock* pblock, bool
         CBlockIndex *pindex = NULL;
         if (fNewBlock) *fNewBlock = false;
         CValidationState state;
-        bool ret = AcceptBlock(*pblock, state, chainparams, &pindex, fForceProcessing, dbp, fNewBlock);
+        bool ret = AcceptBlock(*pblock, hash, state, chainparams, &pindex, fForceProcessing, dbp, fNewBlock);
         CheckBlockIndex(chainparams.GetConsensus());
         if (!ret) {
             GetMainSignals().BlockChecked(*pblock, state);
@@ -5797,6 +5985,7 @@ void PruneOneBlockFile(const int fileNumber)
         if (pindex->nFile == fileNumber) {
             pindex->nStatus &= ~BLOCK_HAVE_DATA;
             pindex->nStatus &= ~BLOCK_HAVE_UNDO;
+            pindex->nStatus &= ~BLOCK_UNDO_COMPACT;
             pindex->nFile = 0;
             pindex->nDataPos = 0;
             pindex->nUndoPos = 0;
@@ -6053,6 +6242,10 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("spentindex", fSpentIndex);
     LogPrintf("%s: spent index %s\n", __func__, fSpentIndex ? "enabled" : "disabled");
 
+    uint256 hashIndexBest;
+    if (pblocktree->ReadIndexBestBlock(hashIndexBest))
+        LogPrintf("%s: chain indexes written up to block %s\n", __func__, hashIndexBest.ToString());
+
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
@@ -6104,6 +6297,11 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
+        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruning or started from a snapshot, only go back as far as we have data.
+            LogPrintf("VerifyDB(): block verification stopping at height %d (no data)\n", pindex->nHeight);
+            break;
+        }
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
@@ -6114,9 +6312,8 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         // check level 2: verify undo validity
         if (nCheckLevel >= 2 && pindex) {
             CBlockUndo undo;
-            CDiskBlockPos pos = pindex->GetUndoPos();
-            if (!pos.IsNull()) {
-                if (!UndoReadFromDisk(undo, pos, pindex->pprev->GetBlockHash()))
+            if (!pindex->GetUndoPos().IsNull()) {
+                if (!UndoReadFromDisk(undo, pindex))
                     return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
             }
         }
@@ -6232,7 +6429,7 @@ bool InitBlockIndex(const CChainParams& chainparams)
                 return error("%s: FindBlockPos failed", __func__);
             if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
                 return error("%s: writing genesis block to disk failed", __func__);
-            CBlockIndex *pindex = AddToBlockIndex(block);
+            CBlockIndex *pindex = AddToBlockIndex(block, block.GetHash());
             if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
                 return error("%s: genesis block not accepted", __func__);
             if (!ActivateBestChain(state, chainparams, &block))
@@ -6249,110 +6446,112 @@ bool InitBlockIndex(const CChainParams& chainparams)
 
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
+    // Blocks with unknown parent, kept in memory up to MAX_IMPORT_UNKNOWN_PARENT
+    static std::multimap<uint256, CImportedBlock> mapImportUnknownParent;
+    static uint64_t nImportUnknownParentUsage = 0;
+    // Map of disk positions for blocks with unknown parent that didn't fit in memory (only used for reindex)
     static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
     int nLoaded = 0;
     try {
-        unsigned int nMaxBlockSize = MaxBlockSize(true);
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*nMaxBlockSize, nMaxBlockSize+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
+        // Leave a core for validation, which consumes the blocks on this thread
+        int nThreads = std::max(1, std::min(GetNumCores() - 1, MAX_IMPORT_THREADS));
+        // This takes over fileIn and closes it when the whole file has been read
+        CBlockImportReader reader(fileIn, dbp ? dbp->nFile : -1, chainparams.MessageStart(), MaxBlockSize(true), nThreads);
+        CImportedBlock imported;
+        while (reader.Next(imported)) {
             boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > nMaxBlockSize)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
-            }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
+            if (!imported.pblock)
+                continue;
+            const CBlock& block = *imported.pblock;
+            const uint256& hash = imported.hash;
+            CDiskBlockPos* pos = dbp ? &imported.pos : NULL;
+
+            // detect out of order blocks, and store them for later
+            if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+                LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                        block.hashPrevBlock.ToString());
+                if (nImportUnknownParentUsage + imported.nMemUsage <= MAX_IMPORT_UNKNOWN_PARENT) {
+                    nImportUnknownParentUsage += imported.nMemUsage;
+                    mapImportUnknownParent.insert(std::make_pair(block.hashPrevBlock, imported));
+                } else if (dbp) {
+                    mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, imported.pos));
+                } else {
+                    LogPrintf("%s: Dropping out of order block %s, too many blocks with unknown parent\n", __func__, hash.ToString());
                 }
+                continue;
+            }
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    LOCK(cs_main);
-                    CValidationState state;
-                    if (AcceptBlock(block, state, chainparams, NULL, true, dbp, NULL))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrint("reindex", "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+            // process in case the block isn't known yet
+            if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+                LOCK(cs_main);
+                CValidationState state;
+                if (AcceptBlock(block, hash, state, chainparams, NULL, true, pos, NULL))
+                    nLoaded++;
+                if (state.IsError())
+                    break;
+            } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+                LogPrint("reindex", "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+            }
+
+            // Activate the genesis block so normal node progress can continue
+            if (hash == chainparams.GetConsensus().hashGenesisBlock) {
+                CValidationState state;
+                if (!ActivateBestChain(state, chainparams)) {
+                    break;
                 }
+            }
 
-                // Activate the genesis block so normal node progress can continue
-                if (hash == chainparams.GetConsensus().hashGenesisBlock) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state, chainparams)) {
-                        break;
+            NotifyHeaderTip();
+
+            // Recursively process earlier encountered successors of this block
+            deque<uint256> queue;
+            queue.push_back(hash);
+            while (!queue.empty()) {
+                uint256 head = queue.front();
+                queue.pop_front();
+                std::pair<std::multimap<uint256, CImportedBlock>::iterator, std::multimap<uint256, CImportedBlock>::iterator> range = mapImportUnknownParent.equal_range(head);
+                while (range.first != range.second) {
+                    std::multimap<uint256, CImportedBlock>::iterator it = range.first;
+                    LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, it->second.hash.ToString(),
+                            head.ToString());
+                    {
+                        LOCK(cs_main);
+                        CValidationState dummy;
+                        if (AcceptBlock(*it->second.pblock, it->second.hash, dummy, chainparams, NULL, true, dbp ? &it->second.pos : NULL, NULL))
+                        {
+                            nLoaded++;
+                            queue.push_back(it->second.hash);
+                        }
                     }
+                    range.first++;
+                    nImportUnknownParentUsage -= it->second.nMemUsage;
+                    mapImportUnknownParent.erase(it);
+                    NotifyHeaderTip();
                 }
-
-                NotifyHeaderTip();
-
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()))
+                std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> rangeDisk = mapBlocksUnknownParent.equal_range(head);
+                while (rangeDisk.first != rangeDisk.second) {
+                    std::multimap<uint256, CDiskBlockPos>::iterator it = rangeDisk.first;
+                    CBlock blockChild;
+                    if (ReadBlockFromDisk(blockChild, it->second, chainparams.GetConsensus()))
+                    {
+                        LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, blockChild.GetHash().ToString(),
+                                head.ToString());
+                        LOCK(cs_main);
+                        CValidationState dummy;
+                        const uint256 hashChild = blockChild.GetHash();
+                        if (AcceptBlock(blockChild, hashChild, dummy, chainparams, NULL, true, &it->second, NULL))
                         {
-                            LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (AcceptBlock(block, dummy, chainparams, NULL, true, &it->second, NULL))
-                            {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
-                            }
+                            nLoaded++;
+                            queue.push_back(hashChild);
                         }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
                     }
+                    rangeDisk.first++;
+                    mapBlocksUnknownParent.erase(it);
+                    NotifyHeaderTip();
                 }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
         }
     } catch (const std::runtime_error& e) {
@@ -7000,7 +7199,7 @@ bool GetRangeChangeHeight(const int nCandyHeight, vector<int>& vChangeHeight)
 static int BinarySearchFromFile(const string& strFile, const string& strAddress, CAmount& nAmount, long* pPos = NULL);
 bool GetAddressAmountByHeight(const int& nHeight, const std::string& strAddress, CAmount& nAmount)
 {
-    std::lock_guard<std::mutex> lock(g_mutexChangeFile);
+    boost::shared_lock<boost::shared_mutex> lock(g_mutexChangeFile); // readers share the change files
 
     uint64_t nDetailFileSize = boost::filesystem::file_size(GetDataDir() / "height/detail.dat");
     if(nDetailFileSize / sizeof(CBlockDetail) + g_nCriticalHeight - 1 - nHeight > 3 * BLOCKS_PER_MONTH)
@@ -7115,25 +7314,8 @@ static bool GetAllCandyInfo()
     vector<pair<CPutCandy_IndexKey, CPutCandy_IndexValue>> vallassetidcandyinfolist(mapCandy.begin(), mapCandy.end());
     sort(vallassetidcandyinfolist.begin(), vallassetidcandyinfolist.end(), CompareCandyInfo());
 
-    map<CKeyID, int64_t> mapKeyBirth;
-    {
-        LOCK(pwalletMain->cs_wallet);
-        pwalletMain->GetKeyBirthTimes(mapKeyBirth);
-    }
-
-    int keyBirthCount = 0;
-    std::vector<std::string> vaddress;
-    for (map<CKeyID, int64_t>::const_iterator tempit = mapKeyBirth.begin(); tempit != mapKeyBirth.end(); tempit++)
-    {
-        boost::this_thread::interruption_point();
-        if(++keyBirthCount==1000)
-        {
-            keyBirthCount = 0;
-            MilliSleep(10);
-        }
-        std::string saddress = CBitcoinAddress(tempit->first).ToString();
-        vaddress.push_back(saddress);
-    }
+    boost::shared_ptr<const std::vector<CKeyAddressEntry> > pKeyAddresses = pwalletMain->GetKeyAddresses();
+    const std::vector<CKeyAddressEntry>& vaddress = *pKeyAddresses;
 
     int nCurrentHeight = g_nChainHeight;
 
@@ -7192,15 +7374,15 @@ static bool GetAllCandyInfo()
             if(addrCount%50==0&&addrCount!=0)
                 MilliSleep(10);
             CAmount nSafe = 0;
-            if(!GetAddressAmountByHeight(nTxHeight, vaddress[addrCount], nSafe))
+            if(!GetAddressAmountByHeight(nTxHeight, vaddress[addrCount].strAddress, nSafe))
                 continue;
             if (nSafe < 1 * COIN || nSafe > nTotalSafe)
                 continue;
 
             CAmount nTempAmount = 0;
-            CAmount nCandyAmount = (CAmount)(1.0 * nSafe / nTotalSafe * candyInfo.nAmount);
+            CAmount nCandyAmount = GetCandyShareAmount(nSafe, nTotalSafe, candyInfo.nAmount);
             //add all nCandyAmount to judge whether more than candyInfo.nAmount
-            if (nCandyAmount >= AmountFromValue("0.0001", assetInfo.assetData.nDecimals, true) && !GetGetCandyAmount(assetId, out, vaddress[addrCount], nTempAmount))
+            if (nCandyAmount >= AmountFromValue("0.0001", assetInfo.assetData.nDecimals, true) && !GetGetCandyAmount(assetId, out, vaddress[addrCount].strAddress, nTempAmount))
             {
                 relust = true;
                 nNowGetCandyTotalAmount += nCandyAmount;
@@ -7694,7 +7876,7 @@ static bool GetHeightAddressAmount(const int& nCandyHeight)
     if (!pblocktree->Write_CandyHeight_TotalAmount_Index(nCandyHeight, nTotalAmount))
         return error("%s: write finnal candy height index failed at %d", __func__, nCandyHeight);
 
-    CBlock candyBlock;
+    boost::shared_ptr<const CBlock> pcandyBlock;
     while(true)
     {
         boost::this_thread::interruption_point();
@@ -7706,28 +7888,18 @@ static bool GetHeightAddressAmount(const int& nCandyHeight)
         }
 
         CBlockIndex* pindex = chainActive[nCandyHeight];
-        if (ReadBlockFromDisk(candyBlock, pindex, Params().GetConsensus()))
+        if (ReadBlockFromDisk(pcandyBlock, pindex, Params().GetConsensus()))
             break;
         MilliSleep(1000);
     }
 
     bool fUpdateUI = false;
 
-    map<CKeyID, int64_t> mapKeyBirth;
-    {
-        LOCK(pwalletMain->cs_wallet);
-        pwalletMain->GetKeyBirthTimes(mapKeyBirth);
-    }
-
-    std::vector<std::string> vaddress;
-    for (map<CKeyID, int64_t>::const_iterator tempit = mapKeyBirth.begin(); tempit != mapKeyBirth.end(); tempit++)
-    {
-        boost::this_thread::interruption_point();
-        std::string saddress = CBitcoinAddress(tempit->first).ToString();
-        vaddress.push_back(saddress);
-    }
+    boost::shared_ptr<const std::vector<CKeyAddressEntry> > pKeyAddresses = pwalletMain->GetKeyAddresses();
+    const std::vector<CKeyAddressEntry>& vaddress = *pKeyAddresses;
 
     int nCurrentHeight = g_nChainHeight;
+    const CBlock& candyBlock = *pcandyBlock;
     BOOST_FOREACH(const CTransaction& tx, candyBlock.vtx)
     {
         for(unsigned int i = 0; i < tx.vout.size(); i++)
@@ -7763,19 +7935,19 @@ static bool GetHeightAddressAmount(const int& nCandyHeight)
                 continue;
 
             bool result = false;
-            for (std::vector<std::string>::iterator addit = vaddress.begin(); addit != vaddress.end(); addit++)
+            for (std::vector<CKeyAddressEntry>::const_iterator addit = vaddress.begin(); addit != vaddress.end(); addit++)
             {
                 boost::this_thread::interruption_point();
 
                 CAmount nSafe = 0;
-                if(!GetAddressAmountByHeight(nCandyHeight, *addit, nSafe))
+                if(!GetAddressAmountByHeight(nCandyHeight, addit->strAddress, nSafe))
                     continue;
                 if (nSafe < 1 * COIN || nSafe > nTotalAmount)
                     continue;
 
                 CAmount nTempAmount = 0;
-                CAmount nCandyAmount = (CAmount)(1.0 * nSafe / nTotalAmount * candyData.nAmount);
-                if (nCandyAmount >= AmountFromValue("0.0001", assetInfo.assetData.nDecimals, true) && !GetGetCandyAmount(assetId, out, *addit, nTempAmount,false))
+                CAmount nCandyAmount = GetCandyShareAmount(nSafe, nTotalAmount, candyData.nAmount);
+                if (nCandyAmount >= AmountFromValue("0.0001", assetInfo.assetData.nDecimals, true) && !GetGetCandyAmount(assetId, out, addit->strAddress, nTempAmount,false))
                 {
                     result = true;
                     break;
@@ -8237,7 +8409,7 @@ static bool WriteChangeInfo(const CChangeInfo& changeInfo)
     if(changeInfo.nHeight <= 0 || changeInfo.nReward <= 0)
         return false;
 
-    std::lock_guard<std::mutex> lock(g_mutexChangeFile);
+    boost::unique_lock<boost::shared_mutex> lock(g_mutexChangeFile);
 
     boost::filesystem::path heightDir = GetDataDir() / "height";
 
@@ -8349,220 +8521,66 @@ void ThreadWriteChangeInfo()
     }
 }
 
-void resetNumA(std::string numAStr)
-{
-    memset(numA, 0, M * sizeof(int));
-
-    for (uint32_t i = 0; i < numAStr.length(); i++)
-        numA[i] = numAStr[numAStr.length() - i - 1] - '0';
-}
-
-void resetNumB(std::string numBStr)
+int GetPendingChangeInfo(std::list<CChangeInfo>& listChangeInfo)
 {
-    memset(numB, 0, M * sizeof(int));
-
-    for (uint32_t i = 0; i < numBStr.length(); i++)
-        numB[i] = numBStr[numBStr.length()-i-1] - '0';
-}
-
-std::string getNumString(int* num)
-{
-    std::string numString = "";
-    bool isBegin = false;
-    for (int i = M - 1; i >= 0 ; i--)
     {
-        if(num[i] != 0)
-            isBegin = true;
-
-        if (isBegin)
-            numString += num[i] + '0';
+        std::lock_guard<std::mutex> lock(g_mutexChangeInfo);
+        listChangeInfo = g_listChangeInfo;
     }
-    return numString;
-}
-
-int comparestring(std::string numAStr, std::string numBStr)
-{
-    if (numAStr.length() > numBStr.length())
-        return 1;
-    else if (numAStr.length() < numBStr.length())
-        return -1;
-    else
-    {
-        for (uint32_t i = 0; i < numAStr.length(); i++)
-        {
-            if (numAStr[i]>numBStr[i])
-                return 1;
-
-            if (numAStr[i]<numBStr[i])
-                return -1;
-        }
-
-        return 0;
-    }
-}
-
-int compareFloatString(const std::string& numAStr,const std::string& numBStr,bool fOnlyCompareInt)
-{
-    int posA = numAStr.find('.');
-    int posB = numBStr.find('.');
-
-    string posAIntStr = numAStr;
-    if(posA>0)
-        posAIntStr = numAStr.substr(0,posA);
-
-    string posBIntStr = numBStr;
-    if(posB>0)
-        posBIntStr = numBStr.substr(0,posB);
-
-    if(fOnlyCompareInt)
-        return comparestring(posAIntStr,posBIntStr);
 
-    string posAFloatStr = "0",posBFloatStr="0";
-    if(posA>0)
-    {
-        bool skipFirstZero = true;
-        for(unsigned int i=posA+1;i<numAStr.size();i++)
-        {
-            if(skipFirstZero&&numAStr[i]=='0')
-                continue;
-            if(skipFirstZero)
-            {
-                skipFirstZero = false;
-                posAFloatStr.clear();
-            }
-            posAFloatStr.push_back(numAStr[i]);
-        }
-    }
-    if(posB>0)
-    {
-        bool skipFirstZero = true;
-        for(unsigned int i=posB+1;i<numBStr.size();i++)
-        {
-            if(skipFirstZero&&numBStr[i]=='0')
-                continue;
-            if(skipFirstZero)
-            {
-                skipFirstZero = false;
-                posBFloatStr.clear();
-            }
-            posBFloatStr.push_back(numBStr[i]);
-        }
-    }
-    int aFloatSize = numAStr.size()-posA-1;
-    int bFloatSize = numBStr.size()-posB-1;
-    int size = std::abs(aFloatSize-bFloatSize);
-    for(int i=0;i<size;i++)
-    {
-        if(aFloatSize<bFloatSize)
-            posAFloatStr.push_back('0');
-        else
-            posBFloatStr.push_back('0');
-    }
-    return comparestring(posAFloatStr,posBFloatStr);
+    boost::system::error_code ec;
+    uint64_t nDetailFileSize = boost::filesystem::file_size(GetDataDir() / "height/detail.dat", ec);
+    if(ec)
+        nDetailFileSize = 0;
+    return nDetailFileSize / sizeof(CBlockDetail) + g_nCriticalHeight - 1;
 }
 
-std::string plusstring(std::string numAStr, std::string numBStr)
+bool WriteChangeInfoToFiles(const std::list<CChangeInfo>& listChangeInfo)
 {
-    resetNumA(numAStr);
-    resetNumB(numBStr);
-
-    for (int i = 0; i < M; i++)
+    for(list<CChangeInfo>::const_iterator it = listChangeInfo.begin(); it != listChangeInfo.end(); it++)
     {
-        numA[i] += numB[i];
-
-        if(numA[i] > 9)
-        {
-            numA[i] -= 10;
-            numA[i+1]++;
-        }
+        if(!WriteChangeInfo(*it))
+            return error("%s: write change info at %d failed", __func__, it->nHeight);
     }
-
-    return getNumString(numA);
+    return true;
 }
 
-std::string minusstring(std::string numAStr, std::string numBStr)
+static bool IsBelowLegacyIntegerPart(const std::string& strCandy, const std::string& strIntPart)
 {
-    bool isNegative = false;
-
-    if (comparestring(numAStr,numBStr)==-1)
-    {
-        isNegative = true;
-        string temp = numAStr;
-        numAStr = numBStr;
-        numBStr = temp;
-    }
-    else if (comparestring(numAStr,numBStr)==0)
-        return "0";
-
-    resetNumA(numAStr);
-    resetNumB(numBStr);
-
-    for (int i = 0; i < M; i++)
-    {
-        if (numA[i]<numB[i])
-        {
-            numA[i] = numA[i]+10-numB[i];
-            numA[i+1]--;
-        }
-        else
-            numA[i] -= numB[i];
-    }
-
-    if (isNegative)
-        return "-"+  getNumString(numA);
-    else
-        return getNumString(numA);
+    // Legacy comparison of integer digit strings: by length first, then lexicographically
+    if (strCandy.size() != strIntPart.size())
+        return strCandy.size() < strIntPart.size();
+    return strCandy.compare(strIntPart) < 0;
 }
 
-std::string mulstring(std::string numAStr, std::string numBStr)
+bool IsCandyAmountInRange(const CAmount& nTotalAmount, const CAmount& nCandyAmount)
 {
-    resetNumA(numAStr);
-    resetNumB(numBStr);
-
-    vector<string> vnums;
-    for (uint32_t i = 0; i < numBStr.length(); i++)
+    // Candy amount must lie in [0.001 * total, 0.1 * total], comparing integer parts only;
+    // a total below 1000 has no minimum and a total below 10 rejects every candy amount.
+    if (nTotalAmount > 0 && nCandyAmount >= 0)
     {
-        int tempnum[M];
-        memset(tempnum, 0, M * sizeof(int));
-
-        for (uint32_t j = i; j < numAStr.length() + i; j++)
-        {
-            tempnum[j] += numA[j - i] * numB[i] % 10;
-            tempnum[j + 1] = numA[j - i] * numB[i] /10;
-            if (tempnum[j] > 9)
-            {
-                tempnum[j] -= 10;
-                tempnum[j + 1]++;
-            }
-        }
-
-        vnums.push_back(getNumString(tempnum));
+        if (nTotalAmount < 10)
+            return false;
+        CAssetAmount total(nTotalAmount), candy(nCandyAmount);
+        if (nTotalAmount >= 1000 && candy < total.Div(1000))
+            return false;
+        return candy <= total.Div(10);
     }
 
-    string strresult = vnums[0];
-    for (uint32_t i = 1; i < vnums.size(); i++)
-        strresult = plusstring(strresult, vnums[i]);
-
-    return strresult;
+    // Malformed amounts keep the exact digit-string semantics this rule was introduced with
+    std::string strTotal = strprintf("%d", nTotalAmount), strCandy = strprintf("%d", nCandyAmount);
+    std::string strMin = strTotal.size() > 3 ? strTotal.substr(0, strTotal.size() - 3) : "";
+    std::string strMax = strTotal.size() > 1 ? strTotal.substr(0, strTotal.size() - 1) : "";
+    if (IsBelowLegacyIntegerPart(strCandy, strMin))
+        return false;
+    return strCandy == strMax || IsBelowLegacyIntegerPart(strCandy, strMax);
 }
 
-std::string numtofloatstring(std::string numstr, int32_t Decimals)
+CAmount GetCandyShareAmount(const CAmount& nSafe, const CAmount& nTotalSafe, const CAmount& nCandyAmount)
 {
-    if (numstr.empty())
-        return "";
-
-    int32_t istrlength = numstr.length();
-    if (istrlength <= Decimals)
-    {
-        return "";
-    }
-
-    std::string strlastfloat = "";
-    std::string strnumber = numstr.substr(0, numstr.length() - Decimals);
-    std::string strfloat = numstr.substr(numstr.length() - Decimals);
-    strlastfloat = strnumber + "." + strfloat;
-
-    return strlastfloat;
+    // Consensus critical: blocks carry candy outputs computed with this double rounding,
+    // so it must not be replaced by an exact quotient without a fork.
+    return (CAmount)(1.0 * nSafe / nTotalSafe * nCandyAmount);
 }
 
 bool VerifyDetailFile()
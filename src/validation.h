@@ -13,10 +13,14 @@
 #endif
 
 #include "amount.h"
+#include "blockcache.h"
+#include "blockwriter.h"
 #include "chain.h"
 #include "coins.h"
 #include "protocol.h" // For CMessageHeader::MessageStartChars
+#include "pubkey.h"
 #include "script/script_error.h"
+#include "script/standard.h"
 #include "sync.h"
 #include "versionbits.h"
 #include "spentindex.h"
@@ -24,6 +28,7 @@
 
 #include <algorithm>
 #include <exception>
+#include <list>
 #include <map>
 #include <set>
 #include <stdint.h>
@@ -37,7 +42,9 @@
 #include <boost/filesystem/path.hpp>
 
 class CBlockIndex;
+class CBlockUndo;
 class CBlockTreeDB;
+class CCoinsViewDB;
 class CBloomFilter;
 class CChainParams;
 class CInv;
@@ -82,7 +89,11 @@ static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 
 /** Maximum number of script-checking threads allowed */
-static const int MAX_SCRIPTCHECK_THREADS = 16;
+static const int MAX_SCRIPTCHECK_THREADS = 64;
+/** Maximum number of worker threads of the header hash and lock vote check queues, whose batches are small */
+static const int MAX_AUX_CHECK_THREADS = 3;
+/** Mempool transactions with at least this many inputs have their scripts checked in parallel */
+static const unsigned int MIN_PARALLEL_SCRIPT_INPUTS = 4;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
 /** Number of blocks that can be requested at any given time from a single peer. */
@@ -143,6 +154,8 @@ struct BlockHasher
 extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
+extern CBlockCache blockcache;
+extern CBlockFileWriter blockwriter;
 typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap mapBlockIndex;
 extern uint64_t nLastBlockTx;
@@ -154,6 +167,9 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fAddressIndex;
+extern bool fTimestampIndex;
+extern bool fSpentIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern unsigned int nBytesPerSigOp;
@@ -221,6 +237,8 @@ static const uint64_t MIN_DISK_SPACE_FOR_BLOCK_FILES = 945 * 1024 * 1024;
  * @return True if state.IsValid()
  */
 bool ProcessNewBlock(const CChainParams& chainparams, const CBlock* pblock, bool fForceProcessing, const CDiskBlockPos* dbp, bool* fNewBlock);
+/** As above, with the hash of pblock already computed by the caller */
+bool ProcessNewBlock(const CChainParams& chainparams, const CBlock* pblock, const uint256& hash, bool fForceProcessing, const CDiskBlockPos* dbp, bool* fNewBlock);
 
 /**
  * Process incoming block headers.
@@ -231,6 +249,10 @@ bool ProcessNewBlock(const CChainParams& chainparams, const CBlock* pblock, bool
  * @param[out] ppindex If set, the pointer will be set to point to the last new block index object for the given headers
  */
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL);
+/** Process incoming block headers whose hashes were already computed by HashBlockHeaders */
+bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& block, const std::vector<uint256>& vHash, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL);
+/** Compute the hashes of a batch of block headers, on the header hashing threads if there are any */
+void HashBlockHeaders(const std::vector<CBlockHeader>& headers, std::vector<uint256>& vHash);
 
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
@@ -250,6 +272,10 @@ bool LoadBlockIndex();
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the app/asset transaction checking thread */
+void ThreadAppCheck();
+/** Run an instance of the header hashing thread */
+void ThreadHeaderHashCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -302,7 +328,7 @@ void PruneAndFlush();
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fOverrideMempoolLimit=false, bool fRejectAbsurdFee=false, bool fDryRun=false);
 
-bool GetUTXOCoins(const COutPoint& outpoint, CCoins& coins);
+bool GetUTXOCoin(const COutPoint& outpoint, Coin& coin);
 int GetUTXOHeight(const COutPoint& outpoint);
 int GetUTXOConfirmations(const COutPoint& outpoint);
 
@@ -352,14 +378,64 @@ struct CAppId_AppInfo_IndexValue
     }
 };
 
+/** Address as stored in the app/asset index keys: the (type, hash160) pair
+ *  used by CAddressIndexKey instead of the base58 string. ALL_USER, the
+ *  grantee of app auths given to every user, has a reserved type of its own. */
+struct CIndexAddress
+{
+    static const uint8_t TYPE_ALL_USER = 0xff;
+
+    uint8_t type;
+    uint160 hashBytes;
+
+    CIndexAddress() : type(0) {
+    }
+
+    CIndexAddress(const uint8_t& type, const uint160& hashBytes) : type(type), hashBytes(hashBytes) {
+    }
+
+    explicit CIndexAddress(const CTxDestination& dest);
+    explicit CIndexAddress(const std::string& strAddress);
+
+    bool IsNull() const { return type == 0; }
+    bool IsAllUser() const { return type == TYPE_ALL_USER; }
+    std::string ToString() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(type);
+        READWRITE(hashBytes);
+    }
+
+    friend bool operator==(const CIndexAddress& a, const CIndexAddress& b)
+    {
+        return (a.type == b.type && a.hashBytes == b.hashBytes);
+    }
+
+    friend bool operator!=(const CIndexAddress& a, const CIndexAddress& b)
+    {
+        return !(a == b);
+    }
+
+    friend bool operator<(const CIndexAddress& a, const CIndexAddress& b)
+    {
+        if(a.type == b.type)
+            return a.hashBytes < b.hashBytes;
+        return a.type < b.type;
+    }
+};
+
 struct CAuth_IndexKey
 {
     uint256 appId;
-    std::string strAddress;
+    CIndexAddress address;
     uint32_t nAuth;
 
-    CAuth_IndexKey(const uint256& appId = uint256(), const std::string& strAddress = "", const uint32_t& nAuth = 0)
-        : appId(appId), strAddress(strAddress), nAuth(nAuth) {
+    CAuth_IndexKey(const uint256& appId = uint256(), const CIndexAddress& address = CIndexAddress(), const uint32_t& nAuth = 0)
+        : appId(appId), address(address), nAuth(nAuth) {
     }
 
     ADD_SERIALIZE_METHODS;
@@ -368,22 +444,22 @@ struct CAuth_IndexKey
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
     {
         READWRITE(appId);
-        READWRITE(LIMITED_STRING(strAddress, MAX_ADDRESS_SIZE));
+        READWRITE(address);
         READWRITE(nAuth);
     }
 
     friend bool operator==(const CAuth_IndexKey&  a, const CAuth_IndexKey& b)
     {
-        return (a.appId == b.appId && a.strAddress == b.strAddress && a.nAuth == b.nAuth);
+        return (a.appId == b.appId && a.address == b.address && a.nAuth == b.nAuth);
     }
 
     friend bool operator<(const CAuth_IndexKey&  a, const CAuth_IndexKey& b)
     {
         if(a.appId == b.appId)
         {
-            if(a.strAddress == b.strAddress)
+            if(a.address == b.address)
                 return a.nAuth < b.nAuth;
-            return a.strAddress < b.strAddress;
+            return a.address < b.address;
         }
         return a.appId < b.appId;
     }
@@ -392,12 +468,12 @@ struct CAuth_IndexKey
 struct CAppTx_IndexKey
 {
     uint256 appId;
-    std::string strAddress;
+    CIndexAddress address;
     uint8_t nTxClass;
     COutPoint out;
 
-    CAppTx_IndexKey(const uint256& appId = uint256(), const std::string& strAddress = "", const uint8_t& nTxClass = 0, const COutPoint& out = COutPoint())
-        : appId(appId), strAddress(strAddress), nTxClass(nTxClass), out(out) {
+    CAppTx_IndexKey(const uint256& appId = uint256(), const CIndexAddress& address = CIndexAddress(), const uint8_t& nTxClass = 0, const COutPoint& out = COutPoint())
+        : appId(appId), address(address), nTxClass(nTxClass), out(out) {
     }
 
     ADD_SERIALIZE_METHODS;
@@ -406,14 +482,14 @@ struct CAppTx_IndexKey
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
     {
         READWRITE(appId);
-        READWRITE(LIMITED_STRING(strAddress, MAX_ADDRESS_SIZE));
+        READWRITE(address);
         READWRITE(nTxClass);
         READWRITE(out);
     }
 
     friend bool operator==(const CAppTx_IndexKey& a, const CAppTx_IndexKey& b)
     {
-        return (a.appId == b.appId && a.strAddress == b.strAddress && a.nTxClass == b.nTxClass && a.out == b.out);
+        return (a.appId == b.appId && a.address == b.address && a.nTxClass == b.nTxClass && a.out == b.out);
     }
 };
 
@@ -436,9 +512,9 @@ struct CIterator_IdKey
 struct CIterator_IdAddressKey
 {
     uint256 id;
-    std::string strAddress;
+    CIndexAddress address;
 
-    CIterator_IdAddressKey(const uint256& id = uint256(), const std::string& strAddress = "") : id(id), strAddress(strAddress) {
+    CIterator_IdAddressKey(const uint256& id = uint256(), const CIndexAddress& address = CIndexAddress()) : id(id), address(address) {
     }
 
     ADD_SERIALIZE_METHODS;
@@ -447,7 +523,7 @@ struct CIterator_IdAddressKey
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
     {
         READWRITE(id);
-        READWRITE(LIMITED_STRING(strAddress, MAX_ADDRESS_SIZE));
+        READWRITE(address);
     }
 };
 
@@ -475,12 +551,12 @@ struct CAssetId_AssetInfo_IndexValue
 struct CAssetTx_IndexKey
 {
     uint256 assetId;
-    std::string strAddress;
+    CIndexAddress address;
     uint8_t nTxClass;
     COutPoint out;
 
-    CAssetTx_IndexKey(const uint256& assetId = uint256(), const std::string& strAddress = "", const uint8_t& nTxClass = 0, const COutPoint& out = COutPoint())
-        : assetId(assetId), strAddress(strAddress), nTxClass(nTxClass), out(out) {
+    CAssetTx_IndexKey(const uint256& assetId = uint256(), const CIndexAddress& address = CIndexAddress(), const uint8_t& nTxClass = 0, const COutPoint& out = COutPoint())
+        : assetId(assetId), address(address), nTxClass(nTxClass), out(out) {
     }
 
     ADD_SERIALIZE_METHODS;
@@ -489,14 +565,14 @@ struct CAssetTx_IndexKey
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
     {
         READWRITE(assetId);
-        READWRITE(LIMITED_STRING(strAddress, MAX_ADDRESS_SIZE));
+        READWRITE(address);
         READWRITE(nTxClass);
         READWRITE(out);
     }
 
     friend bool operator==(const CAssetTx_IndexKey& a, const CAssetTx_IndexKey& b)
     {
-        return (a.assetId == b.assetId && a.strAddress == b.strAddress && a.nTxClass == b.nTxClass && a.out == b.out);
+        return (a.assetId == b.assetId && a.address == b.address && a.nTxClass == b.nTxClass && a.out == b.out);
     }
 };
 
@@ -671,10 +747,10 @@ struct CGetCandy_IndexKey
 {
     uint256 assetId;
     COutPoint out;
-    std::string strAddress;
+    CIndexAddress address;
 
-    CGetCandy_IndexKey(const uint256& assetId = uint256(), const COutPoint& out = COutPoint(), const std::string strAddress = "")
-        : assetId(assetId), out(out), strAddress(strAddress) {
+    CGetCandy_IndexKey(const uint256& assetId = uint256(), const COutPoint& out = COutPoint(), const CIndexAddress& address = CIndexAddress())
+        : assetId(assetId), out(out), address(address) {
     }
 
     ADD_SERIALIZE_METHODS;
@@ -684,12 +760,12 @@ struct CGetCandy_IndexKey
     {
         READWRITE(assetId);
         READWRITE(out);
-        READWRITE(LIMITED_STRING(strAddress, MAX_ADDRESS_SIZE));
+        READWRITE(address);
     }
 
     friend bool operator==(const CGetCandy_IndexKey& a, const CGetCandy_IndexKey& b)
     {
-        return (a.assetId == b.assetId && a.out == b.out && a.strAddress == b.strAddress);
+        return (a.assetId == b.assetId && a.out == b.out && a.address == b.address);
     }
 };
 
@@ -807,6 +883,17 @@ struct CChangeInfo
     {
         return a.nHeight <= b.nHeight;
     }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nHeight);
+        READWRITE(nLastCandyHeight);
+        READWRITE(nReward);
+        READWRITE(fCandy);
+        READWRITE(mapAddressAmount);
+    }
 };
 
 struct CBlockDetail
@@ -1286,8 +1373,8 @@ private:
 
 public:
     CScriptCheck(): ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) :
-        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) :
+        scriptPubKey(outIn.scriptPubKey),
         ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) { }
 
     bool operator()();
@@ -1304,6 +1391,32 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/** Chain lookups of CheckAppTransaction which need cs_main, resolved before the check runs off the main thread */
+struct CAppTxChainInfo
+{
+    int nTxHeight;
+    int nPrevTxHeight; // height of the put candy txin of a get candy tx
+
+    CAppTxChainInfo() : nTxHeight(0), nPrevTxHeight(0) {}
+};
+
+/** Outcome of an app/asset check run ahead of ConnectBlock against the coins before the block */
+struct CAppTxCheckResult
+{
+    bool fChecked;
+    bool fValid;
+    CAppTxChainInfo chainInfo;
+    std::map<CPutCandy_IndexKey, CAmount> mapAssetGetCandy; // candy claimed by this tx alone
+
+    CAppTxCheckResult() : fChecked(false), fValid(false) {}
+};
+
+bool CheckAppTransaction(const CTransaction& tx, CValidationState &state, const CCoinsViewCache& view, std::map<CPutCandy_IndexKey, CAmount>& mapAssetGetCandy, const bool fWithMempool, const CAppTxChainInfo* pChainInfo = NULL);
+/** Check in parallel the app/asset txs of a block which depend on nothing created or spent earlier in the block */
+void CheckBlockAppTransactions(const CBlock& block, const CCoinsViewCache& view, std::vector<CAppTxCheckResult>& vResult);
+/** Check an app/asset tx of a block in block order, reusing its parallel result when no earlier tx touched the same candy */
+bool CheckBlockAppTransaction(const CTransaction& tx, CValidationState &state, const CCoinsViewCache& view, std::map<CPutCandy_IndexKey, CAmount>& mapAssetGetCandy, const CAppTxCheckResult& result);
+
 bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &hashes);
 bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
 bool GetAddressIndex(uint160 addressHash, int type,
@@ -1316,6 +1429,11 @@ bool GetAddressUnspent(uint160 addressHash, int type,
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read a block through blockcache; cached blocks are shared instead of copied and their header isn't rechecked */
+bool ReadBlockFromDisk(boost::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Coins spent by the inputs of a connected block, as ConnectBlock passes them to BlockConnected.
+ *  Reads the undo data, and takes the put-candy coins, which aren't in it, from the UTXO set. */
+bool ReadBlockSpentCoins(const CBlock& block, const CBlockIndex* pindex, CBlockUndo& blockSpent);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -1335,6 +1453,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
 bool CheckBlock(const CBlock& block, const int& nHeight, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+/** As above, with the block hash already computed by the caller */
+bool CheckBlock(const CBlock& block, const uint256& hash, const int& nHeight, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 
 /** Context-dependent validity checks */
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex *pindexPrev);
@@ -1424,6 +1544,9 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Global variable that points to the coin database below pcoinsTip (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
@@ -1488,21 +1611,20 @@ void ThreadCalculateAddressAmount();
 bool VerifyDetailFile();
 bool LoadChangeInfoToList();
 bool LoadCandyHeightToList();
+/** Copy the change info not yet written to the height files and return the last height in detail.dat; hold g_mutexChangeFile */
+int GetPendingChangeInfo(std::list<CChangeInfo>& listChangeInfo);
+/** Write change info to the height files directly, in height order */
+bool WriteChangeInfoToFiles(const std::list<CChangeInfo>& listChangeInfo);
 
 bool GetCOutPointAddress(const uint256& assetId, std::map<COutPoint, std::vector<std::string>> &moutpointaddress);
 bool GetCOutPointList(const uint256& assetId, const std::string& strAddress, std::vector<COutPoint> &vcoutpoint);
 
 bool GetAssetIdCandyInfoList(std::map<CPutCandy_IndexKey, CPutCandy_IndexValue>& mapCandy);
 
-std::string getNumString(int* num);
-void resetNumA(std::string numAStr);
-void resetNumB(std::string numBStr);
-int compareFloatString(const std::string& numAStr,const std::string& numBStr,bool fOnlyCompareInt=true);
-int comparestring(std::string numAStr,std::string numBStr);
-std::string plusstring(std::string numAStr, std::string numBStr);
-std::string minusstring(std::string numAStr, std::string numBStr);
-std::string mulstring(std::string numAStr, std::string numBStr);
-std::string numtofloatstring(std::string numstr, int32_t Decimals);
+/** Check a candy amount against the [0.001 * total, 0.1 * total] consensus range */
+bool IsCandyAmountInRange(const CAmount& nTotalAmount, const CAmount& nCandyAmount);
+/** Candy amount an address holding nSafe of nTotalSafe can get from a candy of nCandyAmount */
+CAmount GetCandyShareAmount(const CAmount& nSafe, const CAmount& nTotalSafe, const CAmount& nCandyAmount);
 
 bool ExistForbidTxin(const int nHeight, const std::vector<int>& prevheights);
 
@@ -12,6 +12,7 @@
 class CBlock;
 struct CBlockLocator;
 class CBlockIndex;
+class CBlockUndo;
 class CConnman;
 class CReserveScript;
 class CTransaction;
@@ -40,6 +41,8 @@ protected:
     virtual void Inventory(const uint256 &hash) {}
     virtual void ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman) {}
     virtual void BlockChecked(const CBlock&, const CValidationState&) {}
+    virtual void BlockConnected(const CBlock &block, const CBlockIndex *pindex, const boost::shared_ptr<const CBlockUndo> &pblockSpent) {}
+    virtual void BlockDisconnected(const CBlock &block, const CBlockIndex *pindex, const boost::shared_ptr<const CBlockUndo> &pblockSpent) {}
     virtual void GetScriptForMining(boost::shared_ptr<CReserveScript>&) {};
     virtual void ResetRequestCount(const uint256 &hash) {};
     friend void ::RegisterValidationInterface(CValidationInterface*);
@@ -68,6 +71,18 @@ struct CMainSignals {
     boost::signals2::signal<void (int64_t nBestBlockTime, CConnman* connman)> Broadcast;
     /** Notifies listeners of a block validation result */
     boost::signals2::signal<void (const CBlock&, const CValidationState&)> BlockChecked;
+    /**
+     * Notifies listeners of a block connected to the chain state, with the coin spent
+     * by every input of every non-coinbase transaction, put-candy inputs included
+     * (unlike the undo data). The coins are only filled in when the address or spent
+     * index is on, and are shared so that listeners can keep them past the call.
+     */
+    boost::signals2::signal<void (const CBlock &, const CBlockIndex *, const boost::shared_ptr<const CBlockUndo> &)> BlockConnected;
+    /**
+     * Notifies listeners of a block disconnected from the chain state, with the coins
+     * restored for its inputs, or null coins for the put-candy inputs that weren't spent
+     */
+    boost::signals2::signal<void (const CBlock &, const CBlockIndex *, const boost::shared_ptr<const CBlockUndo> &)> BlockDisconnected;
     /** Notifies listeners that a key for mining is required (coinbase) */
     boost::signals2::signal<void (boost::shared_ptr<CReserveScript>&)> ScriptForMining;
     /** Notifies listeners that a block has been successfully mined */
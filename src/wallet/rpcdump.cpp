@@ -100,55 +100,61 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
         );
 
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CBlockIndex* pindexRescan = NULL;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
 
-    EnsureWalletIsUnlocked();
+        EnsureWalletIsUnlocked();
 
-    string strSecret = params[0].get_str();
-    string strLabel = "";
-    if (params.size() > 1)
-        strLabel = params[1].get_str();
+        string strSecret = params[0].get_str();
+        string strLabel = "";
+        if (params.size() > 1)
+            strLabel = params[1].get_str();
 
-    // Whether to perform rescan after import
-    bool fRescan = true;
-    if (params.size() > 2)
-        fRescan = params[2].get_bool();
+        // Whether to perform rescan after import
+        bool fRescan = true;
+        if (params.size() > 2)
+            fRescan = params[2].get_bool();
 
-    if (fRescan && fPruneMode)
-        throw JSONRPCError(RPC_WALLET_ERROR, "Rescan is disabled in pruned mode");
+        if (fRescan && fPruneMode)
+            throw JSONRPCError(RPC_WALLET_ERROR, "Rescan is disabled in pruned mode");
 
-    CBitcoinSecret vchSecret;
-    bool fGood = vchSecret.SetString(strSecret);
+        CBitcoinSecret vchSecret;
+        bool fGood = vchSecret.SetString(strSecret);
 
-    if (!fGood) throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid private key encoding");
+        if (!fGood) throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid private key encoding");
 
-    CKey key = vchSecret.GetKey();
-    if (!key.IsValid()) throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Private key outside allowed range");
+        CKey key = vchSecret.GetKey();
+        if (!key.IsValid()) throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Private key outside allowed range");
 
-    CPubKey pubkey = key.GetPubKey();
-    assert(key.VerifyPubKey(pubkey));
-    CKeyID vchAddress = pubkey.GetID();
-    {
-        pwalletMain->MarkDirty();
-        pwalletMain->SetAddressBook(vchAddress, strLabel, "receive");
+        CPubKey pubkey = key.GetPubKey();
+        assert(key.VerifyPubKey(pubkey));
+        CKeyID vchAddress = pubkey.GetID();
+        {
+            pwalletMain->MarkDirty();
+            pwalletMain->SetAddressBook(vchAddress, strLabel, "receive");
 
-        // Don't throw error in case a key is already there
-        if (pwalletMain->HaveKey(vchAddress))
-            return NullUniValue;
+            // Don't throw error in case a key is already there
+            if (pwalletMain->HaveKey(vchAddress))
+                return NullUniValue;
 
-        pwalletMain->mapKeyMetadata[vchAddress].nCreateTime = 1;
+            pwalletMain->mapKeyMetadata[vchAddress].nCreateTime = 1;
 
-        if (!pwalletMain->AddKeyPubKey(key, pubkey))
-            throw JSONRPCError(RPC_WALLET_ERROR, "Error adding key to wallet");
+            if (!pwalletMain->AddKeyPubKey(key, pubkey))
+                throw JSONRPCError(RPC_WALLET_ERROR, "Error adding key to wallet");
 
-        // whenever a key is imported, we need to scan the whole chain
-        pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
+            // whenever a key is imported, we need to scan the whole chain
+            pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
 
-        if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
+            if (fRescan)
+                pindexRescan = chainActive.Genesis();
         }
     }
 
+    // Rescan without holding the locks, so the wallet stays usable meanwhile
+    if (pindexRescan)
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
+
     return NullUniValue;
 }
 
@@ -222,23 +228,29 @@ UniValue importaddress(const UniValue& params, bool fHelp)
     if (params.size() > 3)
         fP2SH = params[3].get_bool();
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CBlockIndex* pindexRescan = NULL;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        CBitcoinAddress address(params[0].get_str());
+        if (address.IsValid()) {
+            if (fP2SH)
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Cannot use the p2sh flag with an address - use a script instead");
+            ImportAddress(address, strLabel);
+        } else if (IsHex(params[0].get_str())) {
+            std::vector<unsigned char> data(ParseHex(params[0].get_str()));
+            ImportScript(CScript(data.begin(), data.end()), strLabel, fP2SH);
+        } else {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Safe address or script");
+        }
 
-    CBitcoinAddress address(params[0].get_str());
-    if (address.IsValid()) {
-        if (fP2SH)
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Cannot use the p2sh flag with an address - use a script instead");
-        ImportAddress(address, strLabel);
-    } else if (IsHex(params[0].get_str())) {
-        std::vector<unsigned char> data(ParseHex(params[0].get_str()));
-        ImportScript(CScript(data.begin(), data.end()), strLabel, fP2SH);
-    } else {
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Safe address or script");
+        if (fRescan)
+            pindexRescan = chainActive.Genesis();
     }
 
-    if (fRescan)
+    if (pindexRescan)
     {
-        pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
         pwalletMain->ReacceptWalletTransactions();
     }
 
@@ -288,14 +300,20 @@ UniValue importpubkey(const UniValue& params, bool fHelp)
     if (!pubKey.IsFullyValid())
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Pubkey is not a valid public key");
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CBlockIndex* pindexRescan = NULL;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        ImportAddress(CBitcoinAddress(pubKey.GetID()), strLabel);
+        ImportScript(GetScriptForRawPubKey(pubKey), strLabel, false);
 
-    ImportAddress(CBitcoinAddress(pubKey.GetID()), strLabel);
-    ImportScript(GetScriptForRawPubKey(pubKey), strLabel, false);
+        if (fRescan)
+            pindexRescan = chainActive.Genesis();
+    }
 
-    if (fRescan)
+    if (pindexRescan)
     {
-        pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
         pwalletMain->ReacceptWalletTransactions();
     }
 
@@ -326,81 +344,87 @@ UniValue importwallet(const UniValue& params, bool fHelp)
     if (fPruneMode)
         throw JSONRPCError(RPC_WALLET_ERROR, "Importing wallets is disabled in pruned mode");
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CBlockIndex *pindex = NULL;
+    bool fGood = true;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
 
-    EnsureWalletIsUnlocked();
+        EnsureWalletIsUnlocked();
 
-    ifstream file;
-    file.open(params[0].get_str().c_str(), std::ios::in | std::ios::ate);
-    if (!file.is_open())
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open wallet dump file");
+        ifstream file;
+        file.open(params[0].get_str().c_str(), std::ios::in | std::ios::ate);
+        if (!file.is_open())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open wallet dump file");
 
-    int64_t nTimeBegin = chainActive.Tip()->GetBlockTime();
+        int64_t nTimeBegin = chainActive.Tip()->GetBlockTime();
 
-    bool fGood = true;
+        int64_t nFilesize = std::max((int64_t)1, (int64_t)file.tellg());
+        file.seekg(0, file.beg);
 
-    int64_t nFilesize = std::max((int64_t)1, (int64_t)file.tellg());
-    file.seekg(0, file.beg);
-
-    pwalletMain->ShowProgress(_("Importing..."), 0); // show progress dialog in GUI
-    while (file.good()) {
-        pwalletMain->ShowProgress("", std::max(1, std::min(99, (int)(((double)file.tellg() / (double)nFilesize) * 100))));
-        std::string line;
-        std::getline(file, line);
-        if (line.empty() || line[0] == '#')
-            continue;
-
-        std::vector<std::string> vstr;
-        boost::split(vstr, line, boost::is_any_of(" "));
-        if (vstr.size() < 2)
-            continue;
-        CBitcoinSecret vchSecret;
-        if (!vchSecret.SetString(vstr[0]))
-            continue;
-        CKey key = vchSecret.GetKey();
-        CPubKey pubkey = key.GetPubKey();
-        assert(key.VerifyPubKey(pubkey));
-        CKeyID keyid = pubkey.GetID();
-        if (pwalletMain->HaveKey(keyid)) {
-            LogPrintf("Skipping import of %s (key already present)\n", CBitcoinAddress(keyid).ToString());
-            continue;
-        }
-        int64_t nTime = DecodeDumpTime(vstr[1]);
-        std::string strLabel;
-        bool fLabel = true;
-        for (unsigned int nStr = 2; nStr < vstr.size(); nStr++) {
-            if (boost::algorithm::starts_with(vstr[nStr], "#"))
-                break;
-            if (vstr[nStr] == "change=1")
-                fLabel = false;
-            if (vstr[nStr] == "reserve=1")
-                fLabel = false;
-            if (boost::algorithm::starts_with(vstr[nStr], "label=")) {
-                strLabel = DecodeDumpString(vstr[nStr].substr(6));
-                fLabel = true;
+        // keys and labels are written in batches of transactions instead of
+        // one database open and flush per record
+        CWalletDBBatch batch(pwalletMain);
+        pwalletMain->ShowProgress(_("Importing..."), 0); // show progress dialog in GUI
+        while (file.good()) {
+            pwalletMain->ShowProgress("", std::max(1, std::min(99, (int)(((double)file.tellg() / (double)nFilesize) * 100))));
+            std::string line;
+            std::getline(file, line);
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            std::vector<std::string> vstr;
+            boost::split(vstr, line, boost::is_any_of(" "));
+            if (vstr.size() < 2)
+                continue;
+            CBitcoinSecret vchSecret;
+            if (!vchSecret.SetString(vstr[0]))
+                continue;
+            CKey key = vchSecret.GetKey();
+            CPubKey pubkey = key.GetPubKey();
+            assert(key.VerifyPubKey(pubkey));
+            CKeyID keyid = pubkey.GetID();
+            if (pwalletMain->HaveKey(keyid)) {
+                LogPrintf("Skipping import of %s (key already present)\n", CBitcoinAddress(keyid).ToString());
+                continue;
             }
+            int64_t nTime = DecodeDumpTime(vstr[1]);
+            std::string strLabel;
+            bool fLabel = true;
+            for (unsigned int nStr = 2; nStr < vstr.size(); nStr++) {
+                if (boost::algorithm::starts_with(vstr[nStr], "#"))
+                    break;
+                if (vstr[nStr] == "change=1")
+                    fLabel = false;
+                if (vstr[nStr] == "reserve=1")
+                    fLabel = false;
+                if (boost::algorithm::starts_with(vstr[nStr], "label=")) {
+                    strLabel = DecodeDumpString(vstr[nStr].substr(6));
+                    fLabel = true;
+                }
+            }
+            LogPrintf("Importing %s...\n", CBitcoinAddress(keyid).ToString());
+            if (!pwalletMain->AddKeyPubKey(key, pubkey)) {
+                fGood = false;
+                continue;
+            }
+            pwalletMain->mapKeyMetadata[keyid].nCreateTime = nTime;
+            if (fLabel)
+                pwalletMain->SetAddressBook(keyid, strLabel, "receive");
+            nTimeBegin = std::min(nTimeBegin, nTime);
         }
-        LogPrintf("Importing %s...\n", CBitcoinAddress(keyid).ToString());
-        if (!pwalletMain->AddKeyPubKey(key, pubkey)) {
-            fGood = false;
-            continue;
-        }
-        pwalletMain->mapKeyMetadata[keyid].nCreateTime = nTime;
-        if (fLabel)
-            pwalletMain->SetAddressBook(keyid, strLabel, "receive");
-        nTimeBegin = std::min(nTimeBegin, nTime);
-    }
-    file.close();
-    pwalletMain->ShowProgress("", 100); // hide progress dialog in GUI
+        file.close();
+        pwalletMain->ShowProgress("", 100); // hide progress dialog in GUI
 
-    CBlockIndex *pindex = chainActive.Tip();
-    while (pindex && pindex->pprev && pindex->GetBlockTime() > nTimeBegin - 7200)
-        pindex = pindex->pprev;
+        pindex = chainActive.Tip();
+        while (pindex && pindex->pprev && pindex->GetBlockTime() > nTimeBegin - 7200)
+            pindex = pindex->pprev;
 
-    if (!pwalletMain->nTimeFirstKey || nTimeBegin < pwalletMain->nTimeFirstKey)
-        pwalletMain->nTimeFirstKey = nTimeBegin;
+        if (!pwalletMain->nTimeFirstKey || nTimeBegin < pwalletMain->nTimeFirstKey)
+            pwalletMain->nTimeFirstKey = nTimeBegin;
+
+        LogPrintf("Rescanning last %i blocks\n", chainActive.Height() - pindex->nHeight + 1);
+    }
 
-    LogPrintf("Rescanning last %i blocks\n", chainActive.Height() - pindex->nHeight + 1);
     pwalletMain->ScanForWalletTransactions(pindex);
     pwalletMain->MarkDirty();
 
@@ -434,109 +458,116 @@ UniValue importelectrumwallet(const UniValue& params, bool fHelp)
     if (fPruneMode)
         throw JSONRPCError(RPC_WALLET_ERROR, "Importing wallets is disabled in pruned mode");
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
-    EnsureWalletIsUnlocked();
-
-    ifstream file;
-    std::string strFileName = params[0].get_str();
-    size_t nDotPos = strFileName.find_last_of(".");
-    if(nDotPos == string::npos)
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "File has no extension, should be .json or .csv");
-
-    std::string strFileExt = strFileName.substr(nDotPos+1);
-    if(strFileExt != "json" && strFileExt != "csv")
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "File has wrong extension, should be .json or .csv");
-
-    file.open(strFileName.c_str(), std::ios::in | std::ios::ate);
-    if (!file.is_open())
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open Electrum wallet export file");
-
+    CBlockIndex *pindex = NULL;
     bool fGood = true;
-
-    int64_t nFilesize = std::max((int64_t)1, (int64_t)file.tellg());
-    file.seekg(0, file.beg);
-
-    pwalletMain->ShowProgress(_("Importing..."), 0); // show progress dialog in GUI
-
-    if(strFileExt == "csv") {
-        while (file.good()) {
-            pwalletMain->ShowProgress("", std::max(1, std::min(99, (int)(((double)file.tellg() / (double)nFilesize) * 100))));
-            std::string line;
-            std::getline(file, line);
-            if (line.empty() || line == "address,private_key")
-                continue;
-            std::vector<std::string> vstr;
-            boost::split(vstr, line, boost::is_any_of(","));
-            if (vstr.size() < 2)
-                continue;
-            CBitcoinSecret vchSecret;
-            if (!vchSecret.SetString(vstr[1]))
-                continue;
-            CKey key = vchSecret.GetKey();
-            CPubKey pubkey = key.GetPubKey();
-            assert(key.VerifyPubKey(pubkey));
-            CKeyID keyid = pubkey.GetID();
-            if (pwalletMain->HaveKey(keyid)) {
-                LogPrintf("Skipping import of %s (key already present)\n", CBitcoinAddress(keyid).ToString());
-                continue;
-            }
-            LogPrintf("Importing %s...\n", CBitcoinAddress(keyid).ToString());
-            if (!pwalletMain->AddKeyPubKey(key, pubkey)) {
-                fGood = false;
-                continue;
-            }
-        }
-    } else {
-        // json
-        char* buffer = new char [nFilesize];
-        file.read(buffer, nFilesize);
-        UniValue data(UniValue::VOBJ);
-        if(!data.read(buffer))
-            throw JSONRPCError(RPC_TYPE_ERROR, "Cannot parse Electrum wallet export file");
-        delete[] buffer;
-
-        std::vector<std::string> vKeys = data.getKeys();
-
-        for (size_t i = 0; i < data.size(); i++) {
-            pwalletMain->ShowProgress("", std::max(1, std::min(99, int(i*100/data.size()))));
-            if(!data[vKeys[i]].isStr())
-                continue;
-            CBitcoinSecret vchSecret;
-            if (!vchSecret.SetString(data[vKeys[i]].get_str()))
-                continue;
-            CKey key = vchSecret.GetKey();
-            CPubKey pubkey = key.GetPubKey();
-            assert(key.VerifyPubKey(pubkey));
-            CKeyID keyid = pubkey.GetID();
-            if (pwalletMain->HaveKey(keyid)) {
-                LogPrintf("Skipping import of %s (key already present)\n", CBitcoinAddress(keyid).ToString());
-                continue;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        EnsureWalletIsUnlocked();
+
+        ifstream file;
+        std::string strFileName = params[0].get_str();
+        size_t nDotPos = strFileName.find_last_of(".");
+        if(nDotPos == string::npos)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "File has no extension, should be .json or .csv");
+
+        std::string strFileExt = strFileName.substr(nDotPos+1);
+        if(strFileExt != "json" && strFileExt != "csv")
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "File has wrong extension, should be .json or .csv");
+
+        file.open(strFileName.c_str(), std::ios::in | std::ios::ate);
+        if (!file.is_open())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open Electrum wallet export file");
+
+        int64_t nFilesize = std::max((int64_t)1, (int64_t)file.tellg());
+        file.seekg(0, file.beg);
+
+        // keys and labels are written in batches of transactions instead of
+        // one database open and flush per record
+        CWalletDBBatch batch(pwalletMain);
+        pwalletMain->ShowProgress(_("Importing..."), 0); // show progress dialog in GUI
+
+        if(strFileExt == "csv") {
+            while (file.good()) {
+                pwalletMain->ShowProgress("", std::max(1, std::min(99, (int)(((double)file.tellg() / (double)nFilesize) * 100))));
+                std::string line;
+                std::getline(file, line);
+                if (line.empty() || line == "address,private_key")
+                    continue;
+                std::vector<std::string> vstr;
+                boost::split(vstr, line, boost::is_any_of(","));
+                if (vstr.size() < 2)
+                    continue;
+                CBitcoinSecret vchSecret;
+                if (!vchSecret.SetString(vstr[1]))
+                    continue;
+                CKey key = vchSecret.GetKey();
+                CPubKey pubkey = key.GetPubKey();
+                assert(key.VerifyPubKey(pubkey));
+                CKeyID keyid = pubkey.GetID();
+                if (pwalletMain->HaveKey(keyid)) {
+                    LogPrintf("Skipping import of %s (key already present)\n", CBitcoinAddress(keyid).ToString());
+                    continue;
+                }
+                LogPrintf("Importing %s...\n", CBitcoinAddress(keyid).ToString());
+                if (!pwalletMain->AddKeyPubKey(key, pubkey)) {
+                    fGood = false;
+                    continue;
+                }
             }
-            LogPrintf("Importing %s...\n", CBitcoinAddress(keyid).ToString());
-            if (!pwalletMain->AddKeyPubKey(key, pubkey)) {
-                fGood = false;
-                continue;
+        } else {
+            // json
+            char* buffer = new char [nFilesize];
+            file.read(buffer, nFilesize);
+            UniValue data(UniValue::VOBJ);
+            if(!data.read(buffer))
+                throw JSONRPCError(RPC_TYPE_ERROR, "Cannot parse Electrum wallet export file");
+            delete[] buffer;
+
+            std::vector<std::string> vKeys = data.getKeys();
+
+            for (size_t i = 0; i < data.size(); i++) {
+                pwalletMain->ShowProgress("", std::max(1, std::min(99, int(i*100/data.size()))));
+                if(!data[vKeys[i]].isStr())
+                    continue;
+                CBitcoinSecret vchSecret;
+                if (!vchSecret.SetString(data[vKeys[i]].get_str()))
+                    continue;
+                CKey key = vchSecret.GetKey();
+                CPubKey pubkey = key.GetPubKey();
+                assert(key.VerifyPubKey(pubkey));
+                CKeyID keyid = pubkey.GetID();
+                if (pwalletMain->HaveKey(keyid)) {
+                    LogPrintf("Skipping import of %s (key already present)\n", CBitcoinAddress(keyid).ToString());
+                    continue;
+                }
+                LogPrintf("Importing %s...\n", CBitcoinAddress(keyid).ToString());
+                if (!pwalletMain->AddKeyPubKey(key, pubkey)) {
+                    fGood = false;
+                    continue;
+                }
             }
         }
+        file.close();
+        pwalletMain->ShowProgress("", 100); // hide progress dialog in GUI
+
+        // Whether to perform rescan after import
+        int nStartHeight = 0;
+        if (params.size() > 1)
+            nStartHeight = params[1].get_int();
+        if (chainActive.Height() < nStartHeight)
+            nStartHeight = chainActive.Height();
+
+        // Assume that electrum wallet was created at that block
+        int nTimeBegin = chainActive[nStartHeight]->GetBlockTime();
+        if (!pwalletMain->nTimeFirstKey || nTimeBegin < pwalletMain->nTimeFirstKey)
+            pwalletMain->nTimeFirstKey = nTimeBegin;
+
+        LogPrintf("Rescanning %i blocks\n", chainActive.Height() - nStartHeight + 1);
+        pindex = chainActive[nStartHeight];
     }
-    file.close();
-    pwalletMain->ShowProgress("", 100); // hide progress dialog in GUI
-
-    // Whether to perform rescan after import
-    int nStartHeight = 0;
-    if (params.size() > 1)
-        nStartHeight = params[1].get_int();
-    if (chainActive.Height() < nStartHeight)
-        nStartHeight = chainActive.Height();
-
-    // Assume that electrum wallet was created at that block
-    int nTimeBegin = chainActive[nStartHeight]->GetBlockTime();
-    if (!pwalletMain->nTimeFirstKey || nTimeBegin < pwalletMain->nTimeFirstKey)
-        pwalletMain->nTimeFirstKey = nTimeBegin;
 
-    LogPrintf("Rescanning %i blocks\n", chainActive.Height() - nStartHeight + 1);
-    pwalletMain->ScanForWalletTransactions(chainActive[nStartHeight], true);
+    pwalletMain->ScanForWalletTransactions(pindex, true);
 
     if (!fGood)
         throw JSONRPCError(RPC_WALLET_ERROR, "Error adding some keys to wallet");
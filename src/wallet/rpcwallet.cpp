@@ -1747,6 +1747,78 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue listaddresstransactions(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() < 1 || params.size() > 6)
+        throw runtime_error(
+            "listaddresstransactions \"address\" ( count from starttime endtime \"beforetxid\" )\n"
+            "\nReturns up to 'count' most recent wallet transactions paying 'address', skipping the first 'from' of them.\n"
+            "\nArguments:\n"
+            "1. \"address\"        (string, required) The safe address\n"
+            "2. count            (numeric, optional, default=10) The number of transactions to return\n"
+            "3. from             (numeric, optional, default=0) The number of transactions to skip\n"
+            "4. starttime        (numeric, optional, default=0) Only transactions at or after this time (seconds since epoch)\n"
+            "5. endtime          (numeric, optional) Only transactions at or before this time (seconds since epoch)\n"
+            "6. \"beforetxid\"     (string, optional) Only transactions older than this wallet transaction. Pass the first txid\n"
+            "                     of a page to get the page before it, which is faster than a large 'from'\n"
+            "\nResult:\n"
+            "[                     (array) The entries of listtransactions for the address, oldest first\n"
+            "  ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("listaddresstransactions", "\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\" 20 100")
+            + HelpExampleRpc("listaddresstransactions", "\"XwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\", 20, 100")
+        );
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    CBitcoinAddress address(params[0].get_str());
+    if (!address.IsValid())
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Safe address");
+    int nCount = 10;
+    if (params.size() > 1)
+        nCount = params[1].get_int();
+    int nFrom = 0;
+    if (params.size() > 2)
+        nFrom = params[2].get_int();
+    int64_t nStartTime = 0;
+    if (params.size() > 3)
+        nStartTime = params[3].get_int64();
+    int64_t nEndTime = std::numeric_limits<int64_t>::max();
+    if (params.size() > 4)
+        nEndTime = params[4].get_int64();
+    uint256 hashBefore;
+    if (params.size() > 5)
+        hashBefore = ParseHashV(params[5], "beforetxid");
+
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+    if (nFrom < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative from");
+
+    vector<const CWalletTx*> vwtx;
+    if (!pwalletMain->ListAddressTransactions(address.Get(), std::numeric_limits<uint32_t>::max(), nStartTime, nEndTime, hashBefore, nFrom, nCount, vwtx))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid or non-wallet transaction id");
+
+    string strAddress = address.ToString();
+    UniValue ret(UniValue::VARR);
+    BOOST_FOREACH(const CWalletTx* pwtx, vwtx)
+    {
+        UniValue entries(UniValue::VARR);
+        ListTransactions(*pwtx, "*", 0, true, entries, ISMINE_ALL);
+        for (unsigned int i = 0; i < entries.size(); i++)
+        {
+            if (find_value(entries[i], "address").getValStr() == strAddress)
+                ret.push_back(entries[i]);
+        }
+    }
+
+    return ret;
+}
+
 UniValue listaccounts(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
@@ -2478,6 +2550,123 @@ UniValue settxfee(const UniValue& params, bool fHelp)
     return true;
 }
 
+UniValue consolidatewallet(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() > 4)
+        throw runtime_error(
+            "consolidatewallet ( dryrun threshold minoutputs maxtxs )\n"
+            "\nMerge the small outputs of each address, of SAFE and of each asset, into one output to the same address.\n"
+            "This is what the -consolidate background thread does each round, except that it runs regardless of fees.\n"
+            "\nArguments:\n"
+            "1. dryrun         (boolean, optional, default=true) Only report the transactions that would be made\n"
+            "2. threshold      (numeric, optional, default=" + FormatMoney(DEFAULT_CONSOLIDATE_THRESHOLD) + ") SAFE outputs below this amount, and asset outputs below as many units of the asset, count as small\n"
+            "3. minoutputs     (numeric, optional, default=" + strprintf("%u", DEFAULT_CONSOLIDATE_MIN_OUTPUTS) + ") Only merge addresses with at least this many small outputs\n"
+            "4. maxtxs         (numeric, optional, default=" + strprintf("%u", DEFAULT_CONSOLIDATE_MAX_TXS) + ") Make at most this many transactions\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"feerate\": x.xxxx,        (numeric) The estimated fee rate in " + CURRENCY_UNIT + "/kB, 0 if there is no estimate\n"
+            "  \"lowfee\": true|false,     (boolean) Whether the background thread would consolidate at this fee rate\n"
+            "  \"transactions\": [\n"
+            "    {\n"
+            "      \"address\": \"address\",  (string) The address whose outputs are merged\n"
+            "      \"assetId\": \"assetid\",  (string) The asset id, only for asset outputs\n"
+            "      \"outputs\": n,          (numeric) Small outputs of the address\n"
+            "      \"inputs\": n,           (numeric) Outputs merged by this transaction\n"
+            "      \"amount\": x.xxxx,      (numeric) The merged amount\n"
+            "      \"fee\": x.xxxx,         (numeric) The fee in " + CURRENCY_UNIT + "\n"
+            "      \"txid\": \"id\",          (string) The transaction id, not in a dry run\n"
+            "      \"error\": \"message\"     (string) Why the transaction could not be made, if it could not\n"
+            "    }\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"inputs\": n,              (numeric) Outputs merged in total\n"
+            "  \"fee\": x.xxxx             (numeric) Fees in total\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("consolidatewallet", "")
+            + HelpExampleCli("consolidatewallet", "false 0.1 20 5")
+            + HelpExampleRpc("consolidatewallet", "false, 0.1, 20, 5")
+        );
+
+    bool fDryRun = true;
+    if (params.size() > 0)
+        fDryRun = params[0].get_bool();
+
+    CAmount nThreshold = DEFAULT_CONSOLIDATE_THRESHOLD;
+    if (params.size() > 1)
+        nThreshold = AmountFromValue(params[1]);
+    if (nThreshold <= 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid threshold");
+
+    int nMinOutputs = DEFAULT_CONSOLIDATE_MIN_OUTPUTS;
+    if (params.size() > 2)
+        nMinOutputs = params[2].get_int();
+    if (nMinOutputs < 2)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid minoutputs, must be at least 2");
+
+    int nMaxTxs = DEFAULT_CONSOLIDATE_MAX_TXS;
+    if (params.size() > 3)
+        nMaxTxs = params[3].get_int();
+    if (nMaxTxs < 1)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid maxtxs, must be at least 1");
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    if (!fDryRun)
+        EnsureWalletIsUnlocked();
+
+    CAmount nFeeRate = mempool.estimateSmartFee(nTxConfirmTarget).GetFeePerK();
+    CAmount nMaxFeeRate = DEFAULT_CONSOLIDATE_MAX_FEERATE;
+    if (mapArgs.count("-consolidatemaxfeerate"))
+        ParseMoney(mapArgs["-consolidatemaxfeerate"], nMaxFeeRate);
+
+    vector<CConsolidationResult> vResults;
+    pwalletMain->ConsolidateCoins(nThreshold, nMinOutputs, nMaxTxs, fDryRun, vResults, g_connman.get());
+
+    UniValue transactions(UniValue::VARR);
+    unsigned int nInputs = 0;
+    CAmount nFee = 0;
+    BOOST_FOREACH(const CConsolidationResult& result, vResults)
+    {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("address", CBitcoinAddress(result.dest).ToString()));
+        if (!result.assetId.IsNull())
+            entry.push_back(Pair("assetId", result.assetId.GetHex()));
+        entry.push_back(Pair("outputs", (int)result.nOutputs));
+        entry.push_back(Pair("inputs", (int)result.nInputs));
+        if (result.assetId.IsNull())
+            entry.push_back(Pair("amount", ValueFromAmount(result.nValue)));
+        else
+        {
+            CAssetId_AssetInfo_IndexValue assetInfo;
+            if (GetAssetInfoByAssetId(result.assetId, assetInfo, false))
+                entry.push_back(Pair("amount", ValueFromAmount(result.nValue, assetInfo.assetData.nDecimals)));
+        }
+        if (result.strError.empty())
+        {
+            entry.push_back(Pair("fee", ValueFromAmount(result.nFee)));
+            if (!result.txid.IsNull())
+                entry.push_back(Pair("txid", result.txid.GetHex()));
+            nInputs += result.nInputs;
+            nFee += result.nFee;
+        }
+        else
+            entry.push_back(Pair("error", result.strError));
+        transactions.push_back(entry);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("feerate", ValueFromAmount(nFeeRate)));
+    ret.push_back(Pair("lowfee", nFeeRate <= nMaxFeeRate));
+    ret.push_back(Pair("transactions", transactions));
+    ret.push_back(Pair("inputs", (int)nInputs));
+    ret.push_back(Pair("fee", ValueFromAmount(nFee)));
+    return ret;
+}
+
 UniValue getlockedtxinfo(const UniValue & params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
@@ -2514,7 +2703,7 @@ UniValue getlockedtxinfo(const UniValue & params, bool fHelp)
                 continue;
             bExist = true;
             nIndex = i;
-            if(IsLockedTxOut(hash, txout))
+            if(wtx.IsLockedOutput(i))
             {
                 bLocked = true;
                 nUnlockedHeight = txout.nUnlockedHeight;
@@ -2593,6 +2782,16 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
             "      }\n"
             "      ,...\n"
             "    ]\n"
+            "  \"rescan\": {                (json object) the running or last wallet rescan, only present after one started\n"
+            "    \"scanning\": true|false,    (boolean) whether the rescan is still running\n"
+            "    \"startheight\": xxxx,       (numeric) the first block height scanned\n"
+            "    \"height\": xxxx,            (numeric) the last block height committed\n"
+            "    \"stopheight\": xxxx,        (numeric) the chain height at which the rescan stops\n"
+            "    \"progress\": x.xxx,         (numeric) the fraction of blocks done\n"
+            "    \"duration\": xxxx,          (numeric) the elapsed time in seconds\n"
+            "    \"blockspersecond\": x.xx,   (numeric) the block throughput\n"
+            "    \"txspersecond\": x.xx       (numeric) the transaction throughput\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getwalletinfo", "")
@@ -2638,6 +2837,26 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
         }
         obj.push_back(Pair("hdaccounts", accounts));
     }
+    if (pwalletMain->nScanStartTime > 0) {
+        bool fScanning = pwalletMain->fScanningWallet;
+        int nStartHeight = pwalletMain->nScanStartHeight;
+        int nHeight = pwalletMain->nScanHeight;
+        int nStopHeight = pwalletMain->nScanStopHeight;
+        int64_t nDuration = (fScanning ? GetTimeMillis() : (int64_t)pwalletMain->nScanEndTime) - pwalletMain->nScanStartTime;
+        int nBlocks = nHeight - nStartHeight + 1;
+        double dSeconds = std::max(nDuration, (int64_t)1) / 1000.0;
+
+        UniValue rescan(UniValue::VOBJ);
+        rescan.push_back(Pair("scanning", fScanning));
+        rescan.push_back(Pair("startheight", nStartHeight));
+        rescan.push_back(Pair("height", nHeight));
+        rescan.push_back(Pair("stopheight", nStopHeight));
+        rescan.push_back(Pair("progress", nStopHeight >= nStartHeight ? (double)nBlocks / (nStopHeight - nStartHeight + 1) : 1.0));
+        rescan.push_back(Pair("duration", nDuration / 1000));
+        rescan.push_back(Pair("blockspersecond", nBlocks / dSeconds));
+        rescan.push_back(Pair("txspersecond", pwalletMain->nScanTxCount / dSeconds));
+        obj.push_back(Pair("rescan", rescan));
+    }
     return obj;
 }
 
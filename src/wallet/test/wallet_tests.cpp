@@ -4,6 +4,23 @@
 
 #include "wallet/wallet.h"
 
+#include "app/app.h"
+#include "base58.h"
+#include "init.h"
+#include "keystore.h"
+#include "main.h"
+#include "masternode-sync.h"
+#include "policy/policy.h"
+#include "privatesend.h"
+#include "random.h"
+#include "rpc/server.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "txdb.h"
+#include "utiltime.h"
+#include "validation.h"
+#include "wallet/walletdb.h"
+
 #include <set>
 #include <stdint.h>
 #include <utility>
@@ -13,6 +30,7 @@
 
 #include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
+#include <univalue.h>
 
 // how many times to run all the tests to have a chance to catch errors that only show up with particular random shuffles
 #define RUN_TESTS 100
@@ -25,6 +43,8 @@ using namespace std;
 
 typedef set<pair<const CWalletTx*,unsigned int> > CoinSet;
 
+extern UniValue CallRPC(string args);
+
 BOOST_FIXTURE_TEST_SUITE(wallet_tests, TestingSetup)
 
 static CWallet wallet;
@@ -328,6 +348,34 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(bnb_selection_tests)
+{
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+
+    LOCK(wallet.cs_wallet);
+
+    // 676 coins of 1500: the knapsack pass avoids small change and takes
+    // enough coins for MIN_CHANGE, but two coins overshoot by only 1000
+    empty_wallet();
+    for (uint16_t j = 0; j < 676; j++)
+        add_coin(1500);
+    BOOST_CHECK(wallet.SelectCoinsMinConf(2000, 1, 1, vCoins, setCoinsRet, nValueRet, false, 1000));
+    BOOST_CHECK_EQUAL(nValueRet, 3000);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+
+    // a narrower window leaves the knapsack result
+    BOOST_CHECK(wallet.SelectCoinsMinConf(2000, 1, 1, vCoins, setCoinsRet, nValueRet, false, 999));
+    BOOST_CHECK(nValueRet >= 2000 + MIN_CHANGE);
+
+    // and so does switching the search off
+    fSelectCoinsBnB = false;
+    BOOST_CHECK(wallet.SelectCoinsMinConf(2000, 1, 1, vCoins, setCoinsRet, nValueRet, false, 1000));
+    BOOST_CHECK(nValueRet >= 2000 + MIN_CHANGE);
+    fSelectCoinsBnB = DEFAULT_SELECT_COINS_BNB;
+    empty_wallet();
+}
+
 BOOST_AUTO_TEST_CASE(ApproximateBestSubset)
 {
     CoinSet setCoinsRet;
@@ -361,4 +409,1102 @@ BOOST_AUTO_TEST_CASE(ApproximateBestSubset)
     BOOST_CHECK_EQUAL(setCoinsRet.size(), 101);
 }
 
+BOOST_AUTO_TEST_CASE(unlock_schedule_tests)
+{
+    // bare block indexes up to the unlock height, one of them confirms the first tx
+    const int nConfirmHeight = 10;
+    const int nUnlockHeight = nConfirmHeight + 29 * BLOCKS_PER_DAY;
+    std::vector<CBlockIndex> vChain(nUnlockHeight + 1);
+    for (size_t i = 0; i < vChain.size(); i++) {
+        vChain[i].nHeight = i;
+        vChain[i].pprev = i ? &vChain[i - 1] : NULL;
+    }
+    uint256 hashConfirm = GetRandHash();
+    vChain[nConfirmHeight].phashBlock = &mapBlockIndex.insert(std::make_pair(hashConfirm, &vChain[nConfirmHeight])).first->first;
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CBlockIndex* pindexTip = chainActive.Tip();
+    int nChainHeight = g_nChainHeight;
+    chainActive.SetTip(&vChain[nConfirmHeight]);
+    g_nChainHeight = nConfirmHeight;
+    CWalletDB walletdb(pwalletMain->strWalletFile);
+    size_t nScheduled = pwalletMain->GetUnlockScheduleSize();
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vout.resize(2);
+    mtx.vout[0].nValue = 1 * COIN;
+    mtx.vout[0].nUnlockedHeight = nUnlockHeight;
+    mtx.vout[1].nValue = 2 * COIN;
+    CWalletTx wtxConfirmed(pwalletMain, mtx);
+    wtxConfirmed.hashBlock = hashConfirm;
+    wtxConfirmed.nIndex = 0;
+    BOOST_CHECK(pwalletMain->AddToWallet(wtxConfirmed, false, &walletdb));
+    const CWalletTx* pwtxConfirmed = pwalletMain->GetWalletTx(wtxConfirmed.GetHash());
+    BOOST_CHECK(pwtxConfirmed->IsLockedOutput(0));
+    BOOST_CHECK(!pwtxConfirmed->IsLockedOutput(1));
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnlockScheduleSize(), nScheduled + 1);
+
+    // the lock offset of an unconfirmed tx is measured from the next block
+    mtx.nLockTime = 1;
+    CWalletTx wtxUnconfirmed(pwalletMain, mtx);
+    BOOST_CHECK(pwalletMain->AddToWallet(wtxUnconfirmed, false, &walletdb));
+    const CWalletTx* pwtxUnconfirmed = pwalletMain->GetWalletTx(wtxUnconfirmed.GetHash());
+    BOOST_CHECK(pwtxUnconfirmed->IsLockedOutput(0));
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnlockScheduleSize(), nScheduled + 2);
+
+    // updates and new blocks reschedule both txs without adding entries
+    for (int i = 1; i <= 20; i++) {
+        BOOST_CHECK(pwalletMain->AddToWallet(wtxConfirmed, false, &walletdb));
+        chainActive.SetTip(&vChain[nConfirmHeight + i]);
+        g_nChainHeight = nConfirmHeight + i;
+        pwalletMain->UpdatedBlockTip(chainActive.Tip(), NULL, false);
+        BOOST_CHECK_EQUAL(pwalletMain->GetUnlockScheduleSize(), nScheduled + 2);
+    }
+    BOOST_CHECK(pwtxConfirmed->IsLockedOutput(0));
+    BOOST_CHECK(pwtxUnconfirmed->IsLockedOutput(0));
+
+    // one block short of the unlock height nothing is released
+    chainActive.SetTip(&vChain[nUnlockHeight - 1]);
+    g_nChainHeight = nUnlockHeight - 1;
+    pwalletMain->UpdatedBlockTip(chainActive.Tip(), NULL, false);
+    BOOST_CHECK(pwtxConfirmed->IsLockedOutput(0));
+
+    // at nUnlockedHeight the outputs unlock and their entries are gone
+    chainActive.SetTip(&vChain[nUnlockHeight]);
+    g_nChainHeight = nUnlockHeight;
+    pwalletMain->UpdatedBlockTip(chainActive.Tip(), NULL, false);
+    BOOST_CHECK(!pwtxConfirmed->IsLockedOutput(0));
+    BOOST_CHECK(!pwtxUnconfirmed->IsLockedOutput(0));
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnlockScheduleSize(), nScheduled);
+
+    chainActive.SetTip(pindexTip);
+    g_nChainHeight = nChainHeight;
+    mapBlockIndex.erase(hashConfirm);
+}
+
+BOOST_AUTO_TEST_CASE(payout_signing_tests)
+{
+    CBasicKeyStore keystore;
+    std::vector<CKey> vKey(8);
+    for (size_t i = 0; i < vKey.size(); i++) {
+        vKey[i].MakeNewKey(true);
+        keystore.AddKey(vKey[i]);
+    }
+
+    // enough inputs for the signing pool to use several threads
+    std::vector<CMutableTransaction> vTx(4);
+    for (size_t i = 0; i < vTx.size(); i++) {
+        vTx[i].vout.push_back(CTxOut(COIN, GetScriptForDestination(vKey[i].GetPubKey().GetID())));
+        for (unsigned int j = 0; j < 64; j++) {
+            CTxIn txin(COutPoint(GetRandHash(), j));
+            txin.prevPubKey = GetScriptForDestination(vKey[(i + j) % vKey.size()].GetPubKey().GetID());
+            vTx[i].vin.push_back(txin);
+        }
+    }
+    std::vector<CMutableTransaction> vTxSerial(vTx);
+
+    size_t nInputs = 0;
+    int nThreads = 0;
+    BOOST_CHECK(SignPayoutTransactions(&keystore, vTx, 0, nInputs, nThreads));
+    BOOST_CHECK_EQUAL(nInputs, 256U);
+    BOOST_CHECK_EQUAL(nThreads, std::max(1, std::min(GetNumCores(), 4)));
+
+    // signatures are deterministic, so the pool signs exactly as a serial pass does
+    for (size_t i = 0; i < vTxSerial.size(); i++) {
+        for (unsigned int j = 0; j < vTxSerial[i].vin.size(); j++) {
+            BOOST_CHECK(SignSignature(keystore, vTxSerial[i].vin[j].prevPubKey, vTxSerial[i], j));
+            BOOST_CHECK(vTx[i].vin[j].scriptSig == vTxSerial[i].vin[j].scriptSig);
+            BOOST_CHECK(VerifyScript(vTx[i].vin[j].scriptSig, vTx[i].vin[j].prevPubKey, STANDARD_SCRIPT_VERIFY_FLAGS,
+                MutableTransactionSignatureChecker(&vTx[i], j)));
+        }
+    }
+
+    // a tail left unsigned stays empty
+    std::vector<CMutableTransaction> vTxTail(1, vTxSerial[0]);
+    BOOST_FOREACH(CTxIn& txin, vTxTail[0].vin)
+        txin.scriptSig = CScript();
+    BOOST_CHECK(SignPayoutTransactions(&keystore, vTxTail, 1, nInputs, nThreads));
+    BOOST_CHECK_EQUAL(nInputs, 63U);
+    BOOST_CHECK(!vTxTail[0].vin[62].scriptSig.empty());
+    BOOST_CHECK(vTxTail[0].vin.back().scriptSig.empty());
+
+    // one input of one transaction without its key fails the whole batch
+    CKey keyMissing;
+    keyMissing.MakeNewKey(true);
+    std::vector<CMutableTransaction> vTxMissing(vTxSerial);
+    BOOST_FOREACH(CMutableTransaction& tx, vTxMissing)
+        BOOST_FOREACH(CTxIn& txin, tx.vin)
+            txin.scriptSig = CScript();
+    vTxMissing[2].vin[5].prevPubKey = GetScriptForDestination(keyMissing.GetPubKey().GetID());
+    BOOST_CHECK(!SignPayoutTransactions(&keystore, vTxMissing, 0, nInputs, nThreads));
+}
+
+static const CAmount PAYOUT_ASSET_COIN = 1000;
+static const unsigned int PAYOUT_OUTPUTS = 100;
+
+/** A registered asset, and a confirmed tx paying asset coins of PAYOUT_ASSET_COIN and
+ * safe coins of 10 SAFE to keys of the wallet, for bulk asset payouts */
+struct PayoutSetup : public TestingSetup {
+    CAppHeader header;
+    CCommonData transferData;
+    int nChainHeightPrev;
+
+    PayoutSetup()
+    {
+        mapArgs["-keypool"] = "10";
+        nChainHeightPrev = g_nChainHeight;
+        g_nChainHeight = chainActive.Height();
+        masternodeSync.SwitchToNextAsset(*connman);
+        masternodeSync.SwitchToNextAsset(*connman);
+        BOOST_REQUIRE(masternodeSync.IsBlockchainSynced());
+
+        CKey keyAdmin;
+        keyAdmin.MakeNewKey(true);
+        CAssetData assetData("PAYOUT", "PayoutAsset", "bulk payout test asset", "pay", 1000000 * PAYOUT_ASSET_COIN, 1000000 * PAYOUT_ASSET_COIN, 1000000 * PAYOUT_ASSET_COIN, 4, false, false, 0, 0, "");
+        std::vector<std::pair<uint256, CAssetId_AssetInfo_IndexValue> > vAsset;
+        vAsset.push_back(std::make_pair(assetData.GetHash(), CAssetId_AssetInfo_IndexValue(CBitcoinAddress(keyAdmin.GetPubKey().GetID()).ToString(), assetData, 0)));
+        BOOST_REQUIRE(pblocktree->Write_AssetId_AssetInfo_Index(vAsset));
+
+        header = CAppHeader(g_nAppHeaderVersion, uint256S(g_strSafeAssetId), TRANSFER_ASSET_CMD);
+        transferData = CCommonData(assetData.GetHash(), 0, "");
+    }
+
+    ~PayoutSetup()
+    {
+        masternodeSync.Reset();
+        g_nChainHeight = nChainHeightPrev;
+        mapArgs.erase("-keypool");
+    }
+
+    void Fund(unsigned int nAssetCoins, unsigned int nSafeCoins)
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        std::vector<CScript> vScript;
+        for (int i = 0; i < 4; i++) {
+            CKey key;
+            key.MakeNewKey(true);
+            BOOST_REQUIRE(pwalletMain->AddKey(key));
+            vScript.push_back(GetScriptForDestination(key.GetPubKey().GetID()));
+        }
+
+        CMutableTransaction mtx;
+        mtx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+        for (unsigned int i = 0; i < nAssetCoins; i++) {
+            CTxOut txout(PAYOUT_ASSET_COIN, vScript[i % vScript.size()]);
+            txout.vReserve = FillCommonData(header, CCommonData(transferData.assetId, PAYOUT_ASSET_COIN, ""));
+            mtx.vout.push_back(txout);
+        }
+        for (unsigned int i = 0; i < nSafeCoins; i++)
+            mtx.vout.push_back(CTxOut(10 * COIN, vScript[i % vScript.size()]));
+
+        // confirmed in the genesis block, which is all the chain there is
+        CWalletTx wtx(pwalletMain, mtx);
+        wtx.hashBlock = chainActive.Tip()->GetBlockHash();
+        wtx.nIndex = 0;
+        CWalletDB walletdb(pwalletMain->strWalletFile);
+        BOOST_REQUIRE(pwalletMain->AddToWallet(wtx, false, &walletdb));
+    }
+
+    std::vector<CRecipient> Recipients(unsigned int nCount)
+    {
+        std::vector<CRecipient> vecSend;
+        for (unsigned int i = 0; i < nCount; i++) {
+            CKey key;
+            key.MakeNewKey(true);
+            vecSend.push_back(CRecipient(GetScriptForDestination(key.GetPubKey().GetID()), PAYOUT_ASSET_COIN, 0, false, true));
+        }
+        return vecSend;
+    }
+
+    size_t CountWalletTxsOnDisk()
+    {
+        CWallet walletCheck(pwalletMain->strWalletFile);
+        std::vector<uint256> vTxHash;
+        std::vector<CWalletTx> vWtx;
+        BOOST_CHECK(CWalletDB(pwalletMain->strWalletFile).FindWalletTx(&walletCheck, vTxHash, vWtx) == DB_LOAD_OK);
+        return vTxHash.size();
+    }
+
+    unsigned int KeyPoolSize()
+    {
+        LOCK(pwalletMain->cs_wallet);
+        return pwalletMain->GetKeyPoolSize();
+    }
+};
+
+BOOST_FIXTURE_TEST_CASE(payout_commit_tests, PayoutSetup)
+{
+    Fund(4 * PAYOUT_OUTPUTS, 10);
+    pwalletMain->TopUpKeyPool();
+    unsigned int nKeyPool = KeyPoolSize();
+    size_t nWalletTxs = pwalletMain->mapWallet.size();
+    size_t nDiskTxs = CountWalletTxsOnDisk();
+
+    std::vector<CRecipient> vecSend = Recipients(3 * PAYOUT_OUTPUTS);
+    std::vector<CWalletTx> vwtx;
+    CReserveKey reservekey(pwalletMain);
+    CAmount nFee = 0;
+    std::string strError;
+    BOOST_REQUIRE_MESSAGE(pwalletMain->CreateAssetPayoutTransactions(header, transferData, vecSend, PAYOUT_OUTPUTS, vwtx, reservekey, nFee, strError), strError);
+    BOOST_REQUIRE_EQUAL(vwtx.size(), 3U);
+    BOOST_CHECK(nFee > 0);
+    // the change of every transaction goes to the one reserved key
+    BOOST_CHECK_EQUAL(KeyPoolSize(), nKeyPool - 1);
+
+    // the pool signs each input as a serial pass over the batch does
+    std::set<COutPoint> setSpent;
+    BOOST_FOREACH(const CWalletTx& wtx, vwtx) {
+        CMutableTransaction mtx(wtx);
+        for (unsigned int i = 0; i < mtx.vin.size(); i++) {
+            BOOST_CHECK(setSpent.insert(mtx.vin[i].prevout).second);
+            mtx.vin[i].scriptSig = CScript();
+        }
+        for (unsigned int i = 0; i < mtx.vin.size(); i++) {
+            BOOST_CHECK(SignSignature(*pwalletMain, mtx.vin[i].prevPubKey, mtx, i));
+            BOOST_CHECK(mtx.vin[i].scriptSig == wtx.vin[i].scriptSig);
+        }
+    }
+
+    std::vector<bool> vAccepted;
+    BOOST_CHECK(pwalletMain->CommitTransactions(vwtx, reservekey, NULL, vAccepted));
+    BOOST_CHECK(vAccepted == std::vector<bool>(vwtx.size(), true));
+    BOOST_CHECK_EQUAL(pwalletMain->mapWallet.size(), nWalletTxs + vwtx.size());
+    BOOST_CHECK_EQUAL(CountWalletTxsOnDisk(), nDiskTxs + vwtx.size());
+    BOOST_CHECK_EQUAL(KeyPoolSize(), nKeyPool - 1);
+    {
+        LOCK(pwalletMain->cs_wallet);
+        BOOST_FOREACH(const COutPoint& out, setSpent)
+            BOOST_CHECK(pwalletMain->IsSpent(out.hash, out.n));
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(payout_rejected_tests, PayoutSetup)
+{
+    // the funding transaction is not in the coins view, so the mempool turns
+    // every payout down after the wallet has recorded them
+    Fund(2 * PAYOUT_OUTPUTS, 10);
+    std::vector<CRecipient> vecSend = Recipients(2 * PAYOUT_OUTPUTS);
+    std::vector<CWalletTx> vwtx;
+    CReserveKey reservekey(pwalletMain);
+    CAmount nFee = 0;
+    std::string strError;
+    BOOST_REQUIRE_MESSAGE(pwalletMain->CreateAssetPayoutTransactions(header, transferData, vecSend, PAYOUT_OUTPUTS, vwtx, reservekey, nFee, strError), strError);
+    BOOST_REQUIRE_EQUAL(vwtx.size(), 2U);
+
+    std::vector<bool> vAccepted;
+    pwalletMain->SetBroadcastTransactions(true);
+    BOOST_CHECK(!pwalletMain->CommitTransactions(vwtx, reservekey, NULL, vAccepted));
+    pwalletMain->SetBroadcastTransactions(false);
+    BOOST_CHECK(vAccepted == std::vector<bool>(vwtx.size(), false));
+
+    // rejected transactions are abandoned and give their inputs back
+    LOCK(pwalletMain->cs_wallet);
+    BOOST_FOREACH(const CWalletTx& wtx, vwtx) {
+        BOOST_CHECK(pwalletMain->mapWallet[wtx.GetHash()].isAbandoned());
+        BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+            BOOST_CHECK(!pwalletMain->IsSpent(txin.prevout.hash, txin.prevout.n));
+    }
+
+    // and coin selection finds those inputs again
+    std::vector<CWalletTx> vwtxRetry;
+    BOOST_CHECK_MESSAGE(pwalletMain->CreateAssetPayoutTransactions(header, transferData, vecSend, PAYOUT_OUTPUTS, vwtxRetry, reservekey, nFee, strError), strError);
+    BOOST_CHECK_EQUAL(vwtxRetry.size(), vwtx.size());
+}
+
+BOOST_FIXTURE_TEST_CASE(payout_failure_tests, PayoutSetup)
+{
+    // asset coins for two of the three transactions: the third fails after the
+    // first two have taken their coins and the change key
+    Fund(2 * PAYOUT_OUTPUTS, 10);
+    pwalletMain->TopUpKeyPool();
+    unsigned int nKeyPool = KeyPoolSize();
+    size_t nWalletTxs = pwalletMain->mapWallet.size();
+    size_t nDiskTxs = CountWalletTxsOnDisk();
+
+    std::vector<CRecipient> vecSend = Recipients(3 * PAYOUT_OUTPUTS);
+    std::vector<CWalletTx> vwtx;
+    CAmount nFee = 0;
+    std::string strError;
+    {
+        CReserveKey reservekey(pwalletMain);
+        BOOST_CHECK(!pwalletMain->CreateAssetPayoutTransactions(header, transferData, vecSend, PAYOUT_OUTPUTS, vwtx, reservekey, nFee, strError));
+        BOOST_CHECK_EQUAL(strError, "Insufficient asset funds.");
+        BOOST_CHECK(vwtx.empty());
+        BOOST_CHECK_EQUAL(KeyPoolSize(), nKeyPool - 1);
+    }
+
+    // nothing was recorded, and the change key went back to the pool
+    BOOST_CHECK_EQUAL(pwalletMain->mapWallet.size(), nWalletTxs);
+    BOOST_CHECK_EQUAL(CountWalletTxsOnDisk(), nDiskTxs);
+    BOOST_CHECK_EQUAL(KeyPoolSize(), nKeyPool);
+
+    // the coins are all still there for a payout that fits them
+    vecSend.erase(vecSend.begin() + 2 * PAYOUT_OUTPUTS, vecSend.end());
+    CReserveKey reservekey(pwalletMain);
+    BOOST_CHECK_MESSAGE(pwalletMain->CreateAssetPayoutTransactions(header, transferData, vecSend, PAYOUT_OUTPUTS, vwtx, reservekey, nFee, strError), strError);
+    BOOST_CHECK_EQUAL(vwtx.size(), 2U);
+}
+
+static std::set<COutPoint> GroupOutPoints(const CConsolidationGroup& group)
+{
+    std::set<COutPoint> setOut;
+    BOOST_FOREACH(const COutput& out, group.vCoins)
+        setOut.insert(COutPoint(out.tx->GetHash(), out.i));
+    return setOut;
+}
+
+BOOST_FIXTURE_TEST_CASE(consolidation_tests, PayoutSetup)
+{
+    CPrivateSend::InitStandardDenominations();
+    const CAmount nThreshold = COIN;
+    const uint256& assetId = transferData.assetId;
+    const CAmount nAssetThreshold = 10000;
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    std::vector<CScript> vScript;
+    for (int i = 0; i < 4; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        BOOST_REQUIRE(pwalletMain->AddKey(key));
+        vScript.push_back(GetScriptForDestination(key.GetPubKey().GetID()));
+    }
+    const CScript& scriptA = vScript[0];
+
+    // address A: 60 small outputs to merge, and next to them outputs of at
+    // least the threshold, a PrivateSend denomination, frozen and time locked
+    // small outputs. Address C has 3 small outputs, D one. Asset outputs: 10
+    // small ones, 2 time locked ones and 2 of at least the threshold at A, one
+    // at B. The threshold counts whole units of the 4 decimal asset.
+    enum { MERGE, KEEP, FROZEN, LOCKED, MERGE_C, SINGLE };
+    CMutableTransaction mtx;
+    mtx.nVersion = SAFE_TX_VERSION_2;
+    mtx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    std::vector<int> vKind;
+    const int nUnlockedHeight = 29 * BLOCKS_PER_DAY + 1;
+    for (int i = 0; i < 60; i++) {
+        mtx.vout.push_back(CTxOut(10 * CENT + i * 1000, scriptA));
+        vKind.push_back(MERGE);
+    }
+    const CAmount vKeepValue[] = {2 * COIN, 2 * COIN, nThreshold, CENT + 10};
+    BOOST_FOREACH(const CAmount& nValue, vKeepValue) {
+        mtx.vout.push_back(CTxOut(nValue, scriptA));
+        vKind.push_back(KEEP);
+    }
+    for (int i = 0; i < 5; i++) {
+        mtx.vout.push_back(CTxOut(5 * CENT + i, scriptA));
+        if (i < 3) {
+            vKind.push_back(FROZEN);
+        } else {
+            mtx.vout.back().nUnlockedHeight = nUnlockedHeight;
+            vKind.push_back(LOCKED);
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        mtx.vout.push_back(CTxOut(20 * CENT + i, vScript[i < 3 ? 2 : 3]));
+        vKind.push_back(i < 3 ? MERGE_C : SINGLE);
+    }
+    for (int i = 0; i < 13; i++) {
+        CTxOut txout(PAYOUT_ASSET_COIN + i, i < 12 ? scriptA : vScript[1]);
+        txout.vReserve = FillCommonData(header, CCommonData(assetId, txout.nValue, ""));
+        if (i >= 10 && i < 12)
+            txout.nUnlockedHeight = nUnlockedHeight;
+        mtx.vout.push_back(txout);
+        vKind.push_back(i < 10 ? MERGE : (i < 12 ? LOCKED : SINGLE));
+    }
+    const CAmount vKeepAssetValue[] = {nAssetThreshold, 2 * nAssetThreshold};
+    BOOST_FOREACH(const CAmount& nValue, vKeepAssetValue) {
+        CTxOut txout(nValue, scriptA);
+        txout.vReserve = FillCommonData(header, CCommonData(assetId, txout.nValue, ""));
+        mtx.vout.push_back(txout);
+        vKind.push_back(KEEP);
+    }
+
+    CWalletTx wtxFund(pwalletMain, mtx);
+    wtxFund.hashBlock = chainActive.Tip()->GetBlockHash();
+    wtxFund.nIndex = 0;
+    CWalletDB walletdb(pwalletMain->strWalletFile);
+    BOOST_REQUIRE(pwalletMain->AddToWallet(wtxFund, false, &walletdb));
+    const uint256 hashFund = wtxFund.GetHash();
+    const CWalletTx* pwtxFund = pwalletMain->GetWalletTx(hashFund);
+
+    std::set<COutPoint> setMerge, setMergeC, setMergeAsset, setKeepAsset, setUntouchable;
+    CAmount nMergeValue = 0;
+    for (unsigned int n = 0; n < mtx.vout.size(); n++) {
+        COutPoint out(hashFund, n);
+        if (vKind[n] == FROZEN) {
+            pwalletMain->FreezeCoin(out);
+            setUntouchable.insert(out);
+        } else if (vKind[n] == LOCKED) {
+            BOOST_REQUIRE(pwtxFund->IsLockedOutput(n));
+            setUntouchable.insert(out);
+        } else if (vKind[n] == MERGE && mtx.vout[n].IsAsset()) {
+            setMergeAsset.insert(out);
+        } else if (vKind[n] == MERGE) {
+            setMerge.insert(out);
+            nMergeValue += mtx.vout[n].nValue;
+        } else if (vKind[n] == MERGE_C) {
+            setMergeC.insert(out);
+        } else if (vKind[n] == KEEP && mtx.vout[n].IsAsset()) {
+            setKeepAsset.insert(out);
+        }
+    }
+
+    // groups need nMinOutputs outputs, and never fewer than two
+    std::vector<CConsolidationGroup> vGroups;
+    pwalletMain->GetConsolidationGroups(nThreshold, 5, vGroups);
+    BOOST_REQUIRE_EQUAL(vGroups.size(), 2U);
+    BOOST_CHECK(vGroups[0].assetId.IsNull());
+    BOOST_CHECK(GetScriptForDestination(vGroups[0].dest) == scriptA);
+    BOOST_CHECK(GroupOutPoints(vGroups[0]) == setMerge);
+    BOOST_CHECK_EQUAL(vGroups[0].nValue, nMergeValue);
+    for (unsigned int i = 1; i < vGroups[0].vCoins.size(); i++)
+        BOOST_CHECK(vGroups[0].vCoins[i - 1].tx->vout[vGroups[0].vCoins[i - 1].i].nValue < vGroups[0].vCoins[i].tx->vout[vGroups[0].vCoins[i].i].nValue);
+    BOOST_CHECK(vGroups[1].assetId == assetId);
+    BOOST_CHECK(GetScriptForDestination(vGroups[1].dest) == scriptA);
+    BOOST_CHECK(GroupOutPoints(vGroups[1]) == setMergeAsset);
+
+    pwalletMain->GetConsolidationGroups(nThreshold, 0, vGroups);
+    BOOST_REQUIRE_EQUAL(vGroups.size(), 3U);
+    BOOST_CHECK(GroupOutPoints(vGroups[2]) == setMergeC);
+
+    // only outputs below the threshold are merged
+    pwalletMain->GetConsolidationGroups(10 * CENT + 30 * 1000, 5, vGroups);
+    BOOST_REQUIRE(!vGroups.empty());
+    BOOST_CHECK_EQUAL(vGroups[0].vCoins.size(), 30U);
+    BOOST_FOREACH(const COutput& out, vGroups[0].vCoins)
+        BOOST_CHECK(out.tx->vout[out.i].nValue < 10 * CENT + 30 * 1000);
+
+    // and for assets below as many units of the asset: 0.1003 units are 1003
+    pwalletMain->GetConsolidationGroups(10 * CENT + 30 * 1000, 0, vGroups);
+    BOOST_REQUIRE_EQUAL(vGroups.size(), 2U);
+    BOOST_CHECK(vGroups[1].assetId == assetId);
+    BOOST_CHECK_EQUAL(vGroups[1].vCoins.size(), 3U);
+    BOOST_FOREACH(const COutput& out, vGroups[1].vCoins)
+        BOOST_CHECK(out.tx->vout[out.i].nValue < 1003);
+
+    // a dry run plans the same merges and stops at nMaxTxs
+    std::vector<CConsolidationResult> vResults;
+    pwalletMain->ConsolidateCoins(nThreshold, 3, 2, true, vResults, NULL);
+    BOOST_REQUIRE_EQUAL(vResults.size(), 2U);
+    BOOST_CHECK_EQUAL(vResults[0].nInputs, setMerge.size());
+    BOOST_CHECK_EQUAL(vResults[0].nValue, nMergeValue);
+    BOOST_CHECK_EQUAL(vResults[1].nInputs, setMergeAsset.size());
+    BOOST_FOREACH(const CConsolidationResult& result, vResults) {
+        BOOST_CHECK_MESSAGE(result.strError.empty(), result.strError);
+        BOOST_CHECK(result.nFee > 0);
+        BOOST_CHECK(result.txid.IsNull());
+    }
+    BOOST_CHECK_EQUAL(pwalletMain->mapWallet.size(), 1U);
+
+    // the real round spends exactly the grouped outputs, plus SAFE fee coins
+    // for the asset merge, and none of the frozen or locked ones
+    pwalletMain->ConsolidateCoins(nThreshold, 3, 10, false, vResults, NULL);
+    BOOST_REQUIRE_EQUAL(vResults.size(), 3U);
+    for (unsigned int i = 0; i < vResults.size(); i++) {
+        const CConsolidationResult& result = vResults[i];
+        BOOST_REQUIRE_MESSAGE(result.strError.empty(), result.strError);
+        const CWalletTx* pwtx = pwalletMain->GetWalletTx(result.txid);
+        BOOST_REQUIRE(pwtx);
+        std::set<COutPoint> setSpent;
+        BOOST_FOREACH(const CTxIn& txin, pwtx->vin) {
+            BOOST_CHECK(txin.prevout.hash == hashFund);
+            BOOST_CHECK(!setUntouchable.count(txin.prevout));
+            setSpent.insert(txin.prevout);
+        }
+        BOOST_CHECK(GetScriptForDestination(result.dest) == pwtx->vout[0].scriptPubKey);
+        if (i == 0) {
+            BOOST_CHECK(setSpent == setMerge);
+            BOOST_REQUIRE_EQUAL(pwtx->vout.size(), 1U);
+            BOOST_CHECK_EQUAL(pwtx->vout[0].nValue, nMergeValue - result.nFee);
+        } else if (i == 1) {
+            BOOST_CHECK(result.assetId == assetId);
+            BOOST_FOREACH(const COutPoint& out, setMergeAsset)
+                BOOST_CHECK(setSpent.count(out));
+            BOOST_FOREACH(const COutPoint& out, setSpent)
+                BOOST_CHECK(setMergeAsset.count(out) || !mtx.vout[out.n].IsAsset());
+            BOOST_FOREACH(const COutPoint& out, setKeepAsset)
+                BOOST_CHECK(!setSpent.count(out));
+            BOOST_CHECK(pwtx->vout[0].IsAsset());
+        } else {
+            BOOST_CHECK(setSpent == setMergeC);
+        }
+    }
+
+    // what is left cannot be merged
+    pwalletMain->GetConsolidationGroups(nThreshold, 0, vGroups);
+    BOOST_CHECK(vGroups.empty());
+    BOOST_FOREACH(const COutPoint& out, setUntouchable)
+        BOOST_CHECK(!pwalletMain->IsSpent(out.hash, out.n));
+}
+
+static UniValue WaitForCandyJob(const std::string& strJobId)
+{
+    for (int i = 0; i < 1000; i++) {
+        UniValue job = CallRPC("getcandyjob " + strJobId);
+        if (find_value(job, "status").get_str() != "running")
+            return job;
+        MilliSleep(10);
+    }
+    BOOST_FAIL("candy job " + strJobId + " did not finish");
+    return NullUniValue;
+}
+
+BOOST_FIXTURE_TEST_CASE(candy_job_tests, PayoutSetup)
+{
+    const std::string strAssetId = transferData.assetId.GetHex();
+
+    // ids that no job was started with
+    BOOST_CHECK_THROW(CallRPC("getcandyjob " + GetRandHash().GetHex()), std::runtime_error);
+    BOOST_CHECK_THROW(CallRPC("getcandyjob notajobid"), std::runtime_error);
+    BOOST_CHECK_THROW(CallRPC("getcandyjob"), std::runtime_error);
+
+    // an asset without candy starts no job
+    BOOST_CHECK_THROW(CallRPC("getcandy " + strAssetId + " true"), std::runtime_error);
+
+    // candies the wallet has no share in: an empty one and two whose
+    // transactions are not in the chain
+    std::vector<std::pair<CPutCandy_IndexKey, CPutCandy_IndexValue> > vCandy;
+    vCandy.push_back(std::make_pair(CPutCandy_IndexKey(transferData.assetId, COutPoint(GetRandHash(), 0), CCandyInfo(0, 1)), CPutCandy_IndexValue()));
+    vCandy.push_back(std::make_pair(CPutCandy_IndexKey(transferData.assetId, COutPoint(GetRandHash(), 1), CCandyInfo(1000 * PAYOUT_ASSET_COIN, 1)), CPutCandy_IndexValue()));
+    vCandy.push_back(std::make_pair(CPutCandy_IndexKey(transferData.assetId, COutPoint(GetRandHash(), 2), CCandyInfo(10 * PAYOUT_ASSET_COIN, 3)), CPutCandy_IndexValue()));
+    BOOST_REQUIRE(pblocktree->Write_PutCandy_Index(vCandy));
+
+    UniValue r = CallRPC("getcandy " + strAssetId);
+    BOOST_CHECK(r.isArray() && r.empty());
+
+    // a finished job keeps its result, every poll returns the same one
+    r = CallRPC("getcandy " + strAssetId + " true");
+    const std::string strJobId = find_value(r, "jobId").get_str();
+    BOOST_CHECK(!uint256S(strJobId).IsNull());
+    UniValue job = WaitForCandyJob(strJobId);
+    BOOST_CHECK_EQUAL(find_value(job, "jobId").get_str(), strJobId);
+    BOOST_CHECK_EQUAL(find_value(job, "assetId").get_str(), strAssetId);
+    BOOST_CHECK_EQUAL(find_value(job, "status").get_str(), "done");
+    BOOST_CHECK_EQUAL(find_value(job, "candies").get_int(), 3);
+    BOOST_CHECK_EQUAL(find_value(job, "processed").get_int(), 3);
+    BOOST_CHECK_EQUAL(find_value(job, "claims").get_int(), 0);
+    BOOST_CHECK(find_value(job, "duration").get_int64() >= 0);
+    BOOST_CHECK(find_value(job, "result").isArray() && find_value(job, "result").empty());
+    BOOST_CHECK(find_value(job, "error").isNull());
+    BOOST_CHECK_EQUAL(CallRPC("getcandyjob " + strJobId).write(), job.write());
+
+    // a second job gets its own id and leaves the first one alone
+    r = CallRPC("getcandy " + strAssetId + " true");
+    const std::string strJobId2 = find_value(r, "jobId").get_str();
+    BOOST_CHECK(strJobId2 != strJobId);
+    BOOST_CHECK_EQUAL(find_value(WaitForCandyJob(strJobId2), "status").get_str(), "done");
+    BOOST_CHECK_EQUAL(CallRPC("getcandyjob " + strJobId).write(), job.write());
+}
+
+static void AddWalletKeys(CWallet& wallet, const std::vector<CKey>& vKey)
+{
+    bool fFirstRun;
+    wallet.LoadWallet(fFirstRun);
+    LOCK(wallet.cs_wallet);
+    BOOST_FOREACH(const CKey& key, vKey)
+        BOOST_REQUIRE(wallet.AddKey(key));
+}
+
+static std::set<uint256> WalletTxHashes(const CWallet& wallet)
+{
+    LOCK(wallet.cs_wallet);
+    std::set<uint256> setHash;
+    for (std::map<uint256, CWalletTx>::const_iterator it = wallet.mapWallet.begin(); it != wallet.mapWallet.end(); ++it)
+        setHash.insert(it->first);
+    return setHash;
+}
+
+BOOST_FIXTURE_TEST_CASE(rescan_tests, TestChain100Setup)
+{
+    std::vector<CKey> vKey(4);
+    CBasicKeyStore keystore;
+    keystore.AddKey(coinbaseKey);
+    for (size_t i = 0; i < vKey.size(); i++) {
+        vKey[i].MakeNewKey(true);
+        keystore.AddKey(vKey[i]);
+    }
+
+    // a wallet following the chain as it grows knows what a rescan has to find
+    CWallet walletLive("wallet_live.dat");
+    AddWalletKeys(walletLive, vKey);
+    RegisterValidationInterface(&walletLive);
+
+    // blocks 101-120: payments to the wallet at odd heights, coinbases to a raw wallet
+    // pubkey at multiples of 4, and a spend of a wallet output at 115. Blocks 111-120
+    // come more than the birthday margin after the others.
+    const int64_t nTimeStart = GetTime() + 1000;
+    const int64_t nTimeLate = nTimeStart + 20000;
+    CScript scriptCoinbase = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    std::map<int, CTransaction> mapPayment;
+    std::map<uint256, int> mapTxHeight;
+    for (int nHeight = 101; nHeight <= 120; nHeight++) {
+        SetMockTime((nHeight <= 110 ? nTimeStart : nTimeLate) + nHeight);
+        const CKey& key = vKey[nHeight % vKey.size()];
+        std::vector<CMutableTransaction> vTx;
+        if (nHeight % 2) {
+            const CTransaction& txFrom = coinbaseTxns[nHeight - 101];
+            CMutableTransaction mtx;
+            mtx.vin.push_back(CTxIn(COutPoint(txFrom.GetHash(), 0)));
+            mtx.vout.push_back(CTxOut(11 * CENT, GetScriptForDestination(key.GetPubKey().GetID())));
+            BOOST_REQUIRE(SignSignature(keystore, txFrom, mtx, 0));
+            vTx.push_back(mtx);
+            mapPayment[nHeight] = mtx;
+        }
+        if (nHeight == 115) {
+            const CTransaction& txFrom = mapPayment[113];
+            CMutableTransaction mtx;
+            mtx.vin.push_back(CTxIn(COutPoint(txFrom.GetHash(), 0)));
+            mtx.vout.push_back(CTxOut(11 * CENT, scriptCoinbase));
+            BOOST_REQUIRE(SignSignature(keystore, txFrom, mtx, 0));
+            vTx.push_back(mtx);
+        }
+        CBlock block = CreateAndProcessBlock(vTx, nHeight % 4 ? scriptCoinbase : GetScriptForRawPubKey(key.GetPubKey()));
+        BOOST_REQUIRE(chainActive.Tip()->GetBlockHash() == block.GetHash());
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            mapTxHeight[tx.GetHash()] = nHeight;
+    }
+    SetMockTime(0);
+    UnregisterValidationInterface(&walletLive);
+
+    std::set<uint256> setAll = WalletTxHashes(walletLive);
+    BOOST_CHECK_EQUAL(setAll.size(), 16U);
+    std::set<uint256> setLate, setFirstHalf;
+    BOOST_FOREACH(const uint256& hash, setAll) {
+        BOOST_REQUIRE(mapTxHeight.count(hash));
+        if (mapTxHeight[hash] >= 111)
+            setLate.insert(hash);
+        if (mapTxHeight[hash] <= 109)
+            setFirstHalf.insert(hash);
+    }
+
+    CBlockIndex* pindexGenesis;
+    {
+        LOCK(cs_main);
+        pindexGenesis = chainActive.Genesis();
+    }
+
+    // a full rescan finds every transaction the live wallet saw
+    CWallet walletFull("wallet_full.dat");
+    AddWalletKeys(walletFull, vKey);
+    BOOST_CHECK_EQUAL(walletFull.ScanForWalletTransactions(pindexGenesis, true), (int)setAll.size());
+    BOOST_CHECK(WalletTxHashes(walletFull) == setAll);
+    BOOST_CHECK(!walletFull.fScanningWallet);
+    BOOST_CHECK_EQUAL(walletFull.nScanHeight, 120);
+
+    // blocks more than two hours older than the first key are skipped
+    CWallet walletLate("wallet_late.dat");
+    AddWalletKeys(walletLate, vKey);
+    walletLate.nTimeFirstKey = nTimeLate;
+    walletLate.ScanForWalletTransactions(pindexGenesis, true);
+    BOOST_CHECK(WalletTxHashes(walletLate) == setLate);
+    BOOST_CHECK_EQUAL(walletLate.nScanStartHeight, 111);
+
+    // a rescan thread interrupted while it commits block 109 keeps the blocks
+    // committed so far, stops its workers and lets the next rescan run
+    CWallet walletAbort("wallet_abort.dat");
+    AddWalletKeys(walletAbort, vKey);
+    const uint256 hashAbort = mapPayment[109].GetHash();
+    boost::signals2::connection conn = walletAbort.NotifyTransactionChanged.connect(
+        [&hashAbort](CWallet* pwallet, const uint256& hash, ChangeType status) {
+            if (hash == hashAbort)
+                throw boost::thread_interrupted();
+        });
+    BOOST_CHECK_THROW(walletAbort.ScanForWalletTransactions(pindexGenesis, true), boost::thread_interrupted);
+    conn.disconnect();
+    BOOST_CHECK(!walletAbort.fScanningWallet);
+    BOOST_CHECK_EQUAL(walletAbort.nScanHeight, 108);
+    BOOST_CHECK(WalletTxHashes(walletAbort) == setFirstHalf);
+
+    walletAbort.ScanForWalletTransactions(pindexGenesis, true);
+    BOOST_CHECK(WalletTxHashes(walletAbort) == setAll);
+    BOOST_CHECK_EQUAL(walletAbort.nScanHeight, 120);
+}
+
+static void NewHDWallet(CWallet& wallet, const std::string& strSeed)
+{
+    bool fFirstRun;
+    wallet.LoadWallet(fFirstRun);
+    mapArgs["-hdseed"] = strSeed;
+    wallet.GenerateNewHDChain();
+    BOOST_REQUIRE(wallet.IsHDEnabled());
+}
+
+static void CheckHDAccount(const CWallet& wallet, uint32_t nExternal, uint32_t nInternal)
+{
+    CHDChain chain;
+    CHDAccount acc;
+    BOOST_REQUIRE(wallet.GetHDChain(chain) && chain.GetAccount(0, acc));
+    BOOST_CHECK_EQUAL(acc.nExternalChainCounter, nExternal);
+    BOOST_CHECK_EQUAL(acc.nInternalChainCounter, nInternal);
+}
+
+BOOST_AUTO_TEST_CASE(hd_keypool_bulk_tests)
+{
+    // enough keys per chain for the top-up to derive them on several threads
+    const unsigned int nFirst = 300;
+    const unsigned int nSecond = 400;
+    const std::string strSeed = "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f";
+
+    CWallet walletBulk("wallet_hdbulk.dat");
+    CWallet walletSeq("wallet_hdseq.dat");
+    NewHDWallet(walletBulk, strSeed);
+    NewHDWallet(walletSeq, strSeed);
+
+    // the keys of m/44'/coin'/0'/change/i, derived step by step from the seed
+    CHDChain chain;
+    BOOST_REQUIRE(walletBulk.GetHDChain(chain));
+    SecureVector vchSeed = chain.GetSeed();
+    CExtKey masterKey;
+    masterKey.SetMaster(&vchSeed[0], vchSeed.size());
+    std::vector<CExtPubKey> vChainKeys[2];
+    for (int nChange = 0; nChange < 2; nChange++) {
+        CExtKey purposeKey, cointypeKey, accountKey, changeKey, changeKeyChain;
+        masterKey.Derive(purposeKey, 44 | 0x80000000);
+        purposeKey.Derive(cointypeKey, Params().ExtCoinType() | 0x80000000);
+        cointypeKey.Derive(accountKey, 0 | 0x80000000);
+        accountKey.Derive(changeKey, nChange);
+        chain.DeriveChangeExtKey(0, nChange != 0, changeKeyChain);
+        BOOST_CHECK(changeKeyChain == changeKey);
+        for (unsigned int i = 0; i <= nSecond + 1; i++) {
+            CExtKey childKey;
+            changeKey.Derive(childKey, i);
+            vChainKeys[nChange].push_back(childKey.Neuter());
+        }
+    }
+
+    // both wallets already hold external key 3 and internal key 0, the derivations skip them
+    const unsigned int nSkip[2] = {3, 0};
+    std::vector<CExtPubKey> vExpected[2];
+    for (int nChange = 0; nChange < 2; nChange++) {
+        CExtKey key;
+        chain.DeriveChildExtKey(0, nChange != 0, nSkip[nChange], key);
+        BOOST_REQUIRE(key.Neuter() == vChainKeys[nChange][nSkip[nChange]]);
+        {
+            LOCK2(walletBulk.cs_wallet, walletSeq.cs_wallet);
+            BOOST_REQUIRE(walletBulk.AddKey(key.key) && walletSeq.AddKey(key.key));
+        }
+        for (unsigned int i = 0; i < vChainKeys[nChange].size() && vExpected[nChange].size() < nSecond; i++) {
+            if (i != nSkip[nChange])
+                vExpected[nChange].push_back(vChainKeys[nChange][i]);
+        }
+    }
+
+    // two top-ups of the pool against one key at a time, external keys before internal ones
+    std::vector<std::pair<CPubKey, bool> > vPool;
+    std::vector<CPubKey> vSeq[2];
+    const unsigned int nRound[3] = {0, nFirst, nSecond};
+    for (int nTopUp = 1; nTopUp <= 2; nTopUp++) {
+        BOOST_REQUIRE(walletBulk.TopUpKeyPool(nRound[nTopUp]));
+        LOCK(walletSeq.cs_wallet);
+        for (int nChange = 0; nChange < 2; nChange++) {
+            for (unsigned int i = nRound[nTopUp - 1]; i < nRound[nTopUp]; i++) {
+                vSeq[nChange].push_back(walletSeq.GenerateNewKey(0, nChange != 0));
+                vPool.push_back(std::make_pair(vSeq[nChange].back(), nChange != 0));
+            }
+        }
+        CheckHDAccount(walletBulk, nRound[nTopUp] + 1, nRound[nTopUp] + 1);
+        CheckHDAccount(walletSeq, nRound[nTopUp] + 1, nRound[nTopUp] + 1);
+    }
+
+    // the same keys at the same HD indexes
+    for (int nChange = 0; nChange < 2; nChange++) {
+        BOOST_REQUIRE_EQUAL(vSeq[nChange].size(), vExpected[nChange].size());
+        for (unsigned int i = 0; i < vExpected[nChange].size(); i++) {
+            const CExtPubKey& extPubKey = vExpected[nChange][i];
+            BOOST_CHECK(vSeq[nChange][i] == extPubKey.pubkey);
+            for (int nWallet = 0; nWallet < 2; nWallet++) {
+                const CWallet& wallet = nWallet ? walletSeq : walletBulk;
+                LOCK(wallet.cs_wallet);
+                std::map<CKeyID, CHDPubKey>::const_iterator it = wallet.mapHdPubKeys.find(extPubKey.pubkey.GetID());
+                BOOST_REQUIRE(it != wallet.mapHdPubKeys.end());
+                BOOST_CHECK(it->second.extPubKey == extPubKey);
+                BOOST_CHECK_EQUAL(it->second.nAccountIndex, 0U);
+                BOOST_CHECK_EQUAL(it->second.nChangeIndex, (uint32_t)nChange);
+                BOOST_CHECK(wallet.mapKeyMetadata.count(extPubKey.pubkey.GetID()));
+            }
+        }
+    }
+
+    // the same pool order, in memory and on disk
+    {
+        LOCK(walletBulk.cs_wallet);
+        BOOST_CHECK_EQUAL(walletBulk.setExternalKeyPool.size(), nSecond);
+        BOOST_CHECK_EQUAL(walletBulk.setInternalKeyPool.size(), nSecond);
+        CWalletDB walletdb("wallet_hdbulk.dat");
+        for (unsigned int i = 0; i < vPool.size(); i++) {
+            const int64_t nIndex = i + 1;
+            CKeyPool keypool;
+            BOOST_REQUIRE(walletdb.ReadPool(nIndex, keypool));
+            BOOST_CHECK(keypool.vchPubKey == vPool[i].first);
+            BOOST_CHECK_EQUAL(keypool.fInternal, vPool[i].second);
+            BOOST_CHECK_EQUAL(walletBulk.setInternalKeyPool.count(nIndex), vPool[i].second ? 1U : 0U);
+            BOOST_CHECK_EQUAL(walletBulk.setExternalKeyPool.count(nIndex), vPool[i].second ? 0U : 1U);
+        }
+    }
+
+    // the pool, HD pubkeys and chain counters of the bulk top-ups were committed
+    CWallet walletReload("wallet_hdbulk.dat");
+    bool fFirstRun;
+    walletReload.LoadWallet(fFirstRun);
+    CheckHDAccount(walletReload, nSecond + 1, nSecond + 1);
+    {
+        LOCK(walletReload.cs_wallet);
+        BOOST_CHECK_EQUAL(walletReload.GetKeyPoolSize(), 2 * nSecond);
+        BOOST_CHECK_EQUAL(walletReload.mapHdPubKeys.size(), 2 * nSecond);
+    }
+}
+
+static void AddKeysInOrder(CWallet* pwallet, const std::vector<CKey>* pvKey)
+{
+    BOOST_FOREACH(const CKey& key, *pvKey) {
+        LOCK(pwallet->cs_wallet);
+        pwallet->AddKey(key);
+    }
+}
+
+static void CheckKeyAddresses(const std::vector<CKeyAddressEntry>& vEntry, const std::vector<CKeyID>& vKeyID)
+{
+    BOOST_REQUIRE(vEntry.size() <= vKeyID.size());
+    for (unsigned int i = 0; i < vEntry.size(); i++) {
+        BOOST_CHECK(vEntry[i].keyID == vKeyID[i]);
+        BOOST_CHECK_EQUAL(vEntry[i].strAddress, CBitcoinAddress(vKeyID[i]).ToString());
+        BOOST_CHECK(vEntry[i].scriptPubKey == GetScriptForDestination(vKeyID[i]));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(key_address_snapshot_tests)
+{
+    std::vector<CKey> vKey(200);
+    std::vector<CKeyID> vKeyID;
+    for (unsigned int i = 0; i < vKey.size(); i++) {
+        vKey[i].MakeNewKey(i % 2 == 0);
+        vKeyID.push_back(vKey[i].GetPubKey().GetID());
+    }
+
+    CWallet walletKeys;
+    boost::shared_ptr<const std::vector<CKeyAddressEntry> > pEmpty = walletKeys.GetKeyAddresses();
+    BOOST_CHECK(pEmpty->empty());
+
+    {
+        LOCK(walletKeys.cs_wallet);
+        for (unsigned int i = 0; i < 3; i++)
+            BOOST_REQUIRE(walletKeys.AddKey(vKey[i]));
+    }
+    boost::shared_ptr<const std::vector<CKeyAddressEntry> > pFirst = walletKeys.GetKeyAddresses();
+    BOOST_CHECK_EQUAL(pFirst->size(), 3U);
+    CheckKeyAddresses(*pFirst, vKeyID);
+    // nothing new, the same snapshot is handed out again
+    BOOST_CHECK(walletKeys.GetKeyAddresses() == pFirst);
+
+    // snapshots taken while keys are added are prefixes of the final list and never change
+    boost::thread adder(boost::bind(&AddKeysInOrder, &walletKeys, &vKey));
+    std::vector<boost::shared_ptr<const std::vector<CKeyAddressEntry> > > vSnapshot;
+    while (!adder.timed_join(boost::posix_time::milliseconds(0)))
+        vSnapshot.push_back(walletKeys.GetKeyAddresses());
+    vSnapshot.push_back(walletKeys.GetKeyAddresses());
+
+    // the first three keys were added again and are still listed once
+    BOOST_CHECK_EQUAL(pFirst->size(), 3U);
+    size_t nSizePrev = 0;
+    BOOST_FOREACH(const boost::shared_ptr<const std::vector<CKeyAddressEntry> >& pSnapshot, vSnapshot) {
+        BOOST_CHECK(pSnapshot->size() >= nSizePrev);
+        nSizePrev = pSnapshot->size();
+        CheckKeyAddresses(*pSnapshot, vKeyID);
+    }
+    BOOST_CHECK_EQUAL(vSnapshot.back()->size(), vKeyID.size());
+
+    // HD keys of a keypool top-up are listed and come back from disk
+    CWallet walletHD("wallet_hdaddresses.dat");
+    NewHDWallet(walletHD, "0f0e0d0c0b0a09080706050403020100");
+    BOOST_REQUIRE(walletHD.TopUpKeyPool(5));
+    std::set<CKeyID> setHD;
+    {
+        LOCK(walletHD.cs_wallet);
+        for (std::map<CKeyID, CHDPubKey>::const_iterator it = walletHD.mapHdPubKeys.begin(); it != walletHD.mapHdPubKeys.end(); ++it)
+            setHD.insert(it->first);
+    }
+    BOOST_CHECK_EQUAL(setHD.size(), 10U);
+    std::set<CKeyID> setListed;
+    boost::shared_ptr<const std::vector<CKeyAddressEntry> > pHD = walletHD.GetKeyAddresses();
+    BOOST_FOREACH(const CKeyAddressEntry& entry, *pHD) {
+        setListed.insert(entry.keyID);
+        BOOST_CHECK_EQUAL(entry.strAddress, CBitcoinAddress(entry.keyID).ToString());
+    }
+    BOOST_CHECK(setListed == setHD);
+    BOOST_CHECK_EQUAL(pHD->size(), setHD.size());
+
+    CWallet walletReload("wallet_hdaddresses.dat");
+    bool fFirstRun;
+    walletReload.LoadWallet(fFirstRun);
+    std::set<CKeyID> setReloaded;
+    BOOST_FOREACH(const CKeyAddressEntry& entry, *walletReload.GetKeyAddresses())
+        setReloaded.insert(entry.keyID);
+    BOOST_CHECK(setReloaded == setHD);
+}
+
+static DBErrors LoadWalletWithThreads(CWallet& wallet, int nThreads)
+{
+    mapArgs["-walletloadthreads"] = strprintf("%d", nThreads);
+    bool fFirstRun;
+    DBErrors nLoadRet = wallet.LoadWallet(fFirstRun);
+    mapArgs.erase("-walletloadthreads");
+    mapArgs.erase("-rescan");
+    return nLoadRet;
+}
+
+BOOST_AUTO_TEST_CASE(wallet_load_threads_tests)
+{
+    // the same transaction records in two wallet files: ordered and unordered
+    // ones, one in the pre-0.3.17 format and one stored under a wrong hash
+    const std::string strFile[2] = {"wallet_load_serial.dat", "wallet_load_parallel.dat"};
+    CKey key;
+    key.MakeNewKey(true);
+    std::vector<std::pair<uint256, CWalletTx> > vRecord;
+    for (int i = 0; i < 300; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.push_back(CTxIn(COutPoint(GetRandHash(), i % 3)));
+        mtx.vout.push_back(CTxOut((i + 1) * CENT, GetScriptForDestination(key.GetPubKey().GetID())));
+        CWalletTx wtx(NULL, CTransaction(mtx));
+        wtx.nTimeReceived = 1500000000 + (i * 7919) % 300;
+        wtx.nOrderPos = i % 10 == 0 ? -1 : i;
+        wtx.mapValue["comment"] = strprintf("tx %d", i);
+        if (i == 42)
+            wtx.fTimeReceivedIsTxTime = 31500;
+        vRecord.push_back(std::make_pair(i == 99 ? GetRandHash() : wtx.GetHash(), wtx));
+    }
+    for (int nFile = 0; nFile < 2; nFile++) {
+        CWalletDB walletdb(strFile[nFile]);
+        for (unsigned int i = 0; i < vRecord.size(); i++)
+            BOOST_REQUIRE(walletdb.WriteTx(vRecord[i].first, vRecord[i].second));
+    }
+
+    // the bad record makes both loads report a noncritical error
+    CWallet walletSerial(strFile[0]);
+    CWallet walletParallel(strFile[1]);
+    BOOST_CHECK_EQUAL((int)LoadWalletWithThreads(walletSerial, 1), (int)DB_NONCRITICAL_ERROR);
+    BOOST_CHECK_EQUAL((int)LoadWalletWithThreads(walletParallel, 4), (int)DB_NONCRITICAL_ERROR);
+
+    LOCK2(walletSerial.cs_wallet, walletParallel.cs_wallet);
+    BOOST_CHECK_EQUAL(walletSerial.mapWallet.size(), vRecord.size() - 1);
+    BOOST_CHECK(!walletSerial.mapWallet.count(vRecord[99].second.GetHash()));
+    BOOST_CHECK_EQUAL(walletSerial.mapWallet[vRecord[42].first].fTimeReceivedIsTxTime, 0U);
+    BOOST_REQUIRE_EQUAL(walletParallel.mapWallet.size(), walletSerial.mapWallet.size());
+
+    // the same transactions, down to the serialized wallet fields
+    std::map<uint256, CWalletTx>::const_iterator itSerial = walletSerial.mapWallet.begin();
+    std::map<uint256, CWalletTx>::const_iterator itParallel = walletParallel.mapWallet.begin();
+    for (; itSerial != walletSerial.mapWallet.end(); ++itSerial, ++itParallel) {
+        BOOST_REQUIRE(itSerial->first == itParallel->first);
+        CWalletTx wtxSerial = itSerial->second, wtxParallel = itParallel->second;
+        CDataStream ssSerial(SER_DISK, CLIENT_VERSION), ssParallel(SER_DISK, CLIENT_VERSION);
+        ssSerial << wtxSerial;
+        ssParallel << wtxParallel;
+        BOOST_CHECK(ssSerial.str() == ssParallel.str());
+        BOOST_CHECK(itSerial->second.nOrderPos >= 0);
+    }
+
+    // and the same order, including the positions given to the unordered ones
+    BOOST_REQUIRE_EQUAL(walletParallel.wtxOrdered.size(), walletSerial.wtxOrdered.size());
+    CWallet::TxItems::const_iterator itOrderSerial = walletSerial.wtxOrdered.begin();
+    CWallet::TxItems::const_iterator itOrderParallel = walletParallel.wtxOrdered.begin();
+    for (; itOrderSerial != walletSerial.wtxOrdered.end(); ++itOrderSerial, ++itOrderParallel) {
+        BOOST_CHECK_EQUAL(itOrderSerial->first, itOrderParallel->first);
+        BOOST_REQUIRE(itOrderSerial->second.first && itOrderParallel->second.first);
+        BOOST_CHECK(itOrderSerial->second.first->GetHash() == itOrderParallel->second.first->GetHash());
+    }
+}
+
+static bool HavePool(const std::string& strFile, int64_t nIndex)
+{
+    CKeyPool keypool;
+    return CWalletDB(strFile).ReadPool(nIndex, keypool);
+}
+
+static bool HaveKeyOnDisk(const std::string& strFile, const CKeyID& keyID)
+{
+    CWallet wallet(strFile);
+    bool fFirstRun;
+    wallet.LoadWallet(fFirstRun);
+    return wallet.HaveKey(keyID);
+}
+
+BOOST_AUTO_TEST_CASE(wallet_batch_tests)
+{
+    const std::string strFile = "wallet_batch.dat";
+    CWallet walletBatch(strFile);
+    bool fFirstRun;
+    walletBatch.LoadWallet(fFirstRun);
+    CKey key;
+    key.MakeNewKey(true);
+    const CKeyPool keypool(key.GetPubKey(), false);
+
+    LOCK(walletBatch.cs_wallet);
+    {
+        // committed writes are there for any other reader, aborted ones are not
+        CWalletDBBatch batch(&walletBatch, 0);
+        BOOST_REQUIRE(batch.Get()->WritePool(1, keypool));
+        BOOST_REQUIRE(batch.Get()->WritePool(2, keypool));
+        BOOST_CHECK(batch.Commit());
+        BOOST_CHECK(HavePool(strFile, 1) && HavePool(strFile, 2));
+
+        BOOST_REQUIRE(batch.Get()->WritePool(3, keypool));
+        batch.Abort();
+        BOOST_CHECK(!HavePool(strFile, 3));
+
+        // the batch stays usable after an abort, and commits when it closes
+        BOOST_REQUIRE(batch.Get()->WritePool(4, keypool));
+    }
+    BOOST_CHECK(HavePool(strFile, 4));
+
+    {
+        // every third write starts a new transaction, an abort only loses the open one
+        CWalletDBBatch batch(&walletBatch, 3);
+        for (int64_t nIndex = 10; nIndex < 14; nIndex++)
+            BOOST_REQUIRE(batch.Get()->WritePool(nIndex, keypool));
+        batch.Abort();
+    }
+    BOOST_CHECK(HavePool(strFile, 10) && HavePool(strFile, 11) && HavePool(strFile, 12));
+    BOOST_CHECK(!HavePool(strFile, 13));
+
+    {
+        // a nested batch joins the outer one, so its abort drops the outer writes too
+        CWalletDBBatch batch(&walletBatch, 0);
+        BOOST_REQUIRE(batch.Get()->WritePool(20, keypool));
+        {
+            CWalletDBBatch batchInner(&walletBatch, 0);
+            BOOST_CHECK(batchInner.Get() == batch.Get());
+            BOOST_REQUIRE(batchInner.Get()->WritePool(21, keypool));
+            batchInner.Abort();
+        }
+    }
+    BOOST_CHECK(!HavePool(strFile, 20) && !HavePool(strFile, 21));
+
+    // a batch left by an exception keeps nothing it had not committed
+    try {
+        CWalletDBBatch batch(&walletBatch, 0);
+        BOOST_REQUIRE(batch.Get()->WritePool(30, keypool));
+        BOOST_CHECK(batch.Commit());
+        BOOST_REQUIRE(batch.Get()->WritePool(31, keypool));
+        throw std::runtime_error("abort the batch");
+    } catch (const std::runtime_error&) {
+    }
+    BOOST_CHECK(HavePool(strFile, 30));
+    BOOST_CHECK(!HavePool(strFile, 31));
+
+    // wallet writes go through the open batch: an aborted key is not on disk
+    // after a reload, a committed one is
+    CKey keyAborted, keyCommitted;
+    keyAborted.MakeNewKey(true);
+    keyCommitted.MakeNewKey(true);
+    {
+        CWalletDBBatch batch(&walletBatch, 0);
+        BOOST_REQUIRE(walletBatch.AddKey(keyAborted));
+        batch.Abort();
+        BOOST_REQUIRE(walletBatch.AddKey(keyCommitted));
+    }
+    BOOST_CHECK(!HaveKeyOnDisk(strFile, keyAborted.GetPubKey().GetID()));
+    BOOST_CHECK(HaveKeyOnDisk(strFile, keyCommitted.GetPubKey().GetID()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
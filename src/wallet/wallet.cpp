@@ -42,6 +42,7 @@
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
+#include <boost/unordered_set.hpp>
 
 
 using namespace std;
@@ -52,6 +53,7 @@ CAmount maxTxFee = DEFAULT_TRANSACTION_MAXFEE;
 unsigned int nTxConfirmTarget = DEFAULT_TX_CONFIRM_TARGET;
 bool bSpendZeroConfChange = DEFAULT_SPEND_ZEROCONF_CHANGE;
 bool fSendFreeTransactions = DEFAULT_SEND_FREE_TRANSACTIONS;
+bool fSelectCoinsBnB = DEFAULT_SELECT_COINS_BNB;
 int g_sleepCount = 50;
 int g_sleepTime = 50;
 
@@ -206,6 +208,106 @@ void CWallet::DeriveNewChildKey(const CKeyMetadata& metadata, CKey& secretRet, u
         throw std::runtime_error(std::string(__func__) + ": AddHDPubKey failed");
 }
 
+/** Worker of the HD derivation pool: derives children of changeKey until all slots are filled */
+static void DeriveHDChildPubKeys(const CExtKey* pChangeKey, uint32_t nFirstIndex, std::vector<CExtPubKey>* pvPubKeys, std::atomic<size_t>* pnNext)
+{
+    while (true)
+    {
+        size_t i = (*pnNext)++;
+        if (i >= pvPubKeys->size())
+            return;
+
+        CExtKey childKey;
+        pChangeKey->Derive(childKey, nFirstIndex + i);
+        (*pvPubKeys)[i] = childKey.Neuter();
+    }
+}
+
+void CWallet::DeriveNewChildKeys(const CKeyMetadata& metadata, uint32_t nAccountIndex, bool fInternal, size_t nCount, std::vector<CPubKey>& vPubKeysRet, CWalletDB* pwalletdb)
+{
+    AssertLockHeld(cs_wallet); // mapKeyMetadata, mapHdPubKeys
+
+    vPubKeysRet.clear();
+    if (nCount == 0)
+        return;
+
+    CHDChain hdChainTmp;
+    if (!GetHDChain(hdChainTmp)) {
+        throw std::runtime_error(std::string(__func__) + ": GetHDChain failed");
+    }
+
+    if (!DecryptHDChain(hdChainTmp))
+        throw std::runtime_error(std::string(__func__) + ": DecryptHDChainSeed failed");
+    // make sure seed matches this chain
+    if (hdChainTmp.GetID() != hdChainTmp.GetSeedHash())
+        throw std::runtime_error(std::string(__func__) + ": Wrong HD chain!");
+
+    CHDAccount acc;
+    if (!hdChainTmp.GetAccount(nAccountIndex, acc))
+        throw std::runtime_error(std::string(__func__) + ": Wrong HD account!");
+
+    // The hardened path down to the change level is the same for every key
+    // of the chain, derive it once for the whole batch
+    CExtKey changeKey;
+    hdChainTmp.DeriveChangeExtKey(nAccountIndex, fInternal, changeKey);
+
+    // derive child keys at the next indexes, skip keys already known to the wallet
+    uint32_t nChildIndex = fInternal ? acc.nInternalChainCounter : acc.nExternalChainCounter;
+    std::vector<CExtPubKey> vNewKeys;
+    while (vNewKeys.size() < nCount)
+    {
+        std::vector<CExtPubKey> vPubKeys(nCount - vNewKeys.size());
+        std::atomic<size_t> nNext(0);
+        int nThreads = std::min(GetNumCores(), (int)(vPubKeys.size() / 64)) - 1;
+        boost::thread_group derivers;
+        for (int i = 0; i < nThreads; i++)
+            derivers.create_thread(boost::bind(&DeriveHDChildPubKeys, &changeKey, nChildIndex, &vPubKeys, &nNext));
+        DeriveHDChildPubKeys(&changeKey, nChildIndex, &vPubKeys, &nNext);
+        derivers.join_all();
+
+        BOOST_FOREACH(const CExtPubKey& extPubKey, vPubKeys)
+        {
+            if (!HaveKey(extPubKey.pubkey.GetID()))
+                vNewKeys.push_back(extPubKey);
+        }
+        nChildIndex += vPubKeys.size();
+    }
+
+    BOOST_FOREACH(const CExtPubKey& extPubKey, vNewKeys)
+    {
+        // store metadata
+        mapKeyMetadata[extPubKey.pubkey.GetID()] = metadata;
+        if (!AddHDPubKey(extPubKey, fInternal, pwalletdb))
+            throw std::runtime_error(std::string(__func__) + ": AddHDPubKey failed");
+        vPubKeysRet.push_back(extPubKey.pubkey);
+    }
+    if (!nTimeFirstKey || metadata.nCreateTime < nTimeFirstKey)
+        nTimeFirstKey = metadata.nCreateTime;
+
+    // update the chain model in the database
+    CHDChain hdChainCurrent;
+    GetHDChain(hdChainCurrent);
+
+    if (fInternal) {
+        acc.nInternalChainCounter = nChildIndex;
+    }
+    else {
+        acc.nExternalChainCounter = nChildIndex;
+    }
+
+    if (!hdChainCurrent.SetAccount(nAccountIndex, acc))
+        throw std::runtime_error(std::string(__func__) + ": SetAccount failed");
+
+    if (IsCrypted()) {
+        if (!SetCryptedHDChain(hdChainCurrent, true) || (fFileBacked && !pwalletdb->WriteCryptedHDChain(hdChainCurrent)))
+            throw std::runtime_error(std::string(__func__) + ": SetCryptedHDChain failed");
+    }
+    else {
+        if (!SetHDChain(hdChainCurrent, true) || (fFileBacked && !pwalletdb->WriteHDChain(hdChainCurrent)))
+            throw std::runtime_error(std::string(__func__) + ": SetHDChain failed");
+    }
+}
+
 bool CWallet::GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) const
 {
     LOCK(cs_wallet);
@@ -261,10 +363,11 @@ bool CWallet::LoadHDPubKey(const CHDPubKey &hdPubKey)
     AssertLockHeld(cs_wallet);
 
     mapHdPubKeys[hdPubKey.extPubKey.pubkey.GetID()] = hdPubKey;
+    AddKeyAddress(hdPubKey.extPubKey.pubkey.GetID());
     return true;
 }
 
-bool CWallet::AddHDPubKey(const CExtPubKey &extPubKey, bool fInternal)
+bool CWallet::AddHDPubKey(const CExtPubKey &extPubKey, bool fInternal, CWalletDB* pwalletdb)
 {
     AssertLockHeld(cs_wallet);
 
@@ -276,19 +379,24 @@ bool CWallet::AddHDPubKey(const CExtPubKey &extPubKey, bool fInternal)
     hdPubKey.hdchainID = hdChainCurrent.GetID();
     hdPubKey.nChangeIndex = fInternal ? 1 : 0;
     mapHdPubKeys[extPubKey.pubkey.GetID()] = hdPubKey;
+    AddKeyAddress(extPubKey.pubkey.GetID());
 
     // check if we need to remove from watch-only
     CScript script;
     script = GetScriptForDestination(extPubKey.pubkey.GetID());
     if (HaveWatchOnly(script))
-        RemoveWatchOnly(script);
+        RemoveWatchOnly(script, pwalletdb);
     script = GetScriptForRawPubKey(extPubKey.pubkey);
     if (HaveWatchOnly(script))
-        RemoveWatchOnly(script);
+        RemoveWatchOnly(script, pwalletdb);
 
     if (!fFileBacked)
         return true;
 
+    if (!pwalletdb)
+        pwalletdb = GetBatchWalletDB();
+    if (pwalletdb)
+        return pwalletdb->WriteHDPubKey(hdPubKey, mapKeyMetadata[extPubKey.pubkey.GetID()]);
     return CWalletDB(strWalletFile).WriteHDPubKey(hdPubKey, mapKeyMetadata[extPubKey.pubkey.GetID()]);
 }
 
@@ -297,6 +405,7 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    AddKeyAddress(pubkey.GetID());
 
     // check if we need to remove from watch-only
     CScript script;
@@ -310,6 +419,10 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     if (!fFileBacked)
         return true;
     if (!IsCrypted()) {
+        if (CWalletDB* pbatchdb = GetBatchWalletDB())
+            return pbatchdb->WriteKey(pubkey,
+                                      secret.GetPrivKey(),
+                                      mapKeyMetadata[pubkey.GetID()]);
         return CWalletDB(strWalletFile).WriteKey(pubkey,
                                                  secret.GetPrivKey(),
                                                  mapKeyMetadata[pubkey.GetID()]);
@@ -330,6 +443,10 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
             return pwalletdbEncryption->WriteCryptedKey(vchPubKey,
                                                         vchCryptedSecret,
                                                         mapKeyMetadata[vchPubKey.GetID()]);
+        else if (CWalletDB* pbatchdb = GetBatchWalletDB())
+            return pbatchdb->WriteCryptedKey(vchPubKey,
+                                             vchCryptedSecret,
+                                             mapKeyMetadata[vchPubKey.GetID()]);
         else
             return CWalletDB(strWalletFile).WriteCryptedKey(vchPubKey,
                                                             vchCryptedSecret,
@@ -350,7 +467,56 @@ bool CWallet::LoadKeyMetadata(const CPubKey &pubkey, const CKeyMetadata &meta)
 
 bool CWallet::LoadCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret)
 {
-    return CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret);
+    if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
+        return false;
+    AddKeyAddress(vchPubKey.GetID());
+    return true;
+}
+
+bool CWallet::LoadKey(const CKey& key, const CPubKey &pubkey)
+{
+    if (!CCryptoKeyStore::AddKeyPubKey(key, pubkey))
+        return false;
+    AddKeyAddress(pubkey.GetID());
+    return true;
+}
+
+CKeyAddressEntry::CKeyAddressEntry(const CKeyID& keyIDIn) : keyID(keyIDIn), strAddress(CBitcoinAddress(keyIDIn).ToString()), scriptPubKey(GetScriptForDestination(keyIDIn))
+{
+}
+
+void CWallet::AddKeyAddress(const CKeyID& keyID)
+{
+    LOCK(cs_keyAddresses);
+    if (setKeyAddressIDs.insert(keyID).second)
+        vKeyAddressPending.push_back(keyID);
+}
+
+boost::shared_ptr<const std::vector<CKeyAddressEntry> > CWallet::GetKeyAddresses() const
+{
+    LOCK(cs_keyAddressSeal);
+
+    std::vector<CKeyID> vPending;
+    boost::shared_ptr<const std::vector<CKeyAddressEntry> > pCurrent;
+    {
+        LOCK(cs_keyAddresses);
+        vPending.swap(vKeyAddressPending);
+        pCurrent = pKeyAddresses;
+    }
+    if (vPending.empty())
+        return pCurrent;
+
+    // Encode the new keys without cs_keyAddresses, so adding keys never
+    // waits for base58 encoding
+    boost::shared_ptr<std::vector<CKeyAddressEntry> > pNew(new std::vector<CKeyAddressEntry>());
+    pNew->reserve(pCurrent->size() + vPending.size());
+    pNew->insert(pNew->end(), pCurrent->begin(), pCurrent->end());
+    BOOST_FOREACH(const CKeyID& keyID, vPending)
+        pNew->push_back(CKeyAddressEntry(keyID));
+
+    LOCK(cs_keyAddresses);
+    pKeyAddresses = pNew;
+    return pKeyAddresses;
 }
 
 bool CWallet::AddCScript(const CScript& redeemScript)
@@ -360,6 +526,8 @@ bool CWallet::AddCScript(const CScript& redeemScript)
     if (!fFileBacked)
         return true;
     LOCK(cs_wallet);
+    if (CWalletDB* pbatchdb = GetBatchWalletDB())
+        return pbatchdb->WriteCScript(Hash160(redeemScript), redeemScript);
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
 }
 
@@ -388,10 +556,17 @@ bool CWallet::AddWatchOnly(const CScript &dest)
     if (!fFileBacked)
         return true;
     LOCK(cs_wallet);
+    if (CWalletDB* pbatchdb = GetBatchWalletDB())
+        return pbatchdb->WriteWatchOnly(dest);
     return CWalletDB(strWalletFile).WriteWatchOnly(dest);
 }
 
 bool CWallet::RemoveWatchOnly(const CScript &dest)
+{
+    return RemoveWatchOnly(dest, NULL);
+}
+
+bool CWallet::RemoveWatchOnly(const CScript &dest, CWalletDB* pwalletdb)
 {
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveWatchOnly(dest))
@@ -399,8 +574,14 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
     if (fFileBacked)
+    {
+        if (!pwalletdb)
+            pwalletdb = GetBatchWalletDB();
+        if (pwalletdb)
+            return pwalletdb->EraseWatchOnly(dest);
         if (!CWalletDB(strWalletFile).EraseWatchOnly(dest))
             return false;
+    }
 
     return true;
 }
@@ -551,6 +732,8 @@ bool CWallet::SetMinVersion(enum WalletFeature nVersion, CWalletDB* pwalletdbIn,
 
     if (fFileBacked)
     {
+        if (!pwalletdbIn)
+            pwalletdbIn = GetBatchWalletDB();
         CWalletDB* pwalletdb = pwalletdbIn ? pwalletdbIn : new CWalletDB(strWalletFile);
         if (nWalletVersion > 40000)
             pwalletdb->WriteMinVersion(nWalletVersion);
@@ -728,14 +911,14 @@ void CWallet::AddToSpends(const uint256& wtxid)
 
     BOOST_FOREACH(const CTxIn& txin, thisTx.vin)
     {
-        CCoins coins;
-        if(GetUTXOCoins(txin.prevout, coins))
+        Coin coin;
+        if(GetUTXOCoin(txin.prevout, coin))
         {
             uint32_t nAppCmd = 0;
-            if(coins.vout[txin.prevout.n].IsAsset(&nAppCmd) && nAppCmd == PUT_CANDY_CMD && txin.scriptSig.empty())
+            if(coin.out.IsAsset(&nAppCmd) && nAppCmd == PUT_CANDY_CMD && txin.scriptSig.empty())
             {
                 CTxDestination dest;
-                if(ExtractDestination(coins.vout[txin.prevout.n].scriptPubKey, dest))
+                if(ExtractDestination(coin.out.scriptPubKey, dest))
                 {
                     if(CBitcoinAddress(dest).ToString() == g_strPutCandyAddress)
                         continue;
@@ -884,6 +1067,8 @@ int64_t CWallet::IncOrderPosNext(CWalletDB *pwalletdb)
 {
     AssertLockHeld(cs_wallet); // nOrderPosNext
     int64_t nRet = nOrderPosNext++;
+    if (!pwalletdb)
+        pwalletdb = GetBatchWalletDB();
     if (pwalletdb) {
         pwalletdb->WriteOrderPosNext(nOrderPosNext);
     } else {
@@ -904,6 +1089,139 @@ void CWallet::MarkDirty()
     fAnonymizableTallyCachedNonDenom = false;
 }
 
+/** The txout class of an asset output, as used by the asset transaction index */
+static bool GetAssetTxOutClass(const CTxOut& txout, uint256& assetId, uint8_t& nTxClass)
+{
+    CAppHeader header;
+    vector<unsigned char> vData;
+    if (!ParseReserve(txout.vReserve, header, vData))
+        return false;
+
+    if (header.nAppCmd == ISSUE_ASSET_CMD)
+    {
+        CAssetData assetData;
+        if (!ParseIssueData(vData, assetData))
+            return false;
+        assetId = assetData.GetHash();
+        nTxClass = ISSUE_TXOUT;
+        return true;
+    }
+    if (header.nAppCmd == ADD_ASSET_CMD || header.nAppCmd == TRANSFER_ASSET_CMD || header.nAppCmd == DESTORY_ASSET_CMD || header.nAppCmd == CHANGE_ASSET_CMD)
+    {
+        CCommonData commonData;
+        if (!ParseCommonData(vData, commonData))
+            return false;
+        assetId = commonData.assetId;
+        if (header.nAppCmd == ADD_ASSET_CMD)
+            nTxClass = ADD_ISSUE_TXOUT;
+        else if (header.nAppCmd == TRANSFER_ASSET_CMD)
+            nTxClass = txout.nUnlockedHeight > 0 ? LOCKED_TXOUT : TRANSFER_TXOUT;
+        else if (header.nAppCmd == DESTORY_ASSET_CMD)
+            nTxClass = DESTORY_TXOUT;
+        else
+            nTxClass = CHANGE_ASSET_TXOUT;
+        return true;
+    }
+    if (header.nAppCmd == PUT_CANDY_CMD)
+    {
+        CPutCandyData candyData;
+        if (!ParsePutCandyData(vData, candyData))
+            return false;
+        assetId = candyData.assetId;
+        nTxClass = PUT_CANDY_TXOUT;
+        return true;
+    }
+    if (header.nAppCmd == GET_CANDY_CMD)
+    {
+        CGetCandyData candyData;
+        if (!ParseGetCandyData(vData, candyData))
+            return false;
+        assetId = candyData.assetId;
+        nTxClass = GET_CANDY_TXOUT;
+        return true;
+    }
+    return false;
+}
+
+void CWallet::AddToTimeIndexes(const CWalletTx& wtx)
+{
+    const std::pair<int64_t, uint256> key(wtx.GetTxTime(), wtx.GetHash());
+    BOOST_FOREACH(const CTxOut& txout, wtx.vout)
+    {
+        uint32_t nClassBit = 1;
+        if (txout.IsAsset())
+        {
+            uint256 assetId;
+            uint8_t nTxClass = 0;
+            if (GetAssetTxOutClass(txout, assetId, nTxClass))
+            {
+                nClassBit = (uint32_t)1 << nTxClass;
+                mapAssetTxTime[assetId][key] |= nClassBit;
+            }
+        }
+
+        CTxDestination dest;
+        if (ExtractDestination(txout.scriptPubKey, dest))
+            mapAddressTxTime[dest][key] |= nClassBit;
+    }
+}
+
+static void PageTxTimeIndex(const CWallet::TxTimeIndex& index, const std::map<uint256, CWalletTx>& mapWallet, uint32_t nClassMask, int64_t nStartTime, int64_t nEndTime, const CWalletTx* pwtxBefore, int nFrom, int nCount, std::vector<const CWalletTx*>& vwtxRet)
+{
+    vwtxRet.clear();
+    // seek to the newest entry at or before nEndTime, and older than the cursor
+    CWallet::TxTimeIndex::const_iterator it = nEndTime == std::numeric_limits<int64_t>::max() ? index.end() : index.lower_bound(std::make_pair(nEndTime + 1, uint256()));
+    if (pwtxBefore)
+    {
+        CWallet::TxTimeIndex::const_iterator itBefore = index.lower_bound(std::make_pair(pwtxBefore->GetTxTime(), pwtxBefore->GetHash()));
+        if (itBefore != index.end() && (it == index.end() || itBefore->first < it->first))
+            it = itBefore;
+    }
+    while (it != index.begin() && (nCount < 0 || (int)vwtxRet.size() < nCount))
+    {
+        --it;
+        if (it->first.first < nStartTime)
+            break;
+        if ((it->second & nClassMask) == 0)
+            continue;
+        if (nFrom > 0)
+        {
+            nFrom--;
+            continue;
+        }
+        std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(it->first.second);
+        if (mi != mapWallet.end())
+            vwtxRet.push_back(&mi->second);
+    }
+    std::reverse(vwtxRet.begin(), vwtxRet.end());
+}
+
+bool CWallet::ListAssetTransactions(const uint256& assetId, uint32_t nClassMask, int64_t nStartTime, int64_t nEndTime, const uint256& hashBefore, int nFrom, int nCount, std::vector<const CWalletTx*>& vwtxRet) const
+{
+    AssertLockHeld(cs_wallet);
+    vwtxRet.clear();
+    const CWalletTx* pwtxBefore = hashBefore.IsNull() ? NULL : GetWalletTx(hashBefore);
+    if (!hashBefore.IsNull() && !pwtxBefore)
+        return false;
+    std::map<uint256, TxTimeIndex>::const_iterator it = mapAssetTxTime.find(assetId);
+    if (it != mapAssetTxTime.end())
+        PageTxTimeIndex(it->second, mapWallet, nClassMask, nStartTime, nEndTime, pwtxBefore, nFrom, nCount, vwtxRet);
+    return true;
+}
+
+bool CWallet::ListAddressTransactions(const CTxDestination& dest, uint32_t nClassMask, int64_t nStartTime, int64_t nEndTime, const uint256& hashBefore, int nFrom, int nCount, std::vector<const CWalletTx*>& vwtxRet) const
+{
+    AssertLockHeld(cs_wallet);
+    vwtxRet.clear();
+    const CWalletTx* pwtxBefore = hashBefore.IsNull() ? NULL : GetWalletTx(hashBefore);
+    if (!hashBefore.IsNull() && !pwtxBefore)
+        return false;
+    std::map<CTxDestination, TxTimeIndex>::const_iterator it = mapAddressTxTime.find(dest);
+    if (it != mapAddressTxTime.end())
+        PageTxTimeIndex(it->second, mapWallet, nClassMask, nStartTime, nEndTime, pwtxBefore, nFrom, nCount, vwtxRet);
+    return true;
+}
+
 bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb)
 {
     uint256 hash = wtxIn.GetHash();
@@ -914,6 +1232,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         CWalletTx& wtx = mapWallet[hash];
         wtx.BindWallet(this);
         wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
+        AddToTimeIndexes(wtx);
         AddToSpends(hash);
         BOOST_FOREACH(const CTxIn& txin, wtx.vin) {
             if (mapWallet.count(txin.prevout.hash)) {
@@ -982,12 +1301,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
                              wtxIn.GetHash().ToString(),
                              wtxIn.hashBlock.ToString());
             }
+            AddToTimeIndexes(wtx);
             AddToSpends(hash);
-            for(unsigned int i = 0; i < wtx.vout.size(); ++i) {
-                if (IsMine(wtx.vout[i]) && !IsSpent(hash, i)) {
-                    setWalletUTXO.insert(COutPoint(hash, i));
-                }
-            }
         }
 
         bool fUpdated = false;
@@ -1017,6 +1332,14 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
             }
         }
 
+        // coin selection walks setWalletUTXO, so outputs of a known transaction
+        // that became ours through a rescan or an import are added here as well
+        for(unsigned int i = 0; i < wtx.vout.size(); ++i) {
+            if (IsMine(wtx.vout[i]) && !IsSpent(hash, i)) {
+                setWalletUTXO.insert(COutPoint(hash, i));
+            }
+        }
+
         //// debug print
         LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
@@ -1028,6 +1351,9 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         // Break debit/credit balance caches:
         wtx.MarkDirty();
 
+        // Confirmation changes the height lock offsets are measured from
+        ScheduleLockedOutputs(wtx);
+
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
 
@@ -1059,14 +1385,14 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
 
         if (pblock) {
             BOOST_FOREACH(const CTxIn& txin, tx.vin) {
-                CCoins coins;
-                if(GetUTXOCoins(txin.prevout, coins))
+                Coin coin;
+                if(GetUTXOCoin(txin.prevout, coin))
                 {
                     uint32_t nAppCmd = 0;
-                    if(coins.vout[txin.prevout.n].IsAsset(&nAppCmd) && nAppCmd == PUT_CANDY_CMD && txin.scriptSig.empty())
+                    if(coin.out.IsAsset(&nAppCmd) && nAppCmd == PUT_CANDY_CMD && txin.scriptSig.empty())
                     {
                         CTxDestination dest;
-                        if(ExtractDestination(coins.vout[txin.prevout.n].scriptPubKey, dest))
+                        if(ExtractDestination(coin.out.scriptPubKey, dest))
                         {
                             if(CBitcoinAddress(dest).ToString() == g_strPutCandyAddress)
                                 continue;
@@ -1095,6 +1421,9 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
             if (pblock)
                 wtx.SetMerkleBranch(*pblock);
 
+            if (CWalletDB* pbatchdb = GetBatchWalletDB())
+                return AddToWallet(wtx, false, pbatchdb);
+
             // Do not flush the wallet here for performance reasons
             // this is safe, as in case of a crash, we rescan the necessary blocks on startup through our SetBestChain-mechanism
             CWalletDB walletdb(strWalletFile, "r+", false);
@@ -1151,11 +1480,15 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
                 iter++;
             }
             // If a transaction changes 'conflicted' state, that changes the balance
-            // available of the outputs it spends. So force those to be recomputed
+            // available of the outputs it spends. So force those to be recomputed,
+            // and give the ones it no longer spends back to coin selection
             BOOST_FOREACH(const CTxIn& txin, wtx.vin)
             {
-                if (mapWallet.count(txin.prevout.hash))
+                if (mapWallet.count(txin.prevout.hash)) {
                     mapWallet[txin.prevout.hash].MarkDirty();
+                    if (IsMine(txin) && !IsSpent(txin.prevout.hash, txin.prevout.n))
+                        setWalletUTXO.insert(txin.prevout);
+                }
             }
         }
     }
@@ -1215,11 +1548,15 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
                  iter++;
             }
             // If a transaction changes 'conflicted' state, that changes the balance
-            // available of the outputs it spends. So force those to be recomputed
+            // available of the outputs it spends. So force those to be recomputed,
+            // and give the ones it no longer spends back to coin selection
             BOOST_FOREACH(const CTxIn& txin, wtx.vin)
             {
-                if (mapWallet.count(txin.prevout.hash))
+                if (mapWallet.count(txin.prevout.hash)) {
                     mapWallet[txin.prevout.hash].MarkDirty();
+                    if (IsMine(txin) && !IsSpent(txin.prevout.hash, txin.prevout.n))
+                        setWalletUTXO.insert(txin.prevout);
+                }
             }
         }
     }
@@ -1249,6 +1586,109 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
 }
 
 
+void CWallet::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    if (!pindexNew)
+        return;
+
+    LOCK2(cs_main, cs_wallet);
+
+    // Blocks we already advanced past were disconnected, outputs may be locked again
+    if (pindexFork && pindexFork->nHeight < nUnlockScheduleHeight)
+    {
+        RebuildUnlockSchedule();
+        return;
+    }
+
+    // The lock offsets of unconfirmed txs are measured from the next block
+    std::set<uint256> setUnconfirmed;
+    setUnconfirmed.swap(setUnconfirmedLockedTx);
+    BOOST_FOREACH(const uint256& hash, setUnconfirmed)
+    {
+        std::map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end())
+            ScheduleLockedOutputs(mi->second);
+    }
+
+    int nHeight = chainActive.Height();
+    bool fUnlocked = false;
+    while (!heapUnlockSchedule.empty() && heapUnlockSchedule.top().first <= nHeight)
+    {
+        const COutPoint outpoint = heapUnlockSchedule.top().second;
+        heapUnlockSchedule.pop();
+        setScheduledOutputs.erase(outpoint);
+
+        std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(outpoint.hash);
+        if (mi == mapWallet.end())
+            continue;
+
+        mi->second.UnlockOutput(outpoint.n);
+        fUnlocked = true;
+    }
+    nUnlockScheduleHeight = nHeight;
+
+    if (fUnlocked)
+    {
+        fAnonymizableTallyCached = false;
+        fAnonymizableTallyCachedNonDenom = false;
+    }
+}
+
+void CWallet::ScheduleLockedOutputs(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+
+    const uint256 hash = wtx.GetHash();
+    int nTxHeight = wtx.GetTxHeight();
+
+    wtx.setLockedOutputs.clear();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+    {
+        if (!IsLockedTxOutByHeight(nTxHeight, wtx.vout[i]))
+            continue;
+        wtx.setLockedOutputs.insert(i);
+        // the unlock height is part of the output, an existing entry is still right
+        if (setScheduledOutputs.insert(COutPoint(hash, i)).second)
+            heapUnlockSchedule.push(std::make_pair(wtx.vout[i].nUnlockedHeight, COutPoint(hash, i)));
+    }
+    wtx.fLockedOutputsCached = true;
+    wtx.fLockedCreditCached = false;
+    wtx.fLockedWatchCreditCached = false;
+
+    if (!wtx.setLockedOutputs.empty() && wtx.GetDepthInMainChain(false) <= 0)
+        setUnconfirmedLockedTx.insert(hash);
+    else
+        setUnconfirmedLockedTx.erase(hash);
+}
+
+void CWallet::RebuildUnlockSchedule()
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    heapUnlockSchedule = std::priority_queue<UnlockScheduleEntry, std::vector<UnlockScheduleEntry>, std::greater<UnlockScheduleEntry> >();
+    setScheduledOutputs.clear();
+    setUnconfirmedLockedTx.clear();
+    BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
+    {
+        item.second.MarkDirty();
+        ScheduleLockedOutputs(item.second);
+    }
+    nUnlockScheduleHeight = chainActive.Height();
+
+    fAnonymizableTallyCached = false;
+    fAnonymizableTallyCachedNonDenom = false;
+}
+
+bool CWallet::IsLockedOutput(const uint256& hash, unsigned int n) const
+{
+    LOCK(cs_wallet);
+    std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hash);
+    if (mi == mapWallet.end())
+        return false;
+    return mi->second.IsLockedOutput(n);
+}
+
 isminetype CWallet::IsMine(const CTxIn &txin) const
 {
     {
@@ -1555,8 +1995,11 @@ bool CWallet::SetHDChain(const CHDChain& chain, bool memonly)
     if (!CCryptoKeyStore::SetHDChain(chain))
         return false;
 
-    if (!memonly && !CWalletDB(strWalletFile).WriteHDChain(chain))
-        throw std::runtime_error(std::string(__func__) + ": WriteHDChain failed");
+    if (!memonly) {
+        CWalletDB* pbatchdb = GetBatchWalletDB();
+        if (pbatchdb ? !pbatchdb->WriteHDChain(chain) : !CWalletDB(strWalletFile).WriteHDChain(chain))
+            throw std::runtime_error(std::string(__func__) + ": WriteHDChain failed");
+    }
 
     return true;
 }
@@ -1574,6 +2017,9 @@ bool CWallet::SetCryptedHDChain(const CHDChain& chain, bool memonly)
         if (pwalletdbEncryption) {
             if (!pwalletdbEncryption->WriteCryptedHDChain(chain))
                 throw std::runtime_error(std::string(__func__) + ": WriteCryptedHDChain failed");
+        } else if (CWalletDB* pbatchdb = GetBatchWalletDB()) {
+            if (!pbatchdb->WriteCryptedHDChain(chain))
+                throw std::runtime_error(std::string(__func__) + ": WriteCryptedHDChain failed");
         } else {
             if (!CWalletDB(strWalletFile).WriteCryptedHDChain(chain))
                 throw std::runtime_error(std::string(__func__) + ": WriteCryptedHDChain failed");
@@ -1890,49 +2336,266 @@ bool CWalletTx::WriteToDisk(CWalletDB *pwalletdb)
     return pwalletdb->WriteTx(GetHash(), *this);
 }
 
+void CWallet::GetScanScripts(std::vector<CScript>& vScripts) const
+{
+    AssertLockHeld(cs_wallet);
+
+    std::set<CKeyID> setKeyIds;
+    GetKeys(setKeyIds);
+    for (std::map<CKeyID, CHDPubKey>::const_iterator it = mapHdPubKeys.begin(); it != mapHdPubKeys.end(); ++it)
+        setKeyIds.insert(it->first);
+
+    vScripts.reserve(setKeyIds.size() * 2);
+    BOOST_FOREACH(const CKeyID& keyid, setKeyIds)
+    {
+        vScripts.push_back(GetScriptForDestination(keyid));
+        CPubKey pubkey;
+        if (GetPubKey(keyid, pubkey))
+            vScripts.push_back(GetScriptForRawPubKey(pubkey));
+    }
+
+    LOCK(cs_KeyStore);
+    for (ScriptMap::const_iterator it = mapScripts.begin(); it != mapScripts.end(); ++it)
+        vScripts.push_back(GetScriptForDestination(it->first));
+    vScripts.insert(vScripts.end(), setWatchOnly.begin(), setWatchOnly.end());
+}
+
+struct CScriptHasher
+{
+    size_t operator()(const CScript& script) const
+    {
+        return boost::hash_range(script.begin(), script.end());
+    }
+};
+
+typedef boost::unordered_set<CScript, CScriptHasher> ScanScriptSet;
+
 /**
- * Scan the block chain (starting in pindexStart) for transactions
- * from or to us. If fUpdate is true, found transactions that already
- * exist in the wallet will be updated.
+ * Read and match stages of a wallet rescan. Worker threads read the blocks
+ * of a window ahead of the commit position and flag the transactions paying
+ * a script of the wallet snapshot; the rescanning thread consumes the
+ * blocks in chain order. Workers never take cs_main or cs_wallet.
  */
-int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
+class CWalletScanPipeline
 {
-    int ret = 0;
-    int64_t nNow = GetTime();
-    const CChainParams& chainParams = Params();
+public:
+    struct Slot
+    {
+        CBlock block;
+        std::vector<bool> vMatch;
+        bool fRead;
+        bool fReady;
 
-    CBlockIndex* pindex = pindexStart;
+        Slot() : fRead(false), fReady(false) {}
+    };
+
+private:
+    const std::vector<CBlockIndex*>& vIndex;
+    const std::vector<CDiskBlockPos>& vPos;
+    const ScanScriptSet& setScripts;
+    const Consensus::Params& consensusParams;
+    std::vector<Slot> vSlot;
+
+    boost::mutex mutex;
+    boost::condition_variable condWorker;
+    boost::condition_variable condConsumer;
+    size_t nNext;
+    size_t nConsumed;
+    bool fStop;
+
+    bool IsMatch(const CTransaction& tx) const
     {
-        LOCK2(cs_main, cs_wallet);
+        BOOST_FOREACH(const CTxOut& txout, tx.vout)
+        {
+            if (setScripts.count(txout.scriptPubKey))
+                return true;
+            // only these two forms are fully decided by the snapshot,
+            // anything else gets the complete IsMine check when committed
+            if (!txout.scriptPubKey.IsPayToPublicKeyHash() && !txout.scriptPubKey.IsPayToScriptHash())
+                return true;
+        }
+        return false;
+    }
 
-        // no need to read and scan block, if block was created before
-        // our wallet birthday (as adjusted for block time variability)
-        while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
-            pindex = chainActive.Next(pindex);
+public:
+    CWalletScanPipeline(const std::vector<CBlockIndex*>& vIndexIn, const std::vector<CDiskBlockPos>& vPosIn, const ScanScriptSet& setScriptsIn,
+                        const Consensus::Params& consensusParamsIn, size_t nWindow)
+        : vIndex(vIndexIn), vPos(vPosIn), setScripts(setScriptsIn), consensusParams(consensusParamsIn), vSlot(nWindow), nNext(0), nConsumed(0), fStop(false) {}
 
-        ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
-        while (pindex)
+    void Worker()
+    {
+        while (true)
         {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+            size_t n;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && nNext < vIndex.size() && nNext >= nConsumed + vSlot.size())
+                    condWorker.wait(lock);
+                if (fStop || nNext >= vIndex.size())
+                    return;
+                n = nNext++;
+            }
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex, Params().GetConsensus());
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            // the slot belongs to this worker until it is marked ready
+            Slot& slot = vSlot[n % vSlot.size()];
+            slot.block.SetNull();
+            slot.vMatch.clear();
+            slot.fRead = ReadBlockFromDisk(slot.block, vPos[n], consensusParams);
+            if (slot.fRead && slot.block.GetHash() != vIndex[n]->GetBlockHash())
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
+                LogPrintf("CWalletScanPipeline: block at height %d does not match index %s\n", vIndex[n]->nHeight, vIndex[n]->GetBlockHash().ToString());
+                slot.fRead = false;
             }
-            pindex = chainActive.Next(pindex);
+            if (slot.fRead)
+            {
+                slot.vMatch.reserve(slot.block.vtx.size());
+                BOOST_FOREACH(const CTransaction& tx, slot.block.vtx)
+                    slot.vMatch.push_back(IsMatch(tx));
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            slot.fReady = true;
+            condConsumer.notify_all();
+        }
+    }
+
+    /** Wait for the n-th block; it stays valid until Release(n) */
+    Slot& Wait(size_t n)
+    {
+        Slot& slot = vSlot[n % vSlot.size()];
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!slot.fReady)
+            condConsumer.wait(lock);
+        return slot;
+    }
+
+    void Release(size_t n)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        vSlot[n % vSlot.size()].fReady = false;
+        nConsumed = n + 1;
+        condWorker.notify_all();
+    }
+
+    void Stop()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+        condWorker.notify_all();
+    }
+};
+
+/**
+ * Scan the block chain (starting in pindexStart) for transactions
+ * from or to us. If fUpdate is true, found transactions that already
+ * exist in the wallet will be updated.
+ */
+int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
+{
+    LOCK(cs_walletScan);
+
+    int ret = 0;
+    int64_t nNow = GetTime();
+    const CChainParams& chainParams = Params();
+
+    std::vector<CBlockIndex*> vIndex;
+    std::vector<CDiskBlockPos> vPos;
+    ScanScriptSet setScripts;
+    double dProgressStart = 0.0, dProgressTip = 0.0;
+    {
+        LOCK2(cs_main, cs_wallet);
+
+        // no need to read and scan block, if block was created before
+        // our wallet birthday (as adjusted for block time variability)
+        CBlockIndex* pindex = pindexStart;
+        while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
+            pindex = chainActive.Next(pindex);
+
+        dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+        for (; pindex; pindex = chainActive.Next(pindex))
+        {
+            vIndex.push_back(pindex);
+            vPos.push_back(pindex->GetBlockPos());
+        }
+
+        // The wallet scripts are fixed for the duration of the scan; keys
+        // added meanwhile are picked up by SyncTransaction or a later rescan
+        std::vector<CScript> vScripts;
+        GetScanScripts(vScripts);
+        setScripts.insert(vScripts.begin(), vScripts.end());
+    }
+
+    ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
+    nScanStartHeight = vIndex.empty() ? 0 : vIndex.front()->nHeight;
+    nScanHeight = nScanStartHeight - 1;
+    nScanStopHeight = vIndex.empty() ? -1 : vIndex.back()->nHeight;
+    nScanStartTime = GetTimeMillis();
+    nScanEndTime = 0;
+    nScanTxCount = 0;
+    fScanningWallet = true;
+
+    // Reading and deserializing dominates, so use every core even though the
+    // commit stage below is serial
+    int nThreads = std::max(1, std::min(GetNumCores(), (int)vIndex.size()));
+    CWalletScanPipeline pipeline(vIndex, vPos, setScripts, chainParams.GetConsensus(), nThreads * 16);
+    boost::thread_group workers;
+    for (int i = 0; i < nThreads; i++)
+        workers.create_thread(boost::bind(&CWalletScanPipeline::Worker, &pipeline));
+
+    try {
+        for (size_t i = 0; i < vIndex.size(); i++)
+        {
+            CBlockIndex* pindex = vIndex[i];
+            CWalletScanPipeline::Slot& slot = pipeline.Wait(i);
+            if (!slot.fRead)
+                LogPrintf("ScanForWalletTransactions: failed to read block %s at height %d, skipped\n", pindex->GetBlockHash().ToString(), pindex->nHeight);
+            else
+            {
+                LOCK2(cs_main, cs_wallet);
+                // the block's wallet records are written in one transaction,
+                // committed before cs_wallet is released
+                CWalletDBBatch batch(this, 0, false);
+
+                if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+                    ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+
+                for (size_t j = 0; j < slot.block.vtx.size(); j++)
+                {
+                    const CTransaction& tx = slot.block.vtx[j];
+
+                    // Transactions that neither pay a wallet script nor touch a
+                    // wallet transaction or spent outpoint cannot involve us
+                    bool fRelevant = slot.vMatch[j] || mapWallet.count(tx.GetHash());
+                    for (size_t k = 0; !fRelevant && k < tx.vin.size(); k++)
+                        fRelevant = mapWallet.count(tx.vin[k].prevout.hash) || mapTxSpends.count(tx.vin[k].prevout);
+                    if (fRelevant && AddToWalletIfInvolvingMe(tx, &slot.block, fUpdate))
+                        ret++;
+                }
+            }
+            nScanHeight = pindex->nHeight;
+            nScanTxCount += slot.block.vtx.size();
+            pipeline.Release(i);
+
             if (GetTime() >= nNow + 60) {
                 nNow = GetTime();
                 LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
             }
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+
+    } catch (...) {
+        pipeline.Stop();
+        workers.join_all();
+        fScanningWallet = false;
+        throw;
     }
+    pipeline.Stop();
+    workers.join_all();
+
+    nScanEndTime = GetTimeMillis();
+    fScanningWallet = false;
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+    LogPrint("bench", "%s: %u blocks, %d txs in %dms with %d threads\n", __func__, vIndex.size(), nScanTxCount.load(), nScanEndTime - nScanStartTime, nThreads);
     return ret;
 }
 
@@ -2097,7 +2760,7 @@ CAmount CWalletTx::GetCredit(const isminefilter& filter, const bool fAsset, cons
     return credit;
 }
 
-CAmount CWalletTx::GetLockedCredit(const bool fAsset, const uint256* pAssetId, const CBitcoinAddress* pAddress) const
+CAmount CWalletTx::GetLockedCredit(const bool fAsset, const uint256* pAssetId, const CBitcoinAddress* pAddress, bool fUseCache) const
 {
     if (pwallet == 0)
         return 0;
@@ -2109,9 +2772,11 @@ CAmount CWalletTx::GetLockedCredit(const bool fAsset, const uint256* pAssetId, c
     if (IsCoinBase() && GetBlocksToMaturity() > 0)
         return 0;
 
+    if (!fAsset && !pAddress && fUseCache && fLockedCreditCached)
+        return nLockedCreditCached;
+
     CAmount nCredit = 0;
     uint256 hashTx = GetHash();
-    int txHeight = GetTxHeight(hashTx);
     for (unsigned int i = 0; i < vout.size(); i++)
     {
         if (pwallet->IsSpent(hashTx, i))
@@ -2127,7 +2792,7 @@ CAmount CWalletTx::GetLockedCredit(const bool fAsset, const uint256* pAssetId, c
                 continue;
         }
 
-        if(!IsLockedTxOutByHeight(txHeight,txout)) // unlocked txout
+        if(!IsLockedOutput(i)) // unlocked txout
             continue;
 
         if((fAsset && !txout.IsAsset()) || (!fAsset && txout.IsAsset()))
@@ -2164,6 +2829,11 @@ CAmount CWalletTx::GetLockedCredit(const bool fAsset, const uint256* pAssetId, c
         }
     }
 
+    if(!fAsset && !pAddress)
+    {
+        nLockedCreditCached = nCredit;
+        fLockedCreditCached = true;
+    }
     return nCredit;
 }
 
@@ -2208,7 +2878,6 @@ CAmount CWalletTx::GetAvailableCredit(const bool fAsset, const uint256* pAssetId
 
     CAmount nCredit = 0;
     uint256 hashTx = GetHash();
-    int txHeight = GetTxHeight(hashTx);
     for (unsigned int i = 0; i < vout.size(); i++)
     {
         if (pwallet->IsSpent(hashTx, i))
@@ -2224,7 +2893,7 @@ CAmount CWalletTx::GetAvailableCredit(const bool fAsset, const uint256* pAssetId
                 continue;
         }
 
-        if(IsLockedTxOutByHeight(txHeight,txout)) // locked txout
+        if(IsLockedOutput(i)) // locked txout
             continue;
 
         if((fAsset && !txout.IsAsset()) || (!fAsset && txout.IsAsset()))
@@ -2298,7 +2967,7 @@ CAmount CWalletTx::GetAvailableCredit(const bool fAsset, const uint256* pAssetId
     return nCredit;
 }
 
-CAmount CWalletTx::GetLockedWatchOnlyCredit(const bool fAsset, const uint256* pAssetId, const CBitcoinAddress* pAddress) const
+CAmount CWalletTx::GetLockedWatchOnlyCredit(const bool fAsset, const uint256* pAssetId, const CBitcoinAddress* pAddress, const bool& fUseCache) const
 {
     if (pwallet == 0)
         return 0;
@@ -2310,9 +2979,11 @@ CAmount CWalletTx::GetLockedWatchOnlyCredit(const bool fAsset, const uint256* pA
     if (IsCoinBase() && GetBlocksToMaturity() > 0)
         return 0;
 
+    if (!fAsset && !pAddress && fUseCache && fLockedWatchCreditCached)
+        return nLockedWatchCreditCached;
+
     CAmount nCredit = 0;
     uint256 hashTx = GetHash();
-    int txHeight = GetTxHeight(hashTx);
     for (unsigned int i = 0; i < vout.size(); i++)
     {
         if (pwallet->IsSpent(hashTx, i))
@@ -2328,7 +2999,7 @@ CAmount CWalletTx::GetLockedWatchOnlyCredit(const bool fAsset, const uint256* pA
                 continue;
         }
 
-        if(!IsLockedTxOutByHeight(txHeight,txout)) // unlocked txout
+        if(!IsLockedOutput(i)) // unlocked txout
             continue;
 
         if((fAsset && !txout.IsAsset()) || (!fAsset && txout.IsAsset()))
@@ -2365,6 +3036,11 @@ CAmount CWalletTx::GetLockedWatchOnlyCredit(const bool fAsset, const uint256* pA
         }
     }
 
+    if(!fAsset && !pAddress)
+    {
+        nLockedWatchCreditCached = nCredit;
+        fLockedWatchCreditCached = true;
+    }
     return nCredit;
 }
 
@@ -2409,7 +3085,6 @@ CAmount CWalletTx::GetAvailableWatchOnlyCredit(const bool fAsset, const uint256*
 
     CAmount nCredit = 0;
     uint256 hashTx = GetHash();
-    int txHeight = GetTxHeight(hashTx);
     for (unsigned int i = 0; i < vout.size(); i++)
     {
         if (pwallet->IsSpent(hashTx, i))
@@ -2425,7 +3100,7 @@ CAmount CWalletTx::GetAvailableWatchOnlyCredit(const bool fAsset, const uint256*
                 continue;
         }
 
-        if(IsLockedTxOutByHeight(txHeight,txout)) // locked txout
+        if(IsLockedOutput(i)) // locked txout
             continue;
 
         if((fAsset && !txout.IsAsset()) || (!fAsset && txout.IsAsset()))
@@ -2514,13 +3189,12 @@ CAmount CWalletTx::GetAnonymizedCredit(bool fUseCache) const
 
     CAmount nCredit = 0;
     uint256 hashTx = GetHash();
-    int txHeight = GetTxHeight(hashTx);
     for (unsigned int i = 0; i < vout.size(); i++)
     {
         const CTxOut &txout = vout[i];
         const COutPoint outpoint = COutPoint(hashTx, i);
 
-        if(pwallet->IsSpent(hashTx, i) || IsLockedTxOutByHeight(txHeight,txout) || txout.vReserve.size() > TXOUT_RESERVE_MIN_SIZE || !pwallet->IsDenominated(outpoint)) continue;
+        if(pwallet->IsSpent(hashTx, i) || IsLockedOutput(i) || txout.vReserve.size() > TXOUT_RESERVE_MIN_SIZE || !pwallet->IsDenominated(outpoint)) continue;
 
         const int nRounds = pwallet->GetOutpointPrivateSendRounds(outpoint);
         if(nRounds >= privateSendClient.nPrivateSendRounds){
@@ -2559,12 +3233,11 @@ CAmount CWalletTx::GetDenominatedCredit(bool unconfirmed, bool fUseCache) const
 
     CAmount nCredit = 0;
     uint256 hashTx = GetHash();
-    int txHeight = GetTxHeight(hashTx);
     for (unsigned int i = 0; i < vout.size(); i++)
     {
         const CTxOut &txout = vout[i];
 
-        if(pwallet->IsSpent(hashTx, i) || IsLockedTxOutByHeight(txHeight,txout) || txout.vReserve.size() > TXOUT_RESERVE_MIN_SIZE || !pwallet->IsDenominatedAmount(vout[i].nValue)) continue;
+        if(pwallet->IsSpent(hashTx, i) || IsLockedOutput(i) || txout.vReserve.size() > TXOUT_RESERVE_MIN_SIZE || !pwallet->IsDenominatedAmount(vout[i].nValue)) continue;
 
         nCredit += pwallet->GetCredit(txout, ISMINE_SPENDABLE,false);
         if (!MoneyRange(nCredit))
@@ -2581,6 +3254,64 @@ CAmount CWalletTx::GetDenominatedCredit(bool unconfirmed, bool fUseCache) const
     return nCredit;
 }
 
+int CWalletTx::GetTxHeight() const
+{
+    int nDepth = GetDepthInMainChain(false);
+    if (nDepth > 0)
+        return g_nChainHeight - nDepth + 1;
+    return g_nChainHeight + 1;
+}
+
+bool CWalletTx::IsLockedOutput(unsigned int n) const
+{
+    if (n >= vout.size())
+        return false;
+
+    // Not scheduled by a wallet (e.g. a tx under construction), fall back to a direct check
+    if (!fLockedOutputsCached)
+        return IsLockedTxOut(GetHash(), vout[n]);
+
+    return setLockedOutputs.count(n) != 0;
+}
+
+void CWalletTx::UnlockOutput(unsigned int n) const
+{
+    if (!setLockedOutputs.erase(n))
+        return;
+
+    const CTxOut& txout = vout[n];
+    if (pwallet && !txout.IsAsset() && !pwallet->IsSpent(GetHash(), n))
+    {
+        CAmount nSpendable = pwallet->GetCredit(txout, ISMINE_SPENDABLE);
+        CAmount nWatchOnly = pwallet->GetCredit(txout, ISMINE_WATCH_ONLY);
+        if (fLockedCreditCached && fAvailableCreditCached)
+        {
+            nLockedCreditCached -= nSpendable;
+            nAvailableCreditCached += nSpendable;
+        }
+        else
+        {
+            fLockedCreditCached = false;
+            fAvailableCreditCached = false;
+        }
+        if (fLockedWatchCreditCached && fAvailableWatchCreditCached)
+        {
+            nLockedWatchCreditCached -= nWatchOnly;
+            nAvailableWatchCreditCached += nWatchOnly;
+        }
+        else
+        {
+            fLockedWatchCreditCached = false;
+            fAvailableWatchCreditCached = false;
+        }
+    }
+
+    // a newly spendable output may be denominated
+    fAnonymizedCreditCached = false;
+    fDenomUnconfCreditCached = false;
+    fDenomConfCreditCached = false;
+}
+
 CAmount CWalletTx::GetChange(const bool fAsset) const
 {
     if(!fAsset)
@@ -2626,14 +3357,14 @@ bool CWalletTx::IsTrusted() const
     // Trusted if all inputs are from us and are in the mempool:
     BOOST_FOREACH(const CTxIn& txin, vin)
     {
-        CCoins coins;
-        if(GetUTXOCoins(txin.prevout, coins)) // if txin is put-candy-txout
+        Coin coin;
+        if(GetUTXOCoin(txin.prevout, coin)) // if txin is put-candy-txout
         {
             uint32_t nAppCmd = 0;
-            if(coins.vout[txin.prevout.n].IsAsset(&nAppCmd) && nAppCmd == PUT_CANDY_CMD && txin.scriptSig.empty())
+            if(coin.out.IsAsset(&nAppCmd) && nAppCmd == PUT_CANDY_CMD && txin.scriptSig.empty())
             {
                 CTxDestination dest;
-                if(ExtractDestination(coins.vout[txin.prevout.n].scriptPubKey, dest))
+                if(ExtractDestination(coin.out.scriptPubKey, dest))
                 {
                     CBitcoinAddress address(dest);
                     if(address.IsValid() && address.ToString() == g_strPutCandyAddress)
@@ -3109,149 +3840,167 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        // setWalletUTXO holds every unspent output of ours, ordered so that the
+        // outputs of a transaction are adjacent: the transaction checks run once
+        // per transaction with unspent outputs instead of once per wallet entry
+        uint256 wtxid;
+        const CWalletTx* pcoin = NULL;
+        bool fTxUsable = false;
+        int nDepth = 0;
+        int nBlockHeight = 0;
+        BOOST_FOREACH(const COutPoint& outpoint, setWalletUTXO)
         {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (!CheckFinalTx(*pcoin))
-                continue;
+            if (outpoint.hash != wtxid)
+            {
+                wtxid = outpoint.hash;
+                fTxUsable = false;
+                map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+                if (it == mapWallet.end())
+                    continue;
+                pcoin = &(*it).second;
 
-            if (fOnlyConfirmed && !pcoin->IsTrusted())
-                continue;
+                if (!CheckFinalTx(*pcoin))
+                    continue;
 
-            if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+                if (fOnlyConfirmed && !pcoin->IsTrusted())
+                    continue;
 
-            int nDepth = pcoin->GetDepthInMainChain(false);
-            if(pcoin->IsForbid())
-                continue;
+                if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
+                    continue;
 
-            int nBlockHeight = g_nChainHeight + 1;
-			if (nDepth > 0)
-			{
-				nBlockHeight = g_nChainHeight - nDepth + 1;
-			}
+                nDepth = pcoin->GetDepthInMainChain(false);
+                if(pcoin->IsForbid())
+                    continue;
 
-            // do not use IX for inputs that have less then INSTANTSEND_CONFIRMATIONS_REQUIRED blockchain confirmations
-            if (fUseInstantSend && nDepth < INSTANTSEND_CONFIRMATIONS_REQUIRED)
-                continue;
+                nBlockHeight = g_nChainHeight + 1;
+                if (nDepth > 0)
+                {
+                    nBlockHeight = g_nChainHeight - nDepth + 1;
+                }
 
-            // We should not consider coins which aren't at least in our mempool
-            // It's possible for these to be conflicted via ancestors which we may never be able to detect
-            if (nDepth == 0 && !pcoin->InMempool())
-                continue;
+                // do not use IX for inputs that have less then INSTANTSEND_CONFIRMATIONS_REQUIRED blockchain confirmations
+                if (fUseInstantSend && nDepth < INSTANTSEND_CONFIRMATIONS_REQUIRED)
+                    continue;
 
-            if(pcoin->InMempool())
-            {
-                LOCK(mempool.cs);
-                CTxMemPool::setEntries setAncestors;
-                size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
-                size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
-                size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
-                size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
-                std::string errString;
-                if (!mempool.CalculateMemPoolAncestors(*mempool.mapTx.find(pcoin->GetHash()), setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString))
+                // We should not consider coins which aren't at least in our mempool
+                // It's possible for these to be conflicted via ancestors which we may never be able to detect
+                if (nDepth == 0 && !pcoin->InMempool())
                     continue;
+
+                if(pcoin->InMempool())
+                {
+                    LOCK(mempool.cs);
+                    CTxMemPool::setEntries setAncestors;
+                    size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+                    size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
+                    size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+                    size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
+                    std::string errString;
+                    if (!mempool.CalculateMemPoolAncestors(*mempool.mapTx.find(pcoin->GetHash()), setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString))
+                        continue;
+                }
+
+                fTxUsable = true;
             }
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                //if(!fContainLockedTxOut && IsLockedTxOut(wtxid, pcoin->vout[i]) && nCoinType != ONLY_1000)
-                if(!fContainLockedTxOut && IsLockedTxOutByHeight(nBlockHeight, pcoin->vout[i]) && nCoinType != ONLY_1000)
-                    continue;
+            if (!fTxUsable)
+                continue;
 
-                if((fAsset && !pcoin->vout[i].IsAsset()) || (!fAsset && pcoin->vout[i].IsAsset()))
+            const unsigned int i = outpoint.n;
+            if(!fContainLockedTxOut && pcoin->IsLockedOutput(i) && nCoinType != ONLY_1000)
+                continue;
+
+            if((fAsset && !pcoin->vout[i].IsAsset()) || (!fAsset && pcoin->vout[i].IsAsset()))
+                continue;
+
+            if(fAsset)
+            {
+                CAppHeader header;
+                std::vector<unsigned char> vData;
+                if(!ParseReserve(pcoin->vout[i].vReserve, header, vData))
                     continue;
 
-                if(fAsset)
+                if(header.nAppCmd == ISSUE_ASSET_CMD || header.nAppCmd == ADD_ASSET_CMD || header.nAppCmd == GET_CANDY_CMD)
                 {
-                    CAppHeader header;
-                    std::vector<unsigned char> vData;
-                    if(!ParseReserve(pcoin->vout[i].vReserve, header, vData))
+                    if(nDepth <= 0)
                         continue;
-
-                    if(header.nAppCmd == ISSUE_ASSET_CMD || header.nAppCmd == ADD_ASSET_CMD || header.nAppCmd == GET_CANDY_CMD)
-                    {
-                        if(nDepth <= 0)
-                            continue;
-                    }
-
-                    if(header.nAppCmd == ISSUE_ASSET_CMD)
-                    {
-                        CAssetData assetData;
-                        if(!ParseIssueData(vData, assetData))
-                            continue;
-                        if(assetData.GetHash() != *pAssetId)
-                            continue;
-                    }
-                    else if(header.nAppCmd == ADD_ASSET_CMD || header.nAppCmd == TRANSFER_ASSET_CMD || header.nAppCmd == CHANGE_ASSET_CMD)
-                    {
-                        CCommonData commonData;
-                        if(!ParseCommonData(vData, commonData))
-                            continue;
-                        if(commonData.assetId != *pAssetId)
-                            continue;
-                    }
-                    else if(header.nAppCmd == GET_CANDY_CMD)
-                    {
-                        CGetCandyData candyData;
-                        if(!ParseGetCandyData(vData, candyData))
-                            continue;
-                        if(candyData.assetId != *pAssetId)
-                            continue;
-                    }
                 }
-                else
+
+                if(header.nAppCmd == ISSUE_ASSET_CMD)
                 {
-                    CAppHeader header;
-                    std::vector<unsigned char> vData;
-                    if(ParseReserve(pcoin->vout[i].vReserve, header, vData))
-                    {
-                        if(header.nAppCmd == REGISTER_APP_CMD || header.nAppCmd == ADD_AUTH_CMD || header.nAppCmd == DELETE_AUTH_CMD || header.nAppCmd == CREATE_EXTEND_TX_CMD)
-                        {
-                            if(nDepth <= 0)
-                                continue;
-                        }
-                    }
+                    CAssetData assetData;
+                    if(!ParseIssueData(vData, assetData))
+                        continue;
+                    if(assetData.GetHash() != *pAssetId)
+                        continue;
                 }
-
-                bool found = false;
-                if(nCoinType == ONLY_DENOMINATED) {
-                    found = IsDenominatedAmount(pcoin->vout[i].nValue);
-                } else if(nCoinType == ONLY_NOT1000IFMN) {
-                    found = !(fMasterNode && pcoin->vout[i].nValue == 1000*COIN && GetLockedMonthByHeight(nBlockHeight, pcoin->vout[i]) >= MIN_MN_LOCKED_MONTH);
-                } else if(nCoinType == ONLY_NONDENOMINATED_NOT1000IFMN) {
-                    if (IsCollateralAmount(pcoin->vout[i].nValue)) continue; // do not use collateral amounts
-                    found = !IsDenominatedAmount(pcoin->vout[i].nValue);
-                    if(found && fMasterNode) found = !(pcoin->vout[i].nValue == 1000*COIN && GetLockedMonthByHeight(nBlockHeight, pcoin->vout[i]) >= MIN_MN_LOCKED_MONTH); // do not use Hot MN funds
-                } else if(nCoinType == ONLY_1000) {
-                    found = (pcoin->vout[i].nValue == 1000*COIN && GetLockedMonthByHeight(nBlockHeight, pcoin->vout[i]) >= MIN_MN_LOCKED_MONTH);
-                } else if(nCoinType == ONLY_PRIVATESEND_COLLATERAL) {
-                    found = IsCollateralAmount(pcoin->vout[i].nValue);
-                } else {
-                    found = true;
+                else if(header.nAppCmd == ADD_ASSET_CMD || header.nAppCmd == TRANSFER_ASSET_CMD || header.nAppCmd == CHANGE_ASSET_CMD)
+                {
+                    CCommonData commonData;
+                    if(!ParseCommonData(vData, commonData))
+                        continue;
+                    if(commonData.assetId != *pAssetId)
+                        continue;
                 }
-                if(!found) continue;
-
-                if(pFixedSrcAddress && pFixedSrcAddress->IsValid())
+                else if(header.nAppCmd == GET_CANDY_CMD)
                 {
-                    CTxDestination dest;
-                    if(!ExtractDestination(pcoin->vout[i].scriptPubKey, dest))
+                    CGetCandyData candyData;
+                    if(!ParseGetCandyData(vData, candyData))
                         continue;
-                    if(!(*pFixedSrcAddress == CBitcoinAddress(dest)))
+                    if(candyData.assetId != *pAssetId)
                         continue;
                 }
+            }
+            else
+            {
+                CAppHeader header;
+                std::vector<unsigned char> vData;
+                if(ParseReserve(pcoin->vout[i].vReserve, header, vData))
+                {
+                    if(header.nAppCmd == REGISTER_APP_CMD || header.nAppCmd == ADD_AUTH_CMD || header.nAppCmd == DELETE_AUTH_CMD || header.nAppCmd == CREATE_EXTEND_TX_CMD)
+                    {
+                        if(nDepth <= 0)
+                            continue;
+                    }
+                }
+            }
+
+            bool found = false;
+            if(nCoinType == ONLY_DENOMINATED) {
+                found = IsDenominatedAmount(pcoin->vout[i].nValue);
+            } else if(nCoinType == ONLY_NOT1000IFMN) {
+                found = !(fMasterNode && pcoin->vout[i].nValue == 1000*COIN && GetLockedMonthByHeight(nBlockHeight, pcoin->vout[i]) >= MIN_MN_LOCKED_MONTH);
+            } else if(nCoinType == ONLY_NONDENOMINATED_NOT1000IFMN) {
+                if (IsCollateralAmount(pcoin->vout[i].nValue)) continue; // do not use collateral amounts
+                found = !IsDenominatedAmount(pcoin->vout[i].nValue);
+                if(found && fMasterNode) found = !(pcoin->vout[i].nValue == 1000*COIN && GetLockedMonthByHeight(nBlockHeight, pcoin->vout[i]) >= MIN_MN_LOCKED_MONTH); // do not use Hot MN funds
+            } else if(nCoinType == ONLY_1000) {
+                found = (pcoin->vout[i].nValue == 1000*COIN && GetLockedMonthByHeight(nBlockHeight, pcoin->vout[i]) >= MIN_MN_LOCKED_MONTH);
+            } else if(nCoinType == ONLY_PRIVATESEND_COLLATERAL) {
+                found = IsCollateralAmount(pcoin->vout[i].nValue);
+            } else {
+                found = true;
+            }
+            if(!found) continue;
 
-                isminetype mine = IsMine(pcoin->vout[i]);
-                if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    (!IsFrozenCoin((*it).first, i) || nCoinType == ONLY_1000) &&
-                    (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(COutPoint((*it).first, i))))
-                        vCoins.push_back(COutput(pcoin, i, nDepth,
-                                                 ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
-                                                  (coinControl && coinControl->fAllowWatchOnly && (mine & ISMINE_WATCH_SOLVABLE) != ISMINE_NO),
-                                                 (mine & (ISMINE_SPENDABLE | ISMINE_WATCH_SOLVABLE)) != ISMINE_NO));
+            if(pFixedSrcAddress && pFixedSrcAddress->IsValid())
+            {
+                CTxDestination dest;
+                if(!ExtractDestination(pcoin->vout[i].scriptPubKey, dest))
+                    continue;
+                if(!(*pFixedSrcAddress == CBitcoinAddress(dest)))
+                    continue;
             }
+
+            isminetype mine = IsMine(pcoin->vout[i]);
+            if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
+                (!IsFrozenCoin(wtxid, i) || nCoinType == ONLY_1000) &&
+                (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
+                (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(outpoint)))
+                    vCoins.push_back(COutput(pcoin, i, nDepth,
+                                             ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
+                                              (coinControl && coinControl->fAllowWatchOnly && (mine & ISMINE_WATCH_SOLVABLE) != ISMINE_NO),
+                                             (mine & (ISMINE_SPENDABLE | ISMINE_WATCH_SOLVABLE)) != ISMINE_NO));
         }
     }
 }
@@ -3315,6 +4064,79 @@ static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,uns
     }
 }
 
+/** Change below the dust threshold is added to the fee, so selections within it need no change output */
+static CAmount GetChangeWindow()
+{
+    return CTxOut(0, GetScriptForDestination(CKeyID())).GetDustThreshold(::minRelayTxFee);
+}
+
+/**
+ * Depth first branch and bound search over vValue (sorted by descending value)
+ * for the selection with the fewest inputs, at most nMaxInputs, whose total is
+ * in [nTargetValue, nTargetValue + nWindow]; among those with equally few
+ * inputs the one with the least excess wins. Branches that cannot reach the
+ * target with the remaining coins, overshoot the window or cannot beat the best
+ * input count are cut, and the search stops after SELECT_COINS_BNB_TRIES steps.
+ */
+static bool SelectCoinsBnB(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTargetValue, const CAmount& nWindow,
+                           size_t nMaxInputs, vector<char>& vfBest, CAmount& nBest)
+{
+    size_t nCoins = vValue.size();
+    vector<CAmount> vRemaining(nCoins + 1, 0);
+    for (size_t i = nCoins; i-- > 0;)
+        vRemaining[i] = vRemaining[i + 1] + vValue[i].first;
+    if (vRemaining[0] < nTargetValue)
+        return false;
+
+    vector<size_t> vSelected;
+    size_t nBestInputs = nMaxInputs;
+    bool fFound = false;
+    CAmount nTotal = 0;
+    size_t i = 0;
+    for (int nTries = 0; nTries < SELECT_COINS_BNB_TRIES; nTries++)
+    {
+        bool fBacktrack = false;
+        if (nTotal >= nTargetValue)
+        {
+            if (!fFound || vSelected.size() < nBestInputs || nTotal < nBest)
+            {
+                fFound = true;
+                nBestInputs = vSelected.size();
+                nBest = nTotal;
+                vfBest.assign(nCoins, false);
+                for (size_t j = 0; j < vSelected.size(); j++)
+                    vfBest[vSelected[j]] = true;
+                if (nBest == nTargetValue && nBestInputs == 1)
+                    break;
+            }
+            fBacktrack = true;
+        }
+        else if (i >= nCoins || nTotal + vRemaining[i] < nTargetValue || vSelected.size() + 1 > nBestInputs)
+            fBacktrack = true;
+        else if (nTotal + vValue[i].first <= nTargetValue + nWindow)
+        {
+            vSelected.push_back(i);
+            nTotal += vValue[i].first;
+            i++;
+        }
+        else
+            i++;
+
+        if (fBacktrack)
+        {
+            if (vSelected.empty())
+                break;
+            // continue with the last selected coin left out, skipping coins of
+            // the same value as they would only repeat the same branch
+            size_t nLast = vSelected.back();
+            vSelected.pop_back();
+            nTotal -= vValue[nLast].first;
+            for (i = nLast + 1; i < nCoins && vValue[i].first == vValue[nLast].first; i++);
+        }
+    }
+    return fFound;
+}
+
 // move denoms down
 bool less_then_denom (const COutput& out1, const COutput& out2)
 {
@@ -3332,7 +4154,7 @@ bool less_then_denom (const COutput& out1, const COutput& out2)
 }
 
 bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins,
-                                 set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, bool fUseInstantSend) const
+                                 set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, bool fUseInstantSend, const CAmount& nChangeWindow) const
 {
     setCoinsRet.clear();
     nValueRet = 0;
@@ -3453,6 +4275,28 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
         LogPrint("selectcoins", "%s - total %s\n", s, FormatMoney(nBest));
     }
 
+    // The selection above leaves change; a selection without change and no
+    // more inputs makes a strictly smaller transaction
+    if (fSelectCoinsBnB && !fUseInstantSend && nValueRet - nTargetValue > nChangeWindow)
+    {
+        vector<char> vfBnB;
+        CAmount nBnB = 0;
+        if (SelectCoinsBnB(vValue, nTargetValue, nChangeWindow, setCoinsRet.size(), vfBnB, nBnB))
+        {
+            setCoinsRet.clear();
+            nValueRet = 0;
+            for (unsigned int i = 0; i < vValue.size(); i++)
+            {
+                if (vfBnB[i])
+                {
+                    setCoinsRet.insert(vValue[i].second);
+                    nValueRet += vValue[i].first;
+                }
+            }
+            LogPrint("selectcoins", "CWallet::SelectCoinsMinConf branch and bound: %u inputs - total %s\n", setCoinsRet.size(), FormatMoney(nBnB));
+        }
+    }
+
     return true;
 }
 
@@ -3537,10 +4381,12 @@ bool CWallet::SelectCoins(const CAmount& nTargetValue, set<pair<const CWalletTx*
             ++it;
     }
 
+    // asset change is never dropped, so only exact asset selections avoid it
+    CAmount nChangeWindow = fAsset ? 0 : GetChangeWindow();
     bool res = nTargetValue <= nValueFromPresetInputs ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 6, vCoins, setCoinsRet, nValueRet, fUseInstantSend) ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 1, vCoins, setCoinsRet, nValueRet, fUseInstantSend) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, vCoins, setCoinsRet, nValueRet, fUseInstantSend));
+        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 6, vCoins, setCoinsRet, nValueRet, fUseInstantSend, nChangeWindow) ||
+        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 1, vCoins, setCoinsRet, nValueRet, fUseInstantSend, nChangeWindow) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, vCoins, setCoinsRet, nValueRet, fUseInstantSend, nChangeWindow));
 
     // because SelectCoinsMinConf clears the setCoinsRet, we now add the possible inputs to the coinset
     setCoinsRet.insert(setPresetCoins.begin(), setPresetCoins.end());
@@ -3719,7 +4565,7 @@ bool CWallet::SelectCoinsGrouppedByAddresses(std::vector<CompactTallyItem>& vecT
         if(fSkipUnconfirmed && !wtx.IsTrusted()) continue;
 
         for (unsigned int i = 0; i < wtx.vout.size(); i++) {
-            if(IsLockedTxOut(outpoint.hash, wtx.vout[i])) continue;
+            if(wtx.IsLockedOutput(i)) continue;
 
             if(wtx.vout[i].vReserve.size() > TXOUT_RESERVE_MIN_SIZE) continue;
 
@@ -3911,7 +4757,7 @@ int CWallet::CountInputsWithAmount(CAmount nInputAmount)
                 for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
                     COutput out = COutput(pcoin, i, nDepth, true, true);
                     COutPoint outpoint = COutPoint(out.tx->GetHash(), out.i);
-                    if(IsLockedTxOut(out.tx->GetHash(), out.tx->vout[out.i])) continue;
+                    if(out.tx->IsLockedOutput(out.i)) continue;
                     if(out.tx->vout[out.i].vReserve.size() > TXOUT_RESERVE_MIN_SIZE) continue;
                     if(out.tx->vout[out.i].nValue != nInputAmount) continue;
                     if(!IsDenominatedAmount(pcoin->vout[i].nValue)) continue;
@@ -5175,14 +6021,14 @@ bool CWallet::CreateAssetTransaction(const CAppHeader* pHeader, const void* pBod
                 if(pHeader->nAppCmd == GET_CANDY_CMD)
                 {
                     const COutPoint& out = ((const CPutCandy_IndexKey*)pBody)->out;
-                    CCoins coins;
-                    if(!GetUTXOCoins(out, coins))
+                    Coin coin;
+                    if(!GetUTXOCoin(out, coin))
                     {
                         strFailReason = _("Get candy information failed");
                         return false;
                     }
                     CTxIn txin = CTxIn(out.hash, out.n, CScript(), std::numeric_limits<unsigned int>::max() - 1);
-                    txin.prevPubKey = coins.vout[out.n].scriptPubKey;
+                    txin.prevPubKey = coin.out.scriptPubKey;
                     txNew.vin.push_back(txin);
                 }
 
@@ -5316,28 +6162,868 @@ bool CWallet::CreateAssetTransaction(const CAppHeader* pHeader, const void* pBod
 
 
 
-/**
- * Call after CreateTransaction unless you want to abort
- */
-bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CConnman* connman, std::string strCommand)
+/** Pick coins for nTargetValue from a shared pool without removing them */
+static bool SelectPayoutCoins(const CWallet* pwallet, const CAmount& nTargetValue, const std::vector<COutput>& vCoins, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, bool fAsset)
+{
+    setCoinsRet.clear();
+    nValueRet = 0;
+    if (nTargetValue <= 0)
+        return true;
+    CAmount nChangeWindow = fAsset ? 0 : GetChangeWindow();
+    return pwallet->SelectCoinsMinConf(nTargetValue, 1, 6, vCoins, setCoinsRet, nValueRet, false, nChangeWindow) ||
+           pwallet->SelectCoinsMinConf(nTargetValue, 1, 1, vCoins, setCoinsRet, nValueRet, false, nChangeWindow) ||
+           (bSpendZeroConfChange && pwallet->SelectCoinsMinConf(nTargetValue, 0, 1, vCoins, setCoinsRet, nValueRet, false, nChangeWindow));
+}
+
+/** Drop coins taken by one payout transaction from the pool shared by the rest */
+static void RemovePayoutCoins(std::vector<COutput>& vCoins, const set<pair<const CWalletTx*,unsigned int> >& setCoins)
 {
+    if (setCoins.empty())
+        return;
+    vector<COutput>::iterator it = vCoins.begin();
+    while (it != vCoins.end())
     {
-        LOCK2(cs_main, cs_wallet);
-        LogPrintf("CommitTransaction:\n%s", wtxNew.ToString());
-        {
-            // This is only to keep the database open to defeat the auto-flush for the
-            // duration of this scope.  This is the only place where this optimization
-            // maybe makes sense; please don't do it anywhere else.
-            CWalletDB* pwalletdb = fFileBacked ? new CWalletDB(strWalletFile,"r+") : NULL;
+        if (setCoins.count(make_pair(it->tx, (unsigned int)it->i)))
+            it = vCoins.erase(it);
+        else
+            ++it;
+    }
+}
 
-            // Take key pair from key pool so it won't be used again
-            reservekey.KeepKey();
+static bool HasPayoutCoinWithScript(const set<pair<const CWalletTx*,unsigned int> >& setCoins, const CScript& script)
+{
+    BOOST_FOREACH(const PAIRTYPE(const CWalletTx*, unsigned int)& coin, setCoins)
+    {
+        if (coin.first->vout[coin.second].scriptPubKey == script)
+            return true;
+    }
+    return false;
+}
 
-            // Add tx to wallet, because if it has change it's also ours,
-            // otherwise just for transaction history.
-            AddToWallet(wtxNew, false, pwalletdb);
+/** Worker of the payout signing pool: signs inputs until the job list is exhausted */
+static void SignPayoutInputs(const CKeyStore* pkeystore, const std::vector<CTransaction>* pvTxConst, std::vector<CMutableTransaction>* pvTx,
+                             const std::vector<std::pair<size_t, unsigned int> >* pvJobs, std::atomic<size_t>* pnNextJob, std::atomic<bool>* pfFailed)
+{
+    while (!*pfFailed)
+    {
+        size_t nJob = (*pnNextJob)++;
+        if (nJob >= pvJobs->size())
+            return;
 
-            // Notify that old coins are spent
+        size_t nTx = (*pvJobs)[nJob].first;
+        unsigned int nIn = (*pvJobs)[nJob].second;
+        CTxIn& txin = (*pvTx)[nTx].vin[nIn];
+        if (!ProduceSignature(TransactionSignatureCreator(pkeystore, &(*pvTxConst)[nTx], nIn, SIGHASH_ALL), txin.prevPubKey, txin.scriptSig))
+            *pfFailed = true;
+    }
+}
+
+// Each job writes only its own scriptSig, and SIGHASH_ALL ignores the other
+// scriptSigs, so the jobs are independent.
+bool SignPayoutTransactions(const CKeyStore* pkeystore, std::vector<CMutableTransaction>& vTx, unsigned int nUnsignedTail, size_t& nInputsRet, int& nThreadsRet)
+{
+    vector<CTransaction> vTxConst(vTx.begin(), vTx.end());
+    vector<std::pair<size_t, unsigned int> > vJobs;
+    for (size_t i = 0; i < vTx.size(); i++)
+        for (unsigned int j = 0; j + nUnsignedTail < vTx[i].vin.size(); j++)
+            vJobs.push_back(make_pair(i, j));
+
+    std::atomic<size_t> nNextJob(0);
+    std::atomic<bool> fSignFailed(false);
+    int nThreads = std::min(GetNumCores(), (int)(vJobs.size() / 64)) - 1;
+    boost::thread_group signers;
+    for (int i = 0; i < nThreads; i++)
+        signers.create_thread(boost::bind(&SignPayoutInputs, pkeystore, &vTxConst, &vTx, &vJobs, &nNextJob, &fSignFailed));
+    SignPayoutInputs(pkeystore, &vTxConst, &vTx, &vJobs, &nNextJob, &fSignFailed);
+    signers.join_all();
+
+    nInputsRet = vJobs.size();
+    nThreadsRet = std::max(nThreads, 0) + 1;
+    return !fSignFailed;
+}
+
+bool CWallet::CreateAssetPayoutTransactions(const CAppHeader& header, const CCommonData& transferData, const vector<CRecipient>& vecSend, unsigned int nMaxOutputs,
+                                            vector<CWalletTx>& vwtxNew, CReserveKey& reservekey, CAmount& nFeeRet, std::string& strFailReason)
+{
+    if(!masternodeSync.IsBlockchainSynced())
+    {
+        strFailReason = _("Synchronizing block data");
+        return false;
+    }
+
+    if (vecSend.empty() || nMaxOutputs == 0)
+    {
+        strFailReason = _("Transaction amounts must be positive");
+        return false;
+    }
+
+    BOOST_FOREACH (const CRecipient& recipient, vecSend)
+    {
+        if (recipient.nAmount <= 0 || !recipient.fAsset)
+        {
+            strFailReason = _("Transaction amounts must be positive");
+            return false;
+        }
+
+        if(recipient.nLockedMonth != 0 && !IsLockedMonthRange(recipient.nLockedMonth))
+        {
+            strFailReason = _("Invalid locked month (min: 0, max: 120)");
+            return false;
+        }
+    }
+
+    vwtxNew.clear();
+    nFeeRet = 0;
+
+    vector<CMutableTransaction> vTx;
+    {
+        LOCK2(cs_main, cs_wallet);
+
+        CAssetId_AssetInfo_IndexValue assetInfo;
+        if(!GetAssetInfoByAssetId(transferData.assetId, assetInfo, false))
+        {
+            strFailReason = _("Cannot get asset info by asset id");
+            return false;
+        }
+        CScript scriptAdmin = GetScriptForDestination(CBitcoinAddress(assetInfo.strAdminAddress).Get());
+        CScript scriptReserved;
+
+        // One snapshot of the spendable coins serves every transaction of the
+        // payout; coins taken by one transaction are removed from the pool, so
+        // the transactions never conflict with each other.
+        vector<COutput> vSafeCoins, vAssetCoins;
+        AvailableCoins(vSafeCoins, true, NULL, false, ALL_COINS, false);
+        AvailableCoins(vAssetCoins, true, NULL, false, ALL_COINS, false, false, NULL, true, &transferData.assetId);
+
+        size_t nNext = 0;
+        while (nNext < vecSend.size())
+        {
+            // vouts to the payees, bounded by count and serialized size
+            vector<CTxOut> vPayout;
+            CAmount nAssetValue = 0;
+            unsigned int nPayoutSize = 0;
+            for (; nNext < vecSend.size() && vPayout.size() < nMaxOutputs; nNext++)
+            {
+                const CRecipient& recipient = vecSend[nNext];
+                CTxOut txout(recipient.nAmount, recipient.scriptPubKey, recipient.nLockedMonth <= 0 ? 0 : g_nChainHeight + 1 + recipient.nLockedMonth * BLOCKS_PER_MONTH);
+                CCommonData commonData(transferData);
+                commonData.nAmount = recipient.nAmount;
+                commonData.strRemarks = recipient.strMemo;
+                txout.vReserve = FillCommonData(header, commonData);
+
+                unsigned int nSize = ::GetSerializeSize(txout, SER_NETWORK, PROTOCOL_VERSION);
+                if (!vPayout.empty() && nPayoutSize + nSize > MAX_ASSET_PAYOUT_OUTPUTS_SIZE)
+                    break;
+                nPayoutSize += nSize;
+                nAssetValue += recipient.nAmount;
+                vPayout.push_back(txout);
+            }
+
+            set<pair<const CWalletTx*,unsigned int> > setAssetCoins;
+            CAmount nAssetValueIn = 0;
+            if (!SelectPayoutCoins(this, nAssetValue, vAssetCoins, setAssetCoins, nAssetValueIn, true))
+            {
+                strFailReason = _("Insufficient asset funds.");
+                return false;
+            }
+
+            CMutableTransaction txNew;
+            set<pair<const CWalletTx*,unsigned int> > setCoins;
+            CAmount nFee = 0;
+            // Start with no fee and loop until there is enough fee
+            while (true)
+            {
+                CAmount nValueIn = 0;
+                if (!SelectPayoutCoins(this, nFee, vSafeCoins, setCoins, nValueIn, false))
+                {
+                    strFailReason = _("Insufficient safe funds.");
+                    return false;
+                }
+
+                txNew = CMutableTransaction();
+                txNew.nLockTime = chainActive.Height();
+                txNew.vout = vPayout;
+
+                const CAmount nChange = nValueIn - nFee;
+                if (nChange > 0)
+                {
+                    CScript scriptChange;
+                    if (HasPayoutCoinWithScript(setCoins, scriptAdmin))
+                        scriptChange = scriptAdmin;
+                    else
+                    {
+                        if (scriptReserved.empty())
+                        {
+                            CPubKey vchPubKey;
+                            if (!reservekey.GetReservedKey(vchPubKey, true))
+                            {
+                                strFailReason = _("Keypool ran out, please call keypoolrefill first");
+                                return false;
+                            }
+                            scriptReserved = GetScriptForDestination(vchPubKey.GetID());
+                        }
+                        scriptChange = scriptReserved;
+                    }
+
+                    // Never create dust outputs; if we would, just add the dust to the fee.
+                    CTxOut changeTxOut(nChange, scriptChange);
+                    if (changeTxOut.IsDust(::minRelayTxFee))
+                        nFee += nChange;
+                    else
+                        txNew.vout.push_back(changeTxOut);
+                }
+
+                const CAmount nAssetChange = nAssetValueIn - nAssetValue;
+                if (nAssetChange > 0)
+                {
+                    CScript scriptChange;
+                    if (HasPayoutCoinWithScript(setAssetCoins, scriptAdmin))
+                        scriptChange = scriptAdmin;
+                    else
+                    {
+                        if (scriptReserved.empty())
+                        {
+                            CPubKey vchPubKey;
+                            if (!reservekey.GetReservedKey(vchPubKey, true))
+                            {
+                                strFailReason = _("Keypool ran out, please call keypoolrefill first");
+                                return false;
+                            }
+                            scriptReserved = GetScriptForDestination(vchPubKey.GetID());
+                        }
+                        scriptChange = scriptReserved;
+                    }
+
+                    CTxOut assetChangeTxOut(nAssetChange, scriptChange);
+                    CAppHeader changeHeader(header.nVersion, header.appId, CHANGE_ASSET_CMD);
+                    assetChangeTxOut.vReserve = FillCommonData(changeHeader, CCommonData(transferData.assetId, nAssetChange, ""));
+                    txNew.vout.push_back(assetChangeTxOut);
+                }
+
+                // Fill vin
+                //
+                // Note how the sequence number is set to max()-1 so that the
+                // nLockTime set above actually works.
+                BOOST_FOREACH(const PAIRTYPE(const CWalletTx*, unsigned int)& coin, setCoins)
+                {
+                    CTxIn txin(coin.first->GetHash(), coin.second, CScript(), std::numeric_limits<unsigned int>::max() - 1);
+                    txin.prevPubKey = coin.first->vout[coin.second].scriptPubKey;
+                    txNew.vin.push_back(txin);
+                }
+                BOOST_FOREACH(const PAIRTYPE(const CWalletTx*, unsigned int)& coin, setAssetCoins)
+                {
+                    CTxIn txin(coin.first->GetHash(), coin.second, CScript(), std::numeric_limits<unsigned int>::max() - 1);
+                    txin.prevPubKey = coin.first->vout[coin.second].scriptPubKey;
+                    txNew.vin.push_back(txin);
+                }
+                sort(txNew.vin.begin(), txNew.vin.end(), CompareInputBIP69());
+                sort(txNew.vout.begin(), txNew.vout.end(), CompareOutputBIP69());
+
+                // Size with dummy signatures; the real ones are made for all
+                // transactions at once below
+                BOOST_FOREACH(CTxIn& txin, txNew.vin)
+                {
+                    if (!ProduceSignature(DummySignatureCreator(this), txin.prevPubKey, txin.scriptSig))
+                    {
+                        strFailReason = _("Signing transaction failed");
+                        return false;
+                    }
+                }
+                unsigned int nBytes = ::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION);
+                BOOST_FOREACH(CTxIn& txin, txNew.vin)
+                    txin.scriptSig = CScript();
+
+                if (nBytes >= MAX_STANDARD_TX_SIZE)
+                {
+                    strFailReason = _("Transaction too large");
+                    return false;
+                }
+
+                CAmount nFeeNeeded = GetMinimumFee(nBytes, nTxConfirmTarget, mempool);
+                CAmount nAdditionalFee = GetTxAdditionalFee(txNew);
+                if(nAdditionalFee < 0)
+                {
+                    strFailReason = _("Transaction reserver is too large");
+                    return false;
+                }
+                nFeeNeeded += nAdditionalFee;
+
+                if (nFeeNeeded < ::minRelayTxFee.GetFee(nBytes))
+                {
+                    strFailReason = _("Transaction too large for fee policy");
+                    return false;
+                }
+
+                if (nFee >= nFeeNeeded)
+                    break; // Done, enough fee included.
+
+                // Include more fee and try again.
+                nFee = nFeeNeeded;
+            }
+
+            RemovePayoutCoins(vSafeCoins, setCoins);
+            RemovePayoutCoins(vAssetCoins, setAssetCoins);
+            nFeeRet += nFee;
+            vTx.push_back(txNew);
+        }
+
+        if (scriptReserved.empty())
+            reservekey.ReturnKey();
+    }
+
+    size_t nInputs = 0;
+    int nThreads = 0;
+    if (!SignPayoutTransactions(this, vTx, 0, nInputs, nThreads))
+    {
+        strFailReason = _("Signing transaction failed");
+        return false;
+    }
+
+    BOOST_FOREACH(const CMutableTransaction& tx, vTx)
+    {
+        CWalletTx wtx;
+        wtx.fTimeReceivedIsTxTime = true;
+        wtx.fFromMe = true;
+        wtx.BindWallet(this);
+        *static_cast<CTransaction*>(&wtx) = CTransaction(tx);
+        vwtxNew.push_back(wtx);
+    }
+
+    LogPrint("bench", "%s: %u recipients in %u transactions, %u inputs signed with %d threads\n", __func__, vecSend.size(), vTx.size(), nInputs, nThreads);
+    return true;
+}
+
+bool CWallet::CreateCandyClaimTransactions(const CAppHeader& header, const CPutCandy_IndexKey& candyKey, const vector<CRecipient>& vecSend,
+                                           vector<CWalletTx>& vwtxNew, CReserveKey& reservekey, CAmount& nFeeRet, std::string& strFailReason)
+{
+    if(!masternodeSync.IsBlockchainSynced())
+    {
+        strFailReason = _("Synchronizing block data");
+        return false;
+    }
+
+    if (vecSend.empty())
+    {
+        strFailReason = _("Transaction amounts must be positive");
+        return false;
+    }
+
+    BOOST_FOREACH (const CRecipient& recipient, vecSend)
+    {
+        if (recipient.nAmount <= 0 || !recipient.fAsset || recipient.nLockedMonth != 0)
+        {
+            strFailReason = _("Transaction amounts must be positive");
+            return false;
+        }
+    }
+
+    vwtxNew.clear();
+    nFeeRet = 0;
+
+    vector<CMutableTransaction> vTx;
+    {
+        LOCK2(cs_main, cs_wallet);
+
+        CAssetId_AssetInfo_IndexValue assetInfo;
+        if(!GetAssetInfoByAssetId(candyKey.assetId, assetInfo, false))
+        {
+            strFailReason = _("Cannot get asset info by asset id");
+            return false;
+        }
+        CScript scriptAdmin = GetScriptForDestination(CBitcoinAddress(assetInfo.strAdminAddress).Get());
+        CScript scriptReserved;
+
+        // Every claim transaction spends the candy output as its last input,
+        // unsigned, alongside the wallet coins paying its fee
+        Coin coin;
+        if(!GetUTXOCoin(candyKey.out, coin))
+        {
+            strFailReason = _("Get candy information failed");
+            return false;
+        }
+        CTxIn candyTxIn(candyKey.out.hash, candyKey.out.n, CScript(), std::numeric_limits<unsigned int>::max() - 1);
+        candyTxIn.prevPubKey = coin.out.scriptPubKey;
+
+        // The fee coins of all chunks are reserved up front from one snapshot
+        vector<COutput> vSafeCoins;
+        AvailableCoins(vSafeCoins, true, NULL, false, ALL_COINS, false);
+
+        for (size_t nNext = 0; nNext < vecSend.size(); nNext += GET_CANDY_TXOUT_SIZE)
+        {
+            vector<CTxOut> vClaim;
+            for (size_t i = nNext; i < vecSend.size() && i < nNext + GET_CANDY_TXOUT_SIZE; i++)
+            {
+                CTxOut txout(vecSend[i].nAmount, vecSend[i].scriptPubKey, 0);
+                txout.vReserve = FillGetCandyData(header, CGetCandyData(candyKey.assetId, vecSend[i].nAmount, ""));
+                vClaim.push_back(txout);
+            }
+
+            CMutableTransaction txNew;
+            set<pair<const CWalletTx*,unsigned int> > setCoins;
+            CAmount nFee = 0;
+            // Start with no fee and loop until there is enough fee
+            while (true)
+            {
+                CAmount nValueIn = 0;
+                if (!SelectPayoutCoins(this, nFee, vSafeCoins, setCoins, nValueIn, false))
+                {
+                    strFailReason = _("Please transfer at least 0.01 SAFE to wallet.");
+                    return false;
+                }
+
+                txNew = CMutableTransaction();
+                txNew.nLockTime = chainActive.Height();
+                txNew.vout = vClaim;
+
+                const CAmount nChange = nValueIn - nFee;
+                if (nChange > 0)
+                {
+                    CScript scriptChange;
+                    if (HasPayoutCoinWithScript(setCoins, scriptAdmin))
+                        scriptChange = scriptAdmin;
+                    else
+                    {
+                        if (scriptReserved.empty())
+                        {
+                            CPubKey vchPubKey;
+                            if (!reservekey.GetReservedKey(vchPubKey, true))
+                            {
+                                strFailReason = _("Keypool ran out, please call keypoolrefill first");
+                                return false;
+                            }
+                            scriptReserved = GetScriptForDestination(vchPubKey.GetID());
+                        }
+                        scriptChange = scriptReserved;
+                    }
+
+                    // Never create dust outputs; if we would, just add the dust to the fee.
+                    CTxOut changeTxOut(nChange, scriptChange);
+                    if (changeTxOut.IsDust(::minRelayTxFee))
+                        nFee += nChange;
+                    else
+                        txNew.vout.push_back(changeTxOut);
+                }
+
+                BOOST_FOREACH(const PAIRTYPE(const CWalletTx*, unsigned int)& coin, setCoins)
+                {
+                    CTxIn txin(coin.first->GetHash(), coin.second, CScript(), std::numeric_limits<unsigned int>::max() - 1);
+                    txin.prevPubKey = coin.first->vout[coin.second].scriptPubKey;
+                    txNew.vin.push_back(txin);
+                }
+                sort(txNew.vin.begin(), txNew.vin.end(), CompareInputBIP69());
+                txNew.vin.push_back(candyTxIn);
+                sort(txNew.vout.begin(), txNew.vout.end(), CompareOutputBIP69());
+
+                // Size with dummy signatures; the real ones are made for all
+                // transactions at once below
+                for (unsigned int i = 0; i + 1 < txNew.vin.size(); i++)
+                {
+                    if (!ProduceSignature(DummySignatureCreator(this), txNew.vin[i].prevPubKey, txNew.vin[i].scriptSig))
+                    {
+                        strFailReason = _("Signing transaction failed");
+                        return false;
+                    }
+                }
+                unsigned int nBytes = ::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION);
+                BOOST_FOREACH(CTxIn& txin, txNew.vin)
+                    txin.scriptSig = CScript();
+
+                if (nBytes >= MAX_STANDARD_TX_SIZE)
+                {
+                    strFailReason = _("Transaction too large");
+                    return false;
+                }
+
+                CAmount nFeeNeeded = GetMinimumFee(nBytes, nTxConfirmTarget, mempool);
+                CAmount nAdditionalFee = GetTxAdditionalFee(txNew);
+                if(nAdditionalFee < 0)
+                {
+                    strFailReason = _("Transaction reserver is too large");
+                    return false;
+                }
+                nFeeNeeded += nAdditionalFee;
+
+                if (nFeeNeeded < ::minRelayTxFee.GetFee(nBytes))
+                {
+                    strFailReason = _("Transaction too large for fee policy");
+                    return false;
+                }
+
+                if (nFee >= nFeeNeeded)
+                    break; // Done, enough fee included.
+
+                // Include more fee and try again.
+                nFee = nFeeNeeded;
+            }
+
+            RemovePayoutCoins(vSafeCoins, setCoins);
+            nFeeRet += nFee;
+            vTx.push_back(txNew);
+        }
+
+        if (scriptReserved.empty())
+            reservekey.ReturnKey();
+    }
+
+    size_t nInputs = 0;
+    int nThreads = 0;
+    if (!SignPayoutTransactions(this, vTx, 1, nInputs, nThreads))
+    {
+        strFailReason = _("Signing transaction failed");
+        return false;
+    }
+
+    BOOST_FOREACH(const CMutableTransaction& tx, vTx)
+    {
+        CWalletTx wtx;
+        wtx.fTimeReceivedIsTxTime = true;
+        wtx.fFromMe = true;
+        wtx.BindWallet(this);
+        *static_cast<CTransaction*>(&wtx) = CTransaction(tx);
+        vwtxNew.push_back(wtx);
+    }
+
+    LogPrint("bench", "%s: %u recipients in %u transactions, %u inputs signed with %d threads\n", __func__, vecSend.size(), vTx.size(), nInputs, nThreads);
+    return true;
+}
+
+struct CompareConsolidationCoins
+{
+    bool operator()(const COutput& a, const COutput& b) const
+    {
+        return a.tx->vout[a.i].nValue < b.tx->vout[b.i].nValue;
+    }
+};
+
+struct CompareConsolidationGroups
+{
+    bool operator()(const CConsolidationGroup& a, const CConsolidationGroup& b) const
+    {
+        return a.vCoins.size() > b.vCoins.size();
+    }
+};
+
+/** nThreshold, an amount of SAFE, as the same number of whole units of an asset with nDecimals decimals */
+static CAmount GetAssetConsolidationThreshold(const CAmount& nThreshold, uint8_t nDecimals)
+{
+    CAmount nAssetThreshold = nThreshold;
+    for (uint8_t i = 8; i < nDecimals; i++)
+    {
+        if (nAssetThreshold > std::numeric_limits<CAmount>::max() / 10)
+            return std::numeric_limits<CAmount>::max();
+        nAssetThreshold *= 10;
+    }
+    for (uint8_t i = nDecimals; i < 8; i++)
+        nAssetThreshold /= 10;
+    return nAssetThreshold;
+}
+
+void CWallet::GetConsolidationGroups(const CAmount& nThreshold, unsigned int nMinOutputs, vector<CConsolidationGroup>& vGroupsRet) const
+{
+    vGroupsRet.clear();
+
+    LOCK2(cs_main, cs_wallet);
+
+    map<pair<CTxDestination, uint256>, CConsolidationGroup> mapGroups;
+    vector<COutput> vCoins;
+    AvailableCoins(vCoins, true, NULL, false, ONLY_NOT1000IFMN, false);
+    BOOST_FOREACH(const COutput& out, vCoins)
+    {
+        const CTxOut& txout = out.tx->vout[out.i];
+        CTxDestination dest;
+        if (!out.fSpendable || out.nDepth < 1 || txout.nValue >= nThreshold || IsDenominatedAmount(txout.nValue) || !ExtractDestination(txout.scriptPubKey, dest))
+            continue;
+        CConsolidationGroup& group = mapGroups[make_pair(dest, uint256())];
+        group.dest = dest;
+        group.vCoins.push_back(out);
+        group.nValue += txout.nValue;
+    }
+
+    for (map<uint256, TxTimeIndex>::const_iterator it = mapAssetTxTime.begin(); it != mapAssetTxTime.end(); ++it)
+    {
+        const uint256& assetId = it->first;
+        CAssetId_AssetInfo_IndexValue assetInfo;
+        if (!GetAssetInfoByAssetId(assetId, assetInfo, false))
+            continue;
+        const CAmount nAssetThreshold = GetAssetConsolidationThreshold(nThreshold, assetInfo.assetData.nDecimals);
+        vCoins.clear();
+        AvailableCoins(vCoins, true, NULL, false, ALL_COINS, false, false, NULL, true, &assetId);
+        BOOST_FOREACH(const COutput& out, vCoins)
+        {
+            const CTxOut& txout = out.tx->vout[out.i];
+            CTxDestination dest;
+            if (!out.fSpendable || out.nDepth < 1 || txout.nValue >= nAssetThreshold || !ExtractDestination(txout.scriptPubKey, dest))
+                continue;
+            CConsolidationGroup& group = mapGroups[make_pair(dest, assetId)];
+            group.dest = dest;
+            group.assetId = assetId;
+            group.vCoins.push_back(out);
+            group.nValue += txout.nValue;
+        }
+    }
+
+    for (map<pair<CTxDestination, uint256>, CConsolidationGroup>::iterator it = mapGroups.begin(); it != mapGroups.end(); ++it)
+    {
+        CConsolidationGroup& group = it->second;
+        if (group.vCoins.size() < std::max(nMinOutputs, 2U))
+            continue;
+        sort(group.vCoins.begin(), group.vCoins.end(), CompareConsolidationCoins());
+        vGroupsRet.push_back(group);
+    }
+    stable_sort(vGroupsRet.begin(), vGroupsRet.end(), CompareConsolidationGroups());
+}
+
+/**
+ * Merge vCoins into a single output to dest. SAFE outputs pay the fee out of
+ * the merged value; asset outputs take SAFE fee coins from the shared pool,
+ * with the change going back to the address of a fee coin.
+ */
+static bool CreateConsolidationTransaction(const CWallet* pwallet, const CTxDestination& dest, const uint256& assetId, const vector<COutput>& vCoins, bool fSign,
+                                           vector<COutput>& vFeeCoins, CMutableTransaction& txRet, CAmount& nFeeRet, std::string& strFailReason)
+{
+    const bool fAsset = !assetId.IsNull();
+    const CScript scriptDest = GetScriptForDestination(dest);
+    CAmount nValue = 0;
+    BOOST_FOREACH(const COutput& out, vCoins)
+        nValue += out.tx->vout[out.i].nValue;
+
+    set<pair<const CWalletTx*,unsigned int> > setFeeCoins;
+    CAmount nFee = 0;
+    // Start with no fee and loop until there is enough fee
+    while (true)
+    {
+        CAmount nFeeValueIn = 0;
+        if (fAsset && !SelectPayoutCoins(pwallet, nFee, vFeeCoins, setFeeCoins, nFeeValueIn, false))
+        {
+            strFailReason = _("Insufficient safe funds.");
+            return false;
+        }
+
+        CMutableTransaction txNew;
+        txNew.nLockTime = chainActive.Height();
+        if (fAsset)
+        {
+            CTxOut txout(nValue, scriptDest);
+            CAppHeader header(g_nAppHeaderVersion, uint256S(g_strSafeAssetId), TRANSFER_ASSET_CMD);
+            txout.vReserve = FillCommonData(header, CCommonData(assetId, nValue, ""));
+            txNew.vout.push_back(txout);
+
+            const CAmount nChange = nFeeValueIn - nFee;
+            if (nChange > 0)
+            {
+                // Never create dust outputs; if we would, just add the dust to the fee.
+                const PAIRTYPE(const CWalletTx*, unsigned int)& coin = *setFeeCoins.begin();
+                CTxOut changeTxOut(nChange, coin.first->vout[coin.second].scriptPubKey);
+                if (changeTxOut.IsDust(::minRelayTxFee))
+                    nFee += nChange;
+                else
+                    txNew.vout.push_back(changeTxOut);
+            }
+        }
+        else
+        {
+            CTxOut txout(nValue - nFee, scriptDest);
+            if (txout.IsDust(::minRelayTxFee))
+            {
+                strFailReason = _("The merged amount is too small to pay the fee");
+                return false;
+            }
+            txNew.vout.push_back(txout);
+        }
+
+        // Fill vin
+        //
+        // Note how the sequence number is set to max()-1 so that the
+        // nLockTime set above actually works.
+        BOOST_FOREACH(const COutput& out, vCoins)
+        {
+            CTxIn txin(out.tx->GetHash(), out.i, CScript(), std::numeric_limits<unsigned int>::max() - 1);
+            txin.prevPubKey = out.tx->vout[out.i].scriptPubKey;
+            txNew.vin.push_back(txin);
+        }
+        BOOST_FOREACH(const PAIRTYPE(const CWalletTx*, unsigned int)& coin, setFeeCoins)
+        {
+            CTxIn txin(coin.first->GetHash(), coin.second, CScript(), std::numeric_limits<unsigned int>::max() - 1);
+            txin.prevPubKey = coin.first->vout[coin.second].scriptPubKey;
+            txNew.vin.push_back(txin);
+        }
+        sort(txNew.vin.begin(), txNew.vin.end(), CompareInputBIP69());
+        sort(txNew.vout.begin(), txNew.vout.end(), CompareOutputBIP69());
+
+        BOOST_FOREACH(CTxIn& txin, txNew.vin)
+        {
+            if (!ProduceSignature(DummySignatureCreator(pwallet), txin.prevPubKey, txin.scriptSig))
+            {
+                strFailReason = _("Signing transaction failed");
+                return false;
+            }
+        }
+        unsigned int nBytes = ::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION);
+        BOOST_FOREACH(CTxIn& txin, txNew.vin)
+            txin.scriptSig = CScript();
+
+        if (nBytes >= MAX_STANDARD_TX_SIZE)
+        {
+            strFailReason = _("Transaction too large");
+            return false;
+        }
+
+        // Consolidation only runs while fees are low, so the required minimum is enough
+        CAmount nFeeNeeded = CWallet::GetRequiredFee(nBytes);
+        CAmount nAdditionalFee = GetTxAdditionalFee(txNew);
+        if (nAdditionalFee < 0)
+        {
+            strFailReason = _("Transaction reserver is too large");
+            return false;
+        }
+        nFeeNeeded += nAdditionalFee;
+
+        if (nFee >= nFeeNeeded)
+        {
+            txRet = txNew;
+            break; // Done, enough fee included.
+        }
+
+        // Include more fee and try again.
+        nFee = nFeeNeeded;
+    }
+
+    if (fSign)
+    {
+        vector<CMutableTransaction> vTx(1, txRet);
+        size_t nInputs = 0;
+        int nThreads = 0;
+        if (!SignPayoutTransactions(pwallet, vTx, 0, nInputs, nThreads))
+        {
+            strFailReason = _("Signing transaction failed");
+            return false;
+        }
+        txRet = vTx[0];
+    }
+
+    RemovePayoutCoins(vFeeCoins, setFeeCoins);
+    nFeeRet = nFee;
+    return true;
+}
+
+void CWallet::ConsolidateCoins(const CAmount& nThreshold, unsigned int nMinOutputs, unsigned int nMaxTxs, bool fDryRun, vector<CConsolidationResult>& vResults, CConnman* connman)
+{
+    vResults.clear();
+
+    LOCK2(cs_main, cs_wallet);
+
+    vector<CConsolidationGroup> vGroups;
+    GetConsolidationGroups(nThreshold, nMinOutputs, vGroups);
+
+    // Fees of asset groups come from one snapshot of the SAFE coins, less the
+    // coins that are being merged themselves
+    vector<COutput> vFeeCoins;
+    AvailableCoins(vFeeCoins, true, NULL, false, ONLY_NOT1000IFMN, false);
+    BOOST_FOREACH(const CConsolidationGroup& group, vGroups)
+    {
+        if (!group.assetId.IsNull())
+            continue;
+        set<pair<const CWalletTx*,unsigned int> > setCoins;
+        BOOST_FOREACH(const COutput& out, group.vCoins)
+            setCoins.insert(make_pair(out.tx, (unsigned int)out.i));
+        RemovePayoutCoins(vFeeCoins, setCoins);
+    }
+
+    for (size_t i = 0; i < vGroups.size() && vResults.size() < nMaxTxs; i++)
+    {
+        const CConsolidationGroup& group = vGroups[i];
+        for (size_t nStart = 0; nStart + 1 < group.vCoins.size() && vResults.size() < nMaxTxs; nStart += MAX_CONSOLIDATE_INPUTS)
+        {
+            vector<COutput> vChunk(group.vCoins.begin() + nStart, group.vCoins.begin() + std::min(nStart + MAX_CONSOLIDATE_INPUTS, group.vCoins.size()));
+
+            CConsolidationResult result;
+            result.dest = group.dest;
+            result.assetId = group.assetId;
+            result.nOutputs = group.vCoins.size();
+            result.nInputs = vChunk.size();
+            BOOST_FOREACH(const COutput& out, vChunk)
+                result.nValue += out.tx->vout[out.i].nValue;
+
+            CMutableTransaction txNew;
+            if (CreateConsolidationTransaction(this, group.dest, group.assetId, vChunk, !fDryRun, vFeeCoins, txNew, result.nFee, result.strError) && !fDryRun)
+            {
+                CWalletTx wtx;
+                wtx.fTimeReceivedIsTxTime = true;
+                wtx.fFromMe = true;
+                wtx.BindWallet(this);
+                *static_cast<CTransaction*>(&wtx) = CTransaction(txNew);
+                CReserveKey reservekey(this);
+                if (CommitTransaction(wtx, reservekey, connman))
+                    result.txid = wtx.GetHash();
+                else
+                    result.strError = _("The transaction was rejected");
+            }
+            vResults.push_back(result);
+
+            // the rest of the group would fail the same way
+            if (!result.strError.empty())
+                break;
+        }
+    }
+}
+
+void ThreadConsolidateWallet(CWallet* pwallet, CAmount nThreshold, CAmount nMaxFeeRate)
+{
+    RenameThread("safe-consolidate");
+
+    const int64_t nInterval = std::max(GetArg("-consolidateinterval", DEFAULT_CONSOLIDATE_INTERVAL), (int64_t)1);
+    const unsigned int nMinOutputs = std::max(GetArg("-consolidateminoutputs", DEFAULT_CONSOLIDATE_MIN_OUTPUTS), (int64_t)2);
+    const unsigned int nMaxTxs = std::max(GetArg("-consolidatemaxtxs", DEFAULT_CONSOLIDATE_MAX_TXS), (int64_t)1);
+
+    while (true)
+    {
+        MilliSleep(nInterval * 1000);
+
+        if (!masternodeSync.IsBlockchainSynced() || pwallet->IsLocked())
+            continue;
+
+        // Merging costs a fee per input; wait for a quiet mempool (no
+        // estimate means too little traffic to make one)
+        CAmount nFeeRate = mempool.estimateSmartFee(nTxConfirmTarget).GetFeePerK();
+        if (nFeeRate > nMaxFeeRate)
+            continue;
+
+        vector<CConsolidationResult> vResults;
+        pwallet->ConsolidateCoins(nThreshold, nMinOutputs, nMaxTxs, false, vResults, g_connman.get());
+        BOOST_FOREACH(const CConsolidationResult& result, vResults)
+        {
+            if (result.strError.empty())
+                LogPrintf("ThreadConsolidateWallet: merged %u of %u outputs of %s%s, fee %s, txid %s\n", result.nInputs, result.nOutputs, CBitcoinAddress(result.dest).ToString(),
+                          result.assetId.IsNull() ? "" : " asset " + result.assetId.GetHex(), FormatMoney(result.nFee), result.txid.GetHex());
+            else
+                LogPrintf("ThreadConsolidateWallet: merging %u outputs of %s%s failed: %s\n", result.nInputs, CBitcoinAddress(result.dest).ToString(),
+                          result.assetId.IsNull() ? "" : " asset " + result.assetId.GetHex(), result.strError);
+        }
+    }
+}
+
+/**
+ * Call after CreateTransaction unless you want to abort
+ */
+bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CConnman* connman, std::string strCommand)
+{
+    {
+        LOCK2(cs_main, cs_wallet);
+        LogPrintf("CommitTransaction:\n%s", wtxNew.ToString());
+        {
+            // This is only to keep the database open to defeat the auto-flush for the
+            // duration of this scope.  This is the only place where this optimization
+            // maybe makes sense; please don't do it anywhere else.
+            CWalletDB* pwalletdb = fFileBacked ? new CWalletDB(strWalletFile,"r+") : NULL;
+
+            // Take key pair from key pool so it won't be used again
+            reservekey.KeepKey();
+
+            // Add tx to wallet, because if it has change it's also ours,
+            // otherwise just for transaction history.
+            AddToWallet(wtxNew, false, pwalletdb);
+
+            // Notify that old coins are spent
             set<uint256> updated_hahes;
             BOOST_FOREACH(const CTxIn& txin, wtxNew.vin)
             {
@@ -5374,6 +7060,79 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CCon
     return true;
 }
 
+bool CWallet::CommitTransactions(std::vector<CWalletTx>& vwtxNew, CReserveKey& reservekey, CConnman* connman, std::vector<bool>& vAccepted)
+{
+    vAccepted.assign(vwtxNew.size(), false);
+    bool fAccepted = true;
+    {
+        LOCK2(cs_main, cs_wallet);
+        {
+            // All transactions and the kept key go into the wallet database in
+            // one transaction, so the wallet never records only part of the batch.
+            CWalletDBBatch batch(this, 0);
+
+            // Take key pair from key pool so it won't be used again
+            reservekey.KeepKey();
+
+            set<uint256> updated_hahes;
+            BOOST_FOREACH(CWalletTx& wtxNew, vwtxNew)
+            {
+                LogPrintf("CommitTransactions: %s\n", wtxNew.GetHash().ToString());
+                AddToWallet(wtxNew, false, batch.Get());
+
+                // Notify that old coins are spent
+                BOOST_FOREACH(const CTxIn& txin, wtxNew.vin)
+                {
+                    // notify only once
+                    if(updated_hahes.find(txin.prevout.hash) != updated_hahes.end()) continue;
+
+                    if(!IsMine(txin))
+                        continue;
+
+                    CWalletTx &coin = mapWallet[txin.prevout.hash];
+                    coin.BindWallet(this);
+                    NotifyTransactionChanged(this, txin.prevout.hash, CT_UPDATED);
+                    updated_hahes.insert(txin.prevout.hash);
+                }
+            }
+
+            if (!batch.Commit())
+                return error("CommitTransactions(): failed to commit wallet database transaction");
+        }
+
+        for (unsigned int i = 0; i < vwtxNew.size(); i++)
+        {
+            CWalletTx& wtxNew = vwtxNew[i];
+
+            // Track how many getdata requests our transaction gets
+            mapRequestCount[wtxNew.GetHash()] = 0;
+
+            if (fBroadcastTransactions)
+            {
+                // Broadcast
+                if (!wtxNew.AcceptToMemoryPool(false))
+                {
+                    // This must not fail. The transaction has already been signed and recorded.
+                    LogPrintf("CommitTransactions(): Error: Transaction %s not valid\n", wtxNew.GetHash().ToString());
+                    fAccepted = false;
+                    continue;
+                }
+                wtxNew.RelayWalletTransaction(connman);
+            }
+            vAccepted[i] = true;
+        }
+
+        // Abandon the rejected transactions, so their inputs become spendable
+        // again and a later resend does not pay receivers the caller retries.
+        for (unsigned int i = 0; i < vwtxNew.size(); i++)
+        {
+            if (!vAccepted[i] && !AbandonTransaction(vwtxNew[i].GetHash()))
+                LogPrintf("CommitTransactions(): failed to abandon transaction %s\n", vwtxNew[i].GetHash().ToString());
+        }
+    }
+    return fAccepted;
+}
+
 bool CWallet::AddAccountingEntry(const CAccountingEntry& acentry, CWalletDB & pwalletdb)
 {
     if (!pwalletdb.WriteAccountingEntry_Backend(acentry))
@@ -5440,6 +7199,7 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
                 }
             }
         }
+        RebuildUnlockSchedule();
     }
 
     if (nLoadWalletRet != DB_LOAD_OK)
@@ -5493,6 +7253,12 @@ bool CWallet::SetAddressBook(const CTxDestination& address, const string& strNam
                              strPurpose, (fUpdated ? CT_UPDATED : CT_NEW) );
     if (!fFileBacked)
         return false;
+    if (CWalletDB* pbatchdb = GetBatchWalletDB())
+    {
+        if (!strPurpose.empty() && !pbatchdb->WritePurpose(CBitcoinAddress(address).ToString(), strPurpose))
+            return false;
+        return pbatchdb->WriteName(CBitcoinAddress(address).ToString(), strName);
+    }
     if (!strPurpose.empty() && !CWalletDB(strWalletFile).WritePurpose(CBitcoinAddress(address).ToString(), strPurpose))
         return false;
     return CWalletDB(strWalletFile).WriteName(CBitcoinAddress(address).ToString(), strName);
@@ -5543,13 +7309,15 @@ bool CWallet::NewKeyPool()
 {
     {
         LOCK(cs_wallet);
-        CWalletDB walletdb(strWalletFile);
+        CWalletDBBatch batch(this);
         BOOST_FOREACH(int64_t nIndex, setInternalKeyPool) {
-            walletdb.ErasePool(nIndex);
+            if (CWalletDB* pwalletdb = batch.Get())
+                pwalletdb->ErasePool(nIndex);
         }
         setInternalKeyPool.clear();
         BOOST_FOREACH(int64_t nIndex, setExternalKeyPool) {
-            walletdb.ErasePool(nIndex);
+            if (CWalletDB* pwalletdb = batch.Get())
+                pwalletdb->ErasePool(nIndex);
         }
         setExternalKeyPool.clear();
         privateSendClient.fEnablePrivateSend = false;
@@ -5604,8 +7372,63 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         } else {
             nTargetSize *= 2;
         }
+        if (missingExternal + missingInternal == 0)
+            return true;
+
+        if (IsHDEnabled())
+        {
+            // Derive the keys of both chains in bulk and record keys, pool
+            // entries and the chain counters in one database transaction
+            CWalletDBBatch batch(this, 0);
+            CWalletDB* pwalletdb = batch.Get();
+            if (!pwalletdb)
+                throw runtime_error("TopUpKeyPool(): wallet is not file backed");
+
+            CKeyMetadata metadata(GetTime());
+            std::vector<CPubKey> vExternal, vInternal;
+            // TODO: implement keypools for all accounts?
+            DeriveNewChildKeys(metadata, 0, false, missingExternal, vExternal, pwalletdb);
+            DeriveNewChildKeys(metadata, 0, true, missingInternal, vInternal, pwalletdb);
+
+            int64_t nEnd = 1;
+            if (!setInternalKeyPool.empty()) {
+                nEnd = *(--setInternalKeyPool.end()) + 1;
+            }
+            if (!setExternalKeyPool.empty()) {
+                nEnd = std::max(nEnd, *(--setExternalKeyPool.end()) + 1);
+            }
+            std::vector<std::pair<int64_t, bool> > vAdded;
+            for (size_t i = 0; i < vExternal.size() + vInternal.size(); i++, nEnd++)
+            {
+                bool fInternal = i >= vExternal.size();
+                const CPubKey& pubkey = fInternal ? vInternal[i - vExternal.size()] : vExternal[i];
+                if (!pwalletdb->WritePool(nEnd, CKeyPool(pubkey, fInternal)))
+                {
+                    batch.Abort();
+                    throw runtime_error("TopUpKeyPool(): writing generated key failed");
+                }
+                vAdded.push_back(std::make_pair(nEnd, fInternal));
+            }
+            if (!batch.Commit())
+                throw runtime_error("TopUpKeyPool(): failed to commit wallet database transaction");
+
+            // only expose the new pool entries once they are on disk
+            for (size_t i = 0; i < vAdded.size(); i++)
+            {
+                if (vAdded[i].second) {
+                    setInternalKeyPool.insert(vAdded[i].first);
+                } else {
+                    setExternalKeyPool.insert(vAdded[i].first);
+                }
+            }
+            LogPrintf("keypool added %u external and %u internal keys, size=%u\n", vExternal.size(), vInternal.size(), setInternalKeyPool.size() + setExternalKeyPool.size());
+            return true;
+        }
+
+        // Generated keys and their pool entries are committed together every
+        // DEFAULT_WALLET_BATCH_WRITES writes instead of one record at a time
+        CWalletDBBatch batch(this);
         bool fInternal = false;
-        CWalletDB walletdb(strWalletFile);
         for (int64_t i = missingInternal + missingExternal; i--;)
         {
             int64_t nEnd = 1;
@@ -5619,7 +7442,9 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
                 nEnd = std::max(nEnd, *(--setExternalKeyPool.end()) + 1);
             }
             // TODO: implement keypools for all accounts?
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey(0, fInternal), fInternal)))
+            CPubKey pubkey = GenerateNewKey(0, fInternal);
+            CWalletDB* pwalletdb = batch.Get();
+            if (!pwalletdb || !pwalletdb->WritePool(nEnd, CKeyPool(pubkey, fInternal)))
                 throw runtime_error("TopUpKeyPool(): writing generated key failed");
 
             if (fInternal) {
@@ -5633,6 +7458,8 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
             std::string strMsg = strprintf(_("Loading wallet... (%3.2f %%)"), dProgress);
             uiInterface.InitMessage(strMsg);
         }
+        if (!batch.Commit())
+            throw runtime_error("TopUpKeyPool(): failed to commit wallet database transaction");
     }
     return true;
 }
@@ -5654,11 +7481,10 @@ void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool, bool fIn
         if(setKeyPool.empty())
             return;
 
-        CWalletDB walletdb(strWalletFile);
-
         nIndex = *setKeyPool.begin();
         setKeyPool.erase(nIndex);
-        if (!walletdb.ReadPool(nIndex, keypool)) {
+        CWalletDB* pbatchdb = GetBatchWalletDB();
+        if (pbatchdb ? !pbatchdb->ReadPool(nIndex, keypool) : !CWalletDB(strWalletFile).ReadPool(nIndex, keypool)) {
             throw std::runtime_error(std::string(__func__) + ": read failed");
         }
         if (!HaveKey(keypool.vchPubKey.GetID())) {
@@ -5679,8 +7505,10 @@ void CWallet::KeepKey(int64_t nIndex)
     if (fFileBacked)
     {
         LOCK(cs_wallet);
-        CWalletDB walletdb(strWalletFile);
-        walletdb.ErasePool(nIndex);
+        if (CWalletDB* pbatchdb = GetBatchWalletDB())
+            pbatchdb->ErasePool(nIndex);
+        else
+            CWalletDB(strWalletFile).ErasePool(nIndex);
         nKeysLeftSinceAutoBackup = nWalletBackups ? nKeysLeftSinceAutoBackup - 1 : 0;
     }
     LogPrintf("keypool keep %d\n", nIndex);
@@ -5913,6 +7741,88 @@ std::set<CTxDestination> CWallet::GetAccountAddresses(const std::string& strAcco
     return result;
 }
 
+CWalletDB* CWallet::GetBatchWalletDB()
+{
+    CWalletDBBatch* pbatch = pwalletdbBatch;
+    if (!pbatch || !pbatch->IsCurrentThread())
+        return NULL;
+    return pbatch->Get();
+}
+
+CWalletDBBatch::CWalletDBBatch(CWallet* pwalletIn, unsigned int nCommitWritesIn, bool fFlushOnCloseIn)
+    : pwallet(pwalletIn), pouter(NULL), pwalletdb(NULL), threadId(boost::this_thread::get_id()), fTxn(false),
+      nCommitWrites(nCommitWritesIn), nWrites(0), nTotalWrites(0), nCommits(0), fFlushOnClose(fFlushOnCloseIn),
+      nTimeStart(GetTimeMillis())
+{
+    AssertLockHeld(pwallet->cs_wallet);
+    pouter = pwallet->pwalletdbBatch;
+    if (pouter && !pouter->IsCurrentThread())
+        pouter = NULL;
+    if (!pouter)
+        pwallet->pwalletdbBatch = this;
+}
+
+CWalletDBBatch::~CWalletDBBatch()
+{
+    if (pouter)
+        return;
+    // a batch left by an exception keeps none of its uncommitted writes
+    if (std::uncaught_exception())
+        Abort();
+    else if (!Commit())
+        LogPrintf("CWalletDBBatch: failed to commit wallet database transaction\n");
+    pwallet->pwalletdbBatch = NULL;
+    if (pwalletdb) {
+        delete pwalletdb;
+        LogPrint("db", "CWalletDBBatch: %u writes in %u transactions, %dms\n", nTotalWrites, nCommits, GetTimeMillis() - nTimeStart);
+    }
+}
+
+CWalletDB* CWalletDBBatch::Get()
+{
+    if (pouter)
+        return pouter->Get();
+    if (!pwallet->fFileBacked)
+        return NULL;
+
+    if (!pwalletdb)
+        pwalletdb = new CWalletDB(pwallet->strWalletFile, "r+", fFlushOnClose);
+    if (nCommitWrites > 0 && nWrites >= nCommitWrites)
+        Commit();
+    if (!fTxn) {
+        // without a transaction the records are still written, one at a time
+        fTxn = pwalletdb->TxnBegin();
+        if (!fTxn)
+            LogPrintf("CWalletDBBatch: failed to begin wallet database transaction\n");
+    }
+    nWrites++;
+    nTotalWrites++;
+    return pwalletdb;
+}
+
+bool CWalletDBBatch::Commit()
+{
+    if (pouter || !fTxn)
+        return true;
+    fTxn = false;
+    nWrites = 0;
+    nCommits++;
+    return pwalletdb->TxnCommit();
+}
+
+void CWalletDBBatch::Abort()
+{
+    if (pouter) {
+        pouter->Abort();
+        return;
+    }
+    if (!fTxn)
+        return;
+    fTxn = false;
+    nWrites = 0;
+    pwalletdb->TxnAbort();
+}
+
 bool CReserveKey::GetReservedKey(CPubKey& pubkey, bool fInternalIn)
 {
     if (nIndex == -1)
@@ -6147,6 +8057,8 @@ bool CWallet::AddDestData(const CTxDestination &dest, const std::string &key, co
     if (!fFileBacked)
         return true;
     LOCK(cs_wallet);
+    if (CWalletDB* pbatchdb = GetBatchWalletDB())
+        return pbatchdb->WriteDestData(CBitcoinAddress(dest).ToString(), key, value);
     return CWalletDB(strWalletFile).WriteDestData(CBitcoinAddress(dest).ToString(), key, value);
 }
 
@@ -21,7 +21,9 @@
 #include "wallet/walletdb.h"
 
 #include <algorithm>
+#include <atomic>
 #include <map>
+#include <queue>
 #include <set>
 #include <stdexcept>
 #include <stdint.h>
@@ -30,6 +32,7 @@
 #include <vector>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 
 /**
  * Settings
@@ -39,6 +42,7 @@ extern CAmount maxTxFee;
 extern unsigned int nTxConfirmTarget;
 extern bool bSpendZeroConfChange;
 extern bool fSendFreeTransactions;
+extern bool fSelectCoinsBnB;
 
 extern bool fLargeWorkForkFound;
 extern bool fLargeWorkInvalidChainFound;
@@ -67,6 +71,24 @@ static const CAmount MIN_CHANGE = CENT;
 static const bool DEFAULT_SPEND_ZEROCONF_CHANGE = true;
 //! Default for -sendfreetransactions
 static const bool DEFAULT_SEND_FREE_TRANSACTIONS = false;
+//! Default for -consolidate
+static const bool DEFAULT_CONSOLIDATE = false;
+//! -consolidatethreshold default: SAFE outputs below this value are merged
+static const CAmount DEFAULT_CONSOLIDATE_THRESHOLD = COIN;
+//! -consolidateminoutputs default: small outputs an address (and asset) needs before they are merged
+static const unsigned int DEFAULT_CONSOLIDATE_MIN_OUTPUTS = 50;
+//! -consolidatemaxtxs default: transactions per consolidation round
+static const unsigned int DEFAULT_CONSOLIDATE_MAX_TXS = 10;
+//! -consolidateinterval default: seconds between consolidation rounds
+static const int64_t DEFAULT_CONSOLIDATE_INTERVAL = 600;
+//! -consolidatemaxfeerate default: rounds are skipped while the estimated fee rate (per kB) is higher
+static const CAmount DEFAULT_CONSOLIDATE_MAX_FEERATE = 10000;
+//! Outputs merged by one consolidation transaction, well below MAX_STANDARD_TX_SIZE
+static const unsigned int MAX_CONSOLIDATE_INPUTS = 500;
+//! Default for -bnbcoinselection
+static const bool DEFAULT_SELECT_COINS_BNB = true;
+//! Branch and bound coin selection gives up after this many search steps
+static const int SELECT_COINS_BNB_TRIES = 100000;
 //! -txconfirmtarget default
 static const unsigned int DEFAULT_TX_CONFIRM_TARGET = 2;
 //! -maxtxfee will warn if called with a higher fee than this amount (in satoshis)
@@ -74,6 +96,15 @@ static const CAmount nHighTransactionMaxFeeWarning = 100 * nHighTransactionFeeWa
 //! Largest (in bytes) free transaction we're willing to create
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
 static const bool DEFAULT_WALLETBROADCAST = true;
+//! Default maximum number of recipients per transaction of a bulk asset payout
+static const unsigned int DEFAULT_ASSET_PAYOUT_OUTPUTS = 500;
+//! Serialized payout outputs per transaction, half of MAX_STANDARD_TX_SIZE to leave room for inputs and change
+static const unsigned int MAX_ASSET_PAYOUT_OUTPUTS_SIZE = 50000;
+
+//! -walletloadthreads default, 0 = one thread per core
+static const int DEFAULT_WALLET_LOAD_THREADS = 0;
+//! Writes a CWalletDBBatch coalesces into one database transaction before committing
+static const unsigned int DEFAULT_WALLET_BATCH_WRITES = 1000;
 
 //! if set, all keys will be derived by using BIP39/BIP44
 static const bool DEFAULT_USE_HD_WALLET = false;
@@ -84,8 +115,11 @@ class COutput;
 class CReserveKey;
 class CScript;
 class CTxMemPool;
+class CWalletDBBatch;
 class CWalletTx;
 class CAppHeader;
+class CCommonData;
+struct CPutCandy_IndexKey;
 
 /** (client) version numbers for particular wallet features */
 enum WalletFeature
@@ -315,6 +349,9 @@ public:
     mutable bool fImmatureWatchCreditCached;
     mutable bool fAvailableWatchCreditCached;
     mutable bool fChangeCached;
+    mutable bool fLockedCreditCached;
+    mutable bool fLockedWatchCreditCached;
+    mutable bool fLockedOutputsCached;
     mutable CAmount nDebitCached;
     mutable CAmount nCreditCached;
     mutable CAmount nImmatureCreditCached;
@@ -327,6 +364,10 @@ public:
     mutable CAmount nImmatureWatchCreditCached;
     mutable CAmount nAvailableWatchCreditCached;
     mutable CAmount nChangeCached;
+    mutable CAmount nLockedCreditCached;
+    mutable CAmount nLockedWatchCreditCached;
+    //! outputs still locked by nUnlockedHeight, maintained by the wallet's unlock schedule
+    mutable std::set<unsigned int> setLockedOutputs;
 
     CWalletTx()
     {
@@ -370,6 +411,9 @@ public:
         fImmatureWatchCreditCached = false;
         fAvailableWatchCreditCached = false;
         fChangeCached = false;
+        fLockedCreditCached = false;
+        fLockedWatchCreditCached = false;
+        fLockedOutputsCached = false;
         nDebitCached = 0;
         nCreditCached = 0;
         nImmatureCreditCached = 0;
@@ -382,6 +426,9 @@ public:
         nAvailableWatchCreditCached = 0;
         nImmatureWatchCreditCached = 0;
         nChangeCached = 0;
+        nLockedCreditCached = 0;
+        nLockedWatchCreditCached = 0;
+        setLockedOutputs.clear();
         nOrderPos = -1;
     }
 
@@ -444,6 +491,8 @@ public:
         fImmatureWatchCreditCached = false;
         fDebitCached = false;
         fChangeCached = false;
+        fLockedCreditCached = false;
+        fLockedWatchCreditCached = false;
     }
 
     void BindWallet(CWallet *pwalletIn)
@@ -455,10 +504,10 @@ public:
     //! filter decides which addresses will count towards the debit
     CAmount GetDebit(const isminefilter& filter, const bool fAsset = false, const uint256* pAssetId = NULL, const CBitcoinAddress* pAddress = NULL) const;
     CAmount GetCredit(const isminefilter& filter, const bool fAsset = false, const uint256* pAssetId = NULL, const CBitcoinAddress* pAddress = NULL) const;
-    CAmount GetLockedCredit(const bool fAsset = false, const uint256* pAssetId = NULL, const CBitcoinAddress* pAddress = NULL) const;
+    CAmount GetLockedCredit(const bool fAsset = false, const uint256* pAssetId = NULL, const CBitcoinAddress* pAddress = NULL, bool fUseCache=true) const;
     CAmount GetImmatureCredit(const bool fAsset = false, const uint256* pAssetId = NULL, const CBitcoinAddress* pAddress = NULL, bool fUseCache=true) const;
     CAmount GetAvailableCredit(const bool fAsset = false, const uint256* pAssetId = NULL, const CBitcoinAddress* pAddress = NULL, bool fUseCache=true) const;
-    CAmount GetLockedWatchOnlyCredit(const bool fAsset = false, const uint256* pAssetId = NULL, const CBitcoinAddress* pAddress = NULL) const;
+    CAmount GetLockedWatchOnlyCredit(const bool fAsset = false, const uint256* pAssetId = NULL, const CBitcoinAddress* pAddress = NULL, const bool& fUseCache=true) const;
     CAmount GetImmatureWatchOnlyCredit(const bool fAsset = false, const uint256* pAssetId = NULL, const CBitcoinAddress* pAddress = NULL, const bool& fUseCache=true) const;
     CAmount GetAvailableWatchOnlyCredit(const bool fAsset = false, const uint256* pAssetId = NULL, const CBitcoinAddress* pAddress = NULL, const bool& fUseCache=true) const;
     CAmount GetChange(const bool fAsset = false) const;
@@ -466,6 +515,13 @@ public:
     CAmount GetAnonymizedCredit(bool fUseCache=true) const;
     CAmount GetDenominatedCredit(bool unconfirmed, bool fUseCache=true) const;
 
+    //! height used to validate nUnlockedHeight offsets (tx block height, or next block if unconfirmed)
+    int GetTxHeight() const;
+    //! true if output n is still locked by its nUnlockedHeight
+    bool IsLockedOutput(unsigned int n) const;
+    //! move output n from the cached locked credit to the cached available credit
+    void UnlockOutput(unsigned int n) const;
+
     void GetAmounts(std::list<COutputEntry>& listReceived,
                     std::list<COutputEntry>& listSent, CAmount& nFee, std::string& strSentAccount, const isminefilter& filter) const;
 
@@ -628,6 +684,46 @@ private:
 };
 
 
+/** Small spendable outputs of one address, of SAFE or of one asset, that consolidation merges */
+struct CConsolidationGroup
+{
+    CTxDestination dest;
+    //! null for SAFE outputs
+    uint256 assetId;
+    std::vector<COutput> vCoins;
+    CAmount nValue;
+
+    CConsolidationGroup() : nValue(0) {}
+};
+
+/** One consolidation transaction, made or (in a dry run) only planned */
+struct CConsolidationResult
+{
+    CTxDestination dest;
+    uint256 assetId;
+    //! small outputs of the address (and asset) at the start of the round
+    unsigned int nOutputs;
+    //! outputs merged by this transaction
+    unsigned int nInputs;
+    CAmount nValue;
+    CAmount nFee;
+    //! null in a dry run or on failure
+    uint256 txid;
+    std::string strError;
+
+    CConsolidationResult() : nOutputs(0), nInputs(0), nValue(0), nFee(0) {}
+};
+
+/** A wallet key with its encoded address and script, as listed by CWallet::GetKeyAddresses */
+struct CKeyAddressEntry
+{
+    CKeyID keyID;
+    std::string strAddress;
+    CScript scriptPubKey;
+
+    explicit CKeyAddressEntry(const CKeyID& keyIDIn);
+};
+
 /**
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -644,6 +740,10 @@ private:
 
     CWalletDB *pwalletdbEncryption;
 
+    //! the write batch currently open on this wallet, see CWalletDBBatch
+    std::atomic<CWalletDBBatch*> pwalletdbBatch;
+    friend class CWalletDBBatch;
+
     //! the current wallet version: clients below this version are not able to load the wallet
     int nWalletVersion;
 
@@ -669,15 +769,51 @@ private:
     void AddToSpends(const COutPoint& outpoint, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    //! Outputs of ours that may be unspent, the coins AvailableCoins looks at
     std::set<COutPoint> setWalletUTXO;
 
+    /**
+     * Min-heap of locked outputs keyed by nUnlockedHeight. Entries are
+     * popped in UpdatedBlockTip once the chain reaches their unlock height;
+     * stale entries (tx rescheduled or removed) are skipped on pop.
+     */
+    typedef std::pair<int64_t, COutPoint> UnlockScheduleEntry;
+    std::priority_queue<UnlockScheduleEntry, std::vector<UnlockScheduleEntry>, std::greater<UnlockScheduleEntry> > heapUnlockSchedule;
+    //! outputs with an entry in heapUnlockSchedule, so rescheduling a tx doesn't add them again
+    std::set<COutPoint> setScheduledOutputs;
+    //! unconfirmed txs with locked outputs, their lock validity depends on the tip height
+    std::set<uint256> setUnconfirmedLockedTx;
+    //! chain height the unlock schedule was last advanced to
+    int nUnlockScheduleHeight;
+
     /* Mark a transaction (and its in-wallet descendants) as conflicting with a particular block. */
     void MarkConflicted(const uint256& hashBlock, const uint256& hashTx);
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /*
+     * Wallet keys in the order they were added, with their base58 address
+     * and P2PKH script. New keys are queued in vKeyAddressPending and only
+     * encoded when the list is next read; readers share an immutable
+     * snapshot. cs_keyAddressSeal serializes readers that encode.
+     * setKeyAddressIDs keeps a key added twice from being listed twice.
+     */
+    mutable CCriticalSection cs_keyAddresses;
+    mutable CCriticalSection cs_keyAddressSeal;
+    std::set<CKeyID> setKeyAddressIDs;
+    mutable std::vector<CKeyID> vKeyAddressPending;
+    mutable boost::shared_ptr<const std::vector<CKeyAddressEntry> > pKeyAddresses;
+    void AddKeyAddress(const CKeyID& keyID);
+
+    void AddToTimeIndexes(const CWalletTx& wtx);
+
+    /* Collect the scriptPubKeys a rescan has to look for (keys, redeem scripts and watch-only scripts) */
+    void GetScanScripts(std::vector<CScript>& vScripts) const;
+
     /* HD derive new child key (on internal or external chain) */
     void DeriveNewChildKey(const CKeyMetadata& metadata, CKey& secretRet, uint32_t nAccountIndex, bool fInternal /*= false*/);
+    /* HD derive nCount new child keys of one chain in parallel, recording them through pwalletdb */
+    void DeriveNewChildKeys(const CKeyMetadata& metadata, uint32_t nAccountIndex, bool fInternal, size_t nCount, std::vector<CPubKey>& vPubKeysRet, CWalletDB* pwalletdb);
 
 public:
     /*
@@ -689,6 +825,24 @@ public:
      */
     mutable CCriticalSection cs_wallet;
 
+    /*
+     * Serializes wallet rescans. Taken before cs_main and cs_wallet, which a
+     * rescan only holds while committing a block.
+     */
+    CCriticalSection cs_walletScan;
+
+    /*
+     * Progress of the running, or else the last, wallet rescan. Updated
+     * without cs_wallet so that it can be reported while a rescan runs.
+     */
+    std::atomic<bool> fScanningWallet;
+    std::atomic<int> nScanStartHeight;
+    std::atomic<int> nScanHeight;
+    std::atomic<int> nScanStopHeight;
+    std::atomic<int64_t> nScanStartTime;
+    std::atomic<int64_t> nScanEndTime;
+    std::atomic<int64_t> nScanTxCount;
+
     bool fFileBacked;
     const std::string strWalletFile;
 
@@ -742,6 +896,7 @@ public:
         fFileBacked = false;
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
+        pwalletdbBatch = NULL;
         nOrderPosNext = 0;
         nNextResend = 0;
         nLastResend = 0;
@@ -751,6 +906,17 @@ public:
         fAnonymizableTallyCachedNonDenom = false;
         vecAnonymizableTallyCached.clear();
         vecAnonymizableTallyCachedNonDenom.clear();
+        nUnlockScheduleHeight = -1;
+        fScanningWallet = false;
+        nScanStartHeight = -1;
+        nScanHeight = -1;
+        nScanStopHeight = -1;
+        nScanStartTime = 0;
+        nScanEndTime = 0;
+        nScanTxCount = 0;
+        setKeyAddressIDs.clear();
+        vKeyAddressPending.clear();
+        pKeyAddresses.reset(new std::vector<CKeyAddressEntry>());
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -761,6 +927,15 @@ public:
     typedef std::multimap<int64_t, TxPair > TxItems;
     TxItems wtxOrdered;
 
+    //! (time, txid) -> bitmask of the txout classes (ALL_TXOUT and friends) of
+    //! the indexed outputs; plain SAFE outputs set bit 0
+    typedef std::map<std::pair<int64_t, uint256>, uint32_t> TxTimeIndex;
+    //! Wallet transactions by asset and by output address in time order. Only
+    //! outputs are indexed, so a transaction appears under the addresses it
+    //! pays, not the ones it spends from.
+    std::map<uint256, TxTimeIndex> mapAssetTxTime;
+    std::map<CTxDestination, TxTimeIndex> mapAddressTxTime;
+
     int64_t nOrderPosNext;
     std::map<uint256, int> mapRequestCount;
 
@@ -789,9 +964,12 @@ public:
      * Shuffle and select coins until nTargetValue is reached while avoiding
      * small change; This method is stochastic for some inputs and upon
      * completion the coin set and corresponding actual target value is
-     * assembled
+     * assembled. Unless the result needs no change output anyway, a branch
+     * and bound search then looks for a selection of no more inputs whose
+     * excess over nTargetValue is at most nChangeWindow, so that no change
+     * output is needed at all.
      */
-    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, bool fUseInstantSend = false) const;
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, bool fUseInstantSend = false, const CAmount& nChangeWindow = 0) const;
 
     bool SelectCoinsByDenominations(int nDenom, CAmount nValueMin, CAmount nValueMax, std::vector<CTxIn>& vecTxInRet, std::vector<COutput>& vCoinsRet, CAmount& nValueRet, int nPrivateSendRoundsMin, int nPrivateSendRoundsMax);
     bool GetCollateralTxIn(CTxIn& txinRet, CAmount& nValueRet) const;
@@ -817,6 +995,14 @@ public:
 
     bool IsSpent(const uint256& hash, unsigned int n) const;
 
+    /** Add the locked outputs of wtx to the unlock schedule */
+    void ScheduleLockedOutputs(const CWalletTx& wtx);
+    /** Recompute the unlock schedule for the whole wallet (load, reorg) */
+    void RebuildUnlockSchedule();
+    //! Entries waiting in the unlock schedule
+    size_t GetUnlockScheduleSize() const { AssertLockHeld(cs_wallet); return heapUnlockSchedule.size(); }
+    bool IsLockedOutput(const uint256& hash, unsigned int n) const;
+
     bool IsFrozenCoin(uint256 hash, unsigned int n) const;
     void FreezeCoin(COutPoint& output);
     void UnfreezeCoin(COutPoint& output);
@@ -834,14 +1020,14 @@ public:
     bool GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) const;
     //! GetKey implementation that can derive a HD private key on the fly
     bool GetKey(const CKeyID &address, CKey& keyOut) const;
-    //! Adds a HDPubKey into the wallet(database)
-    bool AddHDPubKey(const CExtPubKey &extPubKey, bool fInternal);
+    //! Adds a HDPubKey into the wallet(database), writing through pwalletdb if not NULL
+    bool AddHDPubKey(const CExtPubKey &extPubKey, bool fInternal, CWalletDB* pwalletdb = NULL);
     //! loads a HDPubKey into the wallets memory
     bool LoadHDPubKey(const CHDPubKey &hdPubKey);
     //! Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
     //! Adds a key to the store, without saving it to disk (used by LoadWallet)
-    bool LoadKey(const CKey& key, const CPubKey &pubkey) { return CCryptoKeyStore::AddKeyPubKey(key, pubkey); }
+    bool LoadKey(const CKey& key, const CPubKey &pubkey);
     //! Load metadata (used by LoadWallet)
     bool LoadKeyMetadata(const CPubKey &pubkey, const CKeyMetadata &metadata);
 
@@ -866,6 +1052,8 @@ public:
     //! Adds a watch-only address to the store, and saves it to disk.
     bool AddWatchOnly(const CScript &dest);
     bool RemoveWatchOnly(const CScript &dest);
+    //! As above, writing through pwalletdb (if not NULL) so it can join a database transaction
+    bool RemoveWatchOnly(const CScript &dest, CWalletDB* pwalletdb);
     //! Adds a watch-only address to the store, without saving it to disk (used by LoadWallet)
     bool LoadWatchOnly(const CScript &dest);
 
@@ -874,6 +1062,25 @@ public:
     bool EncryptWallet(const SecureString& strWalletPassphrase);
 
     void GetKeyBirthTimes(std::map<CKeyID, int64_t> &mapKeyBirth) const;
+    /**
+     * All keys of the wallet with their encoded addresses. The snapshot is
+     * immutable, so it can be iterated without holding cs_wallet.
+     */
+    boost::shared_ptr<const std::vector<CKeyAddressEntry> > GetKeyAddresses() const;
+
+    /**
+     * Page through the wallet transactions of an asset or paying an address.
+     * Matching transactions are those timed within [nStartTime, nEndTime]
+     * whose txout class mask intersects nClassMask, and older than the wallet
+     * transaction hashBefore unless it is null. The nFrom newest are skipped
+     * and the next nCount (all when negative) returned, oldest first.
+     * The page start is found by a keyed seek on the end time or hashBefore,
+     * so paging with the oldest txid of the previous page costs the size of
+     * the page; nFrom is walked entry by entry. Returns false if hashBefore
+     * is not in the wallet.
+     */
+    bool ListAssetTransactions(const uint256& assetId, uint32_t nClassMask, int64_t nStartTime, int64_t nEndTime, const uint256& hashBefore, int nFrom, int nCount, std::vector<const CWalletTx*>& vwtxRet) const;
+    bool ListAddressTransactions(const CTxDestination& dest, uint32_t nClassMask, int64_t nStartTime, int64_t nEndTime, const uint256& hashBefore, int nFrom, int nCount, std::vector<const CWalletTx*>& vwtxRet) const;
 
     /**
      * Increment the next transaction order id
@@ -884,7 +1091,13 @@ public:
     void MarkDirty();
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
+    /**
+     * Rescan the chain from pindexStart. Blocks are read and matched against
+     * the wallet scripts on worker threads; cs_main and cs_wallet are only
+     * taken to commit each block, so callers should not hold them.
+     */
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman);
@@ -924,7 +1137,38 @@ public:
                            std::string& strFailReason, const CCoinControl *coinControl = NULL, bool sign = true, AvailableCoinsType nCoinType=ALL_COINS, bool fUseInstantSend=false);
     bool CreateAssetTransaction(const CAppHeader* pHeader, const void* pBody, const std::vector<CRecipient>& vecSend, const CBitcoinAddress* pSafeAddress, const CBitcoinAddress* pAssetAddress, CWalletTx& wtxNew, CReserveKey& reservekey, CAmount& nFeeRet, int& nChangePosRet,
                            std::string& strFailReason, const CCoinControl* coinControl = NULL, bool sign = true, AvailableCoinsType nCoinType=ALL_COINS);
+    /**
+     * Pay out an asset to many recipients, at most nMaxOutputs per transaction.
+     * Coins are selected once from a single snapshot of the wallet, and the
+     * inputs of all transactions are signed in parallel.
+     */
+    bool CreateAssetPayoutTransactions(const CAppHeader& header, const CCommonData& transferData, const std::vector<CRecipient>& vecSend, unsigned int nMaxOutputs, std::vector<CWalletTx>& vwtxNew, CReserveKey& reservekey, CAmount& nFeeRet, std::string& strFailReason);
+    /**
+     * Claim a candy for the recipients, GET_CANDY_TXOUT_SIZE per transaction.
+     * Fee coins are reserved once from a single snapshot of the wallet, and
+     * the transactions are signed in parallel.
+     */
+    bool CreateCandyClaimTransactions(const CAppHeader& header, const CPutCandy_IndexKey& candyKey, const std::vector<CRecipient>& vecSend, std::vector<CWalletTx>& vwtxNew, CReserveKey& reservekey, CAmount& nFeeRet, std::string& strFailReason);
+    /**
+     * Group confirmed, spendable SAFE outputs below nThreshold by address, and
+     * asset outputs below as many whole units of the asset by address and
+     * asset. Denominated PrivateSend outputs and masternode collateral are left
+     * alone. Groups of at least nMinOutputs outputs are returned, most
+     * fragmented first, smallest outputs first.
+     */
+    void GetConsolidationGroups(const CAmount& nThreshold, unsigned int nMinOutputs, std::vector<CConsolidationGroup>& vGroupsRet) const;
+    /**
+     * Run one consolidation round: merge the outputs of each group into a single
+     * output to its address, MAX_CONSOLIDATE_INPUTS at a time, making at most
+     * nMaxTxs transactions. SAFE groups pay the fee from the merged value, asset
+     * groups from other SAFE coins. A dry run plans and prices the same
+     * transactions without signing or committing them.
+     */
+    void ConsolidateCoins(const CAmount& nThreshold, unsigned int nMinOutputs, unsigned int nMaxTxs, bool fDryRun, std::vector<CConsolidationResult>& vResults, CConnman* connman);
     bool CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CConnman* connman, std::string strCommand="tx");
+    //! Commit several transactions with a single wallet database transaction;
+    //! vAccepted tells which of them were accepted and relayed, the rest are abandoned
+    bool CommitTransactions(std::vector<CWalletTx>& vwtxNew, CReserveKey& reservekey, CConnman* connman, std::vector<bool>& vAccepted);
 
     bool CreateCollateralTransaction(CMutableTransaction& txCollateral, std::string& strReason);
     bool ConvertList(std::vector<CTxIn> vecTxIn, std::vector<CAmount>& vecAmounts);
@@ -944,6 +1188,9 @@ public:
      */
     static CAmount GetRequiredFee(unsigned int nTxBytes);
 
+    /** Database of the write batch the calling thread has open on this wallet, if any */
+    CWalletDB* GetBatchWalletDB();
+
     bool NewKeyPool();
     size_t KeypoolCountExternalKeys();
     size_t KeypoolCountInternalKeys();
@@ -1070,6 +1317,52 @@ public:
     bool GetDecryptedHDChain(CHDChain& hdChainRet);
 };
 
+/**
+ * Scoped wallet write batch.
+ *
+ * While a batch is open, wallet records written by the thread that opened it
+ * (transactions, keys, key pool entries, address book entries) go through a
+ * single database handle inside one transaction, committed when the batch
+ * goes out of scope or every nCommitWrites writes (0 = only at the end).
+ * Bulk operations such as rescans, imports and key pool top-ups use it to
+ * write their records in one transaction instead of one per record; with
+ * -debug=db each batch logs its writes, commits and wall time, so its effect
+ * on a workload can be measured. A batch opened while another is active on the same thread
+ * joins the outer one. The caller must hold cs_wallet for the whole lifetime
+ * of the batch.
+ */
+class CWalletDBBatch
+{
+private:
+    CWallet* pwallet;
+    CWalletDBBatch* pouter;
+    CWalletDB* pwalletdb;
+    boost::thread::id threadId;
+    bool fTxn;
+    unsigned int nCommitWrites;
+    unsigned int nWrites;
+    unsigned int nTotalWrites;
+    unsigned int nCommits;
+    bool fFlushOnClose;
+    int64_t nTimeStart;
+
+    CWalletDBBatch(const CWalletDBBatch&);
+    CWalletDBBatch& operator=(const CWalletDBBatch&);
+
+public:
+    CWalletDBBatch(CWallet* pwalletIn, unsigned int nCommitWritesIn = DEFAULT_WALLET_BATCH_WRITES, bool fFlushOnCloseIn = true);
+    ~CWalletDBBatch();
+
+    /** Database to write the next record through, NULL if the wallet is not file backed */
+    CWalletDB* Get();
+    /** Commit the writes made so far; the batch stays open */
+    bool Commit();
+    /** Discard the writes made since the last commit, including those of an outer batch */
+    void Abort();
+
+    bool IsCurrentThread() const { return threadId == boost::this_thread::get_id(); }
+};
+
 /** A key allocated from the key pool. */
 class CReserveKey : public CReserveScript
 {
@@ -1127,4 +1420,13 @@ public:
     }
 };
 
+/**
+ * Sign the inputs of a batch of transactions on a small thread pool, leaving the last
+ * nUnsignedTail inputs of each transaction alone. Fails if any input cannot be signed.
+ */
+bool SignPayoutTransactions(const CKeyStore* pkeystore, std::vector<CMutableTransaction>& vTx, unsigned int nUnsignedTail, size_t& nInputsRet, int& nThreadsRet);
+
+/** Consolidate fragmented outputs of pwallet every -consolidateinterval seconds while fees are at most nMaxFeeRate */
+void ThreadConsolidateWallet(CWallet* pwallet, CAmount nThreshold, CAmount nMaxFeeRate);
+
 #endif // BITCOIN_WALLET_WALLET_H
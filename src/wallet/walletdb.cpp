@@ -347,6 +347,40 @@ public:
     }
 };
 
+/**
+ * Decode a "tx" record whose type has already been read from ssKey. Does
+ * not touch the wallet, so records can be decoded on several threads.
+ */
+static bool ReadWalletTx(CDataStream& ssKey, CDataStream& ssValue, uint256& hash, CWalletTx& wtx, bool& fUpgrade, string& strErr)
+{
+    ssKey >> hash;
+    ssValue >> wtx;
+    CValidationState state;
+    if (!(CheckTransaction(wtx, state, FROM_WALLET) && (wtx.GetHash() == hash) && state.IsValid()))
+        return false;
+
+    // Undo serialize changes in 31600
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+    {
+        if (!ssValue.empty())
+        {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                               wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        }
+        else
+        {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        fUpgrade = true;
+    }
+    return true;
+}
+
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
              CWalletScanState &wss, string& strType, string& strErr)
@@ -371,32 +405,12 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         else if (strType == "tx")
         {
             uint256 hash;
-            ssKey >> hash;
             CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            if (!(CheckTransaction(wtx, state, FROM_WALLET) && (wtx.GetHash() == hash) && state.IsValid()))
+            bool fUpgrade = false;
+            if (!ReadWalletTx(ssKey, ssValue, hash, wtx, fUpgrade, strErr))
                 return false;
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-            {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
+            if (fUpgrade)
                 wss.vWalletUpgrade.push_back(hash);
-            }
 
             if (wtx.nOrderPos == -1)
                 wss.fAnyUnordered = true;
@@ -646,6 +660,45 @@ static bool IsKeyType(string strType)
             strType == "hdchain" || strType == "chdchain");
 }
 
+/**
+ * A "tx" record read by LoadWallet, decoded after the cursor walk. Every record
+ * is fully decoded before LoadWallet returns: mapWallet hands out references to
+ * its CWalletTx entries all over the wallet, RPC and GUI code, so there is no
+ * single first access at which decoding could be deferred.
+ */
+struct CWalletTxRecord
+{
+    CDataStream ssKey;
+    CDataStream ssValue;
+    uint256 hash;
+    CWalletTx wtx;
+    bool fOk;
+    bool fUpgrade;
+    string strErr;
+
+    CWalletTxRecord(const CDataStream& ssKeyIn, const CDataStream& ssValueIn) : ssKey(ssKeyIn), ssValue(ssValueIn), fOk(false), fUpgrade(false) {}
+};
+
+static void DecodeWalletTxRecords(std::vector<CWalletTxRecord>* pvRecords, std::atomic<size_t>* pnNext)
+{
+    while (true)
+    {
+        size_t i = (*pnNext)++;
+        if (i >= pvRecords->size())
+            return;
+
+        CWalletTxRecord& record = (*pvRecords)[i];
+        try {
+            record.fOk = ReadWalletTx(record.ssKey, record.ssValue, record.hash, record.wtx, record.fUpgrade, record.strErr);
+        } catch (...) {
+            record.fOk = false;
+        }
+        // the raw record is not needed any more
+        record.ssKey.clear();
+        record.ssValue.clear();
+    }
+}
+
 DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 {
     pwallet->vchDefaultKey = CPubKey();
@@ -671,6 +724,14 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             return DB_CORRUPT;
         }
 
+        // Keys and everything else are loaded while walking the cursor;
+        // transactions, the bulk of a large wallet, are only collected and
+        // decoded on all cores afterwards
+        int nThreads = GetArg("-walletloadthreads", DEFAULT_WALLET_LOAD_THREADS);
+        if (nThreads <= 0)
+            nThreads = GetNumCores();
+        std::vector<CWalletTxRecord> vTxRecords;
+
         while (true)
         {
             // Read next record
@@ -685,6 +746,18 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 return DB_CORRUPT;
             }
 
+            if (nThreads > 1)
+            {
+                string strType;
+                CDataStream ssType(ssKey);
+                ssType >> strType;
+                if (strType == "tx")
+                {
+                    vTxRecords.push_back(CWalletTxRecord(ssType, ssValue));
+                    continue;
+                }
+            }
+
             // Try to be tolerant of single corrupt records:
             string strType, strErr;
             if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
@@ -707,6 +780,37 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         }
         pcursor->close();
 
+        if (!vTxRecords.empty())
+        {
+            int64_t nStart = GetTimeMillis();
+            std::atomic<size_t> nNext(0);
+            boost::thread_group decoders;
+            for (int i = 1; i < std::min(nThreads, (int)vTxRecords.size()); i++)
+                decoders.create_thread(boost::bind(&DecodeWalletTxRecords, &vTxRecords, &nNext));
+            DecodeWalletTxRecords(&vTxRecords, &nNext);
+            decoders.join_all();
+
+            // Add in database order, as the serial load would have
+            BOOST_FOREACH(CWalletTxRecord& record, vTxRecords)
+            {
+                if (!record.fOk)
+                {
+                    fNoncriticalErrors = true;
+                    // Rescan if there is a bad transaction record:
+                    SoftSetBoolArg("-rescan", true);
+                    continue;
+                }
+                if (!record.strErr.empty())
+                    LogPrintf("%s\n", record.strErr);
+                if (record.fUpgrade)
+                    wss.vWalletUpgrade.push_back(record.hash);
+                if (record.wtx.nOrderPos == -1)
+                    wss.fAnyUnordered = true;
+                pwallet->AddToWallet(record.wtx, true, NULL);
+            }
+            LogPrint("bench", "LoadWallet: decoded %u transactions in %dms with %d threads\n", vTxRecords.size(), GetTimeMillis() - nStart, nThreads);
+        }
+
         // Store initial external keypool size since we mostly use external keys in mixing
         pwallet->nKeysLeftSinceAutoBackup = pwallet->KeypoolCountExternalKeys();
         LogPrintf("nKeysLeftSinceAutoBackup: %d\n", pwallet->nKeysLeftSinceAutoBackup);